@@ -0,0 +1,327 @@
+#include "AccelerationStructure.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+void AccelerationStructure::create(VkDevice device, MemoryAllocator& allocator, VkDeviceSize scratchAlignment) {
+	this->device = device;
+	this->allocator = &allocator;
+	this->scratchAlignment = std::max<VkDeviceSize>(1, scratchAlignment);
+
+	createAccelerationStructure = (PFN_vkCreateAccelerationStructureKHR)vkGetDeviceProcAddr(device, "vkCreateAccelerationStructureKHR");
+	destroyAccelerationStructure = (PFN_vkDestroyAccelerationStructureKHR)vkGetDeviceProcAddr(device, "vkDestroyAccelerationStructureKHR");
+	getBuildSizes = (PFN_vkGetAccelerationStructureBuildSizesKHR)vkGetDeviceProcAddr(device, "vkGetAccelerationStructureBuildSizesKHR");
+	cmdBuildAccelerationStructures = (PFN_vkCmdBuildAccelerationStructuresKHR)vkGetDeviceProcAddr(device, "vkCmdBuildAccelerationStructuresKHR");
+	getAccelerationStructureAddress = (PFN_vkGetAccelerationStructureDeviceAddressKHR)vkGetDeviceProcAddr(device, "vkGetAccelerationStructureDeviceAddressKHR");
+
+	if (createAccelerationStructure == nullptr || destroyAccelerationStructure == nullptr || getBuildSizes == nullptr || cmdBuildAccelerationStructures == nullptr ||
+		getAccelerationStructureAddress == nullptr) {
+		throw std::runtime_error("Could not load the acceleration structure functions");
+	}
+
+	stats = AccelerationStructureStats();
+}
+
+void AccelerationStructure::destroy() {
+	if (device == VK_NULL_HANDLE) {
+		return;
+	}
+
+	destroyLevel(topLevel);
+	for (Level& level : bottomLevels) {
+		destroyLevel(level);
+	}
+	bottomLevels.clear();
+	device = VK_NULL_HANDLE;
+}
+
+void AccelerationStructure::createLevel(Level& level, VkAccelerationStructureTypeKHR type, VkDeviceSize size) {
+	allocator->createBuffer(size, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0,
+		level.buffer, level.memory);
+
+	VkAccelerationStructureCreateInfoKHR createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
+	createInfo.buffer = level.buffer;
+	createInfo.offset = 0;
+	createInfo.size = size;
+	createInfo.type = type;
+
+	if (createAccelerationStructure(device, &createInfo, nullptr, &level.handle) != VK_SUCCESS) {
+		throw std::runtime_error("Could not create acceleration structure");
+	}
+}
+
+void AccelerationStructure::destroyLevel(Level& level) {
+	if (level.handle != VK_NULL_HANDLE) {
+		destroyAccelerationStructure(device, level.handle, nullptr);
+		level.handle = VK_NULL_HANDLE;
+	}
+
+	if (level.buffer != VK_NULL_HANDLE) {
+		allocator->destroyBuffer(level.buffer, level.memory);
+	}
+}
+
+VkDeviceAddress AccelerationStructure::getBufferAddress(VkBuffer buffer) const {
+	VkBufferDeviceAddressInfo addressInfo = {};
+	addressInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+	addressInfo.buffer = buffer;
+
+	return vkGetBufferDeviceAddress(device, &addressInfo);
+}
+
+void AccelerationStructure::build(VkQueue queue, uint32_t queueFamily, VkBuffer triangleBuffer, const std::vector<Mesh>& meshes, const std::vector<MeshInstance>& instances,
+	VkSemaphore waitSemaphore, uint64_t waitValue) {
+	destroyLevel(topLevel);
+	for (Level& level : bottomLevels) {
+		destroyLevel(level);
+	}
+
+	uint32_t meshCount = static_cast<uint32_t>(meshes.size());
+	bottomLevels.assign(meshCount, Level());
+
+	stats = AccelerationStructureStats();
+
+	VkDeviceAddress triangleAddress = getBufferAddress(triangleBuffer);
+
+	// Bottom levels: the ranges of the triangle buffer read in place. v0, v1 and v2 each start a 16 byte row
+	// of Triangle, so the vertices form one array with a 16 byte stride and every three of them make a
+	// triangle. Every build gets its own part of the scratch buffer, so they are all recorded at once.
+	std::vector<VkAccelerationStructureGeometryKHR> geometries(meshCount);
+	std::vector<VkAccelerationStructureBuildGeometryInfoKHR> bottomBuildInfos;
+	std::vector<VkAccelerationStructureBuildRangeInfoKHR> bottomRanges;
+	std::vector<VkDeviceSize> scratchOffsets;
+	VkDeviceSize bottomScratchSize = 0;
+
+	bottomBuildInfos.reserve(meshCount);
+	bottomRanges.reserve(meshCount);
+	scratchOffsets.reserve(meshCount);
+
+	for (uint32_t i = 0; i < meshCount; i++) {
+		const Mesh& mesh = meshes[i];
+
+		if (mesh.triangleCount == 0) {
+			continue;
+		}
+
+		VkAccelerationStructureGeometryKHR& triangleGeometry = geometries[i];
+		triangleGeometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+		triangleGeometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
+		triangleGeometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+		triangleGeometry.geometry.triangles.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
+		triangleGeometry.geometry.triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
+		triangleGeometry.geometry.triangles.vertexData.deviceAddress = triangleAddress + static_cast<VkDeviceAddress>(mesh.firstTriangle) * sizeof(Triangle);
+		triangleGeometry.geometry.triangles.vertexStride = 16;
+		triangleGeometry.geometry.triangles.maxVertex = mesh.triangleCount * 3 - 1;
+		triangleGeometry.geometry.triangles.indexType = VK_INDEX_TYPE_NONE_KHR;
+
+		VkAccelerationStructureBuildGeometryInfoKHR bottomBuildInfo = {};
+		bottomBuildInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+		bottomBuildInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+		bottomBuildInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+		bottomBuildInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+		bottomBuildInfo.geometryCount = 1;
+		bottomBuildInfo.pGeometries = &triangleGeometry;
+
+		VkAccelerationStructureBuildSizesInfoKHR bottomSizes = {};
+		bottomSizes.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
+		getBuildSizes(device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &bottomBuildInfo, &mesh.triangleCount, &bottomSizes);
+
+		createLevel(bottomLevels[i], VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, bottomSizes.accelerationStructureSize);
+		bottomBuildInfo.dstAccelerationStructure = bottomLevels[i].handle;
+
+		VkAccelerationStructureBuildRangeInfoKHR bottomRange = {};
+		bottomRange.primitiveCount = mesh.triangleCount;
+
+		bottomBuildInfos.push_back(bottomBuildInfo);
+		bottomRanges.push_back(bottomRange);
+		scratchOffsets.push_back(bottomScratchSize);
+
+		bottomScratchSize += (bottomSizes.buildScratchSize + scratchAlignment - 1) / scratchAlignment * scratchAlignment;
+
+		stats.triangleCount += mesh.triangleCount;
+		stats.bottomLevelBytes += bottomSizes.accelerationStructureSize;
+		stats.bottomLevelCount++;
+	}
+
+	// Top level: the instances with their transforms as 3x4 row major matrices
+	std::vector<VkAccelerationStructureInstanceKHR> instanceRecords;
+	instanceRecords.reserve(instances.size());
+
+	for (uint32_t i = 0; i < static_cast<uint32_t>(instances.size()); i++) {
+		const MeshInstance& source = instances[i];
+
+		if (meshes[source.meshId].triangleCount == 0) {
+			continue;
+		}
+
+		VkAccelerationStructureDeviceAddressInfoKHR bottomAddressInfo = {};
+		bottomAddressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+		bottomAddressInfo.accelerationStructure = bottomLevels[source.meshId].handle;
+
+		VkAccelerationStructureInstanceKHR instance = {};
+		for (int row = 0; row < 3; row++) {
+			for (int column = 0; column < 4; column++) {
+				instance.transform.matrix[row][column] = source.transform[column][row];
+			}
+		}
+		instance.instanceCustomIndex = i;
+		instance.mask = 0xFF;
+		// The tracer flips normals towards the ray itself, so both sides of a triangle must be hit
+		instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
+		instance.accelerationStructureReference = getAccelerationStructureAddress(device, &bottomAddressInfo);
+
+		instanceRecords.push_back(instance);
+	}
+
+	uint32_t instanceCount = static_cast<uint32_t>(instanceRecords.size());
+	stats.instanceCount = instanceCount;
+
+	VkBuffer instanceBuffer;
+	Allocation instanceMemory;
+	allocator->createBuffer(std::max<size_t>(1, instanceRecords.size()) * sizeof(VkAccelerationStructureInstanceKHR),
+		VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0, instanceBuffer, instanceMemory);
+	std::memcpy(instanceMemory.mapped, instanceRecords.data(), instanceRecords.size() * sizeof(VkAccelerationStructureInstanceKHR));
+
+	VkAccelerationStructureGeometryKHR instanceGeometry = {};
+	instanceGeometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+	instanceGeometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+	instanceGeometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+	instanceGeometry.geometry.instances.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
+	instanceGeometry.geometry.instances.arrayOfPointers = VK_FALSE;
+	instanceGeometry.geometry.instances.data.deviceAddress = getBufferAddress(instanceBuffer);
+
+	VkAccelerationStructureBuildGeometryInfoKHR topBuildInfo = {};
+	topBuildInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+	topBuildInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+	topBuildInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+	topBuildInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+	topBuildInfo.geometryCount = 1;
+	topBuildInfo.pGeometries = &instanceGeometry;
+
+	VkAccelerationStructureBuildSizesInfoKHR topSizes = {};
+	topSizes.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
+	getBuildSizes(device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &topBuildInfo, &instanceCount, &topSizes);
+
+	createLevel(topLevel, VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR, topSizes.accelerationStructureSize);
+	topBuildInfo.dstAccelerationStructure = topLevel.handle;
+
+	// The top level build reuses the start of the bottom levels' scratch memory after the barrier between
+	// them. Buffer alignment does not have to satisfy the scratch alignment, so the address is rounded up
+	// inside a larger buffer.
+	VkDeviceSize scratchSize = std::max(bottomScratchSize, topSizes.buildScratchSize);
+
+	VkBuffer scratchBuffer;
+	Allocation scratchMemory;
+	allocator->createBuffer(scratchSize + scratchAlignment, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, scratchBuffer, scratchMemory);
+
+	VkDeviceAddress scratchAddress = (getBufferAddress(scratchBuffer) + scratchAlignment - 1) / scratchAlignment * scratchAlignment;
+	for (size_t i = 0; i < bottomBuildInfos.size(); i++) {
+		bottomBuildInfos[i].scratchData.deviceAddress = scratchAddress + scratchOffsets[i];
+	}
+	topBuildInfo.scratchData.deviceAddress = scratchAddress;
+
+	stats.topLevelBytes = topSizes.accelerationStructureSize;
+	stats.scratchBytes = scratchSize;
+
+	VkCommandPoolCreateInfo poolCreateInfo = {};
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolCreateInfo.queueFamilyIndex = queueFamily;
+	poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+	VkCommandPool commandPool;
+	if (vkCreateCommandPool(device, &poolCreateInfo, nullptr, &commandPool) != VK_SUCCESS) {
+		throw std::runtime_error("Could not create acceleration structure command pool");
+	}
+
+	VkCommandBufferAllocateInfo allocateInfo = {};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocateInfo.commandPool = commandPool;
+	allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocateInfo.commandBufferCount = 1;
+
+	VkCommandBuffer commandBuffer;
+	if (vkAllocateCommandBuffers(device, &allocateInfo, &commandBuffer) != VK_SUCCESS) {
+		throw std::runtime_error("Could not allocate acceleration structure command buffer");
+	}
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+	if (!bottomBuildInfos.empty()) {
+		std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> bottomRangePointers(bottomRanges.size());
+		for (size_t i = 0; i < bottomRanges.size(); i++) {
+			bottomRangePointers[i] = &bottomRanges[i];
+		}
+
+		cmdBuildAccelerationStructures(commandBuffer, static_cast<uint32_t>(bottomBuildInfos.size()), bottomBuildInfos.data(), bottomRangePointers.data());
+	}
+
+	// The top level reads the bottom levels and reuses their scratch memory
+	VkMemoryBarrier buildBarrier = {};
+	buildBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	buildBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+	buildBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0,
+		1, &buildBarrier, 0, nullptr, 0, nullptr);
+
+	VkAccelerationStructureBuildRangeInfoKHR topRange = {};
+	topRange.primitiveCount = instanceCount;
+	const VkAccelerationStructureBuildRangeInfoKHR* topRanges = &topRange;
+	cmdBuildAccelerationStructures(commandBuffer, 1, &topBuildInfo, &topRanges);
+
+	// Frames are submitted to the same queue later, this makes the build visible to their ray queries
+	VkMemoryBarrier traceBarrier = buildBarrier;
+	traceBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+		1, &traceBarrier, 0, nullptr, 0, nullptr);
+
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+		throw std::runtime_error("Could not record acceleration structure build");
+	}
+
+	VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineInfo.waitSemaphoreValueCount = 1;
+	timelineInfo.pWaitSemaphoreValues = &waitValue;
+
+	VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR;
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.pNext = &timelineInfo;
+	submitInfo.waitSemaphoreCount = 1;
+	submitInfo.pWaitSemaphores = &waitSemaphore;
+	submitInfo.pWaitDstStageMask = &waitStage;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+
+	VkFenceCreateInfo fenceCreateInfo = {};
+	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+	VkFence fence;
+	if (vkCreateFence(device, &fenceCreateInfo, nullptr, &fence) != VK_SUCCESS) {
+		throw std::runtime_error("Could not create acceleration structure fence");
+	}
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	if (vkQueueSubmit(queue, 1, &submitInfo, fence) != VK_SUCCESS) {
+		throw std::runtime_error("Could not submit acceleration structure build");
+	}
+
+	vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+
+	stats.buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	vkDestroyFence(device, fence, nullptr);
+	vkDestroyCommandPool(device, commandPool, nullptr);
+	allocator->destroyBuffer(scratchBuffer, scratchMemory);
+	allocator->destroyBuffer(instanceBuffer, instanceMemory);
+}
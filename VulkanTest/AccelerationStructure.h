@@ -0,0 +1,77 @@
+#pragma once
+
+#include "MemoryAllocator.h"
+#include "Scene.h"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+struct AccelerationStructureStats {
+	VkDeviceSize bottomLevelBytes = 0;
+	VkDeviceSize topLevelBytes = 0;
+	VkDeviceSize scratchBytes = 0;
+	uint32_t triangleCount = 0;
+	uint32_t bottomLevelCount = 0;
+	uint32_t instanceCount = 0;
+	// Wall clock time from submitting the builds until they completed, including the wait for the upload
+	double buildMilliseconds = 0.0;
+};
+
+// The scene for the hardware ray query path: one bottom level structure per mesh, built straight from its
+// range of the triangle buffer, and a top level one over the instances. A scene without instances is passed
+// as one mesh with a single identity instance. Triangle stores its vertices 16 bytes apart, which the build
+// reads in place as a non-indexed R32G32B32 vertex array, so the primitive index of a hit is the index into
+// the mesh's triangles. The custom index of every instance is its position in the instances passed to
+// build, which the shader uses to find the mesh's first triangle.
+//
+// Needs the acceleration structure extension and buffer device addresses, see createLogicalDevice.
+class AccelerationStructure {
+public:
+	// Loads the extension entry points, which the loader does not export. scratchAlignment is
+	// minAccelerationStructureScratchOffsetAlignment of the device.
+	void create(VkDevice device, MemoryAllocator& allocator, VkDeviceSize scratchAlignment);
+	void destroy();
+
+	// Builds both levels on queue and blocks until they are done, then releases the scratch and instance
+	// buffers. The build waits on the GPU for waitValue of the timeline semaphore, so it can be started
+	// right after the triangle upload was queued. triangleBuffer needs the device address and build
+	// input usages. Instances of meshes without triangles are left out.
+	void build(VkQueue queue, uint32_t queueFamily, VkBuffer triangleBuffer, const std::vector<Mesh>& meshes, const std::vector<MeshInstance>& instances,
+		VkSemaphore waitSemaphore, uint64_t waitValue);
+
+	VkAccelerationStructureKHR getTopLevel() const {
+		return topLevel.handle;
+	}
+
+	const AccelerationStructureStats& getStats() const {
+		return stats;
+	}
+
+private:
+	struct Level {
+		VkAccelerationStructureKHR handle = VK_NULL_HANDLE;
+		VkBuffer buffer = VK_NULL_HANDLE;
+		Allocation memory;
+	};
+
+	void createLevel(Level& level, VkAccelerationStructureTypeKHR type, VkDeviceSize size);
+	void destroyLevel(Level& level);
+	VkDeviceAddress getBufferAddress(VkBuffer buffer) const;
+
+	VkDevice device = VK_NULL_HANDLE;
+	MemoryAllocator* allocator = nullptr;
+	VkDeviceSize scratchAlignment = 1;
+
+	PFN_vkCreateAccelerationStructureKHR createAccelerationStructure = nullptr;
+	PFN_vkDestroyAccelerationStructureKHR destroyAccelerationStructure = nullptr;
+	PFN_vkGetAccelerationStructureBuildSizesKHR getBuildSizes = nullptr;
+	PFN_vkCmdBuildAccelerationStructuresKHR cmdBuildAccelerationStructures = nullptr;
+	PFN_vkGetAccelerationStructureDeviceAddressKHR getAccelerationStructureAddress = nullptr;
+
+	std::vector<Level> bottomLevels;
+	Level topLevel;
+
+	AccelerationStructureStats stats;
+};
@@ -0,0 +1,138 @@
+#include "AssetPack.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+AssetPack::~AssetPack() {
+	close();
+}
+
+void AssetPack::openFile(const std::string& path) {
+	close();
+
+	file.open(path, "asset pack");
+	base = file.data();
+	size = file.size();
+
+	try {
+		validate();
+	}
+	catch (...) {
+		close();
+		throw;
+	}
+}
+
+void AssetPack::openMemory(const void* data, size_t size) {
+	close();
+
+	if (reinterpret_cast<uintptr_t>(data) % Alignment != 0) {
+		throw std::runtime_error("Embedded asset pack is not aligned");
+	}
+
+	this->base = static_cast<const uint8_t*>(data);
+	this->size = size;
+
+	validate();
+}
+
+void AssetPack::close() {
+	file.close();
+
+	base = nullptr;
+	size = 0;
+}
+
+AssetView AssetPack::get(const std::string& name) const {
+	if (base == nullptr) {
+		throw std::runtime_error("Asset pack is not open");
+	}
+
+	Header header;
+	std::memcpy(&header, base, sizeof(header));
+
+	const Entry* entries = reinterpret_cast<const Entry*>(base + header.tocOffset);
+
+	for (uint32_t i = 0; i < header.entryCount; i++) {
+		if (std::strncmp(entries[i].name, name.c_str(), NameLength) == 0) {
+			AssetView view;
+			view.data = base + entries[i].offset;
+			view.size = static_cast<size_t>(entries[i].size);
+
+			return view;
+		}
+	}
+
+	throw std::runtime_error("Could not find asset " + name);
+}
+
+// Everything is checked once up front, so lookups can trust the table of contents
+void AssetPack::validate() const {
+	Header header;
+
+	if (size < sizeof(header)) {
+		throw std::runtime_error("Asset pack is truncated");
+	}
+
+	std::memcpy(&header, base, sizeof(header));
+
+	if (header.magic != Magic || header.version != Version) {
+		throw std::runtime_error("Asset pack has an unknown format");
+	}
+
+	uint64_t tocEnd = header.tocOffset + static_cast<uint64_t>(header.entryCount) * sizeof(Entry);
+
+	if (header.tocOffset % alignof(Entry) != 0 || tocEnd > size) {
+		throw std::runtime_error("Asset pack table of contents is out of range");
+	}
+
+	const Entry* entries = reinterpret_cast<const Entry*>(base + header.tocOffset);
+
+	for (uint32_t i = 0; i < header.entryCount; i++) {
+		const Entry& entry = entries[i];
+
+		if (std::memchr(entry.name, '\0', NameLength) == nullptr) {
+			throw std::runtime_error("Asset pack entry name is not terminated");
+		}
+
+		if (entry.offset % Alignment != 0 || entry.offset > size || entry.size > size - entry.offset) {
+			throw std::runtime_error("Asset pack entry " + std::string(entry.name) + " is out of range");
+		}
+	}
+}
+
+std::string getExecutableDirectory() {
+	std::string path;
+
+#ifdef _WIN32
+	char buffer[MAX_PATH];
+	DWORD length = GetModuleFileNameA(nullptr, buffer, MAX_PATH);
+
+	if (length > 0 && length < MAX_PATH) {
+		path.assign(buffer, length);
+	}
+#else
+	char buffer[4096];
+	ssize_t length = readlink("/proc/self/exe", buffer, sizeof(buffer));
+
+	if (length > 0 && static_cast<size_t>(length) < sizeof(buffer)) {
+		path.assign(buffer, static_cast<size_t>(length));
+	}
+#endif
+
+	size_t separator = path.find_last_of("/\\");
+
+	if (separator == std::string::npos) {
+		return ".";
+	}
+
+	return path.substr(0, separator);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "MappedFile.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// A read-only view of one asset inside a pack. The data stays owned by the pack.
+struct AssetView {
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+
+	// Every asset starts on a 16 byte boundary, so SPIR-V can be handed to Vulkan without a copy
+	const uint32_t* words() const {
+		return reinterpret_cast<const uint32_t*>(data);
+	}
+};
+
+// Packed archive of shaders and other assets, written by shaders/pack_assets.py. The file is a
+// header, a table of contents and the asset data:
+//
+//   Header  { uint32 magic, uint32 version, uint32 entryCount, uint32 tocOffset }
+//   Entry   { char name[48], uint64 offset, uint64 size } * entryCount
+//   Data    each asset aligned to 16 bytes
+//
+// The pack is either memory-mapped from disk or points at a copy compiled into the executable.
+class AssetPack {
+public:
+	AssetPack() = default;
+	AssetPack(const AssetPack&) = delete;
+	AssetPack& operator=(const AssetPack&) = delete;
+	~AssetPack();
+
+	void openFile(const std::string& path);
+	void openMemory(const void* data, size_t size);
+	void close();
+
+	// Throws if the asset does not exist
+	AssetView get(const std::string& name) const;
+
+	static constexpr uint32_t Magic = 0x50415456; // "VTAP"
+	static constexpr uint32_t Version = 1;
+	static constexpr size_t NameLength = 48;
+	static constexpr size_t Alignment = 16;
+
+private:
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t entryCount;
+		uint32_t tocOffset;
+	};
+
+	struct Entry {
+		char name[NameLength];
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	void validate() const;
+
+	const uint8_t* base = nullptr;
+	size_t size = 0;
+
+	// Only open for packs read from disk
+	MappedFile file;
+};
+
+// Directory of the running executable, so assets are found regardless of the working directory
+std::string getExecutableDirectory();
@@ -0,0 +1,87 @@
+#include "BuddyAllocator.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+BuddyAllocator::BuddyAllocator(uint64_t size, uint64_t minBlockSize) : size(size), minBlockSize(minBlockSize) {
+	if (minBlockSize == 0 || (minBlockSize & (minBlockSize - 1)) != 0 || size < minBlockSize || (size & (size - 1)) != 0) {
+		throw std::runtime_error("Buddy allocator sizes must be powers of two");
+	}
+
+	orderCount = 1;
+	while (blockSize(orderCount - 1) < size) {
+		orderCount++;
+	}
+
+	freeLists.resize(orderCount);
+	freeLists[orderCount - 1].insert(0);
+}
+
+std::optional<uint64_t> BuddyAllocator::allocate(uint64_t requestedSize, uint64_t alignment) {
+	uint64_t needed = std::max({ requestedSize, alignment, minBlockSize });
+
+	uint32_t order = 0;
+	while (order < orderCount && blockSize(order) < needed) {
+		order++;
+	}
+
+	// Find the smallest free block that fits, then split it down to the wanted size
+	uint32_t available = order;
+	while (available < orderCount && freeLists[available].empty()) {
+		available++;
+	}
+
+	if (available >= orderCount) {
+		return std::nullopt;
+	}
+
+	uint64_t offset = *freeLists[available].begin();
+	freeLists[available].erase(freeLists[available].begin());
+
+	while (available > order) {
+		available--;
+		freeLists[available].insert(offset + blockSize(available));
+	}
+
+	allocatedOrders[offset] = order;
+	usedBytes += blockSize(order);
+
+	return offset;
+}
+
+void BuddyAllocator::free(uint64_t offset) {
+	auto allocated = allocatedOrders.find(offset);
+
+	if (allocated == allocatedOrders.end()) {
+		throw std::runtime_error("Freeing a block that was not allocated");
+	}
+
+	uint32_t order = allocated->second;
+	allocatedOrders.erase(allocated);
+	usedBytes -= blockSize(order);
+
+	while (order + 1 < orderCount) {
+		uint64_t buddy = offset ^ blockSize(order);
+		auto freeBuddy = freeLists[order].find(buddy);
+
+		if (freeBuddy == freeLists[order].end()) {
+			break;
+		}
+
+		freeLists[order].erase(freeBuddy);
+		offset = std::min(offset, buddy);
+		order++;
+	}
+
+	freeLists[order].insert(offset);
+}
+
+uint64_t BuddyAllocator::getLargestFreeBlock() const {
+	for (uint32_t order = orderCount; order > 0; order--) {
+		if (!freeLists[order - 1].empty()) {
+			return blockSize(order - 1);
+		}
+	}
+
+	return 0;
+}
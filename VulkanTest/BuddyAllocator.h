@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+// Buddy placement over one range of memory. Every block is a power of two times the minimum block
+// size and starts at a multiple of its own size, so any power of two alignment up to the block size
+// comes for free. Neighbouring free buddies are merged again when released.
+class BuddyAllocator {
+public:
+	BuddyAllocator(uint64_t size, uint64_t minBlockSize);
+
+	// Returns the offset of the new block, or nothing when no free block is large enough
+	std::optional<uint64_t> allocate(uint64_t size, uint64_t alignment);
+	void free(uint64_t offset);
+
+	uint64_t getSize() const {
+		return size;
+	}
+
+	// Bytes handed out, including the rounding up to a power of two
+	uint64_t getUsedBytes() const {
+		return usedBytes;
+	}
+
+	uint64_t getFreeBytes() const {
+		return size - usedBytes;
+	}
+
+	uint64_t getLargestFreeBlock() const;
+
+	uint32_t getAllocationCount() const {
+		return static_cast<uint32_t>(allocatedOrders.size());
+	}
+
+	bool isEmpty() const {
+		return allocatedOrders.empty();
+	}
+
+private:
+	uint64_t blockSize(uint32_t order) const {
+		return minBlockSize << order;
+	}
+
+	uint64_t size;
+	uint64_t minBlockSize;
+	uint64_t usedBytes = 0;
+	uint32_t orderCount;
+	std::vector<std::set<uint64_t>> freeLists;
+	std::unordered_map<uint64_t, uint32_t> allocatedOrders;
+};
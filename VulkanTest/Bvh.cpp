@@ -0,0 +1,248 @@
+#include "Bvh.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+namespace {
+	struct Aabb {
+		glm::vec3 boundsMin = glm::vec3(std::numeric_limits<float>::max());
+		glm::vec3 boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+
+		void grow(const glm::vec3& point) {
+			boundsMin = glm::min(boundsMin, point);
+			boundsMax = glm::max(boundsMax, point);
+		}
+
+		void grow(const Aabb& other) {
+			boundsMin = glm::min(boundsMin, other.boundsMin);
+			boundsMax = glm::max(boundsMax, other.boundsMax);
+		}
+
+		float area() const {
+			glm::vec3 extent = boundsMax - boundsMin;
+
+			if (extent.x < 0.0f) {
+				return 0.0f;
+			}
+
+			return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+		}
+	};
+
+	struct BuildTask {
+		uint32_t nodeIndex;
+		uint32_t depth;
+	};
+
+	// Binned SAH build over primitives with the given bounds and centroids. Returns the primitive indices in
+	// leaf order, which the leaves' ranges refer to.
+	std::vector<uint32_t> buildNodes(const std::vector<Aabb>& primitiveBounds, const std::vector<glm::vec3>& centroids, std::vector<BvhNode>& nodes,
+		BvhBuildStats& stats) {
+		constexpr uint32_t BinCount = Bvh::BinCount;
+		constexpr uint32_t MaxLeafSize = Bvh::MaxLeafSize;
+		constexpr uint32_t MaxDepth = Bvh::MaxDepth;
+
+		nodes.clear();
+		stats = BvhBuildStats();
+
+		uint32_t primitiveCount = static_cast<uint32_t>(primitiveBounds.size());
+
+		std::vector<uint32_t> indices(primitiveCount);
+		for (uint32_t i = 0; i < primitiveCount; i++) {
+			indices[i] = i;
+		}
+
+		// A binary tree over N leaves never needs more than 2N - 1 nodes
+		nodes.reserve(std::max(1u, primitiveCount * 2));
+
+		BvhNode root = {};
+		root.leftFirst = 0;
+		root.count = primitiveCount;
+		nodes.push_back(root);
+
+		std::vector<BuildTask> stack;
+		stack.push_back({ 0, 0 });
+
+		while (!stack.empty()) {
+			BuildTask task = stack.back();
+			stack.pop_back();
+
+			uint32_t first = nodes[task.nodeIndex].leftFirst;
+			uint32_t count = nodes[task.nodeIndex].count;
+
+			Aabb nodeBounds;
+			Aabb centroidBounds;
+			for (uint32_t i = first; i < first + count; i++) {
+				nodeBounds.grow(primitiveBounds[indices[i]]);
+				centroidBounds.grow(centroids[indices[i]]);
+			}
+
+			nodes[task.nodeIndex].boundsMin = nodeBounds.boundsMin;
+			nodes[task.nodeIndex].boundsMax = nodeBounds.boundsMax;
+
+			stats.maxDepth = std::max(stats.maxDepth, task.depth);
+
+			float leafCost = nodeBounds.area() * count;
+			float bestCost = std::numeric_limits<float>::max();
+			int bestAxis = -1;
+			uint32_t bestSplit = 0;
+
+			if (count > 1) {
+				for (int axis = 0; axis < 3; axis++) {
+					float axisMin = centroidBounds.boundsMin[axis];
+					float axisExtent = centroidBounds.boundsMax[axis] - axisMin;
+
+					if (axisExtent <= 0.0f) {
+						continue;
+					}
+
+					Aabb bins[BinCount];
+					uint32_t binCounts[BinCount] = {};
+					float scale = BinCount / axisExtent;
+
+					for (uint32_t i = first; i < first + count; i++) {
+						uint32_t bin = std::min(BinCount - 1, static_cast<uint32_t>((centroids[indices[i]][axis] - axisMin) * scale));
+						bins[bin].grow(primitiveBounds[indices[i]]);
+						binCounts[bin]++;
+					}
+
+					// Sweep from the right to get the cost of every right partition, then from the left
+					float rightAreas[BinCount];
+					uint32_t rightCounts[BinCount];
+					Aabb rightBounds;
+					uint32_t rightCount = 0;
+					for (uint32_t bin = BinCount - 1; bin > 0; bin--) {
+						rightBounds.grow(bins[bin]);
+						rightCount += binCounts[bin];
+						rightAreas[bin] = rightBounds.area();
+						rightCounts[bin] = rightCount;
+					}
+
+					Aabb leftBounds;
+					uint32_t leftCount = 0;
+					for (uint32_t split = 1; split < BinCount; split++) {
+						leftBounds.grow(bins[split - 1]);
+						leftCount += binCounts[split - 1];
+
+						if (leftCount == 0 || rightCounts[split] == 0) {
+							continue;
+						}
+
+						float cost = leftBounds.area() * leftCount + rightAreas[split] * rightCounts[split];
+
+						if (cost < bestCost) {
+							bestCost = cost;
+							bestAxis = axis;
+							bestSplit = split;
+						}
+					}
+				}
+			}
+
+			// Keep the node as a leaf when splitting does not pay off, unless it is too large to be one
+			if (bestAxis < 0 || task.depth + 1 >= MaxDepth || (bestCost >= leafCost && count <= MaxLeafSize)) {
+				stats.leafCount++;
+				stats.sahCost += leafCost;
+				continue;
+			}
+
+			float axisMin = centroidBounds.boundsMin[bestAxis];
+			float scale = BinCount / (centroidBounds.boundsMax[bestAxis] - axisMin);
+
+			auto middle = std::partition(indices.begin() + first, indices.begin() + first + count, [&](uint32_t index) {
+				uint32_t bin = std::min(BinCount - 1, static_cast<uint32_t>((centroids[index][bestAxis] - axisMin) * scale));
+				return bin < bestSplit;
+			});
+
+			uint32_t leftCount = static_cast<uint32_t>(middle - (indices.begin() + first));
+
+			uint32_t leftIndex = static_cast<uint32_t>(nodes.size());
+
+			BvhNode left = {};
+			left.leftFirst = first;
+			left.count = leftCount;
+
+			BvhNode right = {};
+			right.leftFirst = first + leftCount;
+			right.count = count - leftCount;
+
+			nodes.push_back(left);
+			nodes.push_back(right);
+
+			nodes[task.nodeIndex].leftFirst = leftIndex;
+			nodes[task.nodeIndex].count = 0;
+
+			stats.sahCost += nodeBounds.area();
+
+			stack.push_back({ leftIndex + 1, task.depth + 1 });
+			stack.push_back({ leftIndex, task.depth + 1 });
+		}
+
+		// Normalize by the root area so the cost is comparable between scenes
+		float rootArea = Aabb{ nodes[0].boundsMin, nodes[0].boundsMax }.area();
+		if (rootArea > 0.0f) {
+			stats.sahCost /= rootArea;
+		}
+
+		stats.nodeCount = static_cast<uint32_t>(nodes.size());
+
+		return indices;
+	}
+}
+
+void Bvh::build(std::vector<Triangle>& triangles) {
+	auto start = std::chrono::high_resolution_clock::now();
+
+	uint32_t triangleCount = static_cast<uint32_t>(triangles.size());
+
+	std::vector<Aabb> triangleBounds(triangleCount);
+	std::vector<glm::vec3> centroids(triangleCount);
+
+	for (uint32_t i = 0; i < triangleCount; i++) {
+		triangleBounds[i].grow(triangles[i].v0);
+		triangleBounds[i].grow(triangles[i].v1);
+		triangleBounds[i].grow(triangles[i].v2);
+		centroids[i] = (triangles[i].v0 + triangles[i].v1 + triangles[i].v2) * (1.0f / 3.0f);
+	}
+
+	std::vector<uint32_t> indices = buildNodes(triangleBounds, centroids, nodes, stats);
+
+	std::vector<Triangle> reordered(triangleCount);
+	for (uint32_t i = 0; i < triangleCount; i++) {
+		reordered[i] = triangles[indices[i]];
+	}
+	triangles.swap(reordered);
+
+	stats.buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+std::vector<uint32_t> Bvh::build(const std::vector<BvhBox>& boxes) {
+	auto start = std::chrono::high_resolution_clock::now();
+
+	uint32_t boxCount = static_cast<uint32_t>(boxes.size());
+
+	std::vector<Aabb> bounds(boxCount);
+	std::vector<glm::vec3> centroids(boxCount);
+
+	for (uint32_t i = 0; i < boxCount; i++) {
+		bounds[i] = Aabb{ boxes[i].boundsMin, boxes[i].boundsMax };
+		centroids[i] = (boxes[i].boundsMin + boxes[i].boundsMax) * 0.5f;
+	}
+
+	std::vector<uint32_t> indices = buildNodes(bounds, centroids, nodes, stats);
+
+	stats.buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	return indices;
+}
+
+void Bvh::assign(const BvhNode* source, size_t count) {
+	nodes.assign(source, source + count);
+
+	stats = BvhBuildStats();
+	stats.nodeCount = static_cast<uint32_t>(count);
+	stats.leafCount = static_cast<uint32_t>(std::count_if(nodes.begin(), nodes.end(), [](const BvhNode& node) { return node.isLeaf(); }));
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Scene.h"
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// 32 byte node shared with the GPU tracer. Children of an interior node are stored next to each
+// other, so only the left index is kept. Leaves reference a contiguous range of triangles.
+struct BvhNode {
+	glm::vec3 boundsMin;
+	uint32_t leftFirst;
+	glm::vec3 boundsMax;
+	uint32_t count;
+
+	bool isLeaf() const {
+		return count > 0;
+	}
+};
+
+// Bounds of a primitive other than a triangle, for example an instance of a mesh
+struct BvhBox {
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+};
+
+struct BvhBuildStats {
+	uint32_t nodeCount = 0;
+	uint32_t leafCount = 0;
+	uint32_t maxDepth = 0;
+	double sahCost = 0.0;
+	double buildMilliseconds = 0.0;
+};
+
+class Bvh {
+public:
+	// Builds a binned surface area heuristic BVH. The triangles are reordered in place so that
+	// every leaf references a contiguous range.
+	void build(std::vector<Triangle>& triangles);
+
+	// Builds the same BVH over boxes, which are left in place. Returns the box indices in leaf order, which
+	// the leaves' ranges refer to.
+	std::vector<uint32_t> build(const std::vector<BvhBox>& boxes);
+
+	// Adopts nodes built earlier, for example read from a scene cache, over triangles already in leaf order.
+	// Only the node and leaf counts of the stats are known afterwards.
+	void assign(const BvhNode* source, size_t count);
+
+	const std::vector<BvhNode>& getNodes() const {
+		return nodes;
+	}
+
+	const BvhBuildStats& getStats() const {
+		return stats;
+	}
+
+	static constexpr uint32_t BinCount = 16;
+	static constexpr uint32_t MaxLeafSize = 8;
+	// Bounds the traversal stack of both tracers. Nodes at this depth become leaves regardless of size.
+	static constexpr uint32_t MaxDepth = 64;
+
+private:
+	std::vector<BvhNode> nodes;
+	BvhBuildStats stats;
+};
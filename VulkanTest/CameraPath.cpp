@@ -0,0 +1,105 @@
+#include "CameraPath.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+CameraPath CameraPath::load(const std::string& filename, const Camera& base) {
+	std::ifstream file(filename);
+
+	if (!file.is_open()) {
+		throw std::runtime_error("Could not open camera path " + filename);
+	}
+
+	CameraPath path;
+	std::string line;
+	uint32_t lineNumber = 0;
+
+	while (std::getline(file, line)) {
+		lineNumber++;
+
+		size_t first = line.find_first_not_of(" \t\r");
+		if (first == std::string::npos || line[first] == '#') {
+			continue;
+		}
+
+		std::istringstream stream(line);
+		CameraKeyframe keyframe = { 0.0f, base };
+		glm::vec3& position = keyframe.camera.position;
+		glm::vec3& forward = keyframe.camera.forward;
+
+		if (!(stream >> keyframe.time >> position.x >> position.y >> position.z >> forward.x >> forward.y >> forward.z)) {
+			throw std::runtime_error("Could not parse line " + std::to_string(lineNumber) + " of camera path " + filename);
+		}
+
+		float fovDegrees;
+		if (stream >> fovDegrees) {
+			keyframe.camera.verticalFov = glm::radians(fovDegrees);
+		}
+
+		if (glm::length(forward) == 0.0f) {
+			throw std::runtime_error("Camera path " + filename + " has no view direction on line " + std::to_string(lineNumber));
+		}
+		forward = glm::normalize(forward);
+
+		if (!path.keyframes.empty() && keyframe.time <= path.keyframes.back().time) {
+			throw std::runtime_error("Camera path " + filename + " goes back in time on line " + std::to_string(lineNumber));
+		}
+
+		// Opposite directions leave the arc between them undefined
+		if (!path.keyframes.empty() && glm::dot(forward, path.keyframes.back().camera.forward) < -0.999f) {
+			throw std::runtime_error("Camera path " + filename + " turns around in a single step on line " + std::to_string(lineNumber));
+		}
+
+		path.keyframes.push_back(keyframe);
+	}
+
+	if (path.keyframes.empty()) {
+		throw std::runtime_error("Camera path " + filename + " has no keyframes");
+	}
+
+	return path;
+}
+
+uint32_t CameraPath::getFrameCount(float framesPerSecond) const {
+	float duration = keyframes.back().time - keyframes.front().time;
+
+	// The small bias keeps a path of exactly n frames from losing the last one to rounding
+	return static_cast<uint32_t>(std::floor(duration * framesPerSecond + 1e-3f)) + 1;
+}
+
+Camera CameraPath::sample(float time) const {
+	auto next = std::upper_bound(keyframes.begin(), keyframes.end(), time, [](float t, const CameraKeyframe& keyframe) { return t < keyframe.time; });
+
+	if (next == keyframes.begin()) {
+		return keyframes.front().camera;
+	}
+	else if (next == keyframes.end()) {
+		return keyframes.back().camera;
+	}
+
+	const Camera& a = (next - 1)->camera;
+	const Camera& b = next->camera;
+	float t = (time - (next - 1)->time) / (next->time - (next - 1)->time);
+
+	Camera camera = a;
+	camera.position = glm::mix(a.position, b.position, t);
+	camera.verticalFov = glm::mix(a.verticalFov, b.verticalFov, t);
+
+	// Spherical interpolation, so the camera turns at a constant rate
+	float cosAngle = std::min(std::max(glm::dot(a.forward, b.forward), -1.0f), 1.0f);
+	float angle = std::acos(cosAngle);
+
+	if (angle < 1e-4f) {
+		camera.forward = glm::normalize(glm::mix(a.forward, b.forward, t));
+	}
+	else {
+		camera.forward = glm::normalize((std::sin((1.0f - t) * angle) * a.forward + std::sin(t * angle) * b.forward) / std::sin(angle));
+	}
+
+	return camera;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "Scene.h"
+
+#include <string>
+#include <vector>
+
+struct CameraKeyframe {
+	float time;
+	Camera camera;
+};
+
+// A camera animation for batch renders, sampled at a fixed frame rate. Between keyframes the position
+// and field of view are interpolated linearly and the view direction along the shorter arc.
+class CameraPath {
+public:
+	// A text file with one keyframe per line:
+	//
+	//   time px py pz fx fy fz [vertical fov in degrees]
+	//
+	// Times are in seconds and must increase. Empty lines and lines starting with # are skipped. The up
+	// vector, and the field of view of keyframes that leave it out, come from base.
+	static CameraPath load(const std::string& filename, const Camera& base);
+
+	// Frames from the first keyframe to the last one, both included
+	uint32_t getFrameCount(float framesPerSecond) const;
+
+	Camera sample(float time) const;
+
+	float getStartTime() const {
+		return keyframes.front().time;
+	}
+
+private:
+	std::vector<CameraKeyframe> keyframes;
+};
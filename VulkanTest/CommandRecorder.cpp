@@ -0,0 +1,100 @@
+#include "CommandRecorder.h"
+
+#include <stdexcept>
+
+void CommandRecorder::create(VkDevice device, uint32_t queueFamily, uint32_t frameCount, TaskScheduler& scheduler) {
+	this->device = device;
+	this->scheduler = &scheduler;
+
+	pools = std::vector<WorkerPool>(static_cast<size_t>(frameCount) * scheduler.getWorkerCount());
+
+	VkCommandPoolCreateInfo poolCreateInfo = {};
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolCreateInfo.queueFamilyIndex = queueFamily;
+	// Buffers are re-recorded every frame and only ever reset together with their pool
+	poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+	for (auto& pool : pools) {
+		if (vkCreateCommandPool(device, &poolCreateInfo, nullptr, &pool.commandPool) != VK_SUCCESS) {
+			throw std::runtime_error("Could not create worker command pool");
+		}
+	}
+}
+
+void CommandRecorder::destroy() {
+	for (auto& pool : pools) {
+		vkDestroyCommandPool(device, pool.commandPool, nullptr);
+	}
+
+	pools.clear();
+	ordered.clear();
+}
+
+void CommandRecorder::beginFrame(uint32_t frame) {
+	uint32_t workerCount = scheduler->getWorkerCount();
+
+	for (uint32_t worker = 0; worker < workerCount; worker++) {
+		WorkerPool& pool = pools[frame * workerCount + worker];
+
+		if (pool.used > 0) {
+			vkResetCommandPool(device, pool.commandPool, 0);
+			pool.used = 0;
+		}
+	}
+}
+
+void CommandRecorder::record(uint32_t frame, VkCommandBuffer primary, uint32_t count, const RecordTask& task) {
+	if (count == 0) {
+		return;
+	}
+
+	ordered.resize(count);
+
+	uint32_t workerCount = scheduler->getWorkerCount();
+
+	scheduler->parallelFor(count, [&](uint32_t index, uint32_t worker) {
+		VkCommandBuffer commandBuffer = acquire(pools[frame * workerCount + worker]);
+
+		// Compute work has no render pass to inherit, but secondary buffers still need the structure
+		VkCommandBufferInheritanceInfo inheritanceInfo = {};
+		inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+		if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+			throw std::runtime_error("Could not begin secondary command buffer");
+		}
+
+		task(index, commandBuffer);
+
+		if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("Could not record secondary command buffer");
+		}
+
+		ordered[index] = commandBuffer;
+	});
+
+	vkCmdExecuteCommands(primary, count, ordered.data());
+}
+
+VkCommandBuffer CommandRecorder::acquire(WorkerPool& pool) {
+	if (pool.used == pool.commandBuffers.size()) {
+		VkCommandBufferAllocateInfo allocateInfo = {};
+		allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocateInfo.commandPool = pool.commandPool;
+		allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		allocateInfo.commandBufferCount = 1;
+
+		VkCommandBuffer commandBuffer;
+		if (vkAllocateCommandBuffers(device, &allocateInfo, &commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("Could not allocate secondary command buffer");
+		}
+
+		pool.commandBuffers.push_back(commandBuffer);
+	}
+
+	return pool.commandBuffers[pool.used++];
+}
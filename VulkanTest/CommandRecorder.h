@@ -0,0 +1,50 @@
+#pragma once
+
+#include "TaskScheduler.h"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Records secondary command buffers on the workers of a TaskScheduler and stitches them into a
+// primary command buffer in index order. Every worker owns one command pool per frame in flight, so
+// a pool is never touched by two threads and all of a frame's buffers are reset with one call per
+// pool once the frame's fence has signalled.
+class CommandRecorder {
+public:
+	using RecordTask = std::function<void(uint32_t index, VkCommandBuffer commandBuffer)>;
+
+	void create(VkDevice device, uint32_t queueFamily, uint32_t frameCount, TaskScheduler& scheduler);
+	void destroy();
+
+	// Resets every pool of the frame. Only valid once the GPU is done with the frame's last submission.
+	void beginFrame(uint32_t frame);
+
+	// Records count secondary command buffers in parallel, task(i, ...) filling the i-th one, and
+	// executes them from primary in order. Secondary command buffers inherit no state from the
+	// primary, so every task has to bind whatever it uses.
+	void record(uint32_t frame, VkCommandBuffer primary, uint32_t count, const RecordTask& task);
+
+	uint32_t getThreadCount() const {
+		return scheduler->getWorkerCount();
+	}
+
+private:
+	// Padded to a cache line, the counters of neighbouring workers are written concurrently
+	struct alignas(64) WorkerPool {
+		VkCommandPool commandPool = VK_NULL_HANDLE;
+		std::vector<VkCommandBuffer> commandBuffers;
+		uint32_t used = 0;
+	};
+
+	VkCommandBuffer acquire(WorkerPool& pool);
+
+	VkDevice device = VK_NULL_HANDLE;
+	TaskScheduler* scheduler = nullptr;
+
+	// Indexed by frame * worker count + worker
+	std::vector<WorkerPool> pools;
+	std::vector<VkCommandBuffer> ordered;
+};
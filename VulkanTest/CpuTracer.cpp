@@ -0,0 +1,693 @@
+#include "CpuTracer.h"
+#include "Simd.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <bitset>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+namespace {
+	constexpr float RayEpsilon = 1e-4f;
+	constexpr float Pi = 3.14159265358979f;
+	constexpr uint32_t NoHit = 0xFFFFFFFFu;
+
+	// The sampling helpers mirror the ones in raytrace.comp so both tracers walk the same paths
+	uint32_t pcgHash(uint32_t value) {
+		uint32_t state = value * 747796405u + 2891336453u;
+		uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+		return (word >> 22u) ^ word;
+	}
+
+	float randomFloat(uint32_t& state) {
+		state = pcgHash(state);
+		return (state >> 8) * (1.0f / 16777216.0f);
+	}
+
+	uint32_t pathSeed(uint32_t pixelIndex, uint32_t sampleIndex, uint32_t frameIndex) {
+		return pcgHash(pixelIndex ^ pcgHash(sampleIndex + frameIndex * 0x9E3779B9u));
+	}
+
+	glm::vec3 sampleCosineHemisphere(const glm::vec3& normal, float r1, float r2) {
+		// Orthonormal basis from Duff et al. 2017, "Building an Orthonormal Basis, Revisited"
+		float sign = std::copysign(1.0f, normal.z);
+		float a = -1.0f / (sign + normal.z);
+		float b = normal.x * normal.y * a;
+		glm::vec3 tangent(1.0f + sign * normal.x * normal.x * a, sign * b, -sign * normal.x);
+		glm::vec3 bitangent(b, sign + normal.y * normal.y * a, -normal.y);
+
+		float phi = 2.0f * Pi * r1;
+		float radius = std::sqrt(r2);
+
+		return glm::normalize(tangent * (radius * std::cos(phi)) + bitangent * (radius * std::sin(phi)) + normal * std::sqrt(std::max(0.0f, 1.0f - r2)));
+	}
+
+	float safeInverse(float value) {
+		return 1.0f / (std::fabs(value) > 1e-8f ? value : std::copysign(1e-8f, value));
+	}
+
+	float luminance(float r, float g, float b) {
+		return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+	}
+
+	// Standard error of the mean luminance carried through the gamma encode, so the error is measured in
+	// what ends up on screen and dark regions are not over or under sampled. raytrace.comp uses the same estimate.
+	float displayError(const float* sums, uint32_t sampleCount) {
+		constexpr float LuminanceFloor = 1e-4f;
+
+		float mean = luminance(sums[0], sums[1], sums[2]) / sampleCount;
+		float variance = std::max(sums[3] / sampleCount - mean * mean, 0.0f);
+
+		float standardError = std::sqrt(variance / sampleCount);
+		float slope = std::pow(std::min(std::max(mean, LuminanceFloor), 1.0f), 1.0f / 2.2f - 1.0f) / 2.2f;
+
+		return std::min(standardError * slope, 1.0f);
+	}
+
+	// Every tile takes this many samples before its variance estimate is trusted. Path traced noise is
+	// heavy tailed, with fewer samples tiles that have not seen their fireflies yet retire too early.
+	constexpr uint32_t MinimumAdaptiveSamples = 64;
+
+	simd::vfloat safeInverse(simd::vfloat value) {
+		simd::vfloat clamped = simd::select(value < simd::vfloat(0.0f), simd::vfloat(-1e-8f), simd::vfloat(1e-8f));
+		return simd::vfloat(1.0f) / simd::select(simd::abs(value) > simd::vfloat(1e-8f), value, clamped);
+	}
+
+	// Walks the BVH below root with a whole packet, nearer child first, and calls leaf for every leaf the
+	// packet reaches. rays needs the origin, inverse direction and active members of CpuTracer::RayPacket,
+	// hitT is the closest hit so far.
+	template<typename Rays, typename Leaf>
+	void traversePacket(const BvhNode* nodes, uint32_t root, const Rays& rays, const simd::vfloat& hitT, const Leaf& leaf) {
+		using simd::vfloat;
+		using simd::vmask;
+
+		// Slab test of the whole packet against one box. tNear receives the entry distance per lane.
+		auto intersectBox = [&](const BvhNode& node, vfloat& tNear) -> vmask {
+			vfloat t1x = (vfloat(node.boundsMin.x) - rays.originX) * rays.inverseX;
+			vfloat t2x = (vfloat(node.boundsMax.x) - rays.originX) * rays.inverseX;
+			vfloat t1y = (vfloat(node.boundsMin.y) - rays.originY) * rays.inverseY;
+			vfloat t2y = (vfloat(node.boundsMax.y) - rays.originY) * rays.inverseY;
+			vfloat t1z = (vfloat(node.boundsMin.z) - rays.originZ) * rays.inverseZ;
+			vfloat t2z = (vfloat(node.boundsMax.z) - rays.originZ) * rays.inverseZ;
+
+			tNear = simd::max(simd::max(simd::min(t1x, t2x), simd::min(t1y, t2y)), simd::max(simd::min(t1z, t2z), vfloat(0.0f)));
+			vfloat tFar = simd::min(simd::min(simd::max(t1x, t2x), simd::max(t1y, t2y)), simd::min(simd::max(t1z, t2z), hitT));
+
+			return rays.active & (tNear <= tFar);
+		};
+
+		struct StackEntry {
+			uint32_t node;
+			vfloat tNear;
+		};
+
+		StackEntry stack[Bvh::MaxDepth + 1];
+		int stackSize = 0;
+
+		vfloat rootNear;
+		if (!intersectBox(nodes[root], rootNear).any()) {
+			return;
+		}
+
+		stack[stackSize++] = { root, rootNear };
+
+		while (stackSize > 0) {
+			StackEntry entry = stack[--stackSize];
+
+			// A closer hit may have been found since this node was pushed
+			if (!(rays.active & (entry.tNear < hitT)).any()) {
+				continue;
+			}
+
+			const BvhNode& node = nodes[entry.node];
+
+			if (node.isLeaf()) {
+				leaf(node);
+				continue;
+			}
+
+			vfloat leftNear, rightNear;
+			vmask leftHit = intersectBox(nodes[node.leftFirst], leftNear);
+			vmask rightHit = intersectBox(nodes[node.leftFirst + 1], rightNear);
+
+			bool visitLeft = leftHit.any();
+			bool visitRight = rightHit.any();
+
+			if (visitLeft && visitRight) {
+				// Visit the child the packet reaches first, so push it last
+				float nearestLeft[simd::Width], nearestRight[simd::Width];
+				simd::select(leftHit, leftNear, vfloat(INFINITY)).store(nearestLeft);
+				simd::select(rightHit, rightNear, vfloat(INFINITY)).store(nearestRight);
+
+				float leftMin = *std::min_element(nearestLeft, nearestLeft + simd::Width);
+				float rightMin = *std::min_element(nearestRight, nearestRight + simd::Width);
+
+				if (leftMin <= rightMin) {
+					stack[stackSize++] = { node.leftFirst + 1, simd::select(rightHit, rightNear, vfloat(INFINITY)) };
+					stack[stackSize++] = { node.leftFirst, simd::select(leftHit, leftNear, vfloat(INFINITY)) };
+				}
+				else {
+					stack[stackSize++] = { node.leftFirst, simd::select(leftHit, leftNear, vfloat(INFINITY)) };
+					stack[stackSize++] = { node.leftFirst + 1, simd::select(rightHit, rightNear, vfloat(INFINITY)) };
+				}
+			}
+			else if (visitLeft) {
+				stack[stackSize++] = { node.leftFirst, simd::select(leftHit, leftNear, vfloat(INFINITY)) };
+			}
+			else if (visitRight) {
+				stack[stackSize++] = { node.leftFirst + 1, simd::select(rightHit, rightNear, vfloat(INFINITY)) };
+			}
+		}
+	}
+
+	// 2^(biased - 127), built from the bits like uintBitsToFloat in raytrace.comp
+	float exponentScale(uint8_t biased) {
+		uint32_t bits = static_cast<uint32_t>(biased) << 23;
+		float scale;
+		std::memcpy(&scale, &bits, sizeof(scale));
+		return scale;
+	}
+
+	// The same walk through a WideBvh, testing the packet against every child box of a node. Leaves are handed
+	// to leaf as they are found, as a triangle range, and interior children pushed farthest first.
+	template<typename Rays, typename Leaf>
+	void traverseWidePacket(const WideBvh& wideBvh, const Rays& rays, const simd::vfloat& hitT, const Leaf& leaf) {
+		using simd::vfloat;
+		using simd::vmask;
+
+		constexpr uint32_t Width = WideBvh::Width;
+
+		const std::vector<WideBvhNode>& nodes = wideBvh.getNodes();
+		const std::vector<uint32_t>& children = wideBvh.getChildren();
+
+		struct StackEntry {
+			uint32_t node;
+			float nearest;
+			vfloat tNear;
+		};
+
+		StackEntry stack[WideBvh::MaxStackSize];
+		int stackSize = 0;
+
+		stack[stackSize++] = { 0, 0.0f, vfloat(0.0f) };
+
+		while (stackSize > 0) {
+			StackEntry entry = stack[--stackSize];
+
+			if (!(rays.active & (entry.tNear < hitT)).any()) {
+				continue;
+			}
+
+			const WideBvhNode& node = nodes[entry.node];
+
+			// Child planes are origin + q * scale, so their distances along the rays are offset + q * step
+			float scaleX = exponentScale(node.exponents[0]);
+			float scaleY = exponentScale(node.exponents[1]);
+			float scaleZ = exponentScale(node.exponents[2]);
+
+			vfloat offsetX = (vfloat(node.origin.x) - rays.originX) * rays.inverseX;
+			vfloat offsetY = (vfloat(node.origin.y) - rays.originY) * rays.inverseY;
+			vfloat offsetZ = (vfloat(node.origin.z) - rays.originZ) * rays.inverseZ;
+			vfloat stepX = vfloat(scaleX) * rays.inverseX;
+			vfloat stepY = vfloat(scaleY) * rays.inverseY;
+			vfloat stepZ = vfloat(scaleZ) * rays.inverseZ;
+
+			StackEntry hits[Width];
+			uint32_t hitCount = 0;
+
+			for (uint32_t i = 0; i < node.childCount; i++) {
+				vfloat t1x = offsetX + vfloat(node.bounds[0][i]) * stepX;
+				vfloat t2x = offsetX + vfloat(node.bounds[1][i]) * stepX;
+				vfloat t1y = offsetY + vfloat(node.bounds[2][i]) * stepY;
+				vfloat t2y = offsetY + vfloat(node.bounds[3][i]) * stepY;
+				vfloat t1z = offsetZ + vfloat(node.bounds[4][i]) * stepZ;
+				vfloat t2z = offsetZ + vfloat(node.bounds[5][i]) * stepZ;
+
+				vfloat tNear = simd::max(simd::max(simd::min(t1x, t2x), simd::min(t1y, t2y)), simd::max(simd::min(t1z, t2z), vfloat(0.0f)));
+				vfloat tFar = simd::min(simd::min(simd::max(t1x, t2x), simd::max(t1y, t2y)), simd::min(simd::max(t1z, t2z), hitT));
+				vmask hit = rays.active & (tNear <= tFar);
+
+				if (!hit.any()) {
+					continue;
+				}
+
+				uint32_t reference = children[static_cast<size_t>(entry.node) * Width + i];
+
+				if ((reference & WideBvh::LeafFlag) != 0) {
+					leaf(reference & (WideBvh::MaxTriangles - 1), ((reference >> 28) & 7u) + 1);
+					continue;
+				}
+
+				vfloat laneNear = simd::select(hit, tNear, vfloat(INFINITY));
+				float nearLanes[simd::Width];
+				laneNear.store(nearLanes);
+				float nearest = *std::min_element(nearLanes, nearLanes + simd::Width);
+
+				// Sorted by the packet's nearest entry, farthest first
+				uint32_t slot = hitCount++;
+				while (slot > 0 && hits[slot - 1].nearest < nearest) {
+					hits[slot] = hits[slot - 1];
+					slot--;
+				}
+				hits[slot] = { reference, nearest, laneNear };
+			}
+
+			for (uint32_t i = 0; i < hitCount; i++) {
+				stack[stackSize++] = hits[i];
+			}
+		}
+	}
+}
+
+struct CpuTracer::RayPacket {
+	simd::vfloat originX, originY, originZ;
+	simd::vfloat directionX, directionY, directionZ;
+	simd::vfloat inverseX, inverseY, inverseZ;
+	simd::vmask active;
+};
+
+struct CpuTracer::HitPacket {
+	simd::vfloat t;
+	simd::vfloat triangle;
+	// Index into the two level BVH's instances, NoHit for scenes without instances
+	simd::vfloat instance;
+};
+
+void CpuTracer::intersect(RayPacket& rays, HitPacket& hits) const {
+	using simd::vfloat;
+
+	hits.triangle = vfloat::fromBits(NoHit);
+	hits.instance = vfloat::fromBits(NoHit);
+
+	const std::vector<BvhNode>& nodes = bvh.getNodes();
+
+	if (nodes.empty()) {
+		return;
+	}
+
+	if (twoLevelBvh == nullptr && wideBvh != nullptr) {
+		traverseWidePacket(*wideBvh, rays, hits.t, [&](uint32_t first, uint32_t count) {
+			intersectTriangles(first, count, rays, hits, NoHit);
+		});
+		return;
+	}
+
+	if (twoLevelBvh == nullptr) {
+		traversePacket(nodes.data(), 0, rays, hits.t, [&](const BvhNode& leaf) {
+			intersectTriangles(leaf.leftFirst, leaf.count, rays, hits, NoHit);
+		});
+		return;
+	}
+
+	const std::vector<BvhNode>& topNodes = twoLevelBvh->getTopNodes();
+	const std::vector<BvhInstance>& instances = twoLevelBvh->getInstances();
+
+	if (instances.empty()) {
+		return;
+	}
+
+	// Every lane meets the same instance, so the packet is taken into its space as a whole. Directions are
+	// not normalized afterwards, which keeps hit distances the same in both spaces.
+	traversePacket(topNodes.data(), 0, rays, hits.t, [&](const BvhNode& leaf) {
+		for (uint32_t i = leaf.leftFirst; i < leaf.leftFirst + leaf.count; i++) {
+			const BvhInstance& instance = instances[i];
+			const glm::vec4* rows = instance.worldToObject;
+
+			RayPacket local;
+			local.originX = vfloat(rows[0].x) * rays.originX + vfloat(rows[0].y) * rays.originY + vfloat(rows[0].z) * rays.originZ + vfloat(rows[0].w);
+			local.originY = vfloat(rows[1].x) * rays.originX + vfloat(rows[1].y) * rays.originY + vfloat(rows[1].z) * rays.originZ + vfloat(rows[1].w);
+			local.originZ = vfloat(rows[2].x) * rays.originX + vfloat(rows[2].y) * rays.originY + vfloat(rows[2].z) * rays.originZ + vfloat(rows[2].w);
+			local.directionX = vfloat(rows[0].x) * rays.directionX + vfloat(rows[0].y) * rays.directionY + vfloat(rows[0].z) * rays.directionZ;
+			local.directionY = vfloat(rows[1].x) * rays.directionX + vfloat(rows[1].y) * rays.directionY + vfloat(rows[1].z) * rays.directionZ;
+			local.directionZ = vfloat(rows[2].x) * rays.directionX + vfloat(rows[2].y) * rays.directionY + vfloat(rows[2].z) * rays.directionZ;
+			local.inverseX = safeInverse(local.directionX);
+			local.inverseY = safeInverse(local.directionY);
+			local.inverseZ = safeInverse(local.directionZ);
+			local.active = rays.active;
+
+			traversePacket(nodes.data(), instance.rootNode, local, hits.t, [&](const BvhNode& meshLeaf) {
+				intersectTriangles(meshLeaf.leftFirst, meshLeaf.count, local, hits, i);
+			});
+		}
+	});
+}
+
+void CpuTracer::intersectTriangles(uint32_t first, uint32_t count, const RayPacket& rays, HitPacket& hits, uint32_t instance) const {
+	using simd::vfloat;
+	using simd::vmask;
+
+	// Moller-Trumbore with one triangle broadcast against every ray in the packet
+	for (uint32_t i = first; i < first + count; i++) {
+		const Triangle& triangle = scene.triangles[i];
+		glm::vec3 edge1 = triangle.v1 - triangle.v0;
+		glm::vec3 edge2 = triangle.v2 - triangle.v0;
+
+		vfloat e1x(edge1.x), e1y(edge1.y), e1z(edge1.z);
+		vfloat e2x(edge2.x), e2y(edge2.y), e2z(edge2.z);
+
+		vfloat px = rays.directionY * e2z - rays.directionZ * e2y;
+		vfloat py = rays.directionZ * e2x - rays.directionX * e2z;
+		vfloat pz = rays.directionX * e2y - rays.directionY * e2x;
+
+		vfloat determinant = e1x * px + e1y * py + e1z * pz;
+		vfloat inverseDeterminant = vfloat(1.0f) / determinant;
+
+		vfloat tx = rays.originX - vfloat(triangle.v0.x);
+		vfloat ty = rays.originY - vfloat(triangle.v0.y);
+		vfloat tz = rays.originZ - vfloat(triangle.v0.z);
+
+		vfloat u = (tx * px + ty * py + tz * pz) * inverseDeterminant;
+
+		vfloat qx = ty * e1z - tz * e1y;
+		vfloat qy = tz * e1x - tx * e1z;
+		vfloat qz = tx * e1y - ty * e1x;
+
+		vfloat v = (rays.directionX * qx + rays.directionY * qy + rays.directionZ * qz) * inverseDeterminant;
+		vfloat t = (e2x * qx + e2y * qy + e2z * qz) * inverseDeterminant;
+
+		vmask hit = rays.active & (simd::abs(determinant) > vfloat(1e-9f)) & (u >= vfloat(0.0f)) & (v >= vfloat(0.0f)) &
+			((u + v) <= vfloat(1.0f)) & (t > vfloat(RayEpsilon)) & (t < hits.t);
+
+		hits.t = simd::select(hit, t, hits.t);
+		hits.triangle = simd::select(hit, vfloat::fromBits(i), hits.triangle);
+		hits.instance = simd::select(hit, vfloat::fromBits(instance), hits.instance);
+	}
+}
+
+uint64_t CpuTracer::renderTile(const CpuRenderSettings& settings, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, float* radiance, uint32_t rowPitch) const {
+	std::vector<float> sums(static_cast<size_t>(x1 - x0) * (y1 - y0) * 4, 0.0f);
+
+	uint64_t rayCount = traceSamples(settings, x0, y0, x1, y1, 0, settings.samplesPerPixel, sums.data());
+
+	float inverseSamples = 1.0f / std::max(1u, settings.samplesPerPixel);
+
+	for (uint32_t y = y0; y < y1; y++) {
+		for (uint32_t x = x0; x < x1; x++) {
+			const float* sum = &sums[(static_cast<size_t>(y - y0) * (x1 - x0) + (x - x0)) * 4];
+			float* pixel = radiance + (static_cast<size_t>(y - y0) * rowPitch + (x - x0)) * 3;
+			pixel[0] = sum[0] * inverseSamples;
+			pixel[1] = sum[1] * inverseSamples;
+			pixel[2] = sum[2] * inverseSamples;
+		}
+	}
+
+	return rayCount;
+}
+
+uint64_t CpuTracer::traceSamples(const CpuRenderSettings& settings, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, uint32_t firstSample, uint32_t sampleCount,
+	float* sums) const {
+	constexpr int Width = simd::Width;
+
+	const Camera& camera = scene.camera;
+	glm::vec3 forward = glm::normalize(camera.forward);
+	glm::vec3 right = glm::normalize(glm::cross(forward, camera.up));
+	glm::vec3 up = glm::cross(right, forward);
+
+	float tanHalfFov = std::tan(camera.verticalFov * 0.5f);
+	float aspect = static_cast<float>(settings.width) / static_cast<float>(settings.height);
+
+	uint64_t rayCount = 0;
+
+	for (uint32_t y = y0; y < y1; y++) {
+		for (uint32_t x = x0; x < x1; x += Width) {
+			float accumulated[Width][4] = {};
+
+			for (uint32_t sample = firstSample; sample < firstSample + sampleCount; sample++) {
+				float originX[Width], originY[Width], originZ[Width];
+				float directionX[Width], directionY[Width], directionZ[Width];
+				float inverseX[Width], inverseY[Width], inverseZ[Width];
+				float throughput[Width][3];
+				float pathRadiance[Width][3] = {};
+				uint32_t rng[Width];
+				bool alive[Width];
+
+				for (int lane = 0; lane < Width; lane++) {
+					uint32_t px = x + lane;
+					alive[lane] = px < x1;
+
+					// Dead lanes still need finite rays so they cannot produce NaNs in the kernels
+					glm::vec3 direction = forward;
+
+					if (alive[lane]) {
+						rng[lane] = pathSeed(y * settings.width + px, sample, settings.frameIndex);
+
+						float jitterX = randomFloat(rng[lane]);
+						float jitterY = randomFloat(rng[lane]);
+
+						float u = (2.0f * (px + jitterX) / settings.width - 1.0f) * tanHalfFov * aspect;
+						float v = (1.0f - 2.0f * (y + jitterY) / settings.height) * tanHalfFov;
+
+						direction = glm::normalize(forward + right * u + up * v);
+					}
+
+					originX[lane] = camera.position.x;
+					originY[lane] = camera.position.y;
+					originZ[lane] = camera.position.z;
+					directionX[lane] = direction.x;
+					directionY[lane] = direction.y;
+					directionZ[lane] = direction.z;
+					throughput[lane][0] = throughput[lane][1] = throughput[lane][2] = 1.0f;
+				}
+
+				for (uint32_t bounce = 0; bounce < settings.maxBounces; bounce++) {
+					int activeBits = 0;
+					for (int lane = 0; lane < Width; lane++) {
+						if (alive[lane]) {
+							activeBits |= 1 << lane;
+						}
+
+						inverseX[lane] = safeInverse(directionX[lane]);
+						inverseY[lane] = safeInverse(directionY[lane]);
+						inverseZ[lane] = safeInverse(directionZ[lane]);
+					}
+
+					if (activeBits == 0) {
+						break;
+					}
+
+					float laneMask[Width];
+					for (int lane = 0; lane < Width; lane++) {
+						laneMask[lane] = alive[lane] ? 1.0f : 0.0f;
+					}
+
+					RayPacket rays;
+					rays.originX = simd::vfloat::load(originX);
+					rays.originY = simd::vfloat::load(originY);
+					rays.originZ = simd::vfloat::load(originZ);
+					rays.directionX = simd::vfloat::load(directionX);
+					rays.directionY = simd::vfloat::load(directionY);
+					rays.directionZ = simd::vfloat::load(directionZ);
+					rays.inverseX = simd::vfloat::load(inverseX);
+					rays.inverseY = simd::vfloat::load(inverseY);
+					rays.inverseZ = simd::vfloat::load(inverseZ);
+					rays.active = simd::vfloat::load(laneMask) > simd::vfloat(0.0f);
+
+					HitPacket hits;
+					hits.t = simd::vfloat(INFINITY);
+					intersect(rays, hits);
+
+					rayCount += std::bitset<32>(activeBits).count();
+
+					float hitT[Width], hitTriangle[Width], hitInstance[Width];
+					hits.t.store(hitT);
+					hits.triangle.store(hitTriangle);
+					hits.instance.store(hitInstance);
+
+					for (int lane = 0; lane < Width; lane++) {
+						if (!alive[lane]) {
+							continue;
+						}
+
+						uint32_t triangleIndex = simd::laneBits(hitTriangle, lane);
+						glm::vec3 direction(directionX[lane], directionY[lane], directionZ[lane]);
+						glm::vec3 weight(throughput[lane][0], throughput[lane][1], throughput[lane][2]);
+
+						if (triangleIndex == NoHit) {
+							glm::vec3 contribution = weight * scene.backgroundColor;
+							pathRadiance[lane][0] += contribution.x;
+							pathRadiance[lane][1] += contribution.y;
+							pathRadiance[lane][2] += contribution.z;
+							alive[lane] = false;
+							continue;
+						}
+
+						const Triangle& triangle = scene.triangles[triangleIndex];
+						const Material& material = scene.materials[triangle.materialId];
+
+						glm::vec3 contribution = weight * material.emission;
+						pathRadiance[lane][0] += contribution.x;
+						pathRadiance[lane][1] += contribution.y;
+						pathRadiance[lane][2] += contribution.z;
+
+						weight = weight * material.albedo;
+
+						if (bounce + 1 == settings.maxBounces || (weight.x <= 0.0f && weight.y <= 0.0f && weight.z <= 0.0f)) {
+							alive[lane] = false;
+							continue;
+						}
+
+						glm::vec3 normal = glm::cross(triangle.v1 - triangle.v0, triangle.v2 - triangle.v0);
+
+						// Normals go back to world space with the transpose of the inverse transform
+						uint32_t instanceIndex = simd::laneBits(hitInstance, lane);
+						if (instanceIndex != NoHit) {
+							const glm::vec4* rows = twoLevelBvh->getInstances()[instanceIndex].worldToObject;
+							normal = glm::vec3(rows[0]) * normal.x + glm::vec3(rows[1]) * normal.y + glm::vec3(rows[2]) * normal.z;
+						}
+
+						normal = glm::normalize(normal);
+						if (glm::dot(normal, direction) > 0.0f) {
+							normal = -normal;
+						}
+
+						glm::vec3 origin = glm::vec3(originX[lane], originY[lane], originZ[lane]) + direction * hitT[lane] + normal * RayEpsilon;
+
+						float r1 = randomFloat(rng[lane]);
+						float r2 = randomFloat(rng[lane]);
+						glm::vec3 bounceDirection = sampleCosineHemisphere(normal, r1, r2);
+
+						originX[lane] = origin.x;
+						originY[lane] = origin.y;
+						originZ[lane] = origin.z;
+						directionX[lane] = bounceDirection.x;
+						directionY[lane] = bounceDirection.y;
+						directionZ[lane] = bounceDirection.z;
+						throughput[lane][0] = weight.x;
+						throughput[lane][1] = weight.y;
+						throughput[lane][2] = weight.z;
+					}
+				}
+
+				for (int lane = 0; lane < Width; lane++) {
+					float pathLuminance = luminance(pathRadiance[lane][0], pathRadiance[lane][1], pathRadiance[lane][2]);
+
+					accumulated[lane][0] += pathRadiance[lane][0];
+					accumulated[lane][1] += pathRadiance[lane][1];
+					accumulated[lane][2] += pathRadiance[lane][2];
+					accumulated[lane][3] += pathLuminance * pathLuminance;
+				}
+			}
+
+			for (int lane = 0; lane < Width && x + lane < x1; lane++) {
+				float* sum = sums + (static_cast<size_t>(y - y0) * (x1 - x0) + (x - x0) + lane) * 4;
+				sum[0] += accumulated[lane][0];
+				sum[1] += accumulated[lane][1];
+				sum[2] += accumulated[lane][2];
+				sum[3] += accumulated[lane][3];
+			}
+		}
+	}
+
+	return rayCount;
+}
+
+CpuRenderStats CpuTracer::render(const CpuRenderSettings& settings, std::vector<float>& radiance, std::vector<uint32_t>* sampleCounts) {
+	radiance.assign(static_cast<size_t>(settings.width) * settings.height * 3, 0.0f);
+
+	uint32_t tileSize = std::max(1u, settings.tileSize);
+	uint32_t tilesX = (settings.width + tileSize - 1) / tileSize;
+	uint32_t tilesY = (settings.height + tileSize - 1) / tileSize;
+
+	struct Tile {
+		uint32_t x0, y0, x1, y1;
+		std::vector<float> sums;
+		uint32_t sampleCount = 0;
+	};
+
+	std::vector<Tile> tiles(tilesX * tilesY);
+	std::vector<uint32_t> activeTiles(tiles.size());
+
+	for (uint32_t i = 0; i < tiles.size(); i++) {
+		Tile& tile = tiles[i];
+		tile.x0 = (i % tilesX) * tileSize;
+		tile.y0 = (i / tilesX) * tileSize;
+		tile.x1 = std::min(tile.x0 + tileSize, settings.width);
+		tile.y1 = std::min(tile.y0 + tileSize, settings.height);
+		tile.sums.assign(static_cast<size_t>(tile.x1 - tile.x0) * (tile.y1 - tile.y0) * 4, 0.0f);
+		activeTiles[i] = i;
+	}
+
+	bool adaptive = settings.adaptiveThreshold > 0.0f;
+	uint32_t maxSamples = adaptive ? std::max(settings.samplesPerPixel, settings.maxSamplesPerPixel) : settings.samplesPerPixel;
+
+	std::atomic<uint64_t> rayCount{ 0 };
+	std::atomic<uint64_t> sampleCount{ 0 };
+	uint64_t stealsBefore = scheduler.getStealCount();
+	uint32_t passCount = 0;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// Every pass adds samplesPerPixel to the tiles that are still active. Converged tiles retire, so later
+	// passes only spend rays where the image is still noisy.
+	while (!activeTiles.empty()) {
+		std::vector<uint8_t> keepActive(activeTiles.size(), 0);
+
+		scheduler.parallelFor(static_cast<uint32_t>(activeTiles.size()), [&](uint32_t index, uint32_t) {
+			Tile& tile = tiles[activeTiles[index]];
+
+			uint32_t passSamples = std::min(settings.samplesPerPixel, maxSamples - tile.sampleCount);
+			rayCount += traceSamples(settings, tile.x0, tile.y0, tile.x1, tile.y1, tile.sampleCount, passSamples, tile.sums.data());
+			tile.sampleCount += passSamples;
+			sampleCount += static_cast<uint64_t>(passSamples) * (tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+
+			if (!adaptive || tile.sampleCount >= maxSamples) {
+				return;
+			}
+
+			// Root mean square over the tile, so a few noisy pixels keep a mostly clean tile going
+			size_t pixelCount = tile.sums.size() / 4;
+			float squaredErrorSum = 0.0f;
+			for (size_t pixel = 0; pixel < pixelCount; pixel++) {
+				float error = displayError(&tile.sums[pixel * 4], tile.sampleCount);
+				squaredErrorSum += error * error;
+			}
+
+			keepActive[index] = tile.sampleCount < MinimumAdaptiveSamples || std::sqrt(squaredErrorSum / pixelCount) > settings.adaptiveThreshold;
+		});
+
+		passCount++;
+
+		size_t kept = 0;
+		for (size_t i = 0; i < activeTiles.size(); i++) {
+			if (keepActive[i]) {
+				activeTiles[kept++] = activeTiles[i];
+			}
+		}
+		activeTiles.resize(kept);
+	}
+
+	if (sampleCounts != nullptr) {
+		sampleCounts->assign(static_cast<size_t>(settings.width) * settings.height, 0);
+	}
+
+	for (const Tile& tile : tiles) {
+		float inverseSamples = 1.0f / std::max(1u, tile.sampleCount);
+
+		for (uint32_t y = tile.y0; y < tile.y1; y++) {
+			for (uint32_t x = tile.x0; x < tile.x1; x++) {
+				const float* sum = &tile.sums[(static_cast<size_t>(y - tile.y0) * (tile.x1 - tile.x0) + (x - tile.x0)) * 4];
+				size_t pixelIndex = static_cast<size_t>(y) * settings.width + x;
+
+				radiance[pixelIndex * 3 + 0] = sum[0] * inverseSamples;
+				radiance[pixelIndex * 3 + 1] = sum[1] * inverseSamples;
+				radiance[pixelIndex * 3 + 2] = sum[2] * inverseSamples;
+
+				if (sampleCounts != nullptr) {
+					(*sampleCounts)[pixelIndex] = tile.sampleCount;
+				}
+			}
+		}
+	}
+
+	CpuRenderStats stats;
+	stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	stats.rayCount = rayCount.load();
+	stats.sampleCount = sampleCount.load();
+	stats.tileCount = tilesX * tilesY;
+	stats.passCount = passCount;
+	stats.steals = scheduler.getStealCount() - stealsBefore;
+
+	return stats;
+}
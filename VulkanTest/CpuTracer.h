@@ -0,0 +1,78 @@
+#pragma once
+
+#include "Bvh.h"
+#include "Scene.h"
+#include "TaskScheduler.h"
+#include "TwoLevelBvh.h"
+#include "WideBvh.h"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+struct CpuRenderSettings {
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t samplesPerPixel = 16;
+	uint32_t maxBounces = 4;
+	uint32_t tileSize = 16;
+	uint32_t frameIndex = 0;
+	// Adaptive sampling traces samplesPerPixel into every tile and then keeps adding samplesPerPixel to the
+	// tiles whose error is still above adaptiveThreshold, up to maxSamplesPerPixel. The error is the root
+	// mean square over the tile of each pixel's standard error after the gamma encode, 1/255 is one step of 8 bit output.
+	// 0 traces samplesPerPixel everywhere.
+	float adaptiveThreshold = 0.0f;
+	uint32_t maxSamplesPerPixel = 256;
+};
+
+struct CpuRenderStats {
+	uint64_t rayCount = 0;
+	// Camera samples over all pixels, equal to the pixel count times samplesPerPixel unless sampling adaptively
+	uint64_t sampleCount = 0;
+	uint32_t tileCount = 0;
+	uint32_t passCount = 0;
+	uint64_t steals = 0;
+	double milliseconds = 0.0;
+
+	double raysPerSecond() const {
+		return milliseconds > 0.0 ? rayCount / (milliseconds / 1000.0) : 0.0;
+	}
+};
+
+// Reference path tracer that runs entirely on the CPU. It uses the same scene layout, BVH,
+// random number sequence and output encoding as the compute shader tracer, so the two can be
+// compared image against image.
+class CpuTracer {
+public:
+	// Scenes with instances also need twoLevelBvh with its top level built, bvh then holds the bottom levels.
+	// Scenes without can be traced through wideBvh, collapsed from bvh, instead.
+	CpuTracer(const Scene& scene, const Bvh& bvh, TaskScheduler& scheduler, const TwoLevelBvh* twoLevelBvh = nullptr, const WideBvh* wideBvh = nullptr)
+		: scene(scene), bvh(bvh), scheduler(scheduler), twoLevelBvh(twoLevelBvh), wideBvh(wideBvh) { }
+
+	// Renders the full frame. radiance receives three linear floats per pixel and sampleCounts, when
+	// given, the number of samples every pixel received.
+	CpuRenderStats render(const CpuRenderSettings& settings, std::vector<float>& radiance, std::vector<uint32_t>* sampleCounts = nullptr);
+
+	// Renders one rectangle of the frame into radiance, which starts with the rectangle's first pixel and
+	// holds rowPitch pixels per row. Safe to call from several threads at once. Returns the number of rays traced.
+	uint64_t renderTile(const CpuRenderSettings& settings, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, float* radiance, uint32_t rowPitch) const;
+
+private:
+	struct RayPacket;
+	struct HitPacket;
+
+	void intersect(RayPacket& rays, HitPacket& hits) const;
+	void intersectTriangles(uint32_t first, uint32_t count, const RayPacket& rays, HitPacket& hits, uint32_t instance) const;
+
+	// Traces samples [firstSample, firstSample + sampleCount) of every pixel in the rectangle and adds them
+	// to sums, which holds the radiance sum and the sum of squared luminance per pixel, four floats each,
+	// indexed with the rectangle's width. Returns the number of rays traced.
+	uint64_t traceSamples(const CpuRenderSettings& settings, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, uint32_t firstSample, uint32_t sampleCount,
+		float* sums) const;
+
+	const Scene& scene;
+	const Bvh& bvh;
+	TaskScheduler& scheduler;
+	const TwoLevelBvh* twoLevelBvh;
+	const WideBvh* wideBvh;
+};
@@ -0,0 +1,269 @@
+#include "DebugMessageSink.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace {
+	// How long the writer sleeps when the ring is empty. Messages are for reading after the fact, a few
+	// milliseconds of delay do not matter.
+	constexpr auto DrainInterval = std::chrono::milliseconds(5);
+
+	const char* severityName(VkDebugUtilsMessageSeverityFlagBitsEXT severity) {
+		switch (severity) {
+		case VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT:
+			return "error";
+		case VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT:
+			return "warning";
+		case VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT:
+			return "info";
+		default:
+			return "verbose";
+		}
+	}
+
+	const char* typeName(VkDebugUtilsMessageTypeFlagsEXT type) {
+		if (type & VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT) {
+			return "validation";
+		}
+		else if (type & VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT) {
+			return "performance";
+		}
+
+		return "general";
+	}
+
+	// Copies as much of source as fits and always terminates
+	template <size_t Size>
+	void copyTruncated(char (&destination)[Size], const char* source) {
+		if (source == nullptr) {
+			destination[0] = '\0';
+			return;
+		}
+
+		size_t length = std::min(std::strlen(source), Size - 1);
+		std::memcpy(destination, source, length);
+		destination[length] = '\0';
+	}
+}
+
+DebugMessageFilter DebugMessageFilter::parse(const std::string& list) {
+	DebugMessageFilter filter;
+	filter.severities = 0;
+	filter.types = 0;
+
+	std::stringstream stream(list);
+	std::string name;
+
+	while (std::getline(stream, name, ',')) {
+		if (name == "all") {
+			filter.severities = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT |
+				VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+			filter.types = DebugMessageFilter().types;
+		}
+		else if (name == "verbose") {
+			filter.severities |= VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT;
+		}
+		else if (name == "info") {
+			filter.severities |= VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT;
+		}
+		else if (name == "warning") {
+			filter.severities |= VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT;
+		}
+		else if (name == "error") {
+			filter.severities |= VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+		}
+		else if (name == "general") {
+			filter.types |= VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT;
+		}
+		else if (name == "validation") {
+			filter.types |= VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT;
+		}
+		else if (name == "performance") {
+			filter.types |= VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+		}
+		else if (!name.empty()) {
+			throw std::runtime_error("Unknown debug message severity or type: " + name);
+		}
+	}
+
+	if (filter.severities == 0) {
+		filter.severities = DebugMessageFilter().severities;
+	}
+
+	if (filter.types == 0) {
+		filter.types = DebugMessageFilter().types;
+	}
+
+	return filter;
+}
+
+DebugMessageSink::~DebugMessageSink() {
+	stop();
+}
+
+void DebugMessageSink::start(std::ostream& out, const DebugMessageFilter& filter) {
+	this->out = &out;
+	this->filter = filter;
+
+	slots.reset(new Slot[Capacity]);
+	for (uint32_t i = 0; i < Capacity; i++) {
+		slots[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	writePosition.store(0, std::memory_order_relaxed);
+	readPosition = 0;
+	droppedCount.store(0, std::memory_order_relaxed);
+	repeats.clear();
+
+	running.store(true, std::memory_order_release);
+	thread = std::thread(&DebugMessageSink::writerThread, this);
+}
+
+void DebugMessageSink::stop() {
+	if (!thread.joinable()) {
+		return;
+	}
+
+	running.store(false, std::memory_order_release);
+	thread.join();
+
+	writeRepeats();
+
+	uint64_t dropped = droppedCount.load(std::memory_order_relaxed);
+	if (dropped > 0) {
+		*out << dropped << " debug message(s) dropped, the ring buffer was full" << std::endl;
+	}
+
+	slots.reset();
+}
+
+void DebugMessageSink::populateCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo) {
+	createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+	createInfo.messageSeverity = filter.severities;
+	createInfo.messageType = filter.types;
+	createInfo.pfnUserCallback = callback;
+	createInfo.pUserData = this;
+}
+
+void DebugMessageSink::push(VkDebugUtilsMessageSeverityFlagBitsEXT severity, VkDebugUtilsMessageTypeFlagsEXT type, const VkDebugUtilsMessengerCallbackDataEXT* data) {
+	if (!(filter.severities & severity) || !(filter.types & type)) {
+		return;
+	}
+
+	uint64_t position = writePosition.load(std::memory_order_relaxed);
+	Slot* slot;
+
+	for (;;) {
+		slot = &slots[position & (Capacity - 1)];
+		uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+
+		if (sequence == position) {
+			// Free for this position, claim it unless another writer got there first
+			if (writePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		}
+		else if (sequence < position) {
+			// Still holds the message from a lap ago, the writer thread has fallen behind
+			droppedCount.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		else {
+			position = writePosition.load(std::memory_order_relaxed);
+		}
+	}
+
+	slot->message.severity = severity;
+	slot->message.type = type;
+	slot->message.idNumber = data->messageIdNumber;
+	copyTruncated(slot->message.idName, data->pMessageIdName);
+	copyTruncated(slot->message.text, data->pMessage);
+
+	slot->sequence.store(position + 1, std::memory_order_release);
+}
+
+VKAPI_ATTR VkBool32 VKAPI_CALL DebugMessageSink::callback(VkDebugUtilsMessageSeverityFlagBitsEXT severity, VkDebugUtilsMessageTypeFlagsEXT type,
+	const VkDebugUtilsMessengerCallbackDataEXT* data, void* userData) {
+	static_cast<DebugMessageSink*>(userData)->push(severity, type, data);
+
+	return VK_FALSE;
+}
+
+bool DebugMessageSink::pop(Message& message) {
+	Slot& slot = slots[readPosition & (Capacity - 1)];
+
+	if (slot.sequence.load(std::memory_order_acquire) != readPosition + 1) {
+		return false;
+	}
+
+	message = slot.message;
+	slot.sequence.store(readPosition + Capacity, std::memory_order_release);
+	readPosition++;
+
+	return true;
+}
+
+void DebugMessageSink::writerThread() {
+	Message message;
+
+	for (;;) {
+		// Checked before draining, so everything pushed before stop() is written
+		bool stopping = !running.load(std::memory_order_acquire);
+
+		bool wrote = false;
+		while (pop(message)) {
+			write(message);
+			wrote = true;
+		}
+
+		if (stopping) {
+			break;
+		}
+
+		if (wrote) {
+			out->flush();
+		}
+
+		std::this_thread::sleep_for(DrainInterval);
+	}
+
+	out->flush();
+}
+
+void DebugMessageSink::write(const Message& message) {
+	std::string key = message.idNumber != 0 ? std::string(message.idName) + "#" + std::to_string(message.idNumber) : std::string(message.text);
+
+	if (repeats[key]++ > 0) {
+		return;
+	}
+
+	*out << severityName(message.severity) << " (" << typeName(message.type) << "): " << message.text << "\n";
+}
+
+void DebugMessageSink::writeRepeats() {
+	std::vector<std::pair<std::string, uint64_t>> repeated;
+
+	for (const auto& repeat : repeats) {
+		if (repeat.second > 1) {
+			repeated.push_back(repeat);
+		}
+	}
+
+	if (repeated.empty()) {
+		return;
+	}
+
+	std::sort(repeated.begin(), repeated.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+
+	*out << "Repeated debug messages:" << std::endl;
+
+	for (const auto& repeat : repeated) {
+		// Messages without an id are keyed by their whole text, the first line is enough to recognize them
+		*out << "\t" << repeat.second << "x " << repeat.first.substr(0, repeat.first.find('\n')) << std::endl;
+	}
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+// Which debug utils messages are wanted. Both masks go into the messenger's create info, so the layers
+// never even format what is filtered out.
+struct DebugMessageFilter {
+	VkDebugUtilsMessageSeverityFlagsEXT severities = VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+	VkDebugUtilsMessageTypeFlagsEXT types = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
+		VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+
+	// A comma separated list of severities (verbose, info, warning, error) and types (general, validation,
+	// performance), for example "error,validation". Without severities warnings and errors are kept,
+	// without types every type is. "all" keeps everything. Throws on unknown names.
+	static DebugMessageFilter parse(const std::string& list);
+};
+
+// Receives validation and other debug utils messages and writes them out on a background thread, so
+// the thread that hit the message only pays for a copy. The callback may run on any thread that calls
+// into Vulkan, so the messages go through a bounded multi producer, single consumer ring buffer: writers
+// claim a slot with a compare and swap on the write position and publish it through the slot's sequence
+// number, the writer thread drains slots in order. Messages that find the ring full are counted and dropped
+// rather than blocking the caller.
+//
+// Repeated messages are collapsed by their message id, which the validation layers report once per
+// call that breaks a rule, i.e. often every frame. Only the first one is written, the number of repeats
+// is reported when the sink stops.
+class DebugMessageSink {
+public:
+	// Must be a power of two
+	static constexpr uint32_t Capacity = 512;
+	// Longer messages are cut off
+	static constexpr uint32_t MaxMessageLength = 1024;
+	static constexpr uint32_t MaxIdNameLength = 96;
+
+	DebugMessageSink() = default;
+	~DebugMessageSink();
+
+	DebugMessageSink(const DebugMessageSink&) = delete;
+	DebugMessageSink& operator=(const DebugMessageSink&) = delete;
+
+	// out must outlive the sink
+	void start(std::ostream& out, const DebugMessageFilter& filter);
+	// Writes what is left in the ring and the repeat counts. The messenger must be gone by now, nothing
+	// may push concurrently.
+	void stop();
+
+	// A messenger that sends the filtered messages to this sink
+	void populateCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo);
+
+	// Never blocks. Safe to call from any thread while started.
+	void push(VkDebugUtilsMessageSeverityFlagBitsEXT severity, VkDebugUtilsMessageTypeFlagsEXT type, const VkDebugUtilsMessengerCallbackDataEXT* data);
+
+	static VKAPI_ATTR VkBool32 VKAPI_CALL callback(VkDebugUtilsMessageSeverityFlagBitsEXT severity, VkDebugUtilsMessageTypeFlagsEXT type,
+		const VkDebugUtilsMessengerCallbackDataEXT* data, void* userData);
+
+private:
+	struct Message {
+		VkDebugUtilsMessageSeverityFlagBitsEXT severity;
+		VkDebugUtilsMessageTypeFlagsEXT type;
+		int32_t idNumber;
+		char idName[MaxIdNameLength];
+		char text[MaxMessageLength];
+	};
+
+	// The slot holds a message for position p once its sequence is p + 1, and is free for position p
+	// once its sequence is p
+	struct Slot {
+		std::atomic<uint64_t> sequence;
+		Message message;
+	};
+
+	void writerThread();
+	bool pop(Message& message);
+	void write(const Message& message);
+	void writeRepeats();
+
+	std::ostream* out = nullptr;
+	DebugMessageFilter filter;
+
+	std::unique_ptr<Slot[]> slots;
+	std::atomic<uint64_t> writePosition{ 0 };
+	// Only touched by the writer thread
+	uint64_t readPosition = 0;
+
+	std::atomic<uint64_t> droppedCount{ 0 };
+	std::atomic<bool> running{ false };
+	std::thread thread;
+
+	// How often every message came in, keyed by its id, or by its text when it has none. Only touched by
+	// the writer thread until it has been joined.
+	std::unordered_map<std::string, uint64_t> repeats;
+};
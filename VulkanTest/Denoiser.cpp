@@ -0,0 +1,355 @@
+#include "Denoiser.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+	// Profiler zone names must outlive the profiler, so every pass gets a literal
+	const char* const ReprojectZone = "denoiseReproject";
+	const char* const IterationZones[Denoiser::MaxIterations] = {
+		"denoiseAtrous0", "denoiseAtrous1", "denoiseAtrous2", "denoiseAtrous3",
+		"denoiseAtrous4", "denoiseAtrous5", "denoiseAtrous6", "denoiseAtrous7"
+	};
+
+	// Bindings of the set layout shared by both shaders, see reproject.comp and atrous.comp
+	enum Binding : uint32_t {
+		RadianceBinding,
+		AlbedoBinding,
+		NormalDepthBinding,
+		MotionBinding,
+		PreviousNormalDepthBinding,
+		HistoryBinding,
+		MomentsHistoryBinding,
+		MomentsBinding,
+		FilterInputBinding,
+		FilterOutputBinding,
+		DisplayBinding,
+		BindingCount
+	};
+}
+
+void Denoiser::createPipelines(VkDevice device, VkPipelineCache pipelineCache, VkShaderModule reprojectShader, VkShaderModule atrousShader) {
+	VkDescriptorSetLayoutBinding bindings[BindingCount] = {};
+
+	for (uint32_t i = 0; i < BindingCount; i++) {
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {};
+	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutCreateInfo.bindingCount = BindingCount;
+	layoutCreateInfo.pBindings = bindings;
+
+	if (vkCreateDescriptorSetLayout(device, &layoutCreateInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Could not create denoiser descriptor set layout");
+	}
+
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(DenoisePushConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutCreateInfo.setLayoutCount = 1;
+	pipelineLayoutCreateInfo.pSetLayouts = &descriptorSetLayout;
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+	if (vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Could not create denoiser pipeline layout");
+	}
+
+	reprojectPipeline = createPipeline(device, pipelineCache, reprojectShader);
+	atrousPipeline = createPipeline(device, pipelineCache, atrousShader);
+}
+
+VkPipeline Denoiser::createPipeline(VkDevice device, VkPipelineCache pipelineCache, VkShaderModule shader) {
+	VkComputePipelineCreateInfo pipelineCreateInfo = {};
+	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineCreateInfo.stage.module = shader;
+	pipelineCreateInfo.stage.pName = "main";
+	pipelineCreateInfo.layout = pipelineLayout;
+
+	VkPipeline pipeline;
+	if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipeline) != VK_SUCCESS) {
+		throw std::runtime_error("Could not create denoiser pipeline");
+	}
+
+	return pipeline;
+}
+
+void Denoiser::createImages(VkDevice device, MemoryAllocator& allocator, VkExtent2D extent, uint32_t iterations) {
+	this->device = device;
+	this->extent = iterations > 0 ? extent : VkExtent2D{ 1, 1 };
+
+	// Half floats keep the lighting's range at half the bandwidth of full floats. Albedo is in [0, 1].
+	for (uint32_t i = 0; i < ImageCount; i++) {
+		images[i].format = i == Albedo ? VK_FORMAT_R8G8B8A8_UNORM : VK_FORMAT_R16G16B16A16_SFLOAT;
+	}
+
+	for (auto& image : images) {
+		VkImageCreateInfo imageCreateInfo = {};
+		imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageCreateInfo.format = image.format;
+		imageCreateInfo.extent = { this->extent.width, this->extent.height, 1 };
+		imageCreateInfo.mipLevels = 1;
+		imageCreateInfo.arrayLayers = 1;
+		imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		// Normals, depth and moments are copied into their history once reprojection has read the old one
+		imageCreateInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+		imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		allocator.createImage(imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image.image, image.memory);
+
+		VkImageViewCreateInfo viewCreateInfo = {};
+		viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewCreateInfo.image = image.image;
+		viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewCreateInfo.format = image.format;
+		viewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		viewCreateInfo.subresourceRange.levelCount = 1;
+		viewCreateInfo.subresourceRange.layerCount = 1;
+
+		if (vkCreateImageView(device, &viewCreateInfo, nullptr, &image.view) != VK_SUCCESS) {
+			throw std::runtime_error("Could not create denoiser image view");
+		}
+	}
+
+	prepared = false;
+	historyValid = false;
+}
+
+void Denoiser::createDescriptorSets(const std::vector<VkImageView>& displayViews) {
+	uint32_t setCount = static_cast<uint32_t>(displayViews.size()) * 2;
+
+	VkDescriptorPoolSize poolSize = {};
+	poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	poolSize.descriptorCount = setCount * BindingCount;
+
+	VkDescriptorPoolCreateInfo poolCreateInfo = {};
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolCreateInfo.maxSets = setCount;
+	poolCreateInfo.poolSizeCount = 1;
+	poolCreateInfo.pPoolSizes = &poolSize;
+
+	if (vkCreateDescriptorPool(device, &poolCreateInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
+		throw std::runtime_error("Could not create denoiser descriptor pool");
+	}
+
+	std::vector<VkDescriptorSetLayout> layouts(setCount, descriptorSetLayout);
+
+	VkDescriptorSetAllocateInfo allocateInfo = {};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocateInfo.descriptorPool = descriptorPool;
+	allocateInfo.descriptorSetCount = setCount;
+	allocateInfo.pSetLayouts = layouts.data();
+
+	descriptorSets.resize(setCount);
+	if (vkAllocateDescriptorSets(device, &allocateInfo, descriptorSets.data()) != VK_SUCCESS) {
+		throw std::runtime_error("Could not allocate denoiser descriptor sets");
+	}
+
+	for (uint32_t set = 0; set < setCount; set++) {
+		uint32_t direction = set % 2;
+
+		VkImageView views[BindingCount] = {};
+		views[RadianceBinding] = images[Radiance].view;
+		views[AlbedoBinding] = images[Albedo].view;
+		views[NormalDepthBinding] = images[NormalDepth].view;
+		views[MotionBinding] = images[Motion].view;
+		views[PreviousNormalDepthBinding] = images[PreviousNormalDepth].view;
+		views[HistoryBinding] = images[History].view;
+		views[MomentsHistoryBinding] = images[MomentsHistory].view;
+		views[MomentsBinding] = images[Moments].view;
+		views[FilterInputBinding] = images[direction == 0 ? FilterPing : FilterPong].view;
+		views[FilterOutputBinding] = images[direction == 0 ? FilterPong : FilterPing].view;
+		views[DisplayBinding] = displayViews[set / 2];
+
+		VkDescriptorImageInfo imageInfos[BindingCount] = {};
+		VkWriteDescriptorSet writes[BindingCount] = {};
+
+		for (uint32_t i = 0; i < BindingCount; i++) {
+			imageInfos[i].imageView = views[i];
+			imageInfos[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+			writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writes[i].dstSet = descriptorSets[set];
+			writes[i].dstBinding = i;
+			writes[i].descriptorCount = 1;
+			writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+			writes[i].pImageInfo = &imageInfos[i];
+		}
+
+		vkUpdateDescriptorSets(device, BindingCount, writes, 0, nullptr);
+	}
+}
+
+void Denoiser::destroy(MemoryAllocator& allocator) {
+	retireImages(allocator)();
+
+	vkDestroyPipeline(device, atrousPipeline, nullptr);
+	vkDestroyPipeline(device, reprojectPipeline, nullptr);
+	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+
+	atrousPipeline = VK_NULL_HANDLE;
+	reprojectPipeline = VK_NULL_HANDLE;
+	pipelineLayout = VK_NULL_HANDLE;
+	descriptorSetLayout = VK_NULL_HANDLE;
+}
+
+std::function<void()> Denoiser::retireImages(MemoryAllocator& allocator) {
+	std::vector<Image> retiredImages(std::begin(images), std::end(images));
+	VkDescriptorPool retiredPool = descriptorPool;
+
+	for (auto& image : images) {
+		image = Image();
+	}
+
+	descriptorPool = VK_NULL_HANDLE;
+	descriptorSets.clear();
+
+	return [device = device, &allocator, retiredImages, retiredPool]() mutable {
+		vkDestroyDescriptorPool(device, retiredPool, nullptr);
+
+		for (auto& image : retiredImages) {
+			if (image.image == VK_NULL_HANDLE) {
+				continue;
+			}
+
+			vkDestroyImageView(device, image.view, nullptr);
+			allocator.destroyImage(image.image, image.memory);
+		}
+	};
+}
+
+void Denoiser::recordPrepare(VkCommandBuffer commandBuffer) {
+	if (prepared) {
+		return;
+	}
+
+	VkImageMemoryBarrier barriers[ImageCount] = {};
+
+	for (uint32_t i = 0; i < ImageCount; i++) {
+		barriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barriers[i].srcAccessMask = 0;
+		barriers[i].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+		barriers[i].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barriers[i].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barriers[i].image = images[i].image;
+		barriers[i].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barriers[i].subresourceRange.levelCount = 1;
+		barriers[i].subresourceRange.layerCount = 1;
+	}
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+		0, nullptr, 0, nullptr, ImageCount, barriers);
+
+	prepared = true;
+}
+
+void Denoiser::record(VkCommandBuffer commandBuffer, uint32_t slot, Profiler& profiler, const DenoiseSettings& settings) {
+	// Everything runs on one queue in submission order, so global barriers are enough. This one orders the
+	// trace's writes and the previous frame's history copies before reprojection reads them.
+	VkMemoryBarrier toShader = {};
+	toShader.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	toShader.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	toShader.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+		1, &toShader, 0, nullptr, 0, nullptr);
+
+	DenoisePushConstants constants = {};
+	constants.stepSize = 1;
+	constants.flags = historyValid ? FlagHistoryValid : 0;
+	constants.phiColor = settings.phiColor;
+	constants.phiNormal = settings.phiNormal;
+	constants.phiDepth = settings.phiDepth;
+
+	uint32_t reprojectZone = profiler.beginGpuZone(commandBuffer, slot, ReprojectZone);
+	dispatch(commandBuffer, reprojectPipeline, descriptorSets[slot * 2], constants);
+	profiler.endGpuZone(commandBuffer, slot, reprojectZone);
+
+	// Reprojection has read last frame's normals, depth and moments, so this frame's replace them. The
+	// filter passes only read the copy sources.
+	VkMemoryBarrier toCopy = {};
+	toCopy.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	toCopy.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	toCopy.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+		1, &toCopy, 0, nullptr, 0, nullptr);
+
+	copyImage(commandBuffer, NormalDepth, PreviousNormalDepth);
+	copyImage(commandBuffer, Moments, MomentsHistory);
+
+	uint32_t iterations = std::min(settings.iterations, MaxIterations);
+
+	for (uint32_t i = 0; i < iterations; i++) {
+		if (i > 0) {
+			VkMemoryBarrier betweenPasses = {};
+			betweenPasses.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			betweenPasses.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			betweenPasses.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &betweenPasses, 0, nullptr, 0, nullptr);
+		}
+
+		constants.stepSize = 1 << i;
+		constants.flags = (i == 0 ? FlagFirstIteration : 0) | (i + 1 == iterations ? FlagLastIteration : 0);
+
+		uint32_t zone = profiler.beginGpuZone(commandBuffer, slot, IterationZones[i]);
+		dispatch(commandBuffer, atrousPipeline, descriptorSets[slot * 2 + i % 2], constants);
+		profiler.endGpuZone(commandBuffer, slot, zone);
+	}
+
+	historyValid = true;
+}
+
+void Denoiser::printTimings(const Profiler& profiler, std::ostream& out) const {
+	out << "\tdenoise: reproject " << profiler.getStats("gpu", ReprojectZone).meanMilliseconds << "ms";
+
+	double total = profiler.getStats("gpu", ReprojectZone).meanMilliseconds;
+
+	for (uint32_t i = 0; i < MaxIterations; i++) {
+		ProfileStats stats = profiler.getStats("gpu", IterationZones[i]);
+
+		if (stats.count == 0) {
+			break;
+		}
+
+		out << ", step " << (1 << i) << " " << stats.meanMilliseconds << "ms";
+		total += stats.meanMilliseconds;
+	}
+
+	out << ", total " << total << "ms" << std::endl;
+}
+
+void Denoiser::dispatch(VkCommandBuffer commandBuffer, VkPipeline pipeline, VkDescriptorSet descriptorSet, const DenoisePushConstants& constants) {
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(DenoisePushConstants), &constants);
+
+	vkCmdDispatch(commandBuffer, (extent.width + WorkgroupSize - 1) / WorkgroupSize, (extent.height + WorkgroupSize - 1) / WorkgroupSize, 1);
+}
+
+void Denoiser::copyImage(VkCommandBuffer commandBuffer, ImageIndex source, ImageIndex destination) {
+	VkImageCopy region = {};
+	region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.srcSubresource.layerCount = 1;
+	region.dstSubresource = region.srcSubresource;
+	region.extent = { extent.width, extent.height, 1 };
+
+	vkCmdCopyImage(commandBuffer, images[source].image, VK_IMAGE_LAYOUT_GENERAL, images[destination].image, VK_IMAGE_LAYOUT_GENERAL, 1, &region);
+}
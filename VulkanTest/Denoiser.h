@@ -0,0 +1,147 @@
+#pragma once
+
+#include "MemoryAllocator.h"
+#include "Profiler.h"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <vector>
+
+struct DenoiseSettings {
+	// Passes of the a-trous filter, each doubling the spacing of its taps. 0 disables the denoiser.
+	uint32_t iterations = 0;
+	// Edge stopping strengths for luminance (in standard deviations), normals (as an exponent on their
+	// dot product) and depth (relative to the pixel's depth per pixel of tap spacing)
+	float phiColor = 4.0f;
+	float phiNormal = 128.0f;
+	float phiDepth = 0.1f;
+};
+
+// Mirrors the push constant block shared by reproject.comp and atrous.comp
+struct DenoisePushConstants {
+	int32_t stepSize;
+	uint32_t flags;
+	float phiColor;
+	float phiNormal;
+	float phiDepth;
+};
+
+// Reconstructs an image traced at a few samples per pixel, after "Spatiotemporal Variance-Guided
+// Filtering" (Schied et al. 2017). The tracer writes the noisy radiance together with albedo, normals,
+// linear depth and motion vectors of the primary hit. Radiance is divided by albedo so only lighting
+// is filtered, then:
+//
+//   reproject.comp  blends the lighting with last frame's filtered history where the reprojected
+//                   pixel's normal and depth still agree, and tracks the first two luminance moments to
+//                   estimate the variance of every pixel.
+//   atrous.comp     an edge aware a-trous wavelet filter run iterations times with taps 1, 2, 4, ...
+//                   pixels apart. Its weights fall off with luminance differences scaled by the variance,
+//                   and with normal and depth differences. The first pass becomes the next frame's
+//                   history, the last one multiplies the albedo back in and writes the display image.
+//
+// All images are shared by the frames in flight, which run in submission order on one queue, and stay in
+// the general layout. The frame's display image is what gets copied to the swap chain or read back.
+class Denoiser {
+public:
+	static constexpr uint32_t MaxIterations = 8;
+
+	// Creates the descriptor set layout and both pipelines. Only touches the device and the cache, so it
+	// can run on a worker thread while the images are created. Must finish before createDescriptorSets.
+	void createPipelines(VkDevice device, VkPipelineCache pipelineCache, VkShaderModule reprojectShader, VkShaderModule atrousShader);
+
+	// Without iterations the images the tracer binds are still created, as single texels
+	void createImages(VkDevice device, MemoryAllocator& allocator, VkExtent2D extent, uint32_t iterations);
+
+	// One set per frame slot and filter direction, displayViews holds the RGBA8 image of every slot
+	void createDescriptorSets(const std::vector<VkImageView>& displayViews);
+
+	void destroy(MemoryAllocator& allocator);
+
+	// Forgets the images and descriptor sets, so createImages and createDescriptorSets can replace them
+	// while frames in flight still use the old ones. Calling the result destroys the old ones.
+	std::function<void()> retireImages(MemoryAllocator& allocator);
+
+	// Brings every image into the general layout the first time it is called. Must be recorded before the
+	// trace that writes the auxiliary images.
+	void recordPrepare(VkCommandBuffer commandBuffer);
+
+	// Records reprojection and the filter passes, each in its own GPU zone. The trace's writes must
+	// precede it in the command buffer. Leaves displayViews[slot] written in the general layout.
+	void record(VkCommandBuffer commandBuffer, uint32_t slot, Profiler& profiler, const DenoiseSettings& settings);
+
+	// Mean GPU time of reprojection and of every filter pass, from the profiler's GPU track
+	void printTimings(const Profiler& profiler, std::ostream& out) const;
+
+	// The next frame starts without history, for camera cuts and scene changes
+	void resetHistory() {
+		historyValid = false;
+	}
+
+	VkImageView getRadianceView() const {
+		return images[Radiance].view;
+	}
+
+	VkImageView getAlbedoView() const {
+		return images[Albedo].view;
+	}
+
+	VkImageView getNormalDepthView() const {
+		return images[NormalDepth].view;
+	}
+
+	VkImageView getMotionView() const {
+		return images[Motion].view;
+	}
+
+	// Pixels every workgroup of both shaders covers in x and y. Must match local_size in the shaders.
+	static constexpr uint32_t WorkgroupSize = 8;
+
+	static constexpr uint32_t FlagFirstIteration = 1;
+	static constexpr uint32_t FlagLastIteration = 2;
+	static constexpr uint32_t FlagHistoryValid = 4;
+
+private:
+	enum ImageIndex {
+		Radiance,
+		Albedo,
+		NormalDepth,
+		Motion,
+		PreviousNormalDepth,
+		History,
+		MomentsHistory,
+		Moments,
+		FilterPing,
+		FilterPong,
+		ImageCount
+	};
+
+	struct Image {
+		VkImage image = VK_NULL_HANDLE;
+		Allocation memory;
+		VkImageView view = VK_NULL_HANDLE;
+		VkFormat format = VK_FORMAT_UNDEFINED;
+	};
+
+	VkPipeline createPipeline(VkDevice device, VkPipelineCache pipelineCache, VkShaderModule shader);
+	void dispatch(VkCommandBuffer commandBuffer, VkPipeline pipeline, VkDescriptorSet descriptorSet, const DenoisePushConstants& constants);
+	void copyImage(VkCommandBuffer commandBuffer, ImageIndex source, ImageIndex destination);
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	VkPipeline reprojectPipeline = VK_NULL_HANDLE;
+	VkPipeline atrousPipeline = VK_NULL_HANDLE;
+	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+
+	Image images[ImageCount];
+	VkExtent2D extent = {};
+
+	// Indexed by slot * 2 + direction. Direction 0 filters ping into pong, 1 pong into ping.
+	std::vector<VkDescriptorSet> descriptorSets;
+
+	bool prepared = false;
+	bool historyValid = false;
+};
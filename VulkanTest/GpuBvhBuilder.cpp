@@ -0,0 +1,297 @@
+#include "GpuBvhBuilder.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+	// Binding 0 of the set layout shared by both shaders, see lbvh.comp and radix_sort.comp. The builder's
+	// own buffers follow it.
+	constexpr uint32_t SourceTrianglesBinding = 0;
+
+	// Everything runs on one queue in submission order, so global barriers are enough
+	void barrier(VkCommandBuffer commandBuffer, VkPipelineStageFlags sourceStage, VkAccessFlags sourceAccess, VkPipelineStageFlags destinationStage,
+		VkAccessFlags destinationAccess) {
+		VkMemoryBarrier memoryBarrier = {};
+		memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		memoryBarrier.srcAccessMask = sourceAccess;
+		memoryBarrier.dstAccessMask = destinationAccess;
+
+		vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+	}
+
+	void barrier(VkCommandBuffer commandBuffer, VkPipelineStageFlags sourceStage, VkAccessFlags sourceAccess) {
+		barrier(commandBuffer, sourceStage, sourceAccess, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	}
+
+	// Fills must not start before earlier compute work, such as a previous build or the tracer, is done with the buffers
+	void beforeFill(VkCommandBuffer commandBuffer) {
+		barrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+	}
+}
+
+void GpuBvhBuilder::createPipelines(VkDevice device, VkPipelineCache pipelineCache, VkShaderModule lbvhShader, VkShaderModule radixSortShader) {
+	VkDescriptorSetLayoutBinding bindings[BufferCount + 1] = {};
+
+	for (uint32_t i = 0; i < BufferCount + 1; i++) {
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {};
+	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutCreateInfo.bindingCount = BufferCount + 1;
+	layoutCreateInfo.pBindings = bindings;
+
+	if (vkCreateDescriptorSetLayout(device, &layoutCreateInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Could not create BVH builder descriptor set layout");
+	}
+
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(GpuBvhPushConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutCreateInfo.setLayoutCount = 1;
+	pipelineLayoutCreateInfo.pSetLayouts = &descriptorSetLayout;
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+	if (vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Could not create BVH builder pipeline layout");
+	}
+
+	for (uint32_t stage = 0; stage < LbvhStageCount; stage++) {
+		lbvhPipelines[stage] = createPipeline(device, pipelineCache, lbvhShader, stage);
+	}
+
+	for (uint32_t stage = 0; stage < SortStageCount; stage++) {
+		sortPipelines[stage] = createPipeline(device, pipelineCache, radixSortShader, stage);
+	}
+}
+
+// Every stage is the same module specialized on constant 0, so the driver drops the code of the others
+VkPipeline GpuBvhBuilder::createPipeline(VkDevice device, VkPipelineCache pipelineCache, VkShaderModule shader, uint32_t stage) {
+	VkSpecializationMapEntry specializationEntry = {};
+	specializationEntry.constantID = 0;
+	specializationEntry.offset = 0;
+	specializationEntry.size = sizeof(uint32_t);
+
+	VkSpecializationInfo specializationInfo = {};
+	specializationInfo.mapEntryCount = 1;
+	specializationInfo.pMapEntries = &specializationEntry;
+	specializationInfo.dataSize = sizeof(stage);
+	specializationInfo.pData = &stage;
+
+	VkComputePipelineCreateInfo pipelineCreateInfo = {};
+	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineCreateInfo.stage.module = shader;
+	pipelineCreateInfo.stage.pName = "main";
+	pipelineCreateInfo.stage.pSpecializationInfo = &specializationInfo;
+	pipelineCreateInfo.layout = pipelineLayout;
+
+	VkPipeline pipeline;
+	if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipeline) != VK_SUCCESS) {
+		throw std::runtime_error("Could not create BVH builder pipeline");
+	}
+
+	return pipeline;
+}
+
+void GpuBvhBuilder::createBuffers(VkDevice device, MemoryAllocator& allocator, VkBuffer sourceTriangles, uint32_t triangleCount) {
+	this->device = device;
+	this->triangleCount = triangleCount;
+	blockCount = (triangleCount + WorkgroupSize - 1) / WorkgroupSize;
+
+	// Storage buffers cannot be empty, so an empty mesh still gets one element of everything
+	VkDeviceSize elementCount = std::max(1u, triangleCount);
+	VkDeviceSize interiorCount = std::max(1u, triangleCount > 0 ? triangleCount - 1 : 0);
+
+	VkDeviceSize sizes[BufferCount] = {};
+	sizes[SortedTriangles] = sizeof(Triangle) * elementCount;
+	sizes[Nodes] = sizeof(BvhNode) * (elementCount * 2 - 1);
+	sizes[Keys] = sizeof(uint32_t) * elementCount;
+	sizes[Values] = sizeof(uint32_t) * elementCount;
+	sizes[AlternateKeys] = sizeof(uint32_t) * elementCount;
+	sizes[AlternateValues] = sizeof(uint32_t) * elementCount;
+	sizes[Histograms] = sizeof(uint32_t) * (1u << RadixBits) * std::max(1u, blockCount);
+	sizes[InteriorSlots] = sizeof(uint32_t) * interiorCount;
+	sizes[LeafSlots] = sizeof(uint32_t) * elementCount;
+	sizes[RefitCounters] = sizeof(uint32_t) * interiorCount;
+	// Minimum and maximum of the centroids, each padded to a uvec4
+	sizes[SceneBounds] = sizeof(uint32_t) * 8;
+
+	for (uint32_t i = 0; i < BufferCount; i++) {
+		allocator.createBuffer(sizes[i], VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0,
+			buffers[i].buffer, buffers[i].memory);
+	}
+
+	VkDescriptorPoolSize poolSize = {};
+	poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSize.descriptorCount = 2 * (BufferCount + 1);
+
+	VkDescriptorPoolCreateInfo poolCreateInfo = {};
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolCreateInfo.maxSets = 2;
+	poolCreateInfo.poolSizeCount = 1;
+	poolCreateInfo.pPoolSizes = &poolSize;
+
+	if (vkCreateDescriptorPool(device, &poolCreateInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
+		throw std::runtime_error("Could not create BVH builder descriptor pool");
+	}
+
+	VkDescriptorSetLayout layouts[2] = { descriptorSetLayout, descriptorSetLayout };
+
+	VkDescriptorSetAllocateInfo allocateInfo = {};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocateInfo.descriptorPool = descriptorPool;
+	allocateInfo.descriptorSetCount = 2;
+	allocateInfo.pSetLayouts = layouts;
+
+	if (vkAllocateDescriptorSets(device, &allocateInfo, descriptorSets) != VK_SUCCESS) {
+		throw std::runtime_error("Could not allocate BVH builder descriptor sets");
+	}
+
+	for (uint32_t set = 0; set < 2; set++) {
+		VkBuffer bound[BufferCount + 1] = {};
+		bound[SourceTrianglesBinding] = sourceTriangles;
+
+		for (uint32_t i = 0; i < BufferCount; i++) {
+			bound[i + 1] = buffers[i].buffer;
+		}
+
+		if (set == 1) {
+			std::swap(bound[Keys + 1], bound[AlternateKeys + 1]);
+			std::swap(bound[Values + 1], bound[AlternateValues + 1]);
+		}
+
+		VkDescriptorBufferInfo bufferInfos[BufferCount + 1] = {};
+		VkWriteDescriptorSet writes[BufferCount + 1] = {};
+
+		for (uint32_t i = 0; i < BufferCount + 1; i++) {
+			bufferInfos[i].buffer = bound[i];
+			bufferInfos[i].offset = 0;
+			bufferInfos[i].range = VK_WHOLE_SIZE;
+
+			writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writes[i].dstSet = descriptorSets[set];
+			writes[i].dstBinding = i;
+			writes[i].descriptorCount = 1;
+			writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			writes[i].pBufferInfo = &bufferInfos[i];
+		}
+
+		vkUpdateDescriptorSets(device, BufferCount + 1, writes, 0, nullptr);
+	}
+}
+
+void GpuBvhBuilder::destroyBuffers(MemoryAllocator& allocator) {
+	if (descriptorPool != VK_NULL_HANDLE) {
+		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+		descriptorPool = VK_NULL_HANDLE;
+	}
+
+	for (auto& buffer : buffers) {
+		if (buffer.buffer != VK_NULL_HANDLE) {
+			allocator.destroyBuffer(buffer.buffer, buffer.memory);
+		}
+	}
+
+	triangleCount = 0;
+	blockCount = 0;
+}
+
+void GpuBvhBuilder::destroy(MemoryAllocator& allocator) {
+	destroyBuffers(allocator);
+
+	for (auto& pipeline : lbvhPipelines) {
+		vkDestroyPipeline(device, pipeline, nullptr);
+		pipeline = VK_NULL_HANDLE;
+	}
+
+	for (auto& pipeline : sortPipelines) {
+		vkDestroyPipeline(device, pipeline, nullptr);
+		pipeline = VK_NULL_HANDLE;
+	}
+
+	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+
+	pipelineLayout = VK_NULL_HANDLE;
+	descriptorSetLayout = VK_NULL_HANDLE;
+}
+
+void GpuBvhBuilder::recordBuild(VkCommandBuffer commandBuffer) {
+	if (triangleCount == 0) {
+		return;
+	}
+
+	GpuBvhPushConstants constants = {};
+	constants.count = triangleCount;
+	constants.blockCount = blockCount;
+
+	// The atomics of the bounds stage start from an empty box
+	beforeFill(commandBuffer);
+	vkCmdFillBuffer(commandBuffer, buffers[SceneBounds].buffer, 0, sizeof(uint32_t) * 4, 0xFFFFFFFF);
+	vkCmdFillBuffer(commandBuffer, buffers[SceneBounds].buffer, sizeof(uint32_t) * 4, sizeof(uint32_t) * 4, 0);
+	barrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
+
+	dispatch(commandBuffer, lbvhPipelines[BoundsStage], 0, constants, blockCount);
+	barrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+
+	dispatch(commandBuffer, lbvhPipelines[MortonStage], 0, constants, blockCount);
+	barrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+
+	for (uint32_t pass = 0; pass < RadixPasses; pass++) {
+		constants.shift = pass * RadixBits;
+		uint32_t set = pass % 2;
+
+		dispatch(commandBuffer, sortPipelines[HistogramStage], set, constants, blockCount);
+		barrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+
+		dispatch(commandBuffer, sortPipelines[ScanStage], set, constants, 1);
+		barrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+
+		dispatch(commandBuffer, sortPipelines[ScatterStage], set, constants, blockCount);
+		barrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+	}
+
+	// One invocation per interior node, and one for the root leaf of a single triangle
+	dispatch(commandBuffer, lbvhPipelines[HierarchyStage], 0, constants, std::max(1u, (triangleCount - 1 + WorkgroupSize - 1) / WorkgroupSize));
+
+	recordRefitPass(commandBuffer);
+}
+
+void GpuBvhBuilder::recordRefit(VkCommandBuffer commandBuffer) {
+	if (triangleCount == 0) {
+		return;
+	}
+
+	recordRefitPass(commandBuffer);
+}
+
+void GpuBvhBuilder::recordRefitPass(VkCommandBuffer commandBuffer) {
+	GpuBvhPushConstants constants = {};
+	constants.count = triangleCount;
+	constants.blockCount = blockCount;
+
+	beforeFill(commandBuffer);
+	vkCmdFillBuffer(commandBuffer, buffers[RefitCounters].buffer, 0, VK_WHOLE_SIZE, 0);
+	barrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
+
+	dispatch(commandBuffer, lbvhPipelines[RefitStage], 0, constants, blockCount);
+	barrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+}
+
+void GpuBvhBuilder::dispatch(VkCommandBuffer commandBuffer, VkPipeline pipeline, uint32_t set, const GpuBvhPushConstants& constants, uint32_t groupCount) {
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSets[set], 0, nullptr);
+	vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(GpuBvhPushConstants), &constants);
+
+	vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+}
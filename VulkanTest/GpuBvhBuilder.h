@@ -0,0 +1,124 @@
+#pragma once
+
+#include "Bvh.h"
+#include "MemoryAllocator.h"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+
+// Mirrors the push constant blocks of lbvh.comp and radix_sort.comp, which read a prefix of it
+struct GpuBvhPushConstants {
+	uint32_t count;
+	uint32_t shift;
+	uint32_t blockCount;
+};
+
+// Builds the BVH on the GPU, for geometry that changes every frame and would otherwise go through
+// Bvh::build and an upload each time. A linear BVH after Karras 2012:
+//
+//   lbvh.comp        centroid bounds and a 30 bit Morton code per triangle
+//   radix_sort.comp  sorts the codes with their triangle indices, RadixBits per pass
+//   lbvh.comp        emits the binary radix tree over the sorted codes, one interior node per invocation,
+//                    then gathers the triangles in sorted order and refits bounds from the leaves up
+//
+// The output has the layout of Bvh: 2N - 1 BvhNodes with the root at 0, siblings next to each other and
+// one triangle per leaf, over a triangle buffer in leaf order. The compute tracer binds both directly.
+// The depth is at most 30 plus log2 of the triangle count, which keeps it inside Bvh::MaxDepth.
+// The tree is much faster to build than the binned SAH one but traces slower, as splits follow the
+// Morton curve rather than the surface area heuristic.
+//
+// Refit keeps the tree and only recomputes the bounds, which is enough for meshes that deform without
+// moving far. Its cost is a fraction of a build, but the tree degrades as triangles leave their cells.
+class GpuBvhBuilder {
+public:
+	// Invocations per workgroup of both shaders. Must match local_size_x in the shaders.
+	static constexpr uint32_t WorkgroupSize = 256;
+	static constexpr uint32_t RadixBits = 4;
+	// Morton codes use 30 bits, rounded up to whole passes. An even count leaves the result where it started.
+	static constexpr uint32_t RadixPasses = 8;
+
+	// Creates the descriptor set layout and the pipelines of every stage. Only touches the device and the
+	// cache, so it can run on a worker thread. Must finish before createBuffers.
+	void createPipelines(VkDevice device, VkPipelineCache pipelineCache, VkShaderModule lbvhShader, VkShaderModule radixSortShader);
+
+	// Sizes everything for triangleCount triangles read from sourceTriangles, which needs at least that
+	// many Triangles. May be called again after destroyBuffers, e.g. for another mesh.
+	void createBuffers(VkDevice device, MemoryAllocator& allocator, VkBuffer sourceTriangles, uint32_t triangleCount);
+	void destroyBuffers(MemoryAllocator& allocator);
+	void destroy(MemoryAllocator& allocator);
+
+	// Both leave the nodes and sorted triangles written for compute shaders recorded after them, and must
+	// not overlap another build or refit on the GPU. Writes to sourceTriangles must precede them.
+	void recordBuild(VkCommandBuffer commandBuffer);
+	// Only valid after a build over the same number of triangles
+	void recordRefit(VkCommandBuffer commandBuffer);
+
+	VkBuffer getNodeBuffer() const {
+		return buffers[Nodes].buffer;
+	}
+
+	VkBuffer getTriangleBuffer() const {
+		return buffers[SortedTriangles].buffer;
+	}
+
+	uint32_t getNodeCount() const {
+		return triangleCount > 0 ? triangleCount * 2 - 1 : 0;
+	}
+
+private:
+	enum LbvhStage : uint32_t {
+		BoundsStage,
+		MortonStage,
+		HierarchyStage,
+		RefitStage,
+		LbvhStageCount
+	};
+
+	enum SortStage : uint32_t {
+		HistogramStage,
+		ScanStage,
+		ScatterStage,
+		SortStageCount
+	};
+
+	// Bound at binding index + 1, after the source triangles. The sort swaps the two key and value pairs.
+	enum BufferIndex : uint32_t {
+		SortedTriangles,
+		Nodes,
+		Keys,
+		Values,
+		AlternateKeys,
+		AlternateValues,
+		Histograms,
+		InteriorSlots,
+		LeafSlots,
+		RefitCounters,
+		SceneBounds,
+		BufferCount
+	};
+
+	struct Buffer {
+		VkBuffer buffer = VK_NULL_HANDLE;
+		Allocation memory;
+	};
+
+	VkPipeline createPipeline(VkDevice device, VkPipelineCache pipelineCache, VkShaderModule shader, uint32_t stage);
+	void dispatch(VkCommandBuffer commandBuffer, VkPipeline pipeline, uint32_t set, const GpuBvhPushConstants& constants, uint32_t groupCount);
+	void recordRefitPass(VkCommandBuffer commandBuffer);
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	VkPipeline lbvhPipelines[LbvhStageCount] = {};
+	VkPipeline sortPipelines[SortStageCount] = {};
+	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+
+	// Set 0 sorts from Keys and Values into the alternate pair, set 1 back. lbvh.comp uses set 0.
+	VkDescriptorSet descriptorSets[2] = {};
+
+	Buffer buffers[BufferCount];
+	uint32_t triangleCount = 0;
+	// Workgroups covering one invocation per triangle, which is also the number of sort blocks
+	uint32_t blockCount = 0;
+};
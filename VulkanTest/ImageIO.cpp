@@ -0,0 +1,182 @@
+#include "ImageIO.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+	// The CRC of PNG chunks, the usual reflected polynomial 0xEDB88320
+	const std::array<uint32_t, 256> crcTable = [] {
+		std::array<uint32_t, 256> table = {};
+
+		for (uint32_t n = 0; n < 256; n++) {
+			uint32_t c = n;
+			for (int k = 0; k < 8; k++) {
+				c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			}
+			table[n] = c;
+		}
+
+		return table;
+	}();
+
+	uint32_t updateCrc(uint32_t crc, const uint8_t* data, size_t size) {
+		for (size_t i = 0; i < size; i++) {
+			crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+		}
+
+		return crc;
+	}
+
+	void appendBigEndian(std::vector<uint8_t>& out, uint32_t value) {
+		out.push_back(static_cast<uint8_t>(value >> 24));
+		out.push_back(static_cast<uint8_t>(value >> 16));
+		out.push_back(static_cast<uint8_t>(value >> 8));
+		out.push_back(static_cast<uint8_t>(value));
+	}
+
+	void writeChunk(std::ofstream& file, const char* type, const std::vector<uint8_t>& data) {
+		std::vector<uint8_t> header;
+		appendBigEndian(header, static_cast<uint32_t>(data.size()));
+		header.insert(header.end(), type, type + 4);
+
+		uint32_t crc = updateCrc(0xFFFFFFFFu, header.data() + 4, 4);
+		crc = updateCrc(crc, data.data(), data.size()) ^ 0xFFFFFFFFu;
+
+		std::vector<uint8_t> footer;
+		appendBigEndian(footer, crc);
+
+		file.write(reinterpret_cast<const char*>(header.data()), header.size());
+		file.write(reinterpret_cast<const char*>(data.data()), data.size());
+		file.write(reinterpret_cast<const char*>(footer.data()), footer.size());
+	}
+}
+
+static uint8_t encodeChannel(float value) {
+	// Must stay in sync with the encode step of the compute tracer
+	float encoded = std::pow(std::min(std::max(value, 0.0f), 1.0f), 1.0f / 2.2f);
+
+	return static_cast<uint8_t>(encoded * 255.0f + 0.5f);
+}
+
+void encodeRadianceRGBA8(const float* radiance, size_t pixelCount, uint8_t* rgba) {
+	for (size_t i = 0; i < pixelCount; i++) {
+		rgba[i * 4 + 0] = encodeChannel(radiance[i * 3 + 0]);
+		rgba[i * 4 + 1] = encodeChannel(radiance[i * 3 + 1]);
+		rgba[i * 4 + 2] = encodeChannel(radiance[i * 3 + 2]);
+		rgba[i * 4 + 3] = 255;
+	}
+}
+
+void encodeSampleDensityRGBA8(const uint32_t* sampleCounts, size_t pixelCount, uint32_t maxSamples, uint8_t* rgba) {
+	for (size_t i = 0; i < pixelCount; i++) {
+		// Must stay in sync with heatmap() in raytrace.comp
+		float t = std::min(static_cast<float>(sampleCounts[i]) / std::max(1u, maxSamples), 1.0f);
+
+		for (int channel = 0; channel < 3; channel++) {
+			float value = std::min(std::max(1.5f - std::fabs(4.0f * t - (3 - channel)), 0.0f), 1.0f);
+			rgba[i * 4 + channel] = static_cast<uint8_t>(value * 255.0f + 0.5f);
+		}
+
+		rgba[i * 4 + 3] = 255;
+	}
+}
+
+void writeImagePPM(const std::string& filename, uint32_t width, uint32_t height, const uint8_t* rgba, size_t rowPitch) {
+	std::ofstream file(filename, std::ios::binary);
+
+	if (!file.is_open()) {
+		throw std::runtime_error("Could not open output image");
+	}
+
+	file << "P6\n" << width << " " << height << "\n255\n";
+
+	std::vector<uint8_t> row(width * 3);
+	for (uint32_t y = 0; y < height; y++) {
+		const uint8_t* src = rgba + y * rowPitch;
+
+		for (uint32_t x = 0; x < width; x++) {
+			row[x * 3 + 0] = src[x * 4 + 0];
+			row[x * 3 + 1] = src[x * 4 + 1];
+			row[x * 3 + 2] = src[x * 4 + 2];
+		}
+
+		file.write(reinterpret_cast<const char*>(row.data()), row.size());
+	}
+}
+
+void writeImagePNG(const std::string& filename, uint32_t width, uint32_t height, const uint8_t* rgba, size_t rowPitch) {
+	std::ofstream file(filename, std::ios::binary);
+
+	if (!file.is_open()) {
+		throw std::runtime_error("Could not open output image");
+	}
+
+	const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+	std::vector<uint8_t> header;
+	appendBigEndian(header, width);
+	appendBigEndian(header, height);
+	// 8 bits per channel, RGB, deflate, adaptive filtering, no interlacing
+	header.insert(header.end(), { 8, 2, 0, 0, 0 });
+	writeChunk(file, "IHDR", header);
+
+	// Every row starts with its filter type, 0 leaves the bytes as they are
+	size_t rowSize = static_cast<size_t>(width) * 3 + 1;
+	std::vector<uint8_t> raw(rowSize * height);
+
+	for (uint32_t y = 0; y < height; y++) {
+		const uint8_t* src = rgba + y * rowPitch;
+		uint8_t* row = raw.data() + y * rowSize;
+
+		row[0] = 0;
+		for (uint32_t x = 0; x < width; x++) {
+			row[1 + x * 3 + 0] = src[x * 4 + 0];
+			row[1 + x * 3 + 1] = src[x * 4 + 1];
+			row[1 + x * 3 + 2] = src[x * 4 + 2];
+		}
+	}
+
+	// A zlib stream of stored deflate blocks, at most 65535 bytes each, and the Adler-32 of the raw data
+	const size_t maxBlockSize = 65535;
+	std::vector<uint8_t> stream = { 0x78, 0x01 };
+	stream.reserve(raw.size() + raw.size() / maxBlockSize * 5 + 16);
+
+	uint32_t adlerA = 1;
+	uint32_t adlerB = 0;
+
+	for (size_t offset = 0; offset == 0 || offset < raw.size(); offset += maxBlockSize) {
+		size_t blockSize = std::min(maxBlockSize, raw.size() - offset);
+		bool last = offset + blockSize >= raw.size();
+
+		stream.push_back(last ? 1 : 0);
+		stream.push_back(static_cast<uint8_t>(blockSize));
+		stream.push_back(static_cast<uint8_t>(blockSize >> 8));
+		stream.push_back(static_cast<uint8_t>(~blockSize));
+		stream.push_back(static_cast<uint8_t>(~blockSize >> 8));
+		stream.insert(stream.end(), raw.begin() + offset, raw.begin() + offset + blockSize);
+
+		for (size_t i = offset; i < offset + blockSize; i++) {
+			adlerA = (adlerA + raw[i]) % 65521;
+			adlerB = (adlerB + adlerA) % 65521;
+		}
+	}
+
+	appendBigEndian(stream, (adlerB << 16) | adlerA);
+	writeChunk(file, "IDAT", stream);
+	writeChunk(file, "IEND", {});
+}
+
+void writeImage(const std::string& filename, uint32_t width, uint32_t height, const uint8_t* rgba, size_t rowPitch) {
+	size_t extension = filename.rfind('.');
+
+	if (extension != std::string::npos && filename.compare(extension, std::string::npos, ".png") == 0) {
+		writeImagePNG(filename, width, height, rgba, rowPitch);
+	}
+	else {
+		writeImagePPM(filename, width, height, rgba, rowPitch);
+	}
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Converts linear radiance (three floats per pixel) to the gamma encoded RGBA8 layout that the GPU
+// tracer stores in its output image, so both backends produce byte-comparable results.
+void encodeRadianceRGBA8(const float* radiance, size_t pixelCount, uint8_t* rgba);
+
+// Colors samples per pixel on a blue to red ramp, maxSamples and above being red. The compute tracer uses
+// the same ramp for its sample density view.
+void encodeSampleDensityRGBA8(const uint32_t* sampleCounts, size_t pixelCount, uint32_t maxSamples, uint8_t* rgba);
+
+void writeImagePPM(const std::string& filename, uint32_t width, uint32_t height, const uint8_t* rgba, size_t rowPitch);
+
+// An RGB PNG whose deflate stream only has stored blocks. The files are as large as a PPM, but encoding
+// is a single pass of copies and checksums, cheap enough to keep up with the GPU in batch renders.
+void writeImagePNG(const std::string& filename, uint32_t width, uint32_t height, const uint8_t* rgba, size_t rowPitch);
+
+// Picks the format from the extension, .png or anything else as PPM
+void writeImage(const std::string& filename, uint32_t width, uint32_t height, const uint8_t* rgba, size_t rowPitch);
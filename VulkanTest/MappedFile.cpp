@@ -0,0 +1,110 @@
+#include "MappedFile.h"
+
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+void MappedFile::open(const std::string& path, const std::string& what) {
+	close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+	if (file == INVALID_HANDLE_VALUE) {
+		throw std::runtime_error("Could not open " + what + " " + path);
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize)) {
+		CloseHandle(file);
+		throw std::runtime_error("Could not read " + what + " " + path);
+	}
+
+	// Empty files cannot be mapped, they open without data
+	if (fileSize.QuadPart == 0) {
+		CloseHandle(file);
+		opened = true;
+		return;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	const void* view = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+
+	if (view == nullptr) {
+		if (mapping != nullptr) {
+			CloseHandle(mapping);
+		}
+		CloseHandle(file);
+		throw std::runtime_error("Could not map " + what + " " + path);
+	}
+
+	fileHandle = file;
+	mappingHandle = mapping;
+	base = static_cast<const uint8_t*>(view);
+	length = static_cast<size_t>(fileSize.QuadPart);
+	opened = true;
+#else
+	int file = ::open(path.c_str(), O_RDONLY);
+
+	if (file < 0) {
+		throw std::runtime_error("Could not open " + what + " " + path);
+	}
+
+	struct stat fileInfo;
+	if (fstat(file, &fileInfo) != 0) {
+		::close(file);
+		throw std::runtime_error("Could not read " + what + " " + path);
+	}
+
+	// Empty files cannot be mapped, they open without data
+	if (fileInfo.st_size == 0) {
+		::close(file);
+		opened = true;
+		return;
+	}
+
+	void* view = mmap(nullptr, static_cast<size_t>(fileInfo.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+
+	// The mapping keeps the file alive on its own
+	::close(file);
+
+	if (view == MAP_FAILED) {
+		throw std::runtime_error("Could not map " + what + " " + path);
+	}
+
+	base = static_cast<const uint8_t*>(view);
+	length = static_cast<size_t>(fileInfo.st_size);
+	opened = true;
+#endif
+}
+
+void MappedFile::close() {
+	if (base != nullptr) {
+#ifdef _WIN32
+		UnmapViewOfFile(base);
+		CloseHandle(static_cast<HANDLE>(mappingHandle));
+		CloseHandle(static_cast<HANDLE>(fileHandle));
+#else
+		munmap(const_cast<uint8_t*>(base), length);
+#endif
+	}
+
+	base = nullptr;
+	length = 0;
+	opened = false;
+	fileHandle = nullptr;
+	mappingHandle = nullptr;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Maps a whole file read-only into the address space. Pages are read in on first access and stay in the
+// page cache between runs, so opening a large file costs next to nothing until its data is touched.
+class MappedFile {
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+
+	// Throws if the file does not exist or cannot be mapped. what names the file in errors. An empty file
+	// opens with no data and a size of 0.
+	void open(const std::string& path, const std::string& what = "file");
+	void close();
+
+	bool isOpen() const {
+		return opened;
+	}
+
+	const uint8_t* data() const {
+		return base;
+	}
+
+	size_t size() const {
+		return length;
+	}
+
+private:
+	const uint8_t* base = nullptr;
+	size_t length = 0;
+	bool opened = false;
+
+	// Platform handles, unused outside Windows
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+};
@@ -0,0 +1,327 @@
+#include "MemoryAllocator.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+	VkDeviceSize roundUpToPowerOfTwo(VkDeviceSize value) {
+		VkDeviceSize result = 1;
+		while (result < value) {
+			result <<= 1;
+		}
+
+		return result;
+	}
+
+	VkDeviceSize roundDownToPowerOfTwo(VkDeviceSize value) {
+		VkDeviceSize result = 1;
+		while (result * 2 <= value) {
+			result <<= 1;
+		}
+
+		return result;
+	}
+}
+
+void MemoryAllocator::create(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize preferredBlockSize, bool bufferDeviceAddress) {
+	this->device = device;
+	this->preferredBlockSize = roundUpToPowerOfTwo(preferredBlockSize);
+	this->bufferDeviceAddress = bufferDeviceAddress;
+
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+	pools.resize(memoryProperties.memoryTypeCount * 2);
+	for (uint32_t i = 0; i < pools.size(); i++) {
+		pools[i].memoryType = i / 2;
+	}
+
+	dedicatedBytes.assign(memoryProperties.memoryHeapCount, 0);
+	dedicatedCounts.assign(memoryProperties.memoryHeapCount, 0);
+}
+
+void MemoryAllocator::destroy() {
+	for (auto& pool : pools) {
+		for (auto& block : pool.blocks) {
+			if (block) {
+				vkFreeMemory(device, block->memory, nullptr);
+			}
+		}
+	}
+
+	pools.clear();
+}
+
+uint32_t MemoryAllocator::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred) const {
+	// Try the preferred flags first and fall back to the bare requirements
+	for (VkMemoryPropertyFlags wanted : { required | preferred, required }) {
+		for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+			if ((typeFilter & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & wanted) == wanted) {
+				return i;
+			}
+		}
+	}
+
+	throw std::runtime_error("Could not find a suitable memory type");
+}
+
+// Small heaps, such as the host visible window into VRAM, get smaller blocks so one block never
+// claims a large share of them
+VkDeviceSize MemoryAllocator::getBlockSize(uint32_t memoryType) const {
+	VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryType].heapIndex].size;
+
+	return std::max(MinBlockSize, std::min(preferredBlockSize, roundDownToPowerOfTwo(heapSize / 8)));
+}
+
+VkDeviceMemory MemoryAllocator::allocateDeviceMemory(VkDeviceSize size, uint32_t memoryType, void** mapped) {
+	VkMemoryAllocateInfo allocateInfo = {};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocateInfo.allocationSize = size;
+	allocateInfo.memoryTypeIndex = memoryType;
+
+	// Blocks are shared by all buffers of a memory type, so the flag goes on all of them
+	VkMemoryAllocateFlagsInfo flagsInfo = {};
+	flagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+	flagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
+
+	if (bufferDeviceAddress) {
+		allocateInfo.pNext = &flagsInfo;
+	}
+
+	VkDeviceMemory memory;
+	if (vkAllocateMemory(device, &allocateInfo, nullptr, &memory) != VK_SUCCESS) {
+		throw std::runtime_error("Could not allocate device memory");
+	}
+
+	*mapped = nullptr;
+
+	if (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+		if (vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, mapped) != VK_SUCCESS) {
+			vkFreeMemory(device, memory, nullptr);
+			throw std::runtime_error("Could not map device memory");
+		}
+	}
+
+	return memory;
+}
+
+Allocation MemoryAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, bool linearResource) {
+	Allocation allocation;
+	allocation.memoryType = findMemoryType(requirements.memoryTypeBits, required, preferred);
+	allocation.size = requirements.size;
+
+	VkDeviceSize blockSize = getBlockSize(allocation.memoryType);
+
+	if (requirements.size > blockSize / 2) {
+		allocation.memory = allocateDeviceMemory(requirements.size, allocation.memoryType, &allocation.mapped);
+		allocation.poolIndex = DedicatedPool;
+
+		uint32_t heap = memoryProperties.memoryTypes[allocation.memoryType].heapIndex;
+		dedicatedBytes[heap] += requirements.size;
+		dedicatedCounts[heap]++;
+
+		return allocation;
+	}
+
+	allocation.poolIndex = allocation.memoryType * 2 + (linearResource ? 0 : 1);
+	Pool& pool = pools[allocation.poolIndex];
+
+	for (uint32_t i = 0; i < pool.blocks.size(); i++) {
+		Block* block = pool.blocks[i].get();
+
+		if (block == nullptr) {
+			continue;
+		}
+
+		std::optional<uint64_t> offset = block->buddy.allocate(requirements.size, requirements.alignment);
+
+		if (offset.has_value()) {
+			allocation.memory = block->memory;
+			allocation.offset = offset.value();
+			allocation.mapped = block->mapped != nullptr ? static_cast<uint8_t*>(block->mapped) + offset.value() : nullptr;
+			allocation.blockIndex = i;
+
+			return allocation;
+		}
+	}
+
+	// No block has room, so start a new one, reusing a released slot if there is one
+	void* mapped;
+	VkDeviceMemory memory = allocateDeviceMemory(blockSize, allocation.memoryType, &mapped);
+
+	auto slot = std::find(pool.blocks.begin(), pool.blocks.end(), nullptr);
+	if (slot == pool.blocks.end()) {
+		slot = pool.blocks.insert(pool.blocks.end(), nullptr);
+	}
+
+	*slot = std::make_unique<Block>(Block{ memory, mapped, BuddyAllocator(blockSize, MinBlockSize) });
+
+	std::optional<uint64_t> offset = (*slot)->buddy.allocate(requirements.size, requirements.alignment);
+
+	allocation.memory = memory;
+	allocation.offset = offset.value();
+	allocation.mapped = mapped != nullptr ? static_cast<uint8_t*>(mapped) + offset.value() : nullptr;
+	allocation.blockIndex = static_cast<uint32_t>(slot - pool.blocks.begin());
+
+	return allocation;
+}
+
+void MemoryAllocator::free(Allocation& allocation) {
+	if (allocation.memory == VK_NULL_HANDLE) {
+		return;
+	}
+
+	if (allocation.poolIndex == DedicatedPool) {
+		vkFreeMemory(device, allocation.memory, nullptr);
+
+		uint32_t heap = memoryProperties.memoryTypes[allocation.memoryType].heapIndex;
+		dedicatedBytes[heap] -= allocation.size;
+		dedicatedCounts[heap]--;
+	}
+	else {
+		Pool& pool = pools[allocation.poolIndex];
+		std::unique_ptr<Block>& block = pool.blocks[allocation.blockIndex];
+
+		block->buddy.free(allocation.offset);
+
+		// Keep one block per pool around so a resource that is recreated every so often does not
+		// allocate and free device memory each time
+		size_t liveBlocks = std::count_if(pool.blocks.begin(), pool.blocks.end(), [](const std::unique_ptr<Block>& b) { return b != nullptr; });
+
+		if (block->buddy.isEmpty() && liveBlocks > 1) {
+			vkFreeMemory(device, block->memory, nullptr);
+			block.reset();
+		}
+	}
+
+	allocation = Allocation();
+}
+
+void MemoryAllocator::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, VkBuffer& buffer, Allocation& allocation,
+	const std::vector<uint32_t>& queueFamilies) {
+	VkBufferCreateInfo bufferCreateInfo = {};
+	bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferCreateInfo.size = size;
+	bufferCreateInfo.usage = usage;
+
+	if (queueFamilies.size() > 1) {
+		bufferCreateInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		bufferCreateInfo.queueFamilyIndexCount = static_cast<uint32_t>(queueFamilies.size());
+		bufferCreateInfo.pQueueFamilyIndices = queueFamilies.data();
+	}
+	else {
+		bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	}
+
+	if (vkCreateBuffer(device, &bufferCreateInfo, nullptr, &buffer) != VK_SUCCESS) {
+		throw std::runtime_error("Could not create buffer");
+	}
+
+	VkMemoryRequirements requirements;
+	vkGetBufferMemoryRequirements(device, buffer, &requirements);
+
+	allocation = allocate(requirements, required, preferred, true);
+
+	vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset);
+}
+
+void MemoryAllocator::destroyBuffer(VkBuffer& buffer, Allocation& allocation) {
+	vkDestroyBuffer(device, buffer, nullptr);
+	buffer = VK_NULL_HANDLE;
+
+	free(allocation);
+}
+
+void MemoryAllocator::createImage(const VkImageCreateInfo& imageCreateInfo, VkMemoryPropertyFlags required, VkImage& image, Allocation& allocation) {
+	if (vkCreateImage(device, &imageCreateInfo, nullptr, &image) != VK_SUCCESS) {
+		throw std::runtime_error("Could not create image");
+	}
+
+	VkMemoryRequirements requirements;
+	vkGetImageMemoryRequirements(device, image, &requirements);
+
+	allocation = allocate(requirements, required, 0, imageCreateInfo.tiling == VK_IMAGE_TILING_LINEAR);
+
+	vkBindImageMemory(device, image, allocation.memory, allocation.offset);
+}
+
+void MemoryAllocator::destroyImage(VkImage& image, Allocation& allocation) {
+	vkDestroyImage(device, image, nullptr);
+	image = VK_NULL_HANDLE;
+
+	free(allocation);
+}
+
+std::vector<MemoryHeapStats> MemoryAllocator::getHeapStats() const {
+	std::vector<MemoryHeapStats> stats(memoryProperties.memoryHeapCount);
+
+	for (uint32_t heap = 0; heap < memoryProperties.memoryHeapCount; heap++) {
+		stats[heap].heapSize = memoryProperties.memoryHeaps[heap].size;
+		stats[heap].reservedBytes = dedicatedBytes[heap];
+		stats[heap].usedBytes = dedicatedBytes[heap];
+		stats[heap].deviceAllocationCount = dedicatedCounts[heap];
+		stats[heap].allocationCount = dedicatedCounts[heap];
+	}
+
+	for (const auto& pool : pools) {
+		MemoryHeapStats& heapStats = stats[memoryProperties.memoryTypes[pool.memoryType].heapIndex];
+
+		for (const auto& block : pool.blocks) {
+			if (!block) {
+				continue;
+			}
+
+			heapStats.reservedBytes += block->buddy.getSize();
+			heapStats.usedBytes += block->buddy.getUsedBytes();
+			heapStats.largestFreeRange = std::max<VkDeviceSize>(heapStats.largestFreeRange, block->buddy.getLargestFreeBlock());
+			heapStats.deviceAllocationCount++;
+			heapStats.allocationCount += block->buddy.getAllocationCount();
+		}
+	}
+
+	return stats;
+}
+
+void MemoryAllocator::printStats(std::ostream& out) const {
+	std::vector<MemoryHeapStats> stats = getHeapStats();
+
+	for (uint32_t heap = 0; heap < stats.size(); heap++) {
+		const MemoryHeapStats& heapStats = stats[heap];
+
+		if (heapStats.deviceAllocationCount == 0) {
+			continue;
+		}
+
+		out << "Heap " << heap << ": " << heapStats.usedBytes / 1024 << "KiB used of " << heapStats.reservedBytes / 1024 << "KiB reserved (heap " <<
+			heapStats.heapSize / (1024 * 1024) << "MiB), " << heapStats.allocationCount << " allocation(s) in " << heapStats.deviceAllocationCount <<
+			" device allocation(s), fragmentation " << heapStats.fragmentation() << std::endl;
+	}
+}
+
+void LinearArena::create(MemoryAllocator& allocator, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred) {
+	allocator.createBuffer(size, usage, required, preferred, buffer, allocation);
+	this->size = size;
+	head = 0;
+}
+
+void LinearArena::destroy(MemoryAllocator& allocator) {
+	allocator.destroyBuffer(buffer, allocation);
+	head = 0;
+}
+
+LinearArena::Slice LinearArena::allocate(VkDeviceSize size, VkDeviceSize alignment) {
+	VkDeviceSize offset = (head + alignment - 1) / alignment * alignment;
+
+	if (offset + size > this->size) {
+		throw std::runtime_error("Linear arena is full");
+	}
+
+	head = offset + size;
+
+	Slice slice;
+	slice.buffer = buffer;
+	slice.offset = offset;
+	slice.size = size;
+	slice.mapped = allocation.mapped != nullptr ? static_cast<uint8_t*>(allocation.mapped) + offset : nullptr;
+
+	return slice;
+}
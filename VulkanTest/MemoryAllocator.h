@@ -0,0 +1,135 @@
+#pragma once
+
+#include "BuddyAllocator.h"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+// A range of device memory handed out by MemoryAllocator. Host visible allocations stay mapped for
+// their whole lifetime and mapped points at the start of the range.
+struct Allocation {
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	void* mapped = nullptr;
+	uint32_t memoryType = 0;
+	uint32_t poolIndex = 0;
+	uint32_t blockIndex = 0;
+};
+
+struct MemoryHeapStats {
+	VkDeviceSize heapSize = 0;
+	// Bytes reserved from Vulkan, in blocks and dedicated allocations
+	VkDeviceSize reservedBytes = 0;
+	VkDeviceSize usedBytes = 0;
+	VkDeviceSize largestFreeRange = 0;
+	uint32_t deviceAllocationCount = 0;
+	uint32_t allocationCount = 0;
+
+	// 0 when all free space is one range, approaching 1 as it splits into many small ones
+	double fragmentation() const {
+		VkDeviceSize freeBytes = reservedBytes - usedBytes;
+		return freeBytes > 0 ? 1.0 - static_cast<double>(largestFreeRange) / freeBytes : 0.0;
+	}
+};
+
+// Sub-allocates buffers and images out of large VkDeviceMemory blocks, grouped by memory type, so
+// the number of vkAllocateMemory calls stays far below maxMemoryAllocationCount. Buffers and
+// optimally tiled images are kept in separate blocks, which sidesteps bufferImageGranularity.
+// Requests larger than half a block get a dedicated allocation.
+class MemoryAllocator {
+public:
+	// With bufferDeviceAddress every block is allocated so buffers in it can be created with
+	// VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT. The feature must have been enabled on the device.
+	void create(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize preferredBlockSize = 64ull << 20, bool bufferDeviceAddress = false);
+	void destroy();
+
+	// Picks a memory type with the required flags, preferring one that also has the preferred flags
+	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred = 0) const;
+
+	Allocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, bool linearResource);
+	void free(Allocation& allocation);
+
+	// Buffers shared by more than one queue family are created with concurrent sharing, so they need
+	// no ownership transfers between e.g. the transfer and compute queues
+	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, VkBuffer& buffer, Allocation& allocation,
+		const std::vector<uint32_t>& queueFamilies = {});
+	void destroyBuffer(VkBuffer& buffer, Allocation& allocation);
+
+	void createImage(const VkImageCreateInfo& imageCreateInfo, VkMemoryPropertyFlags required, VkImage& image, Allocation& allocation);
+	void destroyImage(VkImage& image, Allocation& allocation);
+
+	std::vector<MemoryHeapStats> getHeapStats() const;
+	void printStats(std::ostream& out) const;
+
+	static constexpr VkDeviceSize MinBlockSize = 256;
+
+private:
+	struct Block {
+		VkDeviceMemory memory;
+		void* mapped;
+		BuddyAllocator buddy;
+	};
+
+	struct Pool {
+		uint32_t memoryType;
+		std::vector<std::unique_ptr<Block>> blocks;
+	};
+
+	static constexpr uint32_t DedicatedPool = UINT32_MAX;
+
+	VkDeviceMemory allocateDeviceMemory(VkDeviceSize size, uint32_t memoryType, void** mapped);
+	VkDeviceSize getBlockSize(uint32_t memoryType) const;
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkPhysicalDeviceMemoryProperties memoryProperties = {};
+	VkDeviceSize preferredBlockSize = 0;
+	bool bufferDeviceAddress = false;
+
+	// Two pools per memory type: even indices hold buffers and linear images, odd ones optimal images
+	std::vector<Pool> pools;
+
+	// Dedicated allocations are tracked only for the statistics
+	std::vector<VkDeviceSize> dedicatedBytes;
+	std::vector<uint32_t> dedicatedCounts;
+};
+
+// Bump allocator over one buffer for data that only lives for a frame. reset() hands out the whole
+// buffer again, so it may only be called once the GPU is done with everything allocated before.
+class LinearArena {
+public:
+	struct Slice {
+		VkBuffer buffer;
+		VkDeviceSize offset;
+		VkDeviceSize size;
+		void* mapped;
+	};
+
+	void create(MemoryAllocator& allocator, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred = 0);
+	void destroy(MemoryAllocator& allocator);
+
+	// Throws when the arena is full
+	Slice allocate(VkDeviceSize size, VkDeviceSize alignment);
+
+	void reset() {
+		head = 0;
+	}
+
+	VkDeviceSize getUsedBytes() const {
+		return head;
+	}
+
+	VkDeviceSize getSize() const {
+		return size;
+	}
+
+private:
+	VkBuffer buffer = VK_NULL_HANDLE;
+	Allocation allocation;
+	VkDeviceSize size = 0;
+	VkDeviceSize head = 0;
+};
@@ -0,0 +1,180 @@
+#include "PipelineCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+	// FNV-1a, enough to catch truncated or corrupted files
+	uint64_t hashData(const uint8_t* data, size_t size) {
+		uint64_t hash = 14695981039346656037ull;
+
+		for (size_t i = 0; i < size; i++) {
+			hash ^= data[i];
+			hash *= 1099511628211ull;
+		}
+
+		return hash;
+	}
+}
+
+void PipelineCache::create(VkPhysicalDevice physicalDevice, VkDevice device, const std::string& path) {
+	this->device = device;
+	this->path = path;
+
+	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+	std::vector<uint8_t> data;
+	warm = !path.empty() && loadData(data);
+
+	VkPipelineCacheCreateInfo cacheCreateInfo = {};
+	cacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cacheCreateInfo.initialDataSize = warm ? data.size() : 0;
+	cacheCreateInfo.pInitialData = warm ? data.data() : nullptr;
+
+	if (vkCreatePipelineCache(device, &cacheCreateInfo, nullptr, &cache) == VK_SUCCESS) {
+		return;
+	}
+
+	// Drivers may still refuse data that passed our checks, in which case start over empty
+	warm = false;
+	cacheCreateInfo.initialDataSize = 0;
+	cacheCreateInfo.pInitialData = nullptr;
+
+	if (vkCreatePipelineCache(device, &cacheCreateInfo, nullptr, &cache) != VK_SUCCESS) {
+		throw std::runtime_error("Could not create pipeline cache");
+	}
+}
+
+void PipelineCache::save() {
+	if (cache == VK_NULL_HANDLE || path.empty()) {
+		return;
+	}
+
+	size_t dataSize = 0;
+	if (vkGetPipelineCacheData(device, cache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0) {
+		return;
+	}
+
+	std::vector<uint8_t> data(dataSize);
+	if (vkGetPipelineCacheData(device, cache, &dataSize, data.data()) != VK_SUCCESS) {
+		return;
+	}
+	data.resize(dataSize);
+
+	FileHeader header = makeHeader();
+	header.dataSize = data.size();
+	header.dataHash = hashData(data.data(), data.size());
+
+	std::string temporaryPath = path + ".tmp";
+
+	{
+		std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+
+		if (!file.is_open()) {
+			std::cerr << "Could not write pipeline cache " << temporaryPath << std::endl;
+			return;
+		}
+
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(data.data()), data.size());
+
+		if (!file.good()) {
+			std::cerr << "Could not write pipeline cache " << temporaryPath << std::endl;
+			return;
+		}
+	}
+
+	// rename() does not replace an existing file on every platform
+	std::remove(path.c_str());
+	if (std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+		std::cerr << "Could not replace pipeline cache " << path << std::endl;
+		std::remove(temporaryPath.c_str());
+	}
+}
+
+void PipelineCache::destroy() {
+	if (cache != VK_NULL_HANDLE) {
+		vkDestroyPipelineCache(device, cache, nullptr);
+		cache = VK_NULL_HANDLE;
+	}
+}
+
+PipelineCache::FileHeader PipelineCache::makeHeader() const {
+	FileHeader header = {};
+	header.magic = Magic;
+	header.version = Version;
+	header.vendorID = deviceProperties.vendorID;
+	header.deviceID = deviceProperties.deviceID;
+	header.driverVersion = deviceProperties.driverVersion;
+	std::memcpy(header.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE);
+
+	return header;
+}
+
+bool PipelineCache::loadData(std::vector<uint8_t>& data) const {
+	std::ifstream file(path, std::ios::ate | std::ios::binary);
+
+	if (!file.is_open()) {
+		return false;
+	}
+
+	size_t fileSize = static_cast<size_t>(file.tellg());
+	file.seekg(0);
+
+	FileHeader header;
+	if (fileSize < sizeof(header) || !file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+		std::cout << "Discarding pipeline cache " << path << ": file is truncated" << std::endl;
+		return false;
+	}
+
+	FileHeader expected = makeHeader();
+
+	if (header.magic != expected.magic || header.version != expected.version) {
+		std::cout << "Discarding pipeline cache " << path << ": unknown format" << std::endl;
+		return false;
+	}
+
+	if (header.vendorID != expected.vendorID || header.deviceID != expected.deviceID || header.driverVersion != expected.driverVersion ||
+		std::memcmp(header.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+		std::cout << "Discarding pipeline cache " << path << ": written by a different device or driver" << std::endl;
+		return false;
+	}
+
+	if (header.dataSize != fileSize - sizeof(header)) {
+		std::cout << "Discarding pipeline cache " << path << ": size does not match its header" << std::endl;
+		return false;
+	}
+
+	data.resize(static_cast<size_t>(header.dataSize));
+	if (!file.read(reinterpret_cast<char*>(data.data()), data.size()) || hashData(data.data(), data.size()) != header.dataHash) {
+		std::cout << "Discarding pipeline cache " << path << ": data is corrupted" << std::endl;
+		return false;
+	}
+
+	if (!validateDriverHeader(data)) {
+		std::cout << "Discarding pipeline cache " << path << ": driver header does not match this device" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+// The data returned by vkGetPipelineCacheData starts with a header the driver fills in. It should
+// agree with ours, but checking it too protects against drivers that reuse a UUID across changes.
+bool PipelineCache::validateDriverHeader(const std::vector<uint8_t>& data) const {
+	VkPipelineCacheHeaderVersionOne driverHeader;
+
+	if (data.size() < sizeof(driverHeader)) {
+		return false;
+	}
+
+	std::memcpy(&driverHeader, data.data(), sizeof(driverHeader));
+
+	return driverHeader.headerSize >= sizeof(driverHeader) && driverHeader.headerSize <= data.size() &&
+		driverHeader.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+		driverHeader.vendorID == deviceProperties.vendorID && driverHeader.deviceID == deviceProperties.deviceID &&
+		std::memcmp(driverHeader.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
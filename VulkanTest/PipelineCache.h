@@ -0,0 +1,57 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A VkPipelineCache that persists between runs. The file starts with a header of our own that keys
+// the data to the device and driver and carries a hash of the payload. Anything that does not match
+// the current device, or fails the hash, is discarded and the cache starts cold.
+class PipelineCache {
+public:
+	// An empty path gives an in-memory cache that is never loaded or saved
+	void create(VkPhysicalDevice physicalDevice, VkDevice device, const std::string& path);
+
+	// Writes the current cache contents back to disk through a temporary file, so an interrupted
+	// write never leaves a truncated cache behind
+	void save();
+
+	void destroy();
+
+	VkPipelineCache get() const {
+		return cache;
+	}
+
+	// True when valid data for this device was loaded from disk
+	bool isWarm() const {
+		return warm;
+	}
+
+	static constexpr uint32_t Magic = 0x43505456; // "VTPC"
+	static constexpr uint32_t Version = 1;
+
+private:
+	struct FileHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t vendorID;
+		uint32_t deviceID;
+		uint32_t driverVersion;
+		uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+		uint32_t reserved;
+		uint64_t dataSize;
+		uint64_t dataHash;
+	};
+
+	FileHeader makeHeader() const;
+	bool loadData(std::vector<uint8_t>& data) const;
+	bool validateDriverHeader(const std::vector<uint8_t>& data) const;
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkPhysicalDeviceProperties deviceProperties = {};
+	VkPipelineCache cache = VK_NULL_HANDLE;
+	std::string path;
+	bool warm = false;
+};
@@ -0,0 +1,284 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+	// GPU events get their own row in the trace viewer, well away from the CPU thread indices
+	constexpr uint32_t GpuThread = 1000;
+
+	void writeJsonString(std::ostream& out, const char* text) {
+		out << '"';
+		for (const char* c = text; *c != '\0'; c++) {
+			if (*c == '"' || *c == '\\') {
+				out << '\\';
+			}
+			out << *c;
+		}
+		out << '"';
+	}
+}
+
+void Profiler::Series::add(double milliseconds) {
+	if (samples.size() < WindowSize) {
+		samples.push_back(milliseconds);
+	}
+	else {
+		samples[next] = milliseconds;
+	}
+
+	next = (next + 1) % WindowSize;
+	count++;
+	last = milliseconds;
+}
+
+Profiler::Profiler() : epoch(Clock::now()) {
+}
+
+void Profiler::addCpuZone(const char* name, Clock::time_point start, Clock::time_point end) {
+	double startMicroseconds = toMicroseconds(start);
+	double durationMicroseconds = toMicroseconds(end) - startMicroseconds;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	addSample("cpu", name, startMicroseconds, durationMicroseconds, getThreadIndex(std::this_thread::get_id()));
+}
+
+void Profiler::createGpuTimers(VkDevice device, uint32_t timestampValidBits, float timestampPeriod, uint32_t slotCount) {
+	this->device = device;
+	gpuSlots.assign(slotCount, GpuSlot());
+
+	if (timestampValidBits == 0) {
+		return;
+	}
+
+	timestampMask = timestampValidBits >= 64 ? ~0ull : (1ull << timestampValidBits) - 1;
+	this->timestampPeriod = timestampPeriod;
+
+	VkQueryPoolCreateInfo queryPoolCreateInfo = {};
+	queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	// A start and end timestamp for every zone of every slot
+	queryPoolCreateInfo.queryCount = 2 * MaxGpuZonesPerSlot * slotCount;
+
+	if (vkCreateQueryPool(device, &queryPoolCreateInfo, nullptr, &queryPool) != VK_SUCCESS) {
+		throw std::runtime_error("Could not create timestamp query pool");
+	}
+}
+
+void Profiler::destroyGpuTimers() {
+	if (queryPool != VK_NULL_HANDLE) {
+		vkDestroyQueryPool(device, queryPool, nullptr);
+		queryPool = VK_NULL_HANDLE;
+	}
+
+	gpuSlots.clear();
+}
+
+void Profiler::beginGpuFrame(VkCommandBuffer commandBuffer, uint32_t slot) {
+	if (queryPool == VK_NULL_HANDLE) {
+		return;
+	}
+
+	gpuSlots[slot].names.clear();
+	vkCmdResetQueryPool(commandBuffer, queryPool, 2 * MaxGpuZonesPerSlot * slot, 2 * MaxGpuZonesPerSlot);
+}
+
+uint32_t Profiler::beginGpuZone(VkCommandBuffer commandBuffer, uint32_t slot, const char* name) {
+	if (queryPool == VK_NULL_HANDLE || gpuSlots[slot].names.size() >= MaxGpuZonesPerSlot) {
+		return UINT32_MAX;
+	}
+
+	uint32_t zone = static_cast<uint32_t>(gpuSlots[slot].names.size());
+	gpuSlots[slot].names.push_back(name);
+
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 2 * (MaxGpuZonesPerSlot * slot + zone));
+
+	return zone;
+}
+
+void Profiler::endGpuZone(VkCommandBuffer commandBuffer, uint32_t slot, uint32_t zone) {
+	if (zone == UINT32_MAX) {
+		return;
+	}
+
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 2 * (MaxGpuZonesPerSlot * slot + zone) + 1);
+}
+
+void Profiler::resolveGpuFrame(uint32_t slot, Clock::time_point submitTime) {
+	GpuSlot& gpuSlot = gpuSlots[slot];
+	gpuSlot.resolved.clear();
+
+	if (queryPool == VK_NULL_HANDLE || gpuSlot.names.empty()) {
+		return;
+	}
+
+	uint32_t zoneCount = static_cast<uint32_t>(gpuSlot.names.size());
+	std::vector<uint64_t> timestamps(2 * zoneCount);
+
+	if (vkGetQueryPoolResults(device, queryPool, 2 * MaxGpuZonesPerSlot * slot, 2 * zoneCount, timestamps.size() * sizeof(uint64_t), timestamps.data(),
+		sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT) != VK_SUCCESS) {
+		return;
+	}
+
+	uint64_t frameStart = timestamps[0];
+	for (uint32_t zone = 0; zone < zoneCount; zone++) {
+		frameStart = std::min(frameStart, timestamps[2 * zone]);
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	double base = std::max(toMicroseconds(submitTime), lastGpuEnd);
+
+	for (uint32_t zone = 0; zone < zoneCount; zone++) {
+		double ticksToMicroseconds = timestampPeriod / 1e3;
+		double start = base + ((timestamps[2 * zone] - frameStart) & timestampMask) * ticksToMicroseconds;
+		double duration = ((timestamps[2 * zone + 1] - timestamps[2 * zone]) & timestampMask) * ticksToMicroseconds;
+
+		gpuSlot.resolved.push_back({ gpuSlot.names[zone], duration / 1e3 });
+		addSample("gpu", gpuSlot.names[zone], start, duration, GpuThread);
+
+		lastGpuEnd = std::max(lastGpuEnd, start + duration);
+	}
+}
+
+double Profiler::getGpuMilliseconds(uint32_t slot, const char* name) const {
+	for (const GpuZone& zone : gpuSlots[slot].resolved) {
+		if (std::string(zone.name) == name) {
+			return zone.milliseconds;
+		}
+	}
+
+	return -1.0;
+}
+
+ProfileStats Profiler::getStats(const std::string& track, const char* name) const {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	ProfileStats stats;
+
+	auto trackSeries = series.find(track);
+	if (trackSeries == series.end()) {
+		return stats;
+	}
+
+	auto found = trackSeries->second.find(name);
+	if (found == trackSeries->second.end() || found->second.samples.empty()) {
+		return stats;
+	}
+
+	std::vector<double> samples = found->second.samples;
+	std::sort(samples.begin(), samples.end());
+
+	double sum = 0.0;
+	for (double sample : samples) {
+		sum += sample;
+	}
+
+	// Nearest rank percentile
+	size_t p99Index = static_cast<size_t>(std::ceil(0.99 * samples.size())) - 1;
+
+	stats.count = found->second.count;
+	stats.minMilliseconds = samples.front();
+	stats.meanMilliseconds = sum / samples.size();
+	stats.p99Milliseconds = samples[p99Index];
+	stats.lastMilliseconds = found->second.last;
+
+	return stats;
+}
+
+void Profiler::printStats(std::ostream& out) const {
+	std::vector<std::pair<std::string, std::string>> names;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		for (const auto& track : series) {
+			for (const auto& entry : track.second) {
+				names.push_back({ track.first, entry.first });
+			}
+		}
+	}
+
+	out << "Profile (last " << WindowSize << " samples, milliseconds):" << std::endl;
+
+	std::ios::fmtflags flags = out.flags();
+	std::streamsize precision = out.precision();
+	out << std::fixed << std::setprecision(3);
+
+	for (const auto& name : names) {
+		ProfileStats stats = getStats(name.first, name.second.c_str());
+
+		out << "\t" << name.first << " " << std::left << std::setw(28) << name.second << std::right << " n " << std::setw(7) << stats.count <<
+			"  min " << std::setw(9) << stats.minMilliseconds << "  mean " << std::setw(9) << stats.meanMilliseconds <<
+			"  p99 " << std::setw(9) << stats.p99Milliseconds << std::endl;
+	}
+
+	out.flags(flags);
+	out.precision(precision);
+}
+
+void Profiler::writeChromeTrace(const std::string& path) const {
+	std::ofstream file(path);
+
+	if (!file.is_open()) {
+		throw std::runtime_error("Could not open trace file");
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	file << std::fixed << std::setprecision(3);
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::endl;
+
+	for (uint32_t thread = 0; thread < threads.size(); thread++) {
+		file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << thread << ",\"args\":{\"name\":\"" <<
+			(thread == 0 ? "Main thread" : "Worker " + std::to_string(thread)) << "\"}}," << std::endl;
+	}
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << GpuThread << ",\"args\":{\"name\":\"GPU\"}}";
+
+	for (const Event& event : events) {
+		file << "," << std::endl << "{\"name\":";
+		writeJsonString(file, event.name);
+		file << ",\"cat\":\"" << (event.thread == GpuThread ? "gpu" : "cpu") << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << event.thread <<
+			",\"ts\":" << event.start << ",\"dur\":" << event.duration << "}";
+	}
+
+	file << std::endl << "]}" << std::endl;
+
+	if (droppedEvents > 0) {
+		std::cout << "Trace " << path << " was truncated after " << events.size() << " events, " << droppedEvents << " were dropped" << std::endl;
+	}
+}
+
+void Profiler::addSample(const std::string& track, const char* name, double start, double duration, uint32_t thread) {
+	series[track][name].add(duration / 1e3);
+
+	if (!capture) {
+		return;
+	}
+
+	if (events.size() < MaxCapturedEvents) {
+		events.push_back({ name, thread, start, duration });
+	}
+	else {
+		droppedEvents++;
+	}
+}
+
+uint32_t Profiler::getThreadIndex(std::thread::id id) {
+	for (uint32_t i = 0; i < threads.size(); i++) {
+		if (threads[i] == id) {
+			return i;
+		}
+	}
+
+	threads.push_back(id);
+
+	return static_cast<uint32_t>(threads.size() - 1);
+}
+
+double Profiler::toMicroseconds(Clock::time_point time) const {
+	return std::chrono::duration<double, std::micro>(time - epoch).count();
+}
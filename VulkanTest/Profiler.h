@@ -0,0 +1,146 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct ProfileStats {
+	uint64_t count = 0;
+	double minMilliseconds = 0.0;
+	double meanMilliseconds = 0.0;
+	double p99Milliseconds = 0.0;
+	double lastMilliseconds = 0.0;
+};
+
+// Collects CPU zones from any thread and GPU zones measured with timestamp queries. Every zone
+// feeds a rolling window per name, from which min, mean and 99th percentile are computed. When
+// capturing, every zone is also kept as an event and can be written out as a Chrome trace
+// (chrome://tracing or ui.perfetto.dev).
+//
+// Zone names are not copied, they must outlive the profiler. String literals are the intent.
+class Profiler {
+public:
+	using Clock = std::chrono::high_resolution_clock;
+
+	Profiler();
+
+	Profiler(const Profiler&) = delete;
+	Profiler& operator=(const Profiler&) = delete;
+
+	void setCapture(bool enabled) {
+		capture = enabled;
+	}
+
+	void addCpuZone(const char* name, Clock::time_point start, Clock::time_point end);
+
+	// GPU zones are recorded per frame slot, so a slot may only be reused once its fence has signalled.
+	// Without timestamp support on the queue family every GPU call is a no-op.
+	void createGpuTimers(VkDevice device, uint32_t timestampValidBits, float timestampPeriod, uint32_t slotCount);
+	void destroyGpuTimers();
+
+	bool hasGpuTimers() const {
+		return queryPool != VK_NULL_HANDLE;
+	}
+
+	// Resets the queries of a slot. Must be recorded before any zone of the slot.
+	void beginGpuFrame(VkCommandBuffer commandBuffer, uint32_t slot);
+	// Returns an id for endGpuZone, zones beyond MaxGpuZonesPerSlot are dropped
+	uint32_t beginGpuZone(VkCommandBuffer commandBuffer, uint32_t slot, const char* name);
+	void endGpuZone(VkCommandBuffer commandBuffer, uint32_t slot, uint32_t zone);
+
+	// Reads the timestamps of a slot whose work has completed. GPU clocks are not calibrated against
+	// the CPU, so captured GPU events are placed relative to submitTime and never before the end of
+	// the previous GPU frame; durations are exact, the offset from the CPU track is approximate.
+	void resolveGpuFrame(uint32_t slot, Clock::time_point submitTime);
+
+	// Duration of the named zone in the last resolved frame of the slot, or a negative value
+	double getGpuMilliseconds(uint32_t slot, const char* name) const;
+
+	ProfileStats getStats(const std::string& track, const char* name) const;
+	void printStats(std::ostream& out) const;
+
+	void writeChromeTrace(const std::string& path) const;
+
+	static constexpr uint32_t WindowSize = 256;
+	static constexpr uint32_t MaxGpuZonesPerSlot = 16;
+	// Bounds the memory of long captures, later events are counted but not kept
+	static constexpr size_t MaxCapturedEvents = 1 << 20;
+
+private:
+	struct Series {
+		std::vector<double> samples;
+		uint32_t next = 0;
+		uint64_t count = 0;
+		double last = 0.0;
+
+		void add(double milliseconds);
+	};
+
+	struct Event {
+		const char* name;
+		uint32_t thread;
+		// Microseconds since the profiler was created
+		double start;
+		double duration;
+	};
+
+	struct GpuZone {
+		const char* name;
+		double milliseconds;
+	};
+
+	struct GpuSlot {
+		std::vector<const char*> names;
+		std::vector<GpuZone> resolved;
+	};
+
+	void addSample(const std::string& track, const char* name, double start, double duration, uint32_t thread);
+	uint32_t getThreadIndex(std::thread::id id);
+	double toMicroseconds(Clock::time_point time) const;
+
+	Clock::time_point epoch;
+	bool capture = false;
+
+	mutable std::mutex mutex;
+	// Keyed by track ("cpu" or "gpu") and then zone name
+	std::map<std::string, std::map<std::string, Series>> series;
+	std::vector<Event> events;
+	size_t droppedEvents = 0;
+	std::vector<std::thread::id> threads;
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkQueryPool queryPool = VK_NULL_HANDLE;
+	float timestampPeriod = 0.0f;
+	uint64_t timestampMask = 0;
+	std::vector<GpuSlot> gpuSlots;
+	double lastGpuEnd = 0.0;
+};
+
+// Times the enclosing scope as a CPU zone
+class ProfileZone {
+public:
+	ProfileZone(Profiler& profiler, const char* name) : profiler(profiler), name(name), start(Profiler::Clock::now()) { }
+
+	~ProfileZone() {
+		profiler.addCpuZone(name, start, Profiler::Clock::now());
+	}
+
+	ProfileZone(const ProfileZone&) = delete;
+	ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+	Profiler& profiler;
+	const char* name;
+	Profiler::Clock::time_point start;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(profiler, name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(profiler, name)
@@ -0,0 +1,46 @@
+#include "ResolutionGovernor.h"
+
+#include <algorithm>
+#include <cmath>
+
+void ResolutionGovernor::configure(const ResolutionSettings& settings) {
+	this->settings = settings;
+	this->settings.minScale = std::min(std::max(settings.minScale, ScaleStep), 1.0f);
+
+	scale = 1.0f;
+	smoothedMilliseconds = 0.0;
+	sampleCount = 0;
+}
+
+bool ResolutionGovernor::update(float frameScale, double milliseconds) {
+	if (!isEnabled() || frameScale != scale || milliseconds <= 0.0) {
+		return false;
+	}
+
+	smoothedMilliseconds = sampleCount == 0 ? milliseconds : smoothedMilliseconds + (milliseconds - smoothedMilliseconds) * Smoothing;
+	sampleCount++;
+
+	double target = settings.targetMilliseconds;
+
+	if (sampleCount < MinimumSamples || std::abs(smoothedMilliseconds - target) <= target * Tolerance) {
+		return false;
+	}
+
+	double ideal = scale * std::sqrt(target / smoothedMilliseconds);
+
+	if (ideal > scale) {
+		ideal = scale + (ideal - scale) * 0.5;
+	}
+
+	float next = static_cast<float>(std::round(ideal / ScaleStep)) * ScaleStep;
+	next = std::min(std::max(next, settings.minScale), 1.0f);
+
+	if (next == scale) {
+		return false;
+	}
+
+	scale = next;
+	sampleCount = 0;
+
+	return true;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+
+struct ResolutionSettings {
+	// GPU time per frame to hold, in milliseconds. 0 always renders at the window's resolution.
+	float targetMilliseconds = 0.0f;
+	// Lowest fraction of the window's width and height the governor may render at
+	float minScale = 0.25f;
+};
+
+// Chooses the fraction of the window's resolution the tracer renders at, so that the GPU time of a
+// frame stays near a target. The trace dominates the frame and costs about the same per pixel, so the
+// time goes with the square of the scale and the scale that meets the target is
+// scale * sqrt(target / time).
+//
+// Every change reallocates the render targets and restarts accumulation, so the governor works from a
+// smoothed time, ignores frames rendered at an older scale, leaves a band around the target alone and
+// moves in steps of ScaleStep. It drops the scale at once when over budget but only approaches a higher
+// one half way, which keeps it from oscillating around a target between two steps.
+class ResolutionGovernor {
+public:
+	static constexpr float ScaleStep = 1.0f / 16.0f;
+	// Frames measured at the current scale before it may change again
+	static constexpr uint32_t MinimumSamples = 8;
+	// Weight of the newest frame in the smoothed time
+	static constexpr double Smoothing = 0.2;
+	// Relative distance from the target within which the scale is kept
+	static constexpr double Tolerance = 0.1;
+
+	// Starts over at full resolution
+	void configure(const ResolutionSettings& settings);
+
+	bool isEnabled() const {
+		return settings.targetMilliseconds > 0.0f;
+	}
+
+	// Feeds the GPU time of a completed frame that was rendered at frameScale. Returns true when the
+	// scale changed and the render targets have to be resized.
+	bool update(float frameScale, double milliseconds);
+
+	float getScale() const {
+		return scale;
+	}
+
+	double getSmoothedMilliseconds() const {
+		return smoothedMilliseconds;
+	}
+
+private:
+	ResolutionSettings settings;
+	float scale = 1.0f;
+	double smoothedMilliseconds = 0.0;
+	uint32_t sampleCount = 0;
+};
@@ -0,0 +1,244 @@
+#include "Scene.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace {
+	// Scales, then rotates about y, then translates
+	glm::mat4 makePlacement(const glm::vec3& position, float rotationY, const glm::vec3& scale) {
+		float c = std::cos(rotationY);
+		float s = std::sin(rotationY);
+
+		glm::mat4 transform(1.0f);
+		transform[0] = glm::vec4(c * scale.x, 0.0f, -s * scale.x, 0.0f);
+		transform[1] = glm::vec4(0.0f, scale.y, 0.0f, 0.0f);
+		transform[2] = glm::vec4(s * scale.z, 0.0f, c * scale.z, 0.0f);
+		transform[3] = glm::vec4(position, 1.0f);
+
+		return transform;
+	}
+
+	glm::vec3 transformPoint(const glm::mat4& transform, const glm::vec3& point) {
+		return glm::vec3(transform * glm::vec4(point, 1.0f));
+	}
+}
+
+uint32_t Scene::addMaterial(const glm::vec3& albedo, const glm::vec3& emission) {
+	Material material = {};
+	material.albedo = albedo;
+	material.emission = emission;
+
+	materials.push_back(material);
+
+	return static_cast<uint32_t>(materials.size() - 1);
+}
+
+void Scene::addTriangle(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, uint32_t materialId) {
+	Triangle triangle = {};
+	triangle.v0 = v0;
+	triangle.v1 = v1;
+	triangle.v2 = v2;
+	triangle.materialId = materialId;
+
+	triangles.push_back(triangle);
+}
+
+void Scene::addQuad(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, const glm::vec3& v3, uint32_t materialId) {
+	addTriangle(v0, v1, v2, materialId);
+	addTriangle(v0, v2, v3, materialId);
+}
+
+void Scene::addBox(const glm::vec3& center, const glm::vec3& halfExtent, float rotationY, uint32_t materialId) {
+	float c = std::cos(rotationY);
+	float s = std::sin(rotationY);
+
+	glm::vec3 corners[8];
+	for (int i = 0; i < 8; i++) {
+		glm::vec3 local((i & 1) ? halfExtent.x : -halfExtent.x, (i & 2) ? halfExtent.y : -halfExtent.y, (i & 4) ? halfExtent.z : -halfExtent.z);
+		corners[i] = center + glm::vec3(c * local.x + s * local.z, local.y, -s * local.x + c * local.z);
+	}
+
+	addQuad(corners[0], corners[1], corners[3], corners[2], materialId); // -z
+	addQuad(corners[4], corners[6], corners[7], corners[5], materialId); // +z
+	addQuad(corners[0], corners[2], corners[6], corners[4], materialId); // -x
+	addQuad(corners[1], corners[5], corners[7], corners[3], materialId); // +x
+	addQuad(corners[0], corners[4], corners[5], corners[1], materialId); // -y
+	addQuad(corners[2], corners[3], corners[7], corners[6], materialId); // +y
+}
+
+void Scene::addSphere(const glm::vec3& center, float radius, uint32_t segments, uint32_t materialId) {
+	const float pi = 3.14159265f;
+	uint32_t rings = std::max(2u, segments / 2);
+
+	auto point = [&](uint32_t ring, uint32_t segment) {
+		float theta = pi * ring / rings;
+		float phi = 2.0f * pi * segment / segments;
+		return center + radius * glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+	};
+
+	// The rings next to the poles are fans of single triangles
+	for (uint32_t ring = 0; ring < rings; ring++) {
+		for (uint32_t segment = 0; segment < segments; segment++) {
+			glm::vec3 v00 = point(ring, segment);
+			glm::vec3 v01 = point(ring, segment + 1);
+			glm::vec3 v10 = point(ring + 1, segment);
+			glm::vec3 v11 = point(ring + 1, segment + 1);
+
+			if (ring > 0) {
+				addTriangle(v00, v01, v11, materialId);
+			}
+			if (ring + 1 < rings) {
+				addTriangle(v00, v11, v10, materialId);
+			}
+		}
+	}
+}
+
+uint32_t Scene::addMesh(uint32_t firstTriangle) {
+	Mesh mesh = {};
+	mesh.firstTriangle = firstTriangle;
+	mesh.triangleCount = static_cast<uint32_t>(triangles.size()) - firstTriangle;
+
+	meshes.push_back(mesh);
+
+	return static_cast<uint32_t>(meshes.size() - 1);
+}
+
+void Scene::addInstance(const glm::mat4& transform, uint32_t meshId) {
+	MeshInstance instance = {};
+	instance.transform = transform;
+	instance.meshId = meshId;
+
+	instances.push_back(instance);
+}
+
+Scene Scene::flatten() const {
+	Scene flat;
+	flat.materials = materials;
+	flat.camera = camera;
+	flat.backgroundColor = backgroundColor;
+
+	if (!isInstanced()) {
+		flat.triangles = triangles;
+		return flat;
+	}
+
+	size_t triangleCount = 0;
+	for (const MeshInstance& instance : instances) {
+		triangleCount += meshes[instance.meshId].triangleCount;
+	}
+
+	flat.triangles.reserve(triangleCount);
+
+	for (const MeshInstance& instance : instances) {
+		const Mesh& mesh = meshes[instance.meshId];
+
+		for (uint32_t i = mesh.firstTriangle; i < mesh.firstTriangle + mesh.triangleCount; i++) {
+			Triangle triangle = triangles[i];
+			triangle.v0 = transformPoint(instance.transform, triangle.v0);
+			triangle.v1 = transformPoint(instance.transform, triangle.v1);
+			triangle.v2 = transformPoint(instance.transform, triangle.v2);
+
+			flat.triangles.push_back(triangle);
+		}
+	}
+
+	return flat;
+}
+
+Scene Scene::createDefault() {
+	Scene scene;
+
+	uint32_t white = scene.addMaterial(glm::vec3(0.73f, 0.73f, 0.73f));
+	uint32_t red = scene.addMaterial(glm::vec3(0.65f, 0.05f, 0.05f));
+	uint32_t green = scene.addMaterial(glm::vec3(0.12f, 0.45f, 0.15f));
+	uint32_t light = scene.addMaterial(glm::vec3(0.0f), glm::vec3(15.0f, 15.0f, 15.0f));
+
+	// Room spanning [-1, 1] on every axis with the front (+z) left open
+	scene.addQuad(glm::vec3(-1, -1, -1), glm::vec3(1, -1, -1), glm::vec3(1, -1, 1), glm::vec3(-1, -1, 1), white); // floor
+	scene.addQuad(glm::vec3(-1, 1, -1), glm::vec3(-1, 1, 1), glm::vec3(1, 1, 1), glm::vec3(1, 1, -1), white); // ceiling
+	scene.addQuad(glm::vec3(-1, -1, -1), glm::vec3(-1, 1, -1), glm::vec3(1, 1, -1), glm::vec3(1, -1, -1), white); // back
+	scene.addQuad(glm::vec3(-1, -1, -1), glm::vec3(-1, -1, 1), glm::vec3(-1, 1, 1), glm::vec3(-1, 1, -1), red); // left
+	scene.addQuad(glm::vec3(1, -1, -1), glm::vec3(1, 1, -1), glm::vec3(1, 1, 1), glm::vec3(1, -1, 1), green); // right
+
+	scene.addQuad(glm::vec3(-0.25f, 0.99f, -0.25f), glm::vec3(-0.25f, 0.99f, 0.25f), glm::vec3(0.25f, 0.99f, 0.25f), glm::vec3(0.25f, 0.99f, -0.25f), light);
+
+	scene.addBox(glm::vec3(0.33f, -0.7f, 0.3f), glm::vec3(0.3f, 0.3f, 0.3f), -0.3f, white);
+	scene.addBox(glm::vec3(-0.35f, -0.4f, -0.35f), glm::vec3(0.3f, 0.6f, 0.3f), 0.3f, white);
+
+	scene.camera.position = glm::vec3(0.0f, 0.0f, 3.4f);
+	scene.camera.forward = glm::vec3(0.0f, 0.0f, -1.0f);
+	scene.camera.up = glm::vec3(0.0f, 1.0f, 0.0f);
+	scene.camera.verticalFov = 0.7f;
+
+	scene.backgroundColor = glm::vec3(0.0f);
+
+	return scene;
+}
+
+Scene Scene::createInstanced(uint32_t instanceCount) {
+	Scene scene;
+
+	uint32_t ground = scene.addMaterial(glm::vec3(0.45f, 0.42f, 0.35f));
+	uint32_t stone = scene.addMaterial(glm::vec3(0.5f, 0.5f, 0.52f));
+	uint32_t bark = scene.addMaterial(glm::vec3(0.3f, 0.18f, 0.1f));
+	uint32_t leaves = scene.addMaterial(glm::vec3(0.15f, 0.4f, 0.12f));
+	uint32_t wood = scene.addMaterial(glm::vec3(0.6f, 0.45f, 0.25f));
+
+	// Instances stand on a square grid with three units between neighbours
+	uint32_t gridSize = std::max(1u, static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(instanceCount)))));
+	float spacing = 3.0f;
+	float halfSize = 0.5f * spacing * gridSize + spacing;
+
+	uint32_t first = static_cast<uint32_t>(scene.triangles.size());
+	scene.addQuad(glm::vec3(-1, 0, -1), glm::vec3(-1, 0, 1), glm::vec3(1, 0, 1), glm::vec3(1, 0, -1), ground);
+	uint32_t groundMesh = scene.addMesh(first);
+
+	first = static_cast<uint32_t>(scene.triangles.size());
+	scene.addSphere(glm::vec3(0.0f, 0.5f, 0.0f), 0.6f, 64, stone);
+	uint32_t rockMesh = scene.addMesh(first);
+
+	first = static_cast<uint32_t>(scene.triangles.size());
+	scene.addBox(glm::vec3(0.0f, 0.6f, 0.0f), glm::vec3(0.12f, 0.6f, 0.12f), 0.0f, bark);
+	scene.addSphere(glm::vec3(0.0f, 1.6f, 0.0f), 0.7f, 48, leaves);
+	uint32_t treeMesh = scene.addMesh(first);
+
+	first = static_cast<uint32_t>(scene.triangles.size());
+	scene.addBox(glm::vec3(0.0f, 0.4f, 0.0f), glm::vec3(0.4f), 0.0f, wood);
+	scene.addBox(glm::vec3(0.1f, 1.1f, 0.05f), glm::vec3(0.3f), 0.4f, wood);
+	scene.addBox(glm::vec3(-0.05f, 1.6f, 0.0f), glm::vec3(0.2f), -0.3f, wood);
+	uint32_t crateMesh = scene.addMesh(first);
+
+	scene.addInstance(makePlacement(glm::vec3(0.0f), 0.0f, glm::vec3(halfSize, 1.0f, halfSize)), groundMesh);
+
+	const uint32_t propMeshes[] = { rockMesh, treeMesh, crateMesh };
+
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	for (uint32_t i = 0; i < instanceCount; i++) {
+		float x = (static_cast<float>(i % gridSize) - 0.5f * (gridSize - 1)) * spacing + (unit(random) - 0.5f) * spacing * 0.5f;
+		float z = (static_cast<float>(i / gridSize) - 0.5f * (gridSize - 1)) * spacing + (unit(random) - 0.5f) * spacing * 0.5f;
+		float rotation = unit(random) * 6.2831853f;
+		float size = 0.7f + unit(random) * 0.8f;
+
+		// Rocks are squashed unevenly, so the instances cover non-uniform scales as well
+		uint32_t meshId = propMeshes[std::min(2u, static_cast<uint32_t>(unit(random) * 3.0f))];
+		glm::vec3 scale = meshId == rockMesh ? glm::vec3(size * (1.0f + unit(random)), size * 0.6f, size) : glm::vec3(size);
+
+		scene.addInstance(makePlacement(glm::vec3(x, 0.0f, z), rotation, scale), meshId);
+	}
+
+	// Looking across the field from one corner, lit by the sky only
+	scene.camera.position = glm::vec3(-0.5f * halfSize, 0.12f * halfSize + 3.0f, 0.5f * halfSize);
+	scene.camera.forward = glm::normalize(glm::vec3(0.7f, -0.25f, -0.7f));
+	scene.camera.up = glm::vec3(0.0f, 1.0f, 0.0f);
+	scene.camera.verticalFov = 0.7f;
+
+	scene.backgroundColor = glm::vec3(0.9f, 0.95f, 1.0f);
+
+	return scene;
+}
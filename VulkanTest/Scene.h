@@ -0,0 +1,80 @@
+#pragma once
+
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+
+#include <vector>
+#include <cstdint>
+
+// The layouts below are shared with the GPU tracer, so they must match the std430 structs in the shaders.
+struct Triangle {
+	glm::vec3 v0;
+	uint32_t materialId;
+	glm::vec3 v1;
+	float pad0;
+	glm::vec3 v2;
+	float pad1;
+};
+
+struct Material {
+	glm::vec3 albedo;
+	float pad0;
+	glm::vec3 emission;
+	float pad1;
+};
+
+struct Camera {
+	glm::vec3 position;
+	glm::vec3 forward;
+	glm::vec3 up;
+	float verticalFov;
+};
+
+// A range of triangles in its own space with its own bottom level BVH, placed in the world by instances
+struct Mesh {
+	uint32_t firstTriangle;
+	uint32_t triangleCount;
+	// First node of the mesh's BVH among all bottom level nodes, set when they are built
+	uint32_t rootNode;
+	uint32_t pad0;
+};
+
+struct MeshInstance {
+	glm::mat4 transform;
+	uint32_t meshId;
+	uint32_t pad0[3];
+};
+
+// Without instances the triangles are in world space and traced through a single BVH. With instances every
+// triangle belongs to a mesh and is only reached through the instances of that mesh.
+struct Scene {
+	std::vector<Triangle> triangles;
+	std::vector<Material> materials;
+	std::vector<Mesh> meshes;
+	std::vector<MeshInstance> instances;
+	Camera camera;
+	glm::vec3 backgroundColor;
+
+	bool isInstanced() const {
+		return !instances.empty();
+	}
+
+	uint32_t addMaterial(const glm::vec3& albedo, const glm::vec3& emission = glm::vec3(0.0f));
+	void addTriangle(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, uint32_t materialId);
+	void addQuad(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, const glm::vec3& v3, uint32_t materialId);
+	void addBox(const glm::vec3& center, const glm::vec3& halfExtent, float rotationY, uint32_t materialId);
+	void addSphere(const glm::vec3& center, float radius, uint32_t segments, uint32_t materialId);
+
+	// Makes the triangles added since firstTriangle a mesh
+	uint32_t addMesh(uint32_t firstTriangle);
+	void addInstance(const glm::mat4& transform, uint32_t meshId);
+
+	// Copies the triangles of every instance into world space, for tracers without instancing
+	Scene flatten() const;
+
+	// Cornell box used when no scene file is given
+	static Scene createDefault();
+
+	// Field of instanced rocks, trees and crates under a sky light, for measuring instancing
+	static Scene createInstanced(uint32_t instanceCount);
+};
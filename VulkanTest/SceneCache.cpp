@@ -0,0 +1,345 @@
+#include "SceneCache.h"
+#include "SceneImporter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+
+namespace {
+	size_t alignOffset(size_t offset, size_t alignment) {
+		return (offset + alignment - 1) / alignment * alignment;
+	}
+
+	// FNV-1a over 64 bit words, the tail byte by byte
+	uint64_t hashBlock(const uint8_t* data, size_t size) {
+		uint64_t hash = 14695981039346656037ull;
+		size_t i = 0;
+
+		for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+			uint64_t word;
+			std::memcpy(&word, data + i, sizeof(word));
+			hash ^= word;
+			hash *= 1099511628211ull;
+		}
+
+		for (; i < size; i++) {
+			hash ^= data[i];
+			hash *= 1099511628211ull;
+		}
+
+		return hash;
+	}
+
+	double millisecondsSince(std::chrono::high_resolution_clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+}
+
+void SceneCache::load(const std::string& scenePath, TaskScheduler& scheduler, bool rebuild) {
+	auto start = std::chrono::high_resolution_clock::now();
+
+	close();
+	stats = SceneLoadStats();
+
+	size_t extensionLength = std::strlen(Extension);
+	if (scenePath.size() > extensionLength && scenePath.compare(scenePath.size() - extensionLength, extensionLength, Extension) == 0) {
+		if (!open(scenePath)) {
+			throw std::runtime_error("Could not read scene cache " + scenePath);
+		}
+
+		stats.cacheHit = true;
+		stats.mapMilliseconds = millisecondsSince(start);
+		return;
+	}
+
+	std::string cachePath = scenePath + Extension;
+
+	if (!rebuild && open(cachePath)) {
+		std::vector<std::string> sources = getSources();
+		SourceStamp stamp = stampFiles(sources);
+
+		if (stamp.exists && stamp.bytes == header.sourceBytes) {
+			if (stamp.time == header.sourceTime) {
+				stats.cacheHit = true;
+				stats.mapMilliseconds = millisecondsSince(start);
+				return;
+			}
+
+			// Same contents with new times, for example after a checkout. The times are stored so that later runs
+			// skip the hash, which needs the mapping closed first on Windows.
+			if (hashFiles(sources, scheduler) == header.contentHash) {
+				close();
+
+				std::fstream stampFile(cachePath, std::ios::in | std::ios::out | std::ios::binary);
+				stampFile.seekp(offsetof(Header, sourceTime));
+				stampFile.write(reinterpret_cast<const char*>(&stamp.time), sizeof(stamp.time));
+				stampFile.close();
+
+				if (open(cachePath)) {
+					stats.cacheHit = true;
+					stats.mapMilliseconds = millisecondsSince(start);
+					return;
+				}
+			}
+		}
+
+		close();
+	}
+
+	// Scoped so the imported scene is released before the cache is mapped
+	{
+		SceneImporter importer(scheduler);
+		Scene scene = importer.import(scenePath);
+		stats.importMilliseconds = importer.getStats().milliseconds;
+
+		std::vector<BvhNode> nodes;
+
+		if (scene.isInstanced()) {
+			TwoLevelBvh twoLevelBvh;
+			twoLevelBvh.buildBottomLevels(scene.triangles, scene.meshes, scheduler);
+			nodes = twoLevelBvh.getBottomNodes();
+			stats.bvhMilliseconds = twoLevelBvh.getStats().bottomMilliseconds;
+		}
+		else {
+			Bvh bvh;
+			bvh.build(scene.triangles);
+			nodes = bvh.getNodes();
+			stats.bvhMilliseconds = bvh.getStats().buildMilliseconds;
+		}
+
+		auto writeStart = std::chrono::high_resolution_clock::now();
+		const std::vector<std::string>& sources = importer.getStats().sourceFiles;
+		write(cachePath, scene, nodes, sources, hashFiles(sources, scheduler));
+		stats.writeMilliseconds = millisecondsSince(writeStart);
+	}
+
+	auto mapStart = std::chrono::high_resolution_clock::now();
+
+	if (!open(cachePath)) {
+		throw std::runtime_error("Could not read scene cache " + cachePath);
+	}
+
+	stats.mapMilliseconds = millisecondsSince(mapStart);
+}
+
+void SceneCache::close() {
+	file.close();
+	header = {};
+}
+
+SceneData SceneCache::getData() const {
+	SceneData data;
+
+	if (!file.isOpen()) {
+		return data;
+	}
+
+	data.triangles = getSection<Triangle>(TriangleSection);
+	data.triangleCount = static_cast<uint32_t>(header.sections[TriangleSection].count);
+	data.materials = getSection<Material>(MaterialSection);
+	data.materialCount = static_cast<uint32_t>(header.sections[MaterialSection].count);
+	data.nodes = getSection<BvhNode>(NodeSection);
+	data.nodeCount = static_cast<uint32_t>(header.sections[NodeSection].count);
+	data.meshes = getSection<Mesh>(MeshSection);
+	data.meshCount = static_cast<uint32_t>(header.sections[MeshSection].count);
+	data.instances = getSection<MeshInstance>(InstanceSection);
+	data.instanceCount = static_cast<uint32_t>(header.sections[InstanceSection].count);
+
+	return data;
+}
+
+void SceneCache::copyTo(Scene& scene, Bvh& bvh) const {
+	SceneData data = getData();
+
+	scene.triangles.assign(data.triangles, data.triangles + data.triangleCount);
+	scene.materials.assign(data.materials, data.materials + data.materialCount);
+	scene.meshes.assign(data.meshes, data.meshes + data.meshCount);
+	scene.instances.assign(data.instances, data.instances + data.instanceCount);
+	scene.camera = header.camera;
+	scene.backgroundColor = header.backgroundColor;
+
+	bvh.assign(data.nodes, data.nodeCount);
+}
+
+uint64_t SceneCache::hashFiles(const std::vector<std::string>& paths, TaskScheduler& scheduler) {
+	uint64_t hash = 14695981039346656037ull;
+
+	for (const std::string& path : paths) {
+		MappedFile source;
+		source.open(path, "scene source");
+
+		uint32_t blockCount = static_cast<uint32_t>((source.size() + HashBlockSize - 1) / HashBlockSize);
+		std::vector<uint64_t> blockHashes(blockCount);
+
+		scheduler.parallelFor(blockCount, [&](uint32_t index, uint32_t) {
+			size_t offset = static_cast<size_t>(index) * HashBlockSize;
+			blockHashes[index] = hashBlock(source.data() + offset, std::min(HashBlockSize, source.size() - offset));
+		});
+
+		// Combined in order, so the result does not depend on the number of workers
+		for (uint64_t blockHash : blockHashes) {
+			hash ^= blockHash;
+			hash *= 1099511628211ull;
+		}
+	}
+
+	return hash;
+}
+
+SceneCache::SourceStamp SceneCache::stampFiles(const std::vector<std::string>& paths) {
+	SourceStamp stamp;
+
+	for (const std::string& path : paths) {
+		std::error_code error;
+		uintmax_t size = std::filesystem::file_size(path, error);
+		std::filesystem::file_time_type time = std::filesystem::last_write_time(path, error);
+
+		if (error) {
+			stamp.exists = false;
+			return stamp;
+		}
+
+		// Only ever compared for equality, so the clock's epoch does not matter
+		stamp.bytes += static_cast<uint64_t>(size);
+		stamp.time = std::max(stamp.time, static_cast<int64_t>(time.time_since_epoch().count()));
+	}
+
+	stamp.exists = !paths.empty();
+
+	return stamp;
+}
+
+void SceneCache::write(const std::string& path, const Scene& scene, const std::vector<BvhNode>& nodes, const std::vector<std::string>& sources, uint64_t contentHash) {
+	std::string sourceList;
+	for (const std::string& source : sources) {
+		sourceList += source;
+		sourceList += '\0';
+	}
+
+	SourceStamp stamp = stampFiles(sources);
+
+	Header fileHeader = {};
+	fileHeader.magic = Magic;
+	fileHeader.version = Version;
+	fileHeader.sourceBytes = stamp.bytes;
+	fileHeader.sourceTime = stamp.time;
+	fileHeader.contentHash = contentHash;
+	fileHeader.camera = scene.camera;
+	fileHeader.backgroundColor = scene.backgroundColor;
+	fileHeader.sectionCount = SectionCount;
+
+	const void* sectionData[SectionCount] = { scene.triangles.data(), scene.materials.data(), nodes.data(), scene.meshes.data(), scene.instances.data(), sourceList.data() };
+	uint32_t elementSizes[SectionCount] = { sizeof(Triangle), sizeof(Material), sizeof(BvhNode), sizeof(Mesh), sizeof(MeshInstance), 1 };
+	uint64_t counts[SectionCount] = { scene.triangles.size(), scene.materials.size(), nodes.size(), scene.meshes.size(), scene.instances.size(), sourceList.size() };
+
+	size_t offset = alignOffset(sizeof(Header), SectionAlignment);
+
+	for (uint32_t i = 0; i < SectionCount; i++) {
+		fileHeader.sections[i].type = i;
+		fileHeader.sections[i].elementSize = elementSizes[i];
+		fileHeader.sections[i].offset = offset;
+		fileHeader.sections[i].count = counts[i];
+
+		offset = alignOffset(offset + static_cast<size_t>(counts[i] * elementSizes[i]), SectionAlignment);
+	}
+
+	// Written next to the cache and renamed over it, so a cache is either complete or absent
+	std::string temporaryPath = path + ".tmp";
+
+	{
+		std::ofstream output(temporaryPath, std::ios::binary | std::ios::trunc);
+
+		if (!output) {
+			throw std::runtime_error("Could not create scene cache " + temporaryPath);
+		}
+
+		const char padding[SectionAlignment] = {};
+
+		output.write(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+
+		for (uint32_t i = 0; i < SectionCount; i++) {
+			size_t position = static_cast<size_t>(output.tellp());
+			output.write(padding, static_cast<std::streamsize>(fileHeader.sections[i].offset - position));
+			output.write(static_cast<const char*>(sectionData[i]), static_cast<std::streamsize>(counts[i] * elementSizes[i]));
+		}
+
+		if (!output) {
+			throw std::runtime_error("Could not write scene cache " + temporaryPath);
+		}
+	}
+
+	std::error_code error;
+	std::filesystem::rename(temporaryPath, path, error);
+
+	if (error) {
+		std::filesystem::remove(temporaryPath, error);
+		throw std::runtime_error("Could not replace scene cache " + path);
+	}
+}
+
+bool SceneCache::open(const std::string& path) {
+	try {
+		file.open(path, "scene cache");
+	}
+	catch (const std::exception&) {
+		return false;
+	}
+
+	if (file.size() < sizeof(Header)) {
+		close();
+		return false;
+	}
+
+	std::memcpy(&header, file.data(), sizeof(header));
+
+	if (header.magic != Magic || header.version != Version || header.sectionCount != SectionCount) {
+		close();
+		return false;
+	}
+
+	// The sections are trusted after this, like the table of contents of an asset pack. Node contents are
+	// not checked, which would mean touching every page of the file.
+	const uint32_t elementSizes[SectionCount] = { sizeof(Triangle), sizeof(Material), sizeof(BvhNode), sizeof(Mesh), sizeof(MeshInstance), 1 };
+
+	for (uint32_t i = 0; i < SectionCount; i++) {
+		const Section& section = header.sections[i];
+
+		bool valid = section.type == i && section.elementSize == elementSizes[i] && section.offset % SectionAlignment == 0 && section.offset <= file.size() &&
+			section.count <= (file.size() - section.offset) / section.elementSize;
+
+		// The tracer indexes triangles, materials and nodes with 32 bits
+		if (!valid || (i != SourceSection && section.count > UINT32_MAX)) {
+			close();
+			return false;
+		}
+	}
+
+	stats.cacheBytes = file.size();
+
+	return true;
+}
+
+std::vector<std::string> SceneCache::getSources() const {
+	std::vector<std::string> sources;
+
+	const char* current = getSection<char>(SourceSection);
+	const char* end = current + header.sections[SourceSection].count;
+
+	while (current < end) {
+		const char* terminator = static_cast<const char*>(std::memchr(current, '\0', static_cast<size_t>(end - current)));
+
+		if (terminator == nullptr) {
+			terminator = end;
+		}
+
+		sources.emplace_back(current, terminator);
+		current = terminator + 1;
+	}
+
+	return sources;
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "Bvh.h"
+#include "MappedFile.h"
+#include "Scene.h"
+#include "TaskScheduler.h"
+#include "TwoLevelBvh.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The arrays the tracer uploads, pointing either into a Scene and Bvh or into a mapped cache
+struct SceneData {
+	const Triangle* triangles = nullptr;
+	uint32_t triangleCount = 0;
+	const Material* materials = nullptr;
+	uint32_t materialCount = 0;
+	// The bottom levels of all meshes when the scene has instances
+	const BvhNode* nodes = nullptr;
+	uint32_t nodeCount = 0;
+	const Mesh* meshes = nullptr;
+	uint32_t meshCount = 0;
+	const MeshInstance* instances = nullptr;
+	uint32_t instanceCount = 0;
+};
+
+struct SceneLoadStats {
+	bool cacheHit = false;
+	uint64_t cacheBytes = 0;
+	double importMilliseconds = 0.0;
+	double bvhMilliseconds = 0.0;
+	double writeMilliseconds = 0.0;
+	// Opening and validating the cache, which does not touch the sections
+	double mapMilliseconds = 0.0;
+};
+
+// Binary scene cache written after importing an OBJ or glTF scene, so later runs skip the text parsing and the
+// BVH build. The file holds everything in the layouts the tracer uploads, so it is memory-mapped and the
+// sections are handed to the staging uploader as they are:
+//
+//   Header   { uint32 magic, uint32 version, uint64 sourceBytes, int64 sourceTime, uint64 contentHash,
+//              Camera camera, vec3 backgroundColor, uint32 sectionCount, Section sections[SectionCount] }
+//   Section  { uint32 type, uint32 elementSize, uint64 offset, uint64 count }
+//   Data     each section aligned to SectionAlignment
+//
+// Triangles are stored in the leaf order of the BVH in the Nodes section. A Triangle carries its three
+// vertices inline, so the triangle section is the vertex data and there is no separate index buffer to
+// expand on load. Scenes with instances store the bottom levels of a TwoLevelBvh in the Nodes section, with
+// the meshes' root nodes set, and leave the top level to be built on load. Sources lists the files the scene
+// was imported from, separated by '\0'.
+//
+// A cache is current when the total size and latest modification time of its sources match the header. When
+// only the times differ, for example after a checkout, the sources are hashed and compared to contentHash.
+// Version must be bumped whenever Triangle, Material, BvhNode, Mesh, MeshInstance or the BVH builder change.
+class SceneCache {
+public:
+	SceneCache() = default;
+	SceneCache(const SceneCache&) = delete;
+	SceneCache& operator=(const SceneCache&) = delete;
+
+	// Opens the cache of scenePath, importing the scene and writing the cache first when there is none or it
+	// is out of date. A path ending in Extension is opened as a cache on its own, without any checks against
+	// its sources. Throws if the scene cannot be imported or the cache cannot be written.
+	void load(const std::string& scenePath, TaskScheduler& scheduler, bool rebuild = false);
+	void close();
+
+	// Pointers stay valid until close
+	SceneData getData() const;
+
+	const Camera& getCamera() const {
+		return header.camera;
+	}
+
+	const glm::vec3& getBackgroundColor() const {
+		return header.backgroundColor;
+	}
+
+	const SceneLoadStats& getStats() const {
+		return stats;
+	}
+
+	// Copies the sections into a Scene and a Bvh, for consumers that need them in memory
+	void copyTo(Scene& scene, Bvh& bvh) const;
+
+	// Hash of the files' contents, computed over blocks of HashBlockSize in parallel
+	static uint64_t hashFiles(const std::vector<std::string>& paths, TaskScheduler& scheduler);
+
+	static constexpr uint32_t Magic = 0x43535456; // "VTSC"
+	static constexpr uint32_t Version = 2;
+	static constexpr size_t SectionAlignment = 64;
+	static constexpr size_t HashBlockSize = 1u << 20;
+	static constexpr const char* Extension = ".vtscene";
+
+private:
+	enum SectionType : uint32_t {
+		TriangleSection,
+		MaterialSection,
+		NodeSection,
+		MeshSection,
+		InstanceSection,
+		SourceSection,
+		SectionCount
+	};
+
+	struct Section {
+		uint32_t type;
+		uint32_t elementSize;
+		uint64_t offset;
+		uint64_t count;
+	};
+
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t sourceBytes;
+		int64_t sourceTime;
+		uint64_t contentHash;
+		Camera camera;
+		glm::vec3 backgroundColor;
+		uint32_t sectionCount;
+		Section sections[SectionCount];
+	};
+
+	struct SourceStamp {
+		uint64_t bytes = 0;
+		int64_t time = 0;
+		bool exists = true;
+	};
+
+	static SourceStamp stampFiles(const std::vector<std::string>& paths);
+	static void write(const std::string& path, const Scene& scene, const std::vector<BvhNode>& nodes, const std::vector<std::string>& sources, uint64_t contentHash);
+
+	// Maps path and checks its header and section table, leaving the cache closed if anything is off
+	bool open(const std::string& path);
+	std::vector<std::string> getSources() const;
+
+	template<typename T>
+	const T* getSection(SectionType type) const {
+		return reinterpret_cast<const T*>(file.data() + header.sections[type].offset);
+	}
+
+	MappedFile file;
+	Header header = {};
+	SceneLoadStats stats;
+};
@@ -0,0 +1,1285 @@
+#include "SceneImporter.h"
+#include "MappedFile.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+namespace {
+	std::string getExtension(const std::string& path) {
+		size_t dot = path.find_last_of('.');
+		size_t separator = path.find_last_of("/\\");
+
+		if (dot == std::string::npos || (separator != std::string::npos && dot < separator)) {
+			return "";
+		}
+
+		std::string extension = path.substr(dot + 1);
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+		return extension;
+	}
+
+	// Relative references inside a scene file are relative to the file itself
+	std::string resolvePath(const std::string& scenePath, const std::string& reference) {
+		if (reference.empty() || reference[0] == '/' || reference[0] == '\\' || reference.find(':') != std::string::npos) {
+			return reference;
+		}
+
+		size_t separator = scenePath.find_last_of("/\\");
+
+		return separator == std::string::npos ? reference : scenePath.substr(0, separator + 1) + reference;
+	}
+
+	// Line and token helpers shared by the OBJ and MTL parsers. Lines never include their terminator.
+	const char* skipSpace(const char* current, const char* end) {
+		while (current < end && (*current == ' ' || *current == '\t')) {
+			current++;
+		}
+
+		return current;
+	}
+
+	const char* trimEnd(const char* begin, const char* end) {
+		while (end > begin && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) {
+			end--;
+		}
+
+		return end;
+	}
+
+	// Returns the text after keyword when the line starts with it as a whole word, otherwise nullptr
+	const char* matchKeyword(const char* line, const char* end, const char* keyword) {
+		size_t length = std::strlen(keyword);
+
+		if (static_cast<size_t>(end - line) < length || std::memcmp(line, keyword, length) != 0) {
+			return nullptr;
+		}
+
+		const char* rest = line + length;
+
+		if (rest < end && *rest != ' ' && *rest != '\t') {
+			return nullptr;
+		}
+
+		return skipSpace(rest, end);
+	}
+
+	template<typename Function>
+	void forEachLine(const char* begin, const char* end, Function function) {
+		while (begin < end) {
+			const char* lineEnd = static_cast<const char*>(std::memchr(begin, '\n', static_cast<size_t>(end - begin)));
+			const char* next = lineEnd != nullptr ? lineEnd + 1 : end;
+
+			if (lineEnd == nullptr) {
+				lineEnd = end;
+			}
+
+			const char* line = skipSpace(begin, lineEnd);
+			function(line, trimEnd(line, lineEnd));
+
+			begin = next;
+		}
+	}
+
+	bool parseFloat(const char*& current, const char* end, float& value) {
+		current = skipSpace(current, end);
+
+		// from_chars takes a minus sign but not a plus
+		if (current < end && *current == '+') {
+			current++;
+		}
+
+		std::from_chars_result result = std::from_chars(current, end, value);
+		current = result.ptr;
+
+		return result.ec == std::errc();
+	}
+
+	bool parseVec3(const char* current, const char* end, glm::vec3& value) {
+		return parseFloat(current, end, value.x) && parseFloat(current, end, value.y) && parseFloat(current, end, value.z);
+	}
+
+	struct ObjChunk {
+		const char* begin = nullptr;
+		const char* end = nullptr;
+
+		// First pass
+		uint64_t positionCount = 0;
+		bool setsMaterial = false;
+		std::string lastMaterial;
+		std::vector<std::string> libraries;
+
+		// Between the passes: the index of the chunk's first position and the material active at its start
+		uint64_t firstPosition = 0;
+		uint32_t initialMaterial = 0;
+
+		// Second pass, three position indices and a material per triangle
+		std::vector<uint32_t> corners;
+		std::vector<uint32_t> materials;
+		size_t firstTriangle = 0;
+	};
+
+	void loadMaterialLibrary(const std::string& path, Scene& scene, std::unordered_map<std::string, uint32_t>& materialIds, SceneImportStats& stats) {
+		MappedFile file;
+		file.open(path, "material library");
+
+		stats.sourceFiles.push_back(path);
+		stats.sourceBytes += file.size();
+
+		const char* begin = reinterpret_cast<const char*>(file.data());
+		Material* current = nullptr;
+
+		forEachLine(begin, begin + file.size(), [&](const char* line, const char* end) {
+			const char* rest;
+
+			if ((rest = matchKeyword(line, end, "newmtl")) != nullptr) {
+				std::string name(rest, end);
+
+				// The first definition of a name wins, as later libraries usually only repeat shared materials
+				if (materialIds.count(name) == 0) {
+					materialIds[name] = scene.addMaterial(glm::vec3(0.73f));
+					current = &scene.materials.back();
+				}
+				else {
+					current = nullptr;
+				}
+			}
+			else if (current != nullptr && (rest = matchKeyword(line, end, "Kd")) != nullptr) {
+				if (!parseVec3(rest, end, current->albedo)) {
+					throw std::runtime_error("Could not parse Kd in " + path);
+				}
+			}
+			else if (current != nullptr && (rest = matchKeyword(line, end, "Ke")) != nullptr) {
+				if (!parseVec3(rest, end, current->emission)) {
+					throw std::runtime_error("Could not parse Ke in " + path);
+				}
+			}
+		});
+	}
+
+	// Minimal JSON reader for glTF documents. Objects keep their members in order, which is fine for the
+	// handful of keys glTF looks up per object.
+	struct JsonValue {
+		enum class Type {
+			Null,
+			Boolean,
+			Number,
+			String,
+			Array,
+			Object
+		};
+
+		Type type = Type::Null;
+		bool boolean = false;
+		double number = 0.0;
+		std::string string;
+		std::vector<JsonValue> elements;
+		std::vector<std::pair<std::string, JsonValue>> members;
+
+		const JsonValue* find(const char* key) const {
+			for (const auto& member : members) {
+				if (member.first == key) {
+					return &member.second;
+				}
+			}
+
+			return nullptr;
+		}
+
+		double getNumber(const char* key, double fallback) const {
+			const JsonValue* value = find(key);
+			return value != nullptr && value->type == Type::Number ? value->number : fallback;
+		}
+
+		// Array elements of key, empty if it is missing
+		const std::vector<JsonValue>& getArray(const char* key) const {
+			static const std::vector<JsonValue> empty;
+
+			const JsonValue* value = find(key);
+			return value != nullptr && value->type == Type::Array ? value->elements : empty;
+		}
+	};
+
+	class JsonParser {
+	public:
+		JsonParser(const char* begin, const char* end) : current(begin), end(end) { }
+
+		JsonValue parseDocument() {
+			JsonValue value = parseValue(0);
+
+			skipWhitespace();
+			if (current != end) {
+				fail("trailing data");
+			}
+
+			return value;
+		}
+
+	private:
+		static constexpr int MaxDepth = 256;
+
+		[[noreturn]] void fail(const char* reason) const {
+			throw std::runtime_error(std::string("Could not parse glTF JSON: ") + reason);
+		}
+
+		void skipWhitespace() {
+			while (current < end && (*current == ' ' || *current == '\t' || *current == '\n' || *current == '\r')) {
+				current++;
+			}
+		}
+
+		void expect(char c) {
+			skipWhitespace();
+
+			if (current >= end || *current != c) {
+				fail("unexpected character");
+			}
+
+			current++;
+		}
+
+		bool consumeLiteral(const char* literal) {
+			size_t length = std::strlen(literal);
+
+			if (static_cast<size_t>(end - current) >= length && std::memcmp(current, literal, length) == 0) {
+				current += length;
+				return true;
+			}
+
+			return false;
+		}
+
+		static void appendUtf8(std::string& text, uint32_t codePoint) {
+			if (codePoint < 0x80) {
+				text += static_cast<char>(codePoint);
+			}
+			else if (codePoint < 0x800) {
+				text += static_cast<char>(0xC0 | (codePoint >> 6));
+				text += static_cast<char>(0x80 | (codePoint & 0x3F));
+			}
+			else if (codePoint < 0x10000) {
+				text += static_cast<char>(0xE0 | (codePoint >> 12));
+				text += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+				text += static_cast<char>(0x80 | (codePoint & 0x3F));
+			}
+			else {
+				text += static_cast<char>(0xF0 | (codePoint >> 18));
+				text += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+				text += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+				text += static_cast<char>(0x80 | (codePoint & 0x3F));
+			}
+		}
+
+		uint32_t parseHex4() {
+			if (end - current < 4) {
+				fail("truncated escape");
+			}
+
+			uint32_t value = 0;
+			std::from_chars_result result = std::from_chars(current, current + 4, value, 16);
+
+			if (result.ec != std::errc() || result.ptr != current + 4) {
+				fail("invalid escape");
+			}
+
+			current += 4;
+			return value;
+		}
+
+		std::string parseString() {
+			expect('"');
+
+			std::string text;
+
+			while (true) {
+				if (current >= end) {
+					fail("unterminated string");
+				}
+
+				char c = *current++;
+
+				if (c == '"') {
+					return text;
+				}
+
+				if (c != '\\') {
+					text += c;
+					continue;
+				}
+
+				if (current >= end) {
+					fail("unterminated string");
+				}
+
+				switch (*current++) {
+				case '"': text += '"'; break;
+				case '\\': text += '\\'; break;
+				case '/': text += '/'; break;
+				case 'b': text += '\b'; break;
+				case 'f': text += '\f'; break;
+				case 'n': text += '\n'; break;
+				case 'r': text += '\r'; break;
+				case 't': text += '\t'; break;
+				case 'u': {
+					uint32_t codePoint = parseHex4();
+
+					// Characters outside the basic plane come as a surrogate pair
+					if (codePoint >= 0xD800 && codePoint < 0xDC00 && consumeLiteral("\\u")) {
+						uint32_t low = parseHex4();
+						codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+					}
+
+					appendUtf8(text, codePoint);
+					break;
+				}
+				default:
+					fail("invalid escape");
+				}
+			}
+		}
+
+		JsonValue parseValue(int depth) {
+			if (depth > MaxDepth) {
+				fail("nested too deeply");
+			}
+
+			skipWhitespace();
+
+			if (current >= end) {
+				fail("unexpected end");
+			}
+
+			JsonValue value;
+
+			if (*current == '{') {
+				value.type = JsonValue::Type::Object;
+				current++;
+				skipWhitespace();
+
+				if (current < end && *current == '}') {
+					current++;
+					return value;
+				}
+
+				while (true) {
+					std::string key = parseString();
+					expect(':');
+					value.members.emplace_back(std::move(key), parseValue(depth + 1));
+
+					skipWhitespace();
+					if (current < end && *current == ',') {
+						current++;
+						continue;
+					}
+
+					expect('}');
+					return value;
+				}
+			}
+
+			if (*current == '[') {
+				value.type = JsonValue::Type::Array;
+				current++;
+				skipWhitespace();
+
+				if (current < end && *current == ']') {
+					current++;
+					return value;
+				}
+
+				while (true) {
+					value.elements.push_back(parseValue(depth + 1));
+
+					skipWhitespace();
+					if (current < end && *current == ',') {
+						current++;
+						continue;
+					}
+
+					expect(']');
+					return value;
+				}
+			}
+
+			if (*current == '"') {
+				value.type = JsonValue::Type::String;
+				value.string = parseString();
+				return value;
+			}
+
+			if (consumeLiteral("true")) {
+				value.type = JsonValue::Type::Boolean;
+				value.boolean = true;
+				return value;
+			}
+
+			if (consumeLiteral("false")) {
+				value.type = JsonValue::Type::Boolean;
+				return value;
+			}
+
+			if (consumeLiteral("null")) {
+				return value;
+			}
+
+			std::from_chars_result result = std::from_chars(current, end, value.number);
+
+			if (result.ec != std::errc()) {
+				fail("invalid value");
+			}
+
+			value.type = JsonValue::Type::Number;
+			current = result.ptr;
+
+			return value;
+		}
+
+		const char* current;
+		const char* end;
+	};
+
+	std::vector<uint8_t> decodeBase64(const char* begin, const char* end) {
+		std::vector<uint8_t> bytes;
+		bytes.reserve(static_cast<size_t>(end - begin) / 4 * 3);
+
+		uint32_t bits = 0;
+		int bitCount = 0;
+
+		for (const char* current = begin; current < end && *current != '='; current++) {
+			char c = *current;
+			uint32_t digit;
+
+			if (c >= 'A' && c <= 'Z') {
+				digit = static_cast<uint32_t>(c - 'A');
+			}
+			else if (c >= 'a' && c <= 'z') {
+				digit = static_cast<uint32_t>(c - 'a') + 26;
+			}
+			else if (c >= '0' && c <= '9') {
+				digit = static_cast<uint32_t>(c - '0') + 52;
+			}
+			else if (c == '+') {
+				digit = 62;
+			}
+			else if (c == '/') {
+				digit = 63;
+			}
+			else {
+				throw std::runtime_error("Could not decode glTF data URI");
+			}
+
+			bits = (bits << 6) | digit;
+			bitCount += 6;
+
+			if (bitCount >= 8) {
+				bitCount -= 8;
+				bytes.push_back(static_cast<uint8_t>(bits >> bitCount));
+			}
+		}
+
+		return bytes;
+	}
+
+	struct GltfBuffer {
+		const uint8_t* data = nullptr;
+		size_t size = 0;
+	};
+
+	// A validated accessor, ready to be read from any thread
+	struct GltfAccessor {
+		const uint8_t* data = nullptr;
+		size_t stride = 0;
+		uint32_t count = 0;
+		uint32_t componentType = 0;
+	};
+
+	constexpr uint32_t GltfUnsignedByte = 5121;
+	constexpr uint32_t GltfUnsignedShort = 5123;
+	constexpr uint32_t GltfUnsignedInt = 5125;
+	constexpr uint32_t GltfFloat = 5126;
+	constexpr uint32_t GltfTriangles = 4;
+
+	constexpr uint32_t GlbMagic = 0x46546C67; // "glTF"
+	constexpr uint32_t GlbJsonChunk = 0x4E4F534A;
+	constexpr uint32_t GlbBinaryChunk = 0x004E4942;
+
+	size_t getComponentSize(uint32_t componentType) {
+		switch (componentType) {
+		case 5120:
+		case GltfUnsignedByte:
+			return 1;
+		case 5122:
+		case GltfUnsignedShort:
+			return 2;
+		case GltfUnsignedInt:
+		case GltfFloat:
+			return 4;
+		default:
+			return 0;
+		}
+	}
+
+	GltfAccessor getAccessor(const JsonValue& document, const std::vector<GltfBuffer>& buffers, size_t index, const char* expectedType) {
+		const std::vector<JsonValue>& accessors = document.getArray("accessors");
+		const std::vector<JsonValue>& bufferViews = document.getArray("bufferViews");
+		std::string name = "glTF accessor " + std::to_string(index);
+
+		if (index >= accessors.size()) {
+			throw std::runtime_error(name + " does not exist");
+		}
+
+		const JsonValue& accessor = accessors[index];
+		const JsonValue* type = accessor.find("type");
+
+		if (type == nullptr || type->string != expectedType) {
+			throw std::runtime_error(name + " is not a " + expectedType);
+		}
+
+		if (accessor.find("sparse") != nullptr || accessor.find("bufferView") == nullptr) {
+			throw std::runtime_error(name + " is sparse, which is not supported");
+		}
+
+		GltfAccessor result;
+		result.componentType = static_cast<uint32_t>(accessor.getNumber("componentType", 0));
+		result.count = static_cast<uint32_t>(accessor.getNumber("count", 0));
+
+		size_t componentCount = std::strcmp(expectedType, "VEC3") == 0 ? 3 : 1;
+		size_t elementSize = getComponentSize(result.componentType) * componentCount;
+
+		size_t viewIndex = static_cast<size_t>(accessor.getNumber("bufferView", 0));
+		if (viewIndex >= bufferViews.size()) {
+			throw std::runtime_error(name + " references a missing buffer view");
+		}
+
+		const JsonValue& view = bufferViews[viewIndex];
+		size_t bufferIndex = static_cast<size_t>(view.getNumber("buffer", 0));
+		size_t viewOffset = static_cast<size_t>(view.getNumber("byteOffset", 0));
+		size_t viewLength = static_cast<size_t>(view.getNumber("byteLength", 0));
+		size_t accessorOffset = static_cast<size_t>(accessor.getNumber("byteOffset", 0));
+		result.stride = static_cast<size_t>(view.getNumber("byteStride", 0));
+
+		if (result.stride == 0) {
+			result.stride = elementSize;
+		}
+
+		if (elementSize == 0 || bufferIndex >= buffers.size() || viewOffset > buffers[bufferIndex].size || viewLength > buffers[bufferIndex].size - viewOffset) {
+			throw std::runtime_error(name + " is out of range");
+		}
+
+		if (result.count > 0 && (accessorOffset > viewLength || (result.count - 1) * static_cast<uint64_t>(result.stride) + elementSize > viewLength - accessorOffset)) {
+			throw std::runtime_error(name + " is out of range");
+		}
+
+		result.data = buffers[bufferIndex].data + viewOffset + accessorOffset;
+
+		return result;
+	}
+
+	glm::mat4 getNodeTransform(const JsonValue& node) {
+		const std::vector<JsonValue>& matrix = node.getArray("matrix");
+
+		if (matrix.size() == 16) {
+			glm::mat4 result;
+
+			// Column major, like glm
+			for (int i = 0; i < 16; i++) {
+				result[i / 4][i % 4] = static_cast<float>(matrix[i].number);
+			}
+
+			return result;
+		}
+
+		glm::vec3 translation(0.0f);
+		glm::vec4 rotation(0.0f, 0.0f, 0.0f, 1.0f);
+		glm::vec3 scale(1.0f);
+
+		const std::vector<JsonValue>& t = node.getArray("translation");
+		const std::vector<JsonValue>& r = node.getArray("rotation");
+		const std::vector<JsonValue>& s = node.getArray("scale");
+
+		if (t.size() == 3) {
+			translation = glm::vec3(t[0].number, t[1].number, t[2].number);
+		}
+
+		// A unit quaternion stored as x, y, z, w
+		if (r.size() == 4) {
+			rotation = glm::vec4(r[0].number, r[1].number, r[2].number, r[3].number);
+		}
+
+		if (s.size() == 3) {
+			scale = glm::vec3(s[0].number, s[1].number, s[2].number);
+		}
+
+		float x = rotation.x, y = rotation.y, z = rotation.z, w = rotation.w;
+
+		glm::mat4 result(1.0f);
+		result[0] = glm::vec4(1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y + z * w), 2.0f * (x * z - y * w), 0.0f) * scale.x;
+		result[1] = glm::vec4(2.0f * (x * y - z * w), 1.0f - 2.0f * (x * x + z * z), 2.0f * (y * z + x * w), 0.0f) * scale.y;
+		result[2] = glm::vec4(2.0f * (x * z + y * w), 2.0f * (y * z - x * w), 1.0f - 2.0f * (x * x + y * y), 0.0f) * scale.z;
+		result[3] = glm::vec4(translation, 1.0f);
+
+		return result;
+	}
+
+	// One triangle list primitive placed in the scene by a node
+	struct GltfDraw {
+		GltfAccessor positions;
+		GltfAccessor indices;
+		bool indexed = false;
+		glm::mat4 transform;
+		uint32_t materialId = 0;
+		uint32_t triangleCount = 0;
+		size_t firstTriangle = 0;
+	};
+
+	struct GltfRange {
+		uint32_t draw;
+		uint32_t firstTriangle;
+		uint32_t triangleCount;
+	};
+
+	uint32_t readIndex(const GltfAccessor& accessor, uint32_t index) {
+		const uint8_t* element = accessor.data + index * accessor.stride;
+
+		if (accessor.componentType == GltfUnsignedByte) {
+			return *element;
+		}
+
+		if (accessor.componentType == GltfUnsignedShort) {
+			uint16_t value;
+			std::memcpy(&value, element, sizeof(value));
+			return value;
+		}
+
+		uint32_t value;
+		std::memcpy(&value, element, sizeof(value));
+		return value;
+	}
+}
+
+bool SceneImporter::isSupported(const std::string& path) {
+	std::string extension = getExtension(path);
+	return extension == "obj" || extension == "gltf" || extension == "glb";
+}
+
+Scene SceneImporter::import(const std::string& path) {
+	auto start = std::chrono::high_resolution_clock::now();
+
+	stats = SceneImportStats();
+
+	std::string extension = getExtension(path);
+	Scene scene;
+
+	if (extension == "obj") {
+		scene = importObj(path);
+	}
+	else if (extension == "gltf" || extension == "glb") {
+		scene = importGltf(path);
+	}
+	else {
+		throw std::runtime_error("Could not import " + path + ", only OBJ and glTF scenes are supported");
+	}
+
+	placeCamera(scene);
+
+	stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	return scene;
+}
+
+Scene SceneImporter::importObj(const std::string& path) {
+	MappedFile file;
+	file.open(path, "scene");
+
+	stats.sourceFiles.push_back(path);
+	stats.sourceBytes += file.size();
+
+	const char* begin = reinterpret_cast<const char*>(file.data());
+	const char* end = begin + file.size();
+
+	// Every chunk but the first starts after the line break closest past a multiple of ObjChunkSize
+	std::vector<ObjChunk> chunks;
+	const char* chunkBegin = begin;
+
+	while (chunkBegin < end) {
+		const char* chunkEnd = end;
+
+		if (static_cast<size_t>(end - chunkBegin) > ObjChunkSize) {
+			const char* lineBreak = static_cast<const char*>(std::memchr(chunkBegin + ObjChunkSize, '\n', static_cast<size_t>(end - chunkBegin - ObjChunkSize)));
+			chunkEnd = lineBreak != nullptr ? lineBreak + 1 : end;
+		}
+
+		ObjChunk chunk;
+		chunk.begin = chunkBegin;
+		chunk.end = chunkEnd;
+		chunks.push_back(std::move(chunk));
+
+		chunkBegin = chunkEnd;
+	}
+
+	stats.chunkCount = static_cast<uint32_t>(chunks.size());
+
+	scheduler.parallelFor(static_cast<uint32_t>(chunks.size()), [&](uint32_t index, uint32_t) {
+		ObjChunk& chunk = chunks[index];
+
+		forEachLine(chunk.begin, chunk.end, [&](const char* line, const char* lineEnd) {
+			const char* rest;
+
+			if (matchKeyword(line, lineEnd, "v") != nullptr) {
+				chunk.positionCount++;
+			}
+			else if ((rest = matchKeyword(line, lineEnd, "usemtl")) != nullptr) {
+				chunk.setsMaterial = true;
+				chunk.lastMaterial.assign(rest, lineEnd);
+			}
+			else if ((rest = matchKeyword(line, lineEnd, "mtllib")) != nullptr) {
+				while (rest < lineEnd) {
+					const char* nameEnd = rest;
+					while (nameEnd < lineEnd && *nameEnd != ' ' && *nameEnd != '\t') {
+						nameEnd++;
+					}
+
+					chunk.libraries.emplace_back(rest, nameEnd);
+					rest = skipSpace(nameEnd, lineEnd);
+				}
+			}
+		});
+	});
+
+	// Materials are few, so the libraries are read on this thread in the order they are referenced
+	Scene scene;
+	std::unordered_map<std::string, uint32_t> materialIds;
+
+	for (const ObjChunk& chunk : chunks) {
+		for (const std::string& library : chunk.libraries) {
+			std::string libraryPath = resolvePath(path, library);
+
+			if (std::find(stats.sourceFiles.begin(), stats.sourceFiles.end(), libraryPath) == stats.sourceFiles.end()) {
+				loadMaterialLibrary(libraryPath, scene, materialIds, stats);
+			}
+		}
+	}
+
+	// Faces before any usemtl, or naming a material no library defines, use a grey default
+	uint32_t defaultMaterial = scene.addMaterial(glm::vec3(0.73f));
+
+	uint64_t positionCount = 0;
+	uint32_t material = defaultMaterial;
+
+	for (ObjChunk& chunk : chunks) {
+		chunk.firstPosition = positionCount;
+		chunk.initialMaterial = material;
+		positionCount += chunk.positionCount;
+
+		if (chunk.setsMaterial) {
+			auto found = materialIds.find(chunk.lastMaterial);
+			material = found != materialIds.end() ? found->second : defaultMaterial;
+		}
+	}
+
+	if (positionCount > std::numeric_limits<uint32_t>::max()) {
+		throw std::runtime_error("Could not import " + path + ", it has more than 2^32 vertices");
+	}
+
+	std::vector<glm::vec3> positions(static_cast<size_t>(positionCount));
+
+	scheduler.parallelFor(static_cast<uint32_t>(chunks.size()), [&](uint32_t index, uint32_t) {
+		ObjChunk& chunk = chunks[index];
+		uint64_t nextPosition = chunk.firstPosition;
+		uint32_t currentMaterial = chunk.initialMaterial;
+		std::vector<uint32_t> polygon;
+
+		// Roughly one triangle for every 40 bytes of a typical file
+		chunk.corners.reserve(static_cast<size_t>(chunk.end - chunk.begin) / 40 * 3);
+		chunk.materials.reserve(static_cast<size_t>(chunk.end - chunk.begin) / 40);
+
+		forEachLine(chunk.begin, chunk.end, [&](const char* line, const char* lineEnd) {
+			const char* rest;
+
+			if ((rest = matchKeyword(line, lineEnd, "v")) != nullptr) {
+				if (!parseVec3(rest, lineEnd, positions[static_cast<size_t>(nextPosition)])) {
+					throw std::runtime_error("Could not parse vertex " + std::to_string(nextPosition + 1) + " in " + path);
+				}
+
+				nextPosition++;
+			}
+			else if ((rest = matchKeyword(line, lineEnd, "f")) != nullptr) {
+				polygon.clear();
+
+				while (rest < lineEnd) {
+					// Only the position of v, v/vt, v//vn and v/vt/vn is used
+					int64_t value = 0;
+					std::from_chars_result result = std::from_chars(rest, lineEnd, value);
+
+					// Negative indices count back from the last position defined before the face
+					int64_t resolved = value > 0 ? value - 1 : static_cast<int64_t>(nextPosition) + value;
+
+					if (result.ec != std::errc() || value == 0 || resolved < 0 || resolved >= static_cast<int64_t>(positionCount)) {
+						throw std::runtime_error("Could not parse a face after vertex " + std::to_string(nextPosition) + " in " + path);
+					}
+
+					polygon.push_back(static_cast<uint32_t>(resolved));
+
+					rest = result.ptr;
+					while (rest < lineEnd && *rest != ' ' && *rest != '\t') {
+						rest++;
+					}
+					rest = skipSpace(rest, lineEnd);
+				}
+
+				for (size_t i = 2; i < polygon.size(); i++) {
+					chunk.corners.push_back(polygon[0]);
+					chunk.corners.push_back(polygon[i - 1]);
+					chunk.corners.push_back(polygon[i]);
+					chunk.materials.push_back(currentMaterial);
+				}
+			}
+			else if ((rest = matchKeyword(line, lineEnd, "usemtl")) != nullptr) {
+				auto found = materialIds.find(std::string(rest, lineEnd));
+				currentMaterial = found != materialIds.end() ? found->second : defaultMaterial;
+			}
+		});
+	});
+
+	size_t triangleCount = 0;
+	for (ObjChunk& chunk : chunks) {
+		chunk.firstTriangle = triangleCount;
+		triangleCount += chunk.materials.size();
+	}
+
+	if (triangleCount > std::numeric_limits<uint32_t>::max()) {
+		throw std::runtime_error("Could not import " + path + ", it has more than 2^32 triangles");
+	}
+
+	scene.triangles.resize(triangleCount);
+
+	scheduler.parallelFor(static_cast<uint32_t>(chunks.size()), [&](uint32_t index, uint32_t) {
+		ObjChunk& chunk = chunks[index];
+
+		for (size_t i = 0; i < chunk.materials.size(); i++) {
+			Triangle& triangle = scene.triangles[chunk.firstTriangle + i];
+			triangle = {};
+			triangle.v0 = positions[chunk.corners[i * 3 + 0]];
+			triangle.v1 = positions[chunk.corners[i * 3 + 1]];
+			triangle.v2 = positions[chunk.corners[i * 3 + 2]];
+			triangle.materialId = chunk.materials[i];
+		}
+
+		// Released as soon as the chunk is done, the corners take more memory than the triangles
+		chunk.corners = std::vector<uint32_t>();
+		chunk.materials = std::vector<uint32_t>();
+	});
+
+	return scene;
+}
+
+Scene SceneImporter::importGltf(const std::string& path) {
+	MappedFile file;
+	file.open(path, "scene");
+
+	stats.sourceFiles.push_back(path);
+	stats.sourceBytes += file.size();
+
+	const char* json = reinterpret_cast<const char*>(file.data());
+	size_t jsonSize = file.size();
+	GltfBuffer binaryChunk;
+
+	// A .glb is a header and a JSON chunk, usually followed by the binary chunk of the first buffer
+	uint32_t magic = 0;
+	if (file.size() >= sizeof(magic)) {
+		std::memcpy(&magic, file.data(), sizeof(magic));
+	}
+
+	if (magic == GlbMagic) {
+		size_t offset = 12;
+		bool foundJson = false;
+
+		while (offset + 8 <= file.size()) {
+			uint32_t chunkHeader[2];
+			std::memcpy(chunkHeader, file.data() + offset, sizeof(chunkHeader));
+			offset += 8;
+
+			if (chunkHeader[0] > file.size() - offset) {
+				throw std::runtime_error("Could not read " + path + ", a chunk is truncated");
+			}
+
+			if (chunkHeader[1] == GlbJsonChunk && !foundJson) {
+				json = reinterpret_cast<const char*>(file.data() + offset);
+				jsonSize = chunkHeader[0];
+				foundJson = true;
+			}
+			else if (chunkHeader[1] == GlbBinaryChunk && binaryChunk.data == nullptr) {
+				binaryChunk.data = file.data() + offset;
+				binaryChunk.size = chunkHeader[0];
+			}
+
+			// Chunks are padded to 4 bytes
+			offset += (chunkHeader[0] + 3) & ~3u;
+		}
+
+		if (!foundJson) {
+			throw std::runtime_error("Could not read " + path + ", it has no JSON chunk");
+		}
+	}
+
+	JsonValue document = JsonParser(json, json + jsonSize).parseDocument();
+
+	// External buffers are mapped and read in place, embedded ones decoded once
+	std::vector<std::unique_ptr<MappedFile>> bufferFiles;
+	std::vector<std::vector<uint8_t>> decodedBuffers;
+	std::vector<GltfBuffer> buffers;
+
+	for (const JsonValue& buffer : document.getArray("buffers")) {
+		const JsonValue* uri = buffer.find("uri");
+		GltfBuffer view;
+
+		if (uri == nullptr) {
+			if (binaryChunk.data == nullptr) {
+				throw std::runtime_error("Could not read " + path + ", a buffer has no data");
+			}
+
+			view = binaryChunk;
+		}
+		else if (uri->string.compare(0, 5, "data:") == 0) {
+			size_t comma = uri->string.find(',');
+
+			if (comma == std::string::npos || uri->string.rfind(";base64", comma) == std::string::npos) {
+				throw std::runtime_error("Could not read " + path + ", only base64 data URIs are supported");
+			}
+
+			decodedBuffers.push_back(decodeBase64(uri->string.data() + comma + 1, uri->string.data() + uri->string.size()));
+			view.data = decodedBuffers.back().data();
+			view.size = decodedBuffers.back().size();
+		}
+		else {
+			std::string bufferPath = resolvePath(path, uri->string);
+
+			bufferFiles.push_back(std::make_unique<MappedFile>());
+			bufferFiles.back()->open(bufferPath, "glTF buffer");
+
+			stats.sourceFiles.push_back(bufferPath);
+			stats.sourceBytes += bufferFiles.back()->size();
+
+			view.data = bufferFiles.back()->data();
+			view.size = bufferFiles.back()->size();
+		}
+
+		// Shorter than declared would read past the data
+		if (view.size < static_cast<size_t>(buffer.getNumber("byteLength", 0))) {
+			throw std::runtime_error("Could not read " + path + ", a buffer is shorter than its byteLength");
+		}
+
+		buffers.push_back(view);
+	}
+
+	Scene scene;
+
+	for (const JsonValue& material : document.getArray("materials")) {
+		glm::vec3 albedo(1.0f);
+		glm::vec3 emission(0.0f);
+
+		if (const JsonValue* pbr = material.find("pbrMetallicRoughness")) {
+			const std::vector<JsonValue>& baseColor = pbr->getArray("baseColorFactor");
+
+			if (baseColor.size() >= 3) {
+				albedo = glm::vec3(baseColor[0].number, baseColor[1].number, baseColor[2].number);
+			}
+		}
+
+		const std::vector<JsonValue>& emissive = material.getArray("emissiveFactor");
+		if (emissive.size() == 3) {
+			emission = glm::vec3(emissive[0].number, emissive[1].number, emissive[2].number);
+		}
+
+		if (const JsonValue* extensions = material.find("extensions")) {
+			if (const JsonValue* strength = extensions->find("KHR_materials_emissive_strength")) {
+				emission *= static_cast<float>(strength->getNumber("emissiveStrength", 1.0));
+			}
+		}
+
+		scene.addMaterial(albedo, emission);
+	}
+
+	uint32_t defaultMaterial = scene.addMaterial(glm::vec3(0.73f));
+
+	// Walks the node hierarchy of the default scene, or of the first one, and collects a draw per primitive
+	const std::vector<JsonValue>& nodes = document.getArray("nodes");
+	const std::vector<JsonValue>& meshes = document.getArray("meshes");
+	const std::vector<JsonValue>& scenes = document.getArray("scenes");
+
+	std::vector<std::pair<size_t, glm::mat4>> pending;
+
+	if (!scenes.empty()) {
+		size_t sceneIndex = static_cast<size_t>(document.getNumber("scene", 0));
+
+		if (sceneIndex >= scenes.size()) {
+			throw std::runtime_error("Could not read " + path + ", the default scene does not exist");
+		}
+
+		for (const JsonValue& root : scenes[sceneIndex].getArray("nodes")) {
+			pending.emplace_back(static_cast<size_t>(root.number), glm::mat4(1.0f));
+		}
+	}
+	else {
+		// Without scenes every node that is nobody's child is a root
+		std::vector<bool> isChild(nodes.size(), false);
+
+		for (const JsonValue& node : nodes) {
+			for (const JsonValue& child : node.getArray("children")) {
+				if (child.number >= 0.0 && child.number < nodes.size()) {
+					isChild[static_cast<size_t>(child.number)] = true;
+				}
+			}
+		}
+
+		for (size_t i = 0; i < nodes.size(); i++) {
+			if (!isChild[i]) {
+				pending.emplace_back(i, glm::mat4(1.0f));
+			}
+		}
+	}
+
+	// Mesh and world transform of every node that draws one
+	std::vector<std::pair<size_t, glm::mat4>> meshNodes;
+	size_t visitedNodes = 0;
+
+	while (!pending.empty()) {
+		size_t nodeIndex = pending.back().first;
+		glm::mat4 parentTransform = pending.back().second;
+		pending.pop_back();
+
+		// Every node has at most one parent, so more visits than nodes means a cycle or a shared child
+		if (nodeIndex >= nodes.size() || ++visitedNodes > nodes.size()) {
+			throw std::runtime_error("Could not read " + path + ", the node hierarchy is invalid");
+		}
+
+		const JsonValue& node = nodes[nodeIndex];
+		glm::mat4 transform = parentTransform * getNodeTransform(node);
+
+		for (const JsonValue& child : node.getArray("children")) {
+			pending.emplace_back(static_cast<size_t>(child.number), transform);
+		}
+
+		const JsonValue* mesh = node.find("mesh");
+		if (mesh == nullptr) {
+			continue;
+		}
+
+		if (static_cast<size_t>(mesh->number) >= meshes.size()) {
+			throw std::runtime_error("Could not read " + path + ", a node references a missing mesh");
+		}
+
+		meshNodes.emplace_back(static_cast<size_t>(mesh->number), transform);
+	}
+
+	std::vector<GltfDraw> draws;
+
+	auto addDraws = [&](size_t meshIndex, const glm::mat4& transform) {
+		for (const JsonValue& primitive : meshes[meshIndex].getArray("primitives")) {
+			// Points, lines and strips are not traced
+			if (static_cast<uint32_t>(primitive.getNumber("mode", GltfTriangles)) != GltfTriangles) {
+				continue;
+			}
+
+			const JsonValue* attributes = primitive.find("attributes");
+			const JsonValue* position = attributes != nullptr ? attributes->find("POSITION") : nullptr;
+
+			if (position == nullptr) {
+				continue;
+			}
+
+			GltfDraw draw;
+			draw.positions = getAccessor(document, buffers, static_cast<size_t>(position->number), "VEC3");
+			draw.transform = transform;
+
+			if (draw.positions.componentType != GltfFloat) {
+				throw std::runtime_error("Could not read " + path + ", only float positions are supported");
+			}
+
+			uint32_t cornerCount = draw.positions.count;
+
+			if (const JsonValue* indices = primitive.find("indices")) {
+				draw.indices = getAccessor(document, buffers, static_cast<size_t>(indices->number), "SCALAR");
+				draw.indexed = true;
+				cornerCount = draw.indices.count;
+
+				uint32_t type = draw.indices.componentType;
+				if (type != GltfUnsignedByte && type != GltfUnsignedShort && type != GltfUnsignedInt) {
+					throw std::runtime_error("Could not read " + path + ", indices must be unsigned integers");
+				}
+			}
+
+			double materialIndex = primitive.getNumber("material", -1.0);
+			draw.materialId = materialIndex >= 0.0 && materialIndex < defaultMaterial ? static_cast<uint32_t>(materialIndex) : defaultMaterial;
+			draw.triangleCount = cornerCount / 3;
+
+			draws.push_back(draw);
+		}
+	};
+
+	// Meshes drawn by more than one node are kept once in their own space and placed by instances. Then
+	// every mesh becomes a scene mesh, so that all triangles are reached through instances.
+	std::vector<uint32_t> meshUses(meshes.size(), 0);
+	for (const auto& meshNode : meshNodes) {
+		meshUses[meshNode.first]++;
+	}
+
+	bool instanced = std::any_of(meshUses.begin(), meshUses.end(), [](uint32_t uses) { return uses > 1; });
+	std::vector<std::pair<size_t, size_t>> meshDraws(meshes.size());
+
+	if (instanced) {
+		for (size_t i = 0; i < meshes.size(); i++) {
+			meshDraws[i].first = draws.size();
+			if (meshUses[i] > 0) {
+				addDraws(i, glm::mat4(1.0f));
+			}
+			meshDraws[i].second = draws.size();
+		}
+	}
+	else {
+		for (const auto& meshNode : meshNodes) {
+			addDraws(meshNode.first, meshNode.second);
+		}
+	}
+
+	size_t triangleCount = 0;
+	std::vector<GltfRange> ranges;
+
+	for (uint32_t i = 0; i < draws.size(); i++) {
+		draws[i].firstTriangle = triangleCount;
+		triangleCount += draws[i].triangleCount;
+
+		for (uint32_t first = 0; first < draws[i].triangleCount; first += GltfChunkTriangles) {
+			ranges.push_back({ i, first, std::min(GltfChunkTriangles, draws[i].triangleCount - first) });
+		}
+	}
+
+	if (triangleCount > std::numeric_limits<uint32_t>::max()) {
+		throw std::runtime_error("Could not import " + path + ", it has more than 2^32 triangles");
+	}
+
+	stats.chunkCount = static_cast<uint32_t>(ranges.size());
+	scene.triangles.resize(triangleCount);
+
+	if (instanced) {
+		std::vector<uint32_t> meshIds(meshes.size(), 0);
+
+		for (size_t i = 0; i < meshes.size(); i++) {
+			if (meshUses[i] == 0) {
+				continue;
+			}
+
+			Mesh mesh = {};
+			for (size_t draw = meshDraws[i].first; draw < meshDraws[i].second; draw++) {
+				mesh.triangleCount += draws[draw].triangleCount;
+			}
+			if (meshDraws[i].first < meshDraws[i].second) {
+				mesh.firstTriangle = static_cast<uint32_t>(draws[meshDraws[i].first].firstTriangle);
+			}
+
+			meshIds[i] = static_cast<uint32_t>(scene.meshes.size());
+			scene.meshes.push_back(mesh);
+		}
+
+		for (const auto& meshNode : meshNodes) {
+			scene.addInstance(meshNode.second, meshIds[meshNode.first]);
+		}
+	}
+
+	scheduler.parallelFor(static_cast<uint32_t>(ranges.size()), [&](uint32_t index, uint32_t) {
+		const GltfRange& range = ranges[index];
+		const GltfDraw& draw = draws[range.draw];
+
+		for (uint32_t i = range.firstTriangle; i < range.firstTriangle + range.triangleCount; i++) {
+			glm::vec3 corners[3];
+
+			for (uint32_t corner = 0; corner < 3; corner++) {
+				uint32_t vertex = draw.indexed ? readIndex(draw.indices, i * 3 + corner) : i * 3 + corner;
+
+				if (vertex >= draw.positions.count) {
+					throw std::runtime_error("Could not import " + path + ", an index is out of range");
+				}
+
+				glm::vec3 position;
+				std::memcpy(&position, draw.positions.data + vertex * draw.positions.stride, sizeof(position));
+				corners[corner] = glm::vec3(draw.transform * glm::vec4(position, 1.0f));
+			}
+
+			Triangle& triangle = scene.triangles[draw.firstTriangle + i];
+			triangle = {};
+			triangle.v0 = corners[0];
+			triangle.v1 = corners[1];
+			triangle.v2 = corners[2];
+			triangle.materialId = draw.materialId;
+		}
+	});
+
+	return scene;
+}
+
+void SceneImporter::placeCamera(Scene& scene) const {
+	glm::vec3 boundsMin(std::numeric_limits<float>::max());
+	glm::vec3 boundsMax(-std::numeric_limits<float>::max());
+
+	if (!scene.isInstanced()) {
+		for (const Triangle& triangle : scene.triangles) {
+			boundsMin = glm::min(boundsMin, glm::min(triangle.v0, glm::min(triangle.v1, triangle.v2)));
+			boundsMax = glm::max(boundsMax, glm::max(triangle.v0, glm::max(triangle.v1, triangle.v2)));
+		}
+	}
+	else {
+		// Triangles are in the space of their meshes, so the corners of every mesh's bounds are placed instead
+		for (const MeshInstance& instance : scene.instances) {
+			const Mesh& mesh = scene.meshes[instance.meshId];
+
+			glm::vec3 meshMin(std::numeric_limits<float>::max());
+			glm::vec3 meshMax(-std::numeric_limits<float>::max());
+
+			for (uint32_t i = mesh.firstTriangle; i < mesh.firstTriangle + mesh.triangleCount; i++) {
+				const Triangle& triangle = scene.triangles[i];
+				meshMin = glm::min(meshMin, glm::min(triangle.v0, glm::min(triangle.v1, triangle.v2)));
+				meshMax = glm::max(meshMax, glm::max(triangle.v0, glm::max(triangle.v1, triangle.v2)));
+			}
+
+			for (int corner = 0; mesh.triangleCount > 0 && corner < 8; corner++) {
+				glm::vec3 point((corner & 1) ? meshMax.x : meshMin.x, (corner & 2) ? meshMax.y : meshMin.y, (corner & 4) ? meshMax.z : meshMin.z);
+				glm::vec3 world = glm::vec3(instance.transform * glm::vec4(point, 1.0f));
+
+				boundsMin = glm::min(boundsMin, world);
+				boundsMax = glm::max(boundsMax, world);
+			}
+		}
+	}
+
+	if (boundsMin.x > boundsMax.x) {
+		boundsMin = glm::vec3(-1.0f);
+		boundsMax = glm::vec3(1.0f);
+	}
+
+	glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+	float radius = std::max(glm::length(boundsMax - boundsMin) * 0.5f, 1e-3f);
+
+	scene.camera.verticalFov = 0.7f;
+	scene.camera.forward = glm::vec3(0.0f, 0.0f, -1.0f);
+	scene.camera.up = glm::vec3(0.0f, 1.0f, 0.0f);
+	// Far enough back that the bounding sphere fits the vertical field of view
+	scene.camera.position = center + glm::vec3(0.0f, 0.0f, radius / std::sin(scene.camera.verticalFov * 0.5f));
+
+	// Scenes without emissive materials would render black, so they are lit by a white background instead
+	bool hasEmission = std::any_of(scene.materials.begin(), scene.materials.end(), [](const Material& material) {
+		return material.emission.x > 0.0f || material.emission.y > 0.0f || material.emission.z > 0.0f;
+	});
+
+	scene.backgroundColor = hasEmission ? glm::vec3(0.0f) : glm::vec3(1.0f);
+}
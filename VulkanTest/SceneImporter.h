@@ -0,0 +1,56 @@
+#pragma once
+
+#include "Scene.h"
+#include "TaskScheduler.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct SceneImportStats {
+	// Every file read, the scene file first, so a cache can tell when any of them changed
+	std::vector<std::string> sourceFiles;
+	uint64_t sourceBytes = 0;
+	uint32_t chunkCount = 0;
+	double milliseconds = 0.0;
+};
+
+// Converts Wavefront OBJ, with the materials of its MTL libraries, and glTF 2.0 (.gltf with external or
+// base64 buffers, and .glb) into a Scene. Both are split into chunks parsed on every worker:
+//
+//   OBJ   the file is cut at line boundaries. A first pass counts the positions of every chunk, which gives
+//         each chunk the absolute index of its first position, so the second pass resolves relative face
+//         indices and writes positions straight into place. A third pass gathers the triangles.
+//   glTF  the JSON document is small and read on one thread, then the triangles of every primitive are
+//         converted in fixed size ranges, reading the buffers in place. When a mesh is drawn by more than
+//         one node, every mesh is kept once in its own space and the nodes become instances of it.
+//
+// Only positions and the diffuse and emissive colors the tracer uses are read; normals, texture
+// coordinates and textures are skipped. Polygons are split into fans. Neither format carries a camera
+// the tracer can use, so one is placed in front of the scene bounds looking down -z.
+class SceneImporter {
+public:
+	explicit SceneImporter(TaskScheduler& scheduler) : scheduler(scheduler) { }
+
+	// Chooses the format by extension. Throws if the file cannot be read or is malformed.
+	Scene import(const std::string& path);
+
+	const SceneImportStats& getStats() const {
+		return stats;
+	}
+
+	static bool isSupported(const std::string& path);
+
+	// OBJ chunks are cut near multiples of this size, glTF primitives into ranges of this many triangles
+	static constexpr size_t ObjChunkSize = 4u << 20;
+	static constexpr uint32_t GltfChunkTriangles = 1u << 16;
+
+private:
+	Scene importObj(const std::string& path);
+	Scene importGltf(const std::string& path);
+
+	void placeCamera(Scene& scene) const;
+
+	TaskScheduler& scheduler;
+	SceneImportStats stats;
+};
@@ -0,0 +1,149 @@
+#pragma once
+
+// Thin wrapper over the widest float vector the compiler was told it may use. Kernels are written
+// once against simd::vfloat and run 8 wide with AVX, 4 wide with SSE, or 1 wide otherwise.
+#if defined(__AVX2__) || defined(__AVX__)
+#define SIMD_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE
+#include <emmintrin.h>
+#endif
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+namespace simd {
+#if defined(SIMD_AVX)
+	constexpr int Width = 8;
+
+	struct vmask {
+		__m256 m;
+
+		friend vmask operator&(vmask a, vmask b) { return { _mm256_and_ps(a.m, b.m) }; }
+		friend vmask operator|(vmask a, vmask b) { return { _mm256_or_ps(a.m, b.m) }; }
+		friend vmask andNot(vmask a, vmask b) { return { _mm256_andnot_ps(b.m, a.m) }; } // a & ~b
+
+		int bits() const { return _mm256_movemask_ps(m); }
+		bool any() const { return bits() != 0; }
+		static vmask none() { return { _mm256_setzero_ps() }; }
+		static vmask all() { return { _mm256_castsi256_ps(_mm256_set1_epi32(-1)) }; }
+	};
+
+	struct vfloat {
+		__m256 v;
+
+		vfloat() = default;
+		vfloat(__m256 v) : v(v) { }
+		vfloat(float s) : v(_mm256_set1_ps(s)) { }
+
+		static vfloat load(const float* p) { return _mm256_loadu_ps(p); }
+		void store(float* p) const { _mm256_storeu_ps(p, v); }
+		static vfloat fromBits(uint32_t bits) { return _mm256_castsi256_ps(_mm256_set1_epi32(static_cast<int>(bits))); }
+
+		friend vfloat operator+(vfloat a, vfloat b) { return _mm256_add_ps(a.v, b.v); }
+		friend vfloat operator-(vfloat a, vfloat b) { return _mm256_sub_ps(a.v, b.v); }
+		friend vfloat operator*(vfloat a, vfloat b) { return _mm256_mul_ps(a.v, b.v); }
+		friend vfloat operator/(vfloat a, vfloat b) { return _mm256_div_ps(a.v, b.v); }
+		friend vmask operator<(vfloat a, vfloat b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+		friend vmask operator<=(vfloat a, vfloat b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+		friend vmask operator>(vfloat a, vfloat b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+		friend vmask operator>=(vfloat a, vfloat b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+	};
+
+	inline vfloat min(vfloat a, vfloat b) { return _mm256_min_ps(a.v, b.v); }
+	inline vfloat max(vfloat a, vfloat b) { return _mm256_max_ps(a.v, b.v); }
+	inline vfloat abs(vfloat a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+	inline vfloat select(vmask m, vfloat a, vfloat b) { return _mm256_blendv_ps(b.v, a.v, m.m); }
+#elif defined(SIMD_SSE)
+	constexpr int Width = 4;
+
+	struct vmask {
+		__m128 m;
+
+		friend vmask operator&(vmask a, vmask b) { return { _mm_and_ps(a.m, b.m) }; }
+		friend vmask operator|(vmask a, vmask b) { return { _mm_or_ps(a.m, b.m) }; }
+		friend vmask andNot(vmask a, vmask b) { return { _mm_andnot_ps(b.m, a.m) }; } // a & ~b
+
+		int bits() const { return _mm_movemask_ps(m); }
+		bool any() const { return bits() != 0; }
+		static vmask none() { return { _mm_setzero_ps() }; }
+		static vmask all() { return { _mm_castsi128_ps(_mm_set1_epi32(-1)) }; }
+	};
+
+	struct vfloat {
+		__m128 v;
+
+		vfloat() = default;
+		vfloat(__m128 v) : v(v) { }
+		vfloat(float s) : v(_mm_set1_ps(s)) { }
+
+		static vfloat load(const float* p) { return _mm_loadu_ps(p); }
+		void store(float* p) const { _mm_storeu_ps(p, v); }
+		static vfloat fromBits(uint32_t bits) { return _mm_castsi128_ps(_mm_set1_epi32(static_cast<int>(bits))); }
+
+		friend vfloat operator+(vfloat a, vfloat b) { return _mm_add_ps(a.v, b.v); }
+		friend vfloat operator-(vfloat a, vfloat b) { return _mm_sub_ps(a.v, b.v); }
+		friend vfloat operator*(vfloat a, vfloat b) { return _mm_mul_ps(a.v, b.v); }
+		friend vfloat operator/(vfloat a, vfloat b) { return _mm_div_ps(a.v, b.v); }
+		friend vmask operator<(vfloat a, vfloat b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+		friend vmask operator<=(vfloat a, vfloat b) { return { _mm_cmple_ps(a.v, b.v) }; }
+		friend vmask operator>(vfloat a, vfloat b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+		friend vmask operator>=(vfloat a, vfloat b) { return { _mm_cmpge_ps(a.v, b.v) }; }
+	};
+
+	inline vfloat min(vfloat a, vfloat b) { return _mm_min_ps(a.v, b.v); }
+	inline vfloat max(vfloat a, vfloat b) { return _mm_max_ps(a.v, b.v); }
+	inline vfloat abs(vfloat a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+	// SSE2 has no blendv, so build the select from bitwise operations
+	inline vfloat select(vmask m, vfloat a, vfloat b) { return _mm_or_ps(_mm_and_ps(m.m, a.v), _mm_andnot_ps(m.m, b.v)); }
+#else
+	constexpr int Width = 1;
+
+	struct vmask {
+		bool m;
+
+		friend vmask operator&(vmask a, vmask b) { return { a.m && b.m }; }
+		friend vmask operator|(vmask a, vmask b) { return { a.m || b.m }; }
+		friend vmask andNot(vmask a, vmask b) { return { a.m && !b.m }; }
+
+		int bits() const { return m ? 1 : 0; }
+		bool any() const { return m; }
+		static vmask none() { return { false }; }
+		static vmask all() { return { true }; }
+	};
+
+	struct vfloat {
+		float v;
+
+		vfloat() = default;
+		vfloat(float s) : v(s) { }
+
+		static vfloat load(const float* p) { return *p; }
+		void store(float* p) const { *p = v; }
+		static vfloat fromBits(uint32_t bits) { float f; std::memcpy(&f, &bits, sizeof(f)); return f; }
+
+		friend vfloat operator+(vfloat a, vfloat b) { return a.v + b.v; }
+		friend vfloat operator-(vfloat a, vfloat b) { return a.v - b.v; }
+		friend vfloat operator*(vfloat a, vfloat b) { return a.v * b.v; }
+		friend vfloat operator/(vfloat a, vfloat b) { return a.v / b.v; }
+		friend vmask operator<(vfloat a, vfloat b) { return { a.v < b.v }; }
+		friend vmask operator<=(vfloat a, vfloat b) { return { a.v <= b.v }; }
+		friend vmask operator>(vfloat a, vfloat b) { return { a.v > b.v }; }
+		friend vmask operator>=(vfloat a, vfloat b) { return { a.v >= b.v }; }
+	};
+
+	inline vfloat min(vfloat a, vfloat b) { return a.v < b.v ? a.v : b.v; }
+	inline vfloat max(vfloat a, vfloat b) { return a.v > b.v ? a.v : b.v; }
+	inline vfloat abs(vfloat a) { return std::fabs(a.v); }
+	inline vfloat select(vmask m, vfloat a, vfloat b) { return m.m ? a : b; }
+#endif
+
+	// Reinterprets a lane that was filled through vfloat::fromBits
+	inline uint32_t laneBits(const float* lanes, int lane) {
+		uint32_t bits;
+		std::memcpy(&bits, &lanes[lane], sizeof(bits));
+		return bits;
+	}
+}
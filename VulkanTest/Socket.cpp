@@ -0,0 +1,335 @@
+#include "Socket.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <afunix.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace {
+#ifdef _WIN32
+	using SocketLength = int;
+
+	void closeHandle(intptr_t handle) {
+		closesocket(static_cast<SOCKET>(handle));
+	}
+
+	void removeFile(const std::string& path) {
+		DeleteFileA(path.c_str());
+	}
+
+	void startNetworking() {
+		static const bool started = [] {
+			WSADATA data;
+			if (WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+				throw std::runtime_error("Could not initialize Winsock");
+			}
+			return true;
+		}();
+		(void)started;
+	}
+#else
+	using SocketLength = socklen_t;
+
+	void closeHandle(intptr_t handle) {
+		::close(static_cast<int>(handle));
+	}
+
+	void removeFile(const std::string& path) {
+		unlink(path.c_str());
+	}
+
+	void startNetworking() { }
+#endif
+
+	const char UnixPrefix[] = "unix:";
+
+	bool isUnixAddress(const std::string& address) {
+		return address.compare(0, sizeof(UnixPrefix) - 1, UnixPrefix) == 0;
+	}
+
+	sockaddr_un unixAddress(const std::string& address) {
+		std::string path = address.substr(sizeof(UnixPrefix) - 1);
+
+		sockaddr_un result = {};
+		result.sun_family = AF_UNIX;
+
+		if (path.empty() || path.size() >= sizeof(result.sun_path)) {
+			throw std::runtime_error("Invalid Unix socket path: " + address);
+		}
+
+		std::memcpy(result.sun_path, path.c_str(), path.size() + 1);
+		return result;
+	}
+
+	// An empty host is the loopback address
+	sockaddr_in tcpAddress(const std::string& address, std::string& host) {
+		size_t separator = address.rfind(':');
+		if (separator == std::string::npos) {
+			throw std::runtime_error("Socket address must be given as host:port or unix:path: " + address);
+		}
+
+		host = separator > 0 ? address.substr(0, separator) : "127.0.0.1";
+		int port = std::stoi(address.substr(separator + 1));
+
+		if (port < 0 || port > 65535) {
+			throw std::runtime_error("Invalid port in socket address: " + address);
+		}
+
+		addrinfo hints = {};
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+
+		addrinfo* info = nullptr;
+		if (getaddrinfo(host.c_str(), nullptr, &hints, &info) != 0 || info == nullptr) {
+			throw std::runtime_error("Could not resolve socket address " + address);
+		}
+
+		sockaddr_in result;
+		std::memcpy(&result, info->ai_addr, sizeof(result));
+		result.sin_port = htons(static_cast<uint16_t>(port));
+		freeaddrinfo(info);
+
+		return result;
+	}
+
+	intptr_t openHandle(int family) {
+		intptr_t handle = static_cast<intptr_t>(::socket(family, SOCK_STREAM, 0));
+
+		if (handle == -1) {
+			throw std::runtime_error("Could not create socket");
+		}
+
+#ifdef SO_NOSIGPIPE
+		int noSignal = 1;
+		setsockopt(static_cast<int>(handle), SOL_SOCKET, SO_NOSIGPIPE, &noSignal, sizeof(noSignal));
+#endif
+
+		return handle;
+	}
+
+	// Tile requests and results are small, latency matters more than packing them
+	void disableNagle(intptr_t handle) {
+		int noDelay = 1;
+		setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+	}
+}
+
+Socket::Socket(Socket&& other) noexcept {
+	*this = std::move(other);
+}
+
+Socket& Socket::operator=(Socket&& other) noexcept {
+	if (this != &other) {
+		close();
+
+		handle = other.handle;
+		address = std::move(other.address);
+		unixPath = std::move(other.unixPath);
+
+		other.handle = InvalidHandle;
+		other.unixPath.clear();
+	}
+
+	return *this;
+}
+
+Socket::~Socket() {
+	close();
+}
+
+Socket Socket::listen(const std::string& address) {
+	startNetworking();
+
+	if (isUnixAddress(address)) {
+		sockaddr_un bindAddress = unixAddress(address);
+
+		// Left behind by a listener that did not shut down
+		removeFile(bindAddress.sun_path);
+
+		Socket result(openHandle(AF_UNIX));
+
+		if (::bind(result.handle, reinterpret_cast<const sockaddr*>(&bindAddress), sizeof(bindAddress)) != 0 || ::listen(result.handle, SOMAXCONN) != 0) {
+			throw std::runtime_error("Could not listen on " + address);
+		}
+
+		result.address = address;
+		result.unixPath = bindAddress.sun_path;
+		return result;
+	}
+
+	std::string host;
+	sockaddr_in bindAddress = tcpAddress(address, host);
+
+	Socket result(openHandle(AF_INET));
+
+#ifndef _WIN32
+	// Lets a coordinator listen on the port of one that just exited
+	int reuse = 1;
+	setsockopt(result.handle, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+#endif
+
+	if (::bind(result.handle, reinterpret_cast<const sockaddr*>(&bindAddress), sizeof(bindAddress)) != 0 || ::listen(result.handle, SOMAXCONN) != 0) {
+		throw std::runtime_error("Could not listen on " + address);
+	}
+
+	SocketLength length = sizeof(bindAddress);
+	getsockname(result.handle, reinterpret_cast<sockaddr*>(&bindAddress), &length);
+
+	result.address = host + ":" + std::to_string(ntohs(bindAddress.sin_port));
+	return result;
+}
+
+Socket Socket::connect(const std::string& address) {
+	startNetworking();
+
+	if (isUnixAddress(address)) {
+		sockaddr_un peerAddress = unixAddress(address);
+		Socket result(openHandle(AF_UNIX));
+
+		if (::connect(result.handle, reinterpret_cast<const sockaddr*>(&peerAddress), sizeof(peerAddress)) != 0) {
+			throw std::runtime_error("Could not connect to " + address);
+		}
+
+		result.address = address;
+		return result;
+	}
+
+	std::string host;
+	sockaddr_in peerAddress = tcpAddress(address, host);
+	Socket result(openHandle(AF_INET));
+
+	if (::connect(result.handle, reinterpret_cast<const sockaddr*>(&peerAddress), sizeof(peerAddress)) != 0) {
+		throw std::runtime_error("Could not connect to " + address);
+	}
+
+	disableNagle(result.handle);
+
+	result.address = address;
+	return result;
+}
+
+Socket Socket::accept(uint32_t timeoutMilliseconds) {
+	if (!waitReadable(timeoutMilliseconds)) {
+		return Socket();
+	}
+
+	intptr_t connection = static_cast<intptr_t>(::accept(handle, nullptr, nullptr));
+	if (connection == -1) {
+		return Socket();
+	}
+
+	if (unixPath.empty()) {
+		disableNagle(connection);
+	}
+
+	Socket result(connection);
+	result.address = address;
+	return result;
+}
+
+bool Socket::waitReadable(uint32_t timeoutMilliseconds) {
+	fd_set readable;
+	FD_ZERO(&readable);
+	FD_SET(handle, &readable);
+
+	timeval timeout;
+	timeout.tv_sec = static_cast<long>(timeoutMilliseconds / 1000);
+	timeout.tv_usec = static_cast<long>(timeoutMilliseconds % 1000) * 1000;
+
+	// The first argument is ignored on Windows
+	return select(static_cast<int>(handle + 1), &readable, nullptr, nullptr, &timeout) > 0;
+}
+
+bool Socket::sendAll(const void* data, size_t size) {
+	const char* bytes = static_cast<const char*>(data);
+
+#ifdef MSG_NOSIGNAL
+	const int flags = MSG_NOSIGNAL;
+#else
+	const int flags = 0;
+#endif
+
+	while (size > 0) {
+		int chunk = static_cast<int>(std::min<size_t>(size, 1 << 20));
+		auto sent = ::send(handle, bytes, chunk, flags);
+
+		if (sent <= 0) {
+#ifndef _WIN32
+			if (sent < 0 && errno == EINTR) {
+				continue;
+			}
+#endif
+			return false;
+		}
+
+		bytes += sent;
+		size -= static_cast<size_t>(sent);
+	}
+
+	return true;
+}
+
+bool Socket::receiveAll(void* data, size_t size) {
+	char* bytes = static_cast<char*>(data);
+
+	while (size > 0) {
+		int chunk = static_cast<int>(std::min<size_t>(size, 1 << 20));
+		auto received = ::recv(handle, bytes, chunk, 0);
+
+		if (received <= 0) {
+#ifndef _WIN32
+			if (received < 0 && errno == EINTR) {
+				continue;
+			}
+#endif
+			return false;
+		}
+
+		bytes += received;
+		size -= static_cast<size_t>(received);
+	}
+
+	return true;
+}
+
+void Socket::shutdown() {
+	if (isValid()) {
+#ifdef _WIN32
+		::shutdown(handle, SD_BOTH);
+#else
+		::shutdown(static_cast<int>(handle), SHUT_RDWR);
+#endif
+	}
+}
+
+void Socket::close() {
+	if (isValid()) {
+		closeHandle(handle);
+	}
+
+	if (!unixPath.empty()) {
+		removeFile(unixPath);
+	}
+
+	handle = InvalidHandle;
+	address.clear();
+	unixPath.clear();
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Blocking stream socket over TCP or a Unix domain socket. Addresses are "host:port" for TCP, where port
+// 0 lets the system pick one, or "unix:path" for a socket file. Failing to listen or connect throws, while
+// a connection that breaks or is closed by the peer makes sending and receiving return false.
+class Socket {
+public:
+	Socket() = default;
+	Socket(Socket&& other) noexcept;
+	Socket& operator=(Socket&& other) noexcept;
+	Socket(const Socket&) = delete;
+	Socket& operator=(const Socket&) = delete;
+	~Socket();
+
+	static Socket listen(const std::string& address);
+	static Socket connect(const std::string& address);
+
+	// Waits up to timeoutMilliseconds for a connection, returns an invalid socket if none arrived
+	Socket accept(uint32_t timeoutMilliseconds);
+
+	// Whether data or a closed connection is waiting, after up to timeoutMilliseconds
+	bool waitReadable(uint32_t timeoutMilliseconds);
+
+	bool sendAll(const void* data, size_t size);
+	bool receiveAll(void* data, size_t size);
+
+	// Wakes up every call blocked on this socket in another thread, which then fail like on a closed connection
+	void shutdown();
+	void close();
+
+	bool isValid() const {
+		return handle != InvalidHandle;
+	}
+
+	// The address a listening socket can be reached at, with the port the system picked
+	const std::string& getAddress() const {
+		return address;
+	}
+
+private:
+	// SOCKET on Windows, a file descriptor elsewhere
+	using Handle = intptr_t;
+	static constexpr Handle InvalidHandle = -1;
+
+	explicit Socket(Handle handle) : handle(handle) { }
+
+	Handle handle = InvalidHandle;
+	std::string address;
+	// Unix socket files are removed again by the socket that created them
+	std::string unixPath;
+};
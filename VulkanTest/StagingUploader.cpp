@@ -0,0 +1,199 @@
+#include "StagingUploader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+	// Keeps every copy source aligned the same way regardless of what was uploaded before it
+	constexpr VkDeviceSize CopyAlignment = 16;
+}
+
+void StagingUploader::create(VkDevice device, MemoryAllocator& allocator, uint32_t queueFamily, VkQueue queue, VkDeviceSize segmentSize, uint32_t segmentCount) {
+	this->device = device;
+	this->allocator = &allocator;
+	this->queueFamily = queueFamily;
+	this->queue = queue;
+	this->segmentSize = (segmentSize + CopyAlignment - 1) / CopyAlignment * CopyAlignment;
+	stats = StagingUploadStats();
+
+	allocator.createBuffer(this->segmentSize * segmentCount, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0, ringBuffer, ringMemory);
+
+	VkCommandPoolCreateInfo poolCreateInfo = {};
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolCreateInfo.queueFamilyIndex = queueFamily;
+	poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+	if (vkCreateCommandPool(device, &poolCreateInfo, nullptr, &commandPool) != VK_SUCCESS) {
+		throw std::runtime_error("Could not create staging command pool");
+	}
+
+	std::vector<VkCommandBuffer> commandBuffers(segmentCount);
+
+	VkCommandBufferAllocateInfo allocateInfo = {};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocateInfo.commandPool = commandPool;
+	allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocateInfo.commandBufferCount = segmentCount;
+
+	if (vkAllocateCommandBuffers(device, &allocateInfo, commandBuffers.data()) != VK_SUCCESS) {
+		throw std::runtime_error("Could not allocate staging command buffers");
+	}
+
+	segments.resize(segmentCount);
+	for (uint32_t i = 0; i < segmentCount; i++) {
+		segments[i].offset = i * this->segmentSize;
+		segments[i].commandBuffer = commandBuffers[i];
+	}
+	currentSegment = 0;
+
+	VkSemaphoreTypeCreateInfo typeCreateInfo = {};
+	typeCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	typeCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	typeCreateInfo.initialValue = 0;
+
+	VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+	semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	semaphoreCreateInfo.pNext = &typeCreateInfo;
+
+	if (vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &timelineSemaphore) != VK_SUCCESS) {
+		throw std::runtime_error("Could not create staging timeline semaphore");
+	}
+
+	lastSubmittedValue = 0;
+}
+
+void StagingUploader::destroy() {
+	wait(lastSubmittedValue);
+
+	vkDestroySemaphore(device, timelineSemaphore, nullptr);
+	vkDestroyCommandPool(device, commandPool, nullptr);
+	allocator->destroyBuffer(ringBuffer, ringMemory);
+
+	segments.clear();
+	timelineSemaphore = VK_NULL_HANDLE;
+	commandPool = VK_NULL_HANDLE;
+}
+
+void StagingUploader::upload(VkBuffer buffer, VkDeviceSize offset, const void* data, VkDeviceSize size) {
+	const uint8_t* source = static_cast<const uint8_t*>(data);
+
+	// Uploads larger than a segment are split, so the ring size only bounds the memory used, not what fits
+	while (size > 0) {
+		Segment& segment = segments[currentSegment];
+
+		if (!segment.recording) {
+			beginSegment(segment);
+		}
+
+		if (segment.used >= segmentSize) {
+			submitSegment(segment);
+			currentSegment = (currentSegment + 1) % static_cast<uint32_t>(segments.size());
+			continue;
+		}
+
+		VkDeviceSize chunk = std::min(size, segmentSize - segment.used);
+
+		std::memcpy(static_cast<uint8_t*>(ringMemory.mapped) + segment.offset + segment.used, source, static_cast<size_t>(chunk));
+
+		VkBufferCopy region = {};
+		region.srcOffset = segment.offset + segment.used;
+		region.dstOffset = offset;
+		region.size = chunk;
+		vkCmdCopyBuffer(segment.commandBuffer, ringBuffer, buffer, 1, &region);
+
+		segment.used = std::min(segmentSize, (segment.used + chunk + CopyAlignment - 1) / CopyAlignment * CopyAlignment);
+		source += chunk;
+		offset += chunk;
+		size -= chunk;
+		stats.bytesUploaded += chunk;
+	}
+}
+
+uint64_t StagingUploader::flush() {
+	Segment& segment = segments[currentSegment];
+
+	if (segment.recording) {
+		submitSegment(segment);
+		currentSegment = (currentSegment + 1) % static_cast<uint32_t>(segments.size());
+	}
+
+	return lastSubmittedValue;
+}
+
+void StagingUploader::wait(uint64_t value) {
+	if (value == 0 || isComplete(value)) {
+		return;
+	}
+
+	VkSemaphoreWaitInfo waitInfo = {};
+	waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &timelineSemaphore;
+	waitInfo.pValues = &value;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	if (vkWaitSemaphores(device, &waitInfo, UINT64_MAX) != VK_SUCCESS) {
+		throw std::runtime_error("Could not wait for staging uploads");
+	}
+
+	stats.stallMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+bool StagingUploader::isComplete(uint64_t value) const {
+	uint64_t completed = 0;
+	vkGetSemaphoreCounterValue(device, timelineSemaphore, &completed);
+
+	return completed >= value;
+}
+
+void StagingUploader::beginSegment(Segment& segment) {
+	// The GPU may still be copying out of this part of the ring from its previous trip around
+	wait(segment.value);
+
+	vkResetCommandBuffer(segment.commandBuffer, 0);
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	if (vkBeginCommandBuffer(segment.commandBuffer, &beginInfo) != VK_SUCCESS) {
+		throw std::runtime_error("Could not begin staging command buffer");
+	}
+
+	segment.used = 0;
+	segment.recording = true;
+}
+
+void StagingUploader::submitSegment(Segment& segment) {
+	if (vkEndCommandBuffer(segment.commandBuffer) != VK_SUCCESS) {
+		throw std::runtime_error("Could not record staging command buffer");
+	}
+
+	uint64_t signalValue = lastSubmittedValue + 1;
+
+	VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineInfo.signalSemaphoreValueCount = 1;
+	timelineInfo.pSignalSemaphoreValues = &signalValue;
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.pNext = &timelineInfo;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &segment.commandBuffer;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &timelineSemaphore;
+
+	if (vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+		throw std::runtime_error("Could not submit staging uploads");
+	}
+
+	lastSubmittedValue = signalValue;
+	segment.value = signalValue;
+	segment.recording = false;
+	stats.submissionCount++;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "MemoryAllocator.h"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+struct StagingUploadStats {
+	uint64_t bytesUploaded = 0;
+	uint32_t submissionCount = 0;
+	// Time the CPU spent waiting for the GPU to release a segment of the ring
+	double stallMilliseconds = 0.0;
+};
+
+// Streams data into device local buffers through a persistently mapped ring of staging memory. The
+// ring is split into segments, each recorded into its own command buffer and submitted to the
+// transfer queue as it fills, so copying into one segment on the CPU overlaps with the GPU draining
+// the others. Completion is tracked with a single timeline semaphore: every submission signals the
+// next value, and consumers wait on the value returned by flush() instead of the CPU blocking.
+//
+// Destination buffers used by another queue family must be created with concurrent sharing across
+// both families, see getQueueFamily().
+class StagingUploader {
+public:
+	void create(VkDevice device, MemoryAllocator& allocator, uint32_t queueFamily, VkQueue queue,
+		VkDeviceSize segmentSize = 4ull << 20, uint32_t segmentCount = 4);
+	void destroy();
+
+	// Copies data into staging memory before returning, so the caller may release it right away. The
+	// copy into buffer is only guaranteed to have happened once the value of a later flush() signals.
+	void upload(VkBuffer buffer, VkDeviceSize offset, const void* data, VkDeviceSize size);
+
+	// Submits everything queued so far. Returns the timeline value that signals when it has landed.
+	uint64_t flush();
+
+	// Blocks the CPU until value has signalled
+	void wait(uint64_t value);
+
+	bool isComplete(uint64_t value) const;
+
+	VkSemaphore getSemaphore() const {
+		return timelineSemaphore;
+	}
+
+	uint32_t getQueueFamily() const {
+		return queueFamily;
+	}
+
+	const StagingUploadStats& getStats() const {
+		return stats;
+	}
+
+private:
+	struct Segment {
+		VkDeviceSize offset = 0;
+		VkDeviceSize used = 0;
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		// Timeline value of the last submission that read from this segment
+		uint64_t value = 0;
+		bool recording = false;
+	};
+
+	void beginSegment(Segment& segment);
+	void submitSegment(Segment& segment);
+
+	VkDevice device = VK_NULL_HANDLE;
+	MemoryAllocator* allocator = nullptr;
+	uint32_t queueFamily = 0;
+	VkQueue queue = VK_NULL_HANDLE;
+
+	VkBuffer ringBuffer = VK_NULL_HANDLE;
+	Allocation ringMemory;
+	VkDeviceSize segmentSize = 0;
+
+	VkCommandPool commandPool = VK_NULL_HANDLE;
+	VkSemaphore timelineSemaphore = VK_NULL_HANDLE;
+	uint64_t lastSubmittedValue = 0;
+
+	std::vector<Segment> segments;
+	uint32_t currentSegment = 0;
+
+	StagingUploadStats stats;
+};
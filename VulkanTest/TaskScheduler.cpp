@@ -0,0 +1,159 @@
+#include "TaskScheduler.h"
+
+#include <algorithm>
+
+TaskScheduler::TaskScheduler(uint32_t threadCount) {
+	if (threadCount == 0) {
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	for (uint32_t i = 0; i < threadCount; i++) {
+		queues.push_back(std::make_unique<WorkerQueue>());
+	}
+
+	// Worker 0 is whichever thread calls parallelFor
+	for (uint32_t i = 1; i < threadCount; i++) {
+		threads.emplace_back(&TaskScheduler::workerThread, this, i);
+	}
+}
+
+TaskScheduler::~TaskScheduler() {
+	{
+		std::lock_guard<std::mutex> lock(jobMutex);
+		stopping = true;
+	}
+
+	jobStarted.notify_all();
+
+	for (auto& thread : threads) {
+		thread.join();
+	}
+}
+
+void TaskScheduler::parallelFor(uint32_t count, const Task& task) {
+	if (count == 0) {
+		return;
+	}
+
+	uint32_t workerCount = getWorkerCount();
+
+	{
+		std::lock_guard<std::mutex> lock(jobMutex);
+
+		for (uint32_t worker = 0; worker < workerCount; worker++) {
+			uint32_t begin = static_cast<uint32_t>(static_cast<uint64_t>(count) * worker / workerCount);
+			uint32_t end = static_cast<uint32_t>(static_cast<uint64_t>(count) * (worker + 1) / workerCount);
+
+			std::lock_guard<std::mutex> queueLock(queues[worker]->mutex);
+			for (uint32_t i = begin; i < end; i++) {
+				queues[worker]->items.push_back(i);
+			}
+		}
+
+		currentTask = &task;
+		firstException = nullptr;
+		activeWorkers++;
+		jobGeneration++;
+	}
+
+	jobStarted.notify_all();
+
+	runItems(0, task);
+
+	std::exception_ptr exception;
+	{
+		std::unique_lock<std::mutex> lock(jobMutex);
+		activeWorkers--;
+
+		// Every item has been claimed once all queues are drained, but the task must stay alive
+		// until the workers that claimed the last items are done with it
+		jobFinished.wait(lock, [this] { return activeWorkers == 0; });
+
+		currentTask = nullptr;
+		exception = firstException;
+		firstException = nullptr;
+	}
+
+	if (exception) {
+		std::rethrow_exception(exception);
+	}
+}
+
+void TaskScheduler::workerThread(uint32_t worker) {
+	uint64_t seenGeneration = 0;
+
+	while (true) {
+		const Task* task;
+
+		{
+			std::unique_lock<std::mutex> lock(jobMutex);
+			jobStarted.wait(lock, [&] { return stopping || (jobGeneration != seenGeneration && currentTask != nullptr); });
+
+			if (stopping) {
+				return;
+			}
+
+			seenGeneration = jobGeneration;
+			task = currentTask;
+			activeWorkers++;
+		}
+
+		runItems(worker, *task);
+
+		{
+			std::lock_guard<std::mutex> lock(jobMutex);
+			activeWorkers--;
+		}
+
+		jobFinished.notify_all();
+	}
+}
+
+void TaskScheduler::runItems(uint32_t worker, const Task& task) {
+	uint32_t index;
+
+	while (popLocal(worker, index) || steal(worker, index)) {
+		try {
+			task(index, worker);
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> lock(jobMutex);
+			if (!firstException) {
+				firstException = std::current_exception();
+			}
+		}
+	}
+}
+
+bool TaskScheduler::popLocal(uint32_t worker, uint32_t& index) {
+	WorkerQueue& queue = *queues[worker];
+	std::lock_guard<std::mutex> lock(queue.mutex);
+
+	if (queue.items.empty()) {
+		return false;
+	}
+
+	index = queue.items.back();
+	queue.items.pop_back();
+
+	return true;
+}
+
+bool TaskScheduler::steal(uint32_t worker, uint32_t& index) {
+	uint32_t workerCount = getWorkerCount();
+
+	for (uint32_t offset = 1; offset < workerCount; offset++) {
+		WorkerQueue& victim = *queues[(worker + offset) % workerCount];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+
+		if (!victim.items.empty()) {
+			index = victim.items.front();
+			victim.items.pop_front();
+			stealCount++;
+
+			return true;
+		}
+	}
+
+	return false;
+}
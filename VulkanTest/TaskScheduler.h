@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed pool of worker threads that runs parallel loops with work stealing. Every loop index is
+// handed out up front in contiguous runs, one deque per worker. Workers pop from the back of their
+// own deque and steal from the front of a victim's deque once theirs is empty, so uneven work (for
+// example image tiles with very different costs) still keeps every core busy.
+class TaskScheduler {
+public:
+	using Task = std::function<void(uint32_t index, uint32_t worker)>;
+
+	// A thread count of 0 uses every hardware thread. The calling thread counts as worker 0.
+	explicit TaskScheduler(uint32_t threadCount = 0);
+	~TaskScheduler();
+
+	TaskScheduler(const TaskScheduler&) = delete;
+	TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+	// Runs task for every index in [0, count) and returns once all of them have finished. The first
+	// exception thrown by a task is rethrown here.
+	void parallelFor(uint32_t count, const Task& task);
+
+	uint32_t getWorkerCount() const {
+		return static_cast<uint32_t>(queues.size());
+	}
+
+	uint64_t getStealCount() const {
+		return stealCount.load();
+	}
+
+private:
+	struct WorkerQueue {
+		std::mutex mutex;
+		std::deque<uint32_t> items;
+	};
+
+	void workerThread(uint32_t worker);
+	void runItems(uint32_t worker, const Task& task);
+	bool popLocal(uint32_t worker, uint32_t& index);
+	bool steal(uint32_t worker, uint32_t& index);
+
+	std::vector<std::unique_ptr<WorkerQueue>> queues;
+	std::vector<std::thread> threads;
+
+	std::mutex jobMutex;
+	std::condition_variable jobStarted;
+	std::condition_variable jobFinished;
+	const Task* currentTask = nullptr;
+	uint64_t jobGeneration = 0;
+	uint32_t activeWorkers = 0;
+	bool stopping = false;
+	std::exception_ptr firstException;
+
+	std::atomic<uint64_t> stealCount{ 0 };
+};
@@ -0,0 +1,411 @@
+#include "TileCoordinator.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+#endif
+
+namespace {
+	// How often render checks for late tiles and lost workers while waiting for connections
+	constexpr uint32_t PollMilliseconds = 50;
+
+	// Workers exit on their own once told there are no tiles left, this is for the ones that hang
+	constexpr uint32_t ExitTimeoutMilliseconds = 5000;
+
+	double secondsBetween(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+		return std::chrono::duration<double>(end - start).count();
+	}
+
+#ifdef _WIN32
+	// Quotes an argument so the C runtime of the started process splits it back out unchanged
+	std::string quoteArgument(const std::string& argument) {
+		if (!argument.empty() && argument.find_first_of(" \t\"") == std::string::npos) {
+			return argument;
+		}
+
+		std::string quoted = "\"";
+		size_t backslashes = 0;
+
+		for (char c : argument) {
+			if (c == '\\') {
+				backslashes++;
+				continue;
+			}
+
+			// Backslashes only escape when a quote follows them
+			quoted.append(c == '"' ? backslashes * 2 + 1 : backslashes, '\\');
+			quoted += c;
+			backslashes = 0;
+		}
+
+		quoted.append(backslashes * 2, '\\');
+		quoted += '"';
+		return quoted;
+	}
+#endif
+}
+
+TileCoordinator::TileCoordinator(const TileCoordinatorSettings& settings)
+	: settings(settings), listener(Socket::listen(settings.address.empty() ? "127.0.0.1:0" : settings.address)) { }
+
+TileCoordinator::~TileCoordinator() {
+	waitForWorkers();
+}
+
+void TileCoordinator::spawnWorker(const std::string& executable, const std::vector<std::string>& arguments) {
+#ifdef _WIN32
+	std::string commandLine = quoteArgument(executable);
+	for (const std::string& argument : arguments) {
+		commandLine += " " + quoteArgument(argument);
+	}
+
+	STARTUPINFOA startupInfo = {};
+	startupInfo.cb = sizeof(startupInfo);
+	PROCESS_INFORMATION processInfo = {};
+
+	// Without an application name the executable is looked up like on a command prompt, which also adds .exe
+	if (!CreateProcessA(nullptr, &commandLine[0], nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startupInfo, &processInfo)) {
+		throw std::runtime_error("Could not start tile worker " + executable);
+	}
+
+	CloseHandle(processInfo.hThread);
+	processes.push_back(reinterpret_cast<intptr_t>(processInfo.hProcess));
+#else
+	std::vector<char*> argv;
+	argv.push_back(const_cast<char*>(executable.c_str()));
+	for (const std::string& argument : arguments) {
+		argv.push_back(const_cast<char*>(argument.c_str()));
+	}
+	argv.push_back(nullptr);
+
+	pid_t processId;
+	if (posix_spawnp(&processId, executable.c_str(), nullptr, nullptr, argv.data(), environ) != 0) {
+		throw std::runtime_error("Could not start tile worker " + executable);
+	}
+
+	processes.push_back(processId);
+#endif
+}
+
+DistributedRenderStats TileCoordinator::render(std::vector<float>& output) {
+	uint32_t tileSize = std::max(1u, settings.tileSize);
+	uint32_t tilesX = (settings.width + tileSize - 1) / tileSize;
+	uint32_t tilesY = (settings.height + tileSize - 1) / tileSize;
+
+	output.assign(static_cast<size_t>(settings.width) * settings.height * 3, 0.0f);
+
+	std::unique_lock<std::mutex> lock(mutex);
+
+	radiance = &output;
+	tiles.assign(tilesX * tilesY, Tile());
+	queue.clear();
+
+	for (uint32_t i = 0; i < tiles.size(); i++) {
+		Tile& tile = tiles[i];
+		tile.x0 = (i % tilesX) * tileSize;
+		tile.y0 = (i / tilesX) * tileSize;
+		tile.x1 = std::min(tile.x0 + tileSize, settings.width);
+		tile.y1 = std::min(tile.y0 + tileSize, settings.height);
+		tile.queued = true;
+		queue.push_back(i);
+	}
+
+	completedCount = 0;
+	requeuedCount = 0;
+	completedSeconds = 0.0;
+	finished = tiles.empty();
+	started = false;
+
+	Clock::time_point renderStart = Clock::now();
+	Clock::time_point lastConnected = renderStart;
+	std::string error;
+
+	while (!finished) {
+		lock.unlock();
+		Socket socket = listener.accept(PollMilliseconds);
+		lock.lock();
+
+		Clock::time_point now = Clock::now();
+
+		if (socket.isValid() && !finished) {
+			connections.push_back(std::make_unique<Connection>());
+			Connection& connection = *connections.back();
+			connection.socket = std::move(socket);
+			connection.tile = NoTile;
+			connection.thread = std::thread([this, &connection] { serveWorker(connection); });
+		}
+
+		bool connected = std::any_of(connections.begin(), connections.end(), [](const std::unique_ptr<Connection>& connection) { return !connection->closed; });
+		if (connected) {
+			lastConnected = now;
+		}
+		else if (!finished && secondsBetween(lastConnected, now) > settings.connectTimeoutSeconds) {
+			error = started ? "Lost every tile worker with " + std::to_string(tiles.size() - completedCount) + " of " + std::to_string(tiles.size()) + " tiles left" :
+				"No tile worker connected to " + getAddress() + " within " + std::to_string(settings.connectTimeoutSeconds) + "s";
+			finished = true;
+		}
+
+		requeueLateTiles(now);
+	}
+
+	// Idle workers are told there is nothing left by their threads. The ones still busy with tiles that
+	// others already returned are cut off, like connections that never said hello.
+	tileQueued.notify_all();
+	for (auto& connection : connections) {
+		if (connection->tile != NoTile || connection->stats.name.empty()) {
+			connection->socket.shutdown();
+		}
+	}
+
+	lock.unlock();
+
+	for (auto& connection : connections) {
+		connection->thread.join();
+	}
+
+	DistributedRenderStats stats;
+	stats.tileCount = static_cast<uint32_t>(tiles.size());
+	stats.requeuedCount = requeuedCount;
+
+	if (started) {
+		stats.startupSeconds = secondsBetween(renderStart, startTime);
+		stats.seconds = secondsBetween(startTime, finishTime);
+	}
+
+	for (auto& connection : connections) {
+		// Connections that never introduced themselves were not workers
+		if (!connection->stats.name.empty()) {
+			stats.rayCount += connection->stats.rayCount;
+			stats.workers.push_back(connection->stats);
+		}
+	}
+
+	connections.clear();
+	radiance = nullptr;
+
+	waitForWorkers();
+
+	if (!error.empty()) {
+		throw std::runtime_error(error);
+	}
+
+	return stats;
+}
+
+void TileCoordinator::serveWorker(Connection& connection) {
+	Clock::time_point connectTime = Clock::now();
+
+	TileMessage hello;
+	if (!connection.socket.receiveAll(&hello, sizeof(hello)) || hello.magic != TileProtocolMagic || hello.type != TileMessageType::Hello) {
+		std::lock_guard<std::mutex> lock(mutex);
+		connection.closed = true;
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		connection.stats.name = "worker " + std::to_string(hello.processId);
+
+		if (!started) {
+			started = true;
+			startTime = Clock::now();
+		}
+	}
+
+	TileMessage job;
+	job.type = TileMessageType::Job;
+	job.width = settings.width;
+	job.height = settings.height;
+	job.samplesPerPixel = settings.samplesPerPixel;
+	job.maxBounces = settings.maxBounces;
+	job.frameIndex = settings.frameIndex;
+
+	bool connected = connection.socket.sendAll(&job, sizeof(job));
+	std::vector<float> pixels;
+
+	while (connected) {
+		uint32_t tileIndex = takeTile(connection);
+
+		if (tileIndex == NoTile) {
+			TileMessage done;
+			done.type = TileMessageType::Done;
+			connection.socket.sendAll(&done, sizeof(done));
+			break;
+		}
+
+		// The rectangles do not change during a render, only the flags next to them
+		const Tile& tile = tiles[tileIndex];
+
+		TileMessage request;
+		request.type = TileMessageType::Tile;
+		request.tileIndex = tileIndex;
+		request.x0 = tile.x0;
+		request.y0 = tile.y0;
+		request.x1 = tile.x1;
+		request.y1 = tile.y1;
+
+		TileMessage result;
+		pixels.resize(static_cast<size_t>(tile.x1 - tile.x0) * (tile.y1 - tile.y0) * 3);
+
+		connected = connection.socket.sendAll(&request, sizeof(request)) && connection.socket.receiveAll(&result, sizeof(result)) &&
+			result.magic == TileProtocolMagic && result.type == TileMessageType::Result && result.tileIndex == tileIndex &&
+			connection.socket.receiveAll(pixels.data(), pixels.size() * sizeof(float));
+
+		if (connected) {
+			completeTile(connection, tileIndex, result, pixels);
+		}
+		else {
+			requeueTile(connection, tileIndex);
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	connection.closed = true;
+	connection.tile = NoTile;
+	connection.stats.failed = !connected && !finished;
+	connection.stats.connectedSeconds = secondsBetween(connectTime, Clock::now());
+}
+
+uint32_t TileCoordinator::takeTile(Connection& connection) {
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true) {
+		tileQueued.wait(lock, [this] { return finished || !queue.empty(); });
+
+		if (finished) {
+			return NoTile;
+		}
+
+		uint32_t tileIndex = queue.front();
+		queue.pop_front();
+		tiles[tileIndex].queued = false;
+
+		// Late tiles are queued while their first worker keeps going, which may return them first
+		if (tiles[tileIndex].done) {
+			continue;
+		}
+
+		connection.tile = tileIndex;
+		connection.tileStart = Clock::now();
+		connection.late = false;
+		return tileIndex;
+	}
+}
+
+void TileCoordinator::requeueTile(Connection& connection, uint32_t tileIndex) {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	connection.tile = NoTile;
+
+	Tile& tile = tiles[tileIndex];
+	if (!tile.done && !tile.queued) {
+		tile.queued = true;
+		queue.push_front(tileIndex);
+		requeuedCount++;
+		tileQueued.notify_one();
+	}
+}
+
+void TileCoordinator::completeTile(Connection& connection, uint32_t tileIndex, const TileMessage& result, const std::vector<float>& pixels) {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	connection.tile = NoTile;
+
+	Tile& tile = tiles[tileIndex];
+	if (tile.done) {
+		connection.stats.discardedCount++;
+		return;
+	}
+
+	tile.done = true;
+
+	size_t rowFloats = static_cast<size_t>(tile.x1 - tile.x0) * 3;
+	for (uint32_t y = tile.y0; y < tile.y1; y++) {
+		std::memcpy(&(*radiance)[(static_cast<size_t>(y) * settings.width + tile.x0) * 3], &pixels[(y - tile.y0) * rowFloats], rowFloats * sizeof(float));
+	}
+
+	connection.stats.tileCount++;
+	connection.stats.rayCount += result.rayCount;
+	connection.stats.renderMilliseconds += result.milliseconds;
+
+	completedSeconds += secondsBetween(connection.tileStart, Clock::now());
+	completedCount++;
+
+	if (completedCount == tiles.size()) {
+		finishTime = Clock::now();
+		finished = true;
+		tileQueued.notify_all();
+	}
+}
+
+void TileCoordinator::requeueLateTiles(Clock::time_point now) {
+	// Nothing to judge a tile against before the first one returned, lost workers are still noticed
+	if (completedCount == 0) {
+		return;
+	}
+
+	double deadline = std::max(settings.slowTileSeconds, SlowTileFactor * completedSeconds / completedCount);
+
+	for (auto& connection : connections) {
+		if (connection->tile == NoTile || connection->late || secondsBetween(connection->tileStart, now) < deadline) {
+			continue;
+		}
+
+		connection->late = true;
+		connection->stats.lateCount++;
+
+		Tile& tile = tiles[connection->tile];
+		if (!tile.done && !tile.queued) {
+			tile.queued = true;
+			queue.push_front(connection->tile);
+			requeuedCount++;
+			tileQueued.notify_one();
+		}
+	}
+}
+
+void TileCoordinator::waitForWorkers() {
+#ifdef _WIN32
+	for (intptr_t process : processes) {
+		HANDLE handle = reinterpret_cast<HANDLE>(process);
+
+		if (WaitForSingleObject(handle, ExitTimeoutMilliseconds) == WAIT_TIMEOUT) {
+			TerminateProcess(handle, 1);
+			WaitForSingleObject(handle, INFINITE);
+		}
+
+		CloseHandle(handle);
+	}
+#else
+	Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(ExitTimeoutMilliseconds);
+
+	for (intptr_t process : processes) {
+		pid_t processId = static_cast<pid_t>(process);
+		int status;
+
+		while (waitpid(processId, &status, WNOHANG) == 0) {
+			if (Clock::now() > deadline) {
+				kill(processId, SIGKILL);
+				waitpid(processId, &status, 0);
+				break;
+			}
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+	}
+#endif
+
+	processes.clear();
+}
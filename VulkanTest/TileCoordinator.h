@@ -0,0 +1,190 @@
+#pragma once
+
+#include "Socket.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+constexpr uint32_t TileProtocolMagic = 0x54524b56; // "VKRT"
+
+enum class TileMessageType : uint32_t {
+	// Worker to coordinator once connected, with processId
+	Hello,
+	// Coordinator to worker once, with the frame every following tile belongs to
+	Job,
+	// Coordinator to worker, with the rectangle to render
+	Tile,
+	// Worker to coordinator, followed by three linear floats per pixel of the rectangle, row by row
+	Result,
+	// Coordinator to worker when there are no tiles left
+	Done
+};
+
+// Every message between TileCoordinator and TileWorker, with only the fields of its type set. Sent as
+// is, so both ends must share the byte order, which they always do on one machine.
+struct TileMessage {
+	uint32_t magic = TileProtocolMagic;
+	TileMessageType type = TileMessageType::Done;
+	uint32_t processId = 0;
+
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t samplesPerPixel = 0;
+	uint32_t maxBounces = 0;
+	uint32_t frameIndex = 0;
+
+	uint32_t tileIndex = 0;
+	uint32_t x0 = 0;
+	uint32_t y0 = 0;
+	uint32_t x1 = 0;
+	uint32_t y1 = 0;
+	// Keeps the 64 bit fields aligned without padding, which would send uninitialized bytes
+	uint32_t reserved = 0;
+
+	uint64_t rayCount = 0;
+	double milliseconds = 0.0;
+};
+
+static_assert(sizeof(TileMessage) == 72, "TileMessage must have the same layout in every build");
+
+struct TileCoordinatorSettings {
+	// Empty listens on a free port of the loopback address
+	std::string address;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t tileSize = 64;
+	uint32_t samplesPerPixel = 16;
+	uint32_t maxBounces = 4;
+	uint32_t frameIndex = 0;
+	// A tile is late once it has been out for SlowTileFactor times the mean time of the tiles returned so far,
+	// and at least this long. Late tiles are handed to the next idle worker as well and the first result wins.
+	double slowTileSeconds = 1.0;
+	// Gives up when no worker has been connected for this long
+	double connectTimeoutSeconds = 30.0;
+};
+
+struct TileWorkerStats {
+	std::string name;
+	uint32_t tileCount = 0;
+	// Tiles that were handed to another worker as well since this one was slow with them
+	uint32_t lateCount = 0;
+	// Results that arrived after another worker had already returned the tile
+	uint32_t discardedCount = 0;
+	uint64_t rayCount = 0;
+	// Time the worker spent rendering the tiles it returned, as it measured it
+	double renderMilliseconds = 0.0;
+	double connectedSeconds = 0.0;
+	// Lost the connection before there were no tiles left
+	bool failed = false;
+
+	double tilesPerSecond() const {
+		return connectedSeconds > 0.0 ? tileCount / connectedSeconds : 0.0;
+	}
+};
+
+struct DistributedRenderStats {
+	std::vector<TileWorkerStats> workers;
+	uint32_t tileCount = 0;
+	// Tiles handed out again, because their worker was late or disconnected
+	uint32_t requeuedCount = 0;
+	uint64_t rayCount = 0;
+	// From the start of render until the first worker connected, which includes loading its scene
+	double startupSeconds = 0.0;
+	// From the first worker connecting until the last tile returned
+	double seconds = 0.0;
+
+	double tilesPerSecond() const {
+		return seconds > 0.0 ? tileCount / seconds : 0.0;
+	}
+};
+
+// Splits a frame into tiles and hands them out to worker processes connected over a socket, see TileWorker.
+// Every worker connection is served by its own thread, which sends the worker its next tile as soon as the
+// previous one returned, so faster workers take more tiles. The tiles of workers that disconnect go back
+// to the front of the queue, and those of slow workers are handed out a second time without waiting for
+// the first worker to give up.
+//
+// Workers can be processes the coordinator spawns or ones started by hand, on this machine or another
+// one that can reach the listening address.
+class TileCoordinator {
+public:
+	// Listens right away, so workers can be pointed at getAddress() before render
+	explicit TileCoordinator(const TileCoordinatorSettings& settings);
+	~TileCoordinator();
+
+	TileCoordinator(const TileCoordinator&) = delete;
+	TileCoordinator& operator=(const TileCoordinator&) = delete;
+
+	const std::string& getAddress() const {
+		return listener.getAddress();
+	}
+
+	// Starts executable with arguments, which must make it a worker of this coordinator. Workers that
+	// are still running once render has returned are waited for, and terminated after a while.
+	void spawnWorker(const std::string& executable, const std::vector<std::string>& arguments);
+
+	// Renders every tile through the workers into radiance, three linear floats per pixel. Throws if no
+	// worker connects within the connect timeout.
+	DistributedRenderStats render(std::vector<float>& radiance);
+
+	// Tile results arrive within this many times the mean tile time, or count as late
+	static constexpr double SlowTileFactor = 4.0;
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	struct Tile {
+		uint32_t x0, y0, x1, y1;
+		bool queued = false;
+		bool done = false;
+	};
+
+	struct Connection {
+		Socket socket;
+		std::thread thread;
+		TileWorkerStats stats;
+		// The tile being rendered, or NoTile
+		uint32_t tile;
+		Clock::time_point tileStart;
+		bool late = false;
+		bool closed = false;
+	};
+
+	static constexpr uint32_t NoTile = ~0u;
+
+	void serveWorker(Connection& connection);
+	// Blocks until a tile is waiting or every tile is done, in which case it returns NoTile
+	uint32_t takeTile(Connection& connection);
+	void requeueTile(Connection& connection, uint32_t tile);
+	void completeTile(Connection& connection, uint32_t tile, const TileMessage& result, const std::vector<float>& pixels);
+	// Hands out the tiles of late workers again, called with the mutex held
+	void requeueLateTiles(Clock::time_point now);
+	void waitForWorkers();
+
+	TileCoordinatorSettings settings;
+	Socket listener;
+
+	std::mutex mutex;
+	std::condition_variable tileQueued;
+	std::vector<Tile> tiles;
+	std::deque<uint32_t> queue;
+	std::vector<std::unique_ptr<Connection>> connections;
+	std::vector<float>* radiance = nullptr;
+	uint32_t completedCount = 0;
+	uint32_t requeuedCount = 0;
+	double completedSeconds = 0.0;
+	bool finished = false;
+	bool started = false;
+	Clock::time_point startTime;
+	Clock::time_point finishTime;
+
+	// HANDLEs on Windows, process ids elsewhere
+	std::vector<intptr_t> processes;
+};
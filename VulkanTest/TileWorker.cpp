@@ -0,0 +1,93 @@
+#include "TileWorker.h"
+
+#include "Socket.h"
+#include "TileCoordinator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+uint32_t TileWorker::run(const std::string& address) {
+	Socket socket = Socket::connect(address);
+
+	TileMessage hello;
+	hello.type = TileMessageType::Hello;
+#ifdef _WIN32
+	hello.processId = static_cast<uint32_t>(GetCurrentProcessId());
+#else
+	hello.processId = static_cast<uint32_t>(getpid());
+#endif
+
+	TileMessage job;
+	if (!socket.sendAll(&hello, sizeof(hello)) || !socket.receiveAll(&job, sizeof(job))) {
+		return 0;
+	}
+
+	if (job.magic != TileProtocolMagic || job.type != TileMessageType::Job) {
+		throw std::runtime_error("Could not start tile worker, " + address + " is not a tile coordinator");
+	}
+
+	CpuRenderSettings settings;
+	settings.width = job.width;
+	settings.height = job.height;
+	settings.samplesPerPixel = job.samplesPerPixel;
+	settings.maxBounces = job.maxBounces;
+	settings.frameIndex = job.frameIndex;
+
+	uint32_t tileCount = 0;
+	std::vector<float> pixels;
+
+	while (true) {
+		TileMessage request;
+		if (!socket.receiveAll(&request, sizeof(request)) || request.type != TileMessageType::Tile) {
+			// Done, or the coordinator went away, which it does when another worker returned this tile first
+			return tileCount;
+		}
+
+		if (request.magic != TileProtocolMagic || request.x0 >= request.x1 || request.x1 > job.width || request.y0 >= request.y1 || request.y1 > job.height) {
+			throw std::runtime_error("Could not render tile, " + address + " sent a rectangle outside the frame");
+		}
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		uint32_t width = request.x1 - request.x0;
+		uint32_t height = request.y1 - request.y0;
+		uint32_t subTilesX = (width + SubTileSize - 1) / SubTileSize;
+		uint32_t subTilesY = (height + SubTileSize - 1) / SubTileSize;
+
+		pixels.resize(static_cast<size_t>(width) * height * 3);
+		std::atomic<uint64_t> rayCount{ 0 };
+
+		scheduler.parallelFor(subTilesX * subTilesY, [&](uint32_t index, uint32_t) {
+			uint32_t x0 = (index % subTilesX) * SubTileSize;
+			uint32_t y0 = (index / subTilesX) * SubTileSize;
+			uint32_t x1 = std::min(x0 + SubTileSize, width);
+			uint32_t y1 = std::min(y0 + SubTileSize, height);
+
+			float* subTile = &pixels[(static_cast<size_t>(y0) * width + x0) * 3];
+			rayCount += tracer.renderTile(settings, request.x0 + x0, request.y0 + y0, request.x0 + x1, request.y0 + y1, subTile, width);
+		});
+
+		TileMessage result;
+		result.type = TileMessageType::Result;
+		result.tileIndex = request.tileIndex;
+		result.rayCount = rayCount.load();
+		result.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		if (!socket.sendAll(&result, sizeof(result)) || !socket.sendAll(pixels.data(), pixels.size() * sizeof(float))) {
+			return tileCount;
+		}
+
+		tileCount++;
+	}
+}
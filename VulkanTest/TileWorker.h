@@ -0,0 +1,26 @@
+#pragma once
+
+#include "CpuTracer.h"
+#include "TaskScheduler.h"
+
+#include <cstdint>
+#include <string>
+
+// Renders the tiles a TileCoordinator hands out with the CPU tracer. Every tile is split into smaller
+// ones that the scheduler's threads share, so one worker process per machine can use all of its cores.
+// The scene is loaded by the process from its own command line, which must match the coordinator's.
+class TileWorker {
+public:
+	TileWorker(const CpuTracer& tracer, TaskScheduler& scheduler) : tracer(tracer), scheduler(scheduler) { }
+
+	// Connects to the coordinator at address and renders tiles until it has none left or the connection
+	// breaks. Returns the number of tiles sent back.
+	uint32_t run(const std::string& address);
+
+	// Edge length of the pieces a tile is split into for the scheduler
+	static constexpr uint32_t SubTileSize = 16;
+
+private:
+	const CpuTracer& tracer;
+	TaskScheduler& scheduler;
+};
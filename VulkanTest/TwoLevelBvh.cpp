@@ -0,0 +1,123 @@
+#include "TwoLevelBvh.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+void TwoLevelBvh::buildBottomLevels(std::vector<Triangle>& triangles, std::vector<Mesh>& meshes, TaskScheduler& scheduler) {
+	auto start = std::chrono::high_resolution_clock::now();
+
+	uint32_t meshCount = static_cast<uint32_t>(meshes.size());
+	std::vector<std::vector<BvhNode>> meshNodes(meshCount);
+
+	// Every mesh is built on one worker, meshes are few next to their triangles
+	scheduler.parallelFor(meshCount, [&](uint32_t index, uint32_t) {
+		const Mesh& mesh = meshes[index];
+
+		if (mesh.triangleCount == 0) {
+			return;
+		}
+
+		std::vector<Triangle> meshTriangles(triangles.begin() + mesh.firstTriangle, triangles.begin() + mesh.firstTriangle + mesh.triangleCount);
+
+		Bvh bvh;
+		bvh.build(meshTriangles);
+
+		std::copy(meshTriangles.begin(), meshTriangles.end(), triangles.begin() + mesh.firstTriangle);
+		meshNodes[index] = bvh.getNodes();
+	});
+
+	bottomNodes.clear();
+
+	for (uint32_t i = 0; i < meshCount; i++) {
+		uint32_t nodeOffset = static_cast<uint32_t>(bottomNodes.size());
+		meshes[i].rootNode = nodeOffset;
+
+		for (BvhNode node : meshNodes[i]) {
+			node.leftFirst += node.isLeaf() ? meshes[i].firstTriangle : nodeOffset;
+			bottomNodes.push_back(node);
+		}
+
+		// Meshes without triangles get an empty box no ray enters, so they need no special case
+		if (meshNodes[i].empty()) {
+			BvhNode empty = {};
+			empty.boundsMin = glm::vec3(std::numeric_limits<float>::max());
+			empty.boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+			empty.leftFirst = meshes[i].firstTriangle;
+			bottomNodes.push_back(empty);
+		}
+	}
+
+	stats.meshCount = meshCount;
+	stats.bottomNodeCount = static_cast<uint32_t>(bottomNodes.size());
+	stats.bottomMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void TwoLevelBvh::buildTopLevel(const BvhNode* meshNodes, const Mesh* meshes, const MeshInstance* sourceInstances, uint32_t instanceCount) {
+	auto start = std::chrono::high_resolution_clock::now();
+
+	std::vector<BvhBox> boxes;
+	std::vector<uint32_t> sourceIndices;
+	boxes.reserve(instanceCount);
+	sourceIndices.reserve(instanceCount);
+
+	// World bounds of an instance are the bounds of its mesh's root box with all eight corners transformed
+	for (uint32_t i = 0; i < instanceCount; i++) {
+		const MeshInstance& instance = sourceInstances[i];
+		const Mesh& mesh = meshes[instance.meshId];
+
+		if (mesh.triangleCount == 0) {
+			continue;
+		}
+
+		const BvhNode& root = meshNodes[mesh.rootNode];
+
+		BvhBox box;
+		box.boundsMin = glm::vec3(std::numeric_limits<float>::max());
+		box.boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+
+		for (int corner = 0; corner < 8; corner++) {
+			glm::vec3 point((corner & 1) ? root.boundsMax.x : root.boundsMin.x, (corner & 2) ? root.boundsMax.y : root.boundsMin.y,
+				(corner & 4) ? root.boundsMax.z : root.boundsMin.z);
+			glm::vec3 world = glm::vec3(instance.transform * glm::vec4(point, 1.0f));
+
+			box.boundsMin = glm::min(box.boundsMin, world);
+			box.boundsMax = glm::max(box.boundsMax, world);
+		}
+
+		boxes.push_back(box);
+		sourceIndices.push_back(i);
+	}
+
+	Bvh topLevel;
+	std::vector<uint32_t> order = topLevel.build(boxes);
+	topNodes = topLevel.getNodes();
+
+	instances.resize(order.size());
+	leafInstances.resize(order.size());
+
+	for (size_t i = 0; i < order.size(); i++) {
+		const MeshInstance& source = sourceInstances[sourceIndices[order[i]]];
+		const Mesh& mesh = meshes[source.meshId];
+
+		// glm is column major, so row r of the inverse is element r of every column
+		glm::mat4 worldToObject = glm::inverse(source.transform);
+
+		BvhInstance& instance = instances[i];
+		for (int row = 0; row < 3; row++) {
+			instance.worldToObject[row] = glm::vec4(worldToObject[0][row], worldToObject[1][row], worldToObject[2][row], worldToObject[3][row]);
+		}
+		instance.rootNode = mesh.rootNode;
+		instance.firstTriangle = mesh.firstTriangle;
+		instance.meshId = source.meshId;
+		instance.pad0 = 0;
+
+		leafInstances[i] = source;
+	}
+
+	stats.instanceCount = static_cast<uint32_t>(instances.size());
+	stats.topNodeCount = static_cast<uint32_t>(topNodes.size());
+	stats.topMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "Bvh.h"
+#include "Scene.h"
+#include "TaskScheduler.h"
+
+#include <glm/vec4.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// 64 byte instance shared with the GPU tracer. Rays are taken into the mesh's space with the rows of the
+// inverse transform, w holding the translation, and traced through the mesh's BVH from rootNode.
+struct BvhInstance {
+	glm::vec4 worldToObject[3];
+	uint32_t rootNode;
+	uint32_t firstTriangle;
+	uint32_t meshId;
+	uint32_t pad0;
+};
+
+struct TwoLevelBvhStats {
+	uint32_t meshCount = 0;
+	uint32_t instanceCount = 0;
+	uint32_t bottomNodeCount = 0;
+	uint32_t topNodeCount = 0;
+	double bottomMilliseconds = 0.0;
+	double topMilliseconds = 0.0;
+};
+
+// BVH over instanced meshes. Every mesh has its own bottom level BVH, built once over its triangles in the
+// mesh's space. The top level BVH is built over the world space bounds of the instances, and its leaves
+// reference ranges of instances, so moving instances only needs the top level to be rebuilt, which is
+// cheap next to building one BVH over every instance's triangles.
+//
+// The bottom levels of all meshes are stored one after another in a single node array with absolute
+// indices, children pointing into that array and leaves into the scene's triangles, so the tracers walk
+// them with the same loop as a single BVH starting at the mesh's root node.
+class TwoLevelBvh {
+public:
+	// Builds the BVH of every mesh, meshes in parallel, and sets their root nodes. The triangles of every
+	// mesh are reordered within its range so that each leaf references a contiguous range.
+	void buildBottomLevels(std::vector<Triangle>& triangles, std::vector<Mesh>& meshes, TaskScheduler& scheduler);
+
+	// Builds the top level over the instances, leaving out instances of meshes without triangles. Can be
+	// repeated whenever the instances move. meshNodes are the bottom levels the meshes' root nodes refer to.
+	void buildTopLevel(const BvhNode* meshNodes, const Mesh* meshes, const MeshInstance* instances, uint32_t instanceCount);
+
+	const std::vector<BvhNode>& getBottomNodes() const {
+		return bottomNodes;
+	}
+
+	const std::vector<BvhNode>& getTopNodes() const {
+		return topNodes;
+	}
+
+	// Instances in the leaf order of the top level
+	const std::vector<BvhInstance>& getInstances() const {
+		return instances;
+	}
+
+	// The source instances in the same order, for the hardware top level
+	const std::vector<MeshInstance>& getLeafInstances() const {
+		return leafInstances;
+	}
+
+	const TwoLevelBvhStats& getStats() const {
+		return stats;
+	}
+
+private:
+	std::vector<BvhNode> bottomNodes;
+	std::vector<BvhNode> topNodes;
+	std::vector<BvhInstance> instances;
+	std::vector<MeshInstance> leafInstances;
+
+	TwoLevelBvhStats stats;
+};
@@ -0,0 +1,369 @@
+#include "WavefrontTracer.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+
+namespace {
+	// Sizes of Path, Hit and ShadowRay in raytrace.comp
+	constexpr VkDeviceSize PathSize = 80;
+	constexpr VkDeviceSize HitSize = 16;
+	constexpr VkDeviceSize ShadowRaySize = 48;
+
+	constexpr uint32_t LightsBinding = 9;
+
+	// Must match the Dispatch constants in raytrace.comp
+	constexpr uint32_t DispatchIntersect = 0;
+	constexpr uint32_t DispatchShade = 1;
+	constexpr uint32_t DispatchShadow = 2;
+
+	// Everything runs on one queue in submission order, so global barriers are enough. Every stage reads
+	// what the ones before it wrote, the queue counts also as indirect dispatch arguments.
+	void barrier(VkCommandBuffer commandBuffer, VkPipelineStageFlags sourceStage, VkAccessFlags sourceAccess, VkPipelineStageFlags destinationStage,
+		VkAccessFlags destinationAccess) {
+		VkMemoryBarrier memoryBarrier = {};
+		memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		memoryBarrier.srcAccessMask = sourceAccess;
+		memoryBarrier.dstAccessMask = destinationAccess;
+
+		vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+	}
+
+	void barrier(VkCommandBuffer commandBuffer, VkPipelineStageFlags sourceStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VkAccessFlags sourceAccess = VK_ACCESS_SHADER_WRITE_BIT) {
+		barrier(commandBuffer, sourceStage, sourceAccess, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+			VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+	}
+
+	// The fill must not start before earlier stages, or the previous frame, are done with the counts
+	void beforeFill(VkCommandBuffer commandBuffer) {
+		barrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+			VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_ACCESS_TRANSFER_WRITE_BIT);
+	}
+}
+
+std::vector<WavefrontLight> WavefrontTracer::gatherLights(const SceneData& scene) {
+	std::vector<WavefrontLight> lights;
+	float totalArea = 0.0f;
+
+	auto addLights = [&](uint32_t first, uint32_t count, const glm::mat4& transform) {
+		for (uint32_t i = first; i < first + count; i++) {
+			const Triangle& triangle = scene.triangles[i];
+
+			if (triangle.materialId >= scene.materialCount) {
+				continue;
+			}
+
+			glm::vec3 emission = scene.materials[triangle.materialId].emission;
+			if (std::max(emission.x, std::max(emission.y, emission.z)) <= 0.0f) {
+				continue;
+			}
+
+			WavefrontLight light = {};
+			light.v0 = glm::vec3(transform * glm::vec4(triangle.v0, 1.0f));
+			light.edge1 = glm::vec3(transform * glm::vec4(triangle.v1, 1.0f)) - light.v0;
+			light.edge2 = glm::vec3(transform * glm::vec4(triangle.v2, 1.0f)) - light.v0;
+			light.materialId = triangle.materialId;
+
+			// Degenerate triangles would never be picked and have no normal to sample with
+			float area = 0.5f * glm::length(glm::cross(light.edge1, light.edge2));
+			if (!(area > 0.0f)) {
+				continue;
+			}
+
+			totalArea += area;
+			light.cdf = totalArea;
+			lights.push_back(light);
+		}
+	};
+
+	if (scene.instanceCount == 0) {
+		addLights(0, scene.triangleCount, glm::mat4(1.0f));
+	}
+	else {
+		for (uint32_t i = 0; i < scene.instanceCount; i++) {
+			const MeshInstance& instance = scene.instances[i];
+			const Mesh& mesh = scene.meshes[instance.meshId];
+
+			addLights(mesh.firstTriangle, mesh.triangleCount, instance.transform);
+		}
+	}
+
+	for (auto& light : lights) {
+		light.cdf /= totalArea;
+		light.pdf = 1.0f / totalArea;
+	}
+
+	// Rounding must not leave picks close to 1 past the last light
+	if (!lights.empty()) {
+		lights.back().cdf = 1.0f;
+	}
+
+	return lights;
+}
+
+void WavefrontTracer::createPipelines(VkDevice device, VkPipelineCache pipelineCache, VkShaderModule shader, VkDescriptorSetLayout traceSetLayout,
+	uint32_t tracePushConstantSize) {
+	this->device = device;
+	this->tracePushConstantSize = tracePushConstantSize;
+
+	VkDescriptorSetLayoutBinding bindings[BufferCount + 1] = {};
+
+	for (uint32_t i = 0; i < BufferCount + 1; i++) {
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {};
+	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutCreateInfo.bindingCount = BufferCount + 1;
+	layoutCreateInfo.pBindings = bindings;
+
+	if (vkCreateDescriptorSetLayout(device, &layoutCreateInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Could not create wavefront descriptor set layout");
+	}
+
+	// One range over both blocks, so the trace constants and the tracer's own can be pushed separately
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = tracePushConstantSize + sizeof(WavefrontPushConstants);
+
+	VkDescriptorSetLayout setLayouts[2] = { traceSetLayout, descriptorSetLayout };
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutCreateInfo.setLayoutCount = 2;
+	pipelineLayoutCreateInfo.pSetLayouts = setLayouts;
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+	if (vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Could not create wavefront pipeline layout");
+	}
+
+	for (uint32_t stage = 0; stage < StageCount; stage++) {
+		pipelines[stage] = createPipeline(device, pipelineCache, shader, stage);
+	}
+}
+
+// Every stage is the same module specialized on constant 0, so the driver drops the code of the others
+VkPipeline WavefrontTracer::createPipeline(VkDevice device, VkPipelineCache pipelineCache, VkShaderModule shader, uint32_t stage) {
+	VkSpecializationMapEntry specializationEntry = {};
+	specializationEntry.constantID = 0;
+	specializationEntry.offset = 0;
+	specializationEntry.size = sizeof(uint32_t);
+
+	VkSpecializationInfo specializationInfo = {};
+	specializationInfo.mapEntryCount = 1;
+	specializationInfo.pMapEntries = &specializationEntry;
+	specializationInfo.dataSize = sizeof(stage);
+	specializationInfo.pData = &stage;
+
+	VkComputePipelineCreateInfo pipelineCreateInfo = {};
+	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineCreateInfo.stage.module = shader;
+	pipelineCreateInfo.stage.pName = "main";
+	pipelineCreateInfo.stage.pSpecializationInfo = &specializationInfo;
+	pipelineCreateInfo.layout = pipelineLayout;
+
+	VkPipeline pipeline;
+	if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipeline) != VK_SUCCESS) {
+		throw std::runtime_error("Could not create wavefront pipeline");
+	}
+
+	return pipeline;
+}
+
+void WavefrontTracer::createBuffers(VkDevice device, MemoryAllocator& allocator, VkExtent2D extent, uint32_t materialCount, VkBuffer lightBuffer,
+	uint32_t lightCount) {
+	this->device = device;
+	this->lightCount = lightCount;
+	pathCount = extent.width * extent.height;
+
+	// The material bins cover every entry of the material buffer, which holds one element even when empty
+	VkDeviceSize elementCount = std::max(1u, pathCount);
+
+	VkDeviceSize sizes[BufferCount] = {};
+	sizes[Paths] = PathSize * elementCount;
+	sizes[Hits] = HitSize * elementCount;
+	sizes[ShadowRays] = ShadowRaySize * elementCount;
+	sizes[RayQueues] = sizeof(uint32_t) * 2 * elementCount;
+	sizes[HitQueue] = sizeof(uint32_t) * elementCount;
+	sizes[ShadowQueue] = sizeof(uint32_t) * elementCount;
+	sizes[SortedHits] = sizeof(uint32_t) * elementCount;
+	sizes[MaterialBins] = sizeof(uint32_t) * std::max(1u, materialCount);
+	sizes[Queues] = sizeof(WavefrontQueues);
+
+	for (uint32_t i = 0; i < BufferCount; i++) {
+		VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+		if (i == Queues) {
+			usage |= VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		}
+
+		allocator.createBuffer(sizes[i], usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, buffers[i].buffer, buffers[i].memory);
+	}
+
+	VkDescriptorPoolSize poolSize = {};
+	poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSize.descriptorCount = BufferCount + 1;
+
+	VkDescriptorPoolCreateInfo poolCreateInfo = {};
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolCreateInfo.maxSets = 1;
+	poolCreateInfo.poolSizeCount = 1;
+	poolCreateInfo.pPoolSizes = &poolSize;
+
+	if (vkCreateDescriptorPool(device, &poolCreateInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
+		throw std::runtime_error("Could not create wavefront descriptor pool");
+	}
+
+	VkDescriptorSetAllocateInfo allocateInfo = {};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocateInfo.descriptorPool = descriptorPool;
+	allocateInfo.descriptorSetCount = 1;
+	allocateInfo.pSetLayouts = &descriptorSetLayout;
+
+	if (vkAllocateDescriptorSets(device, &allocateInfo, &descriptorSet) != VK_SUCCESS) {
+		throw std::runtime_error("Could not allocate wavefront descriptor set");
+	}
+
+	VkDescriptorBufferInfo bufferInfos[BufferCount + 1] = {};
+	VkWriteDescriptorSet writes[BufferCount + 1] = {};
+
+	for (uint32_t i = 0; i < BufferCount + 1; i++) {
+		bufferInfos[i].buffer = i == LightsBinding ? lightBuffer : buffers[i].buffer;
+		bufferInfos[i].offset = 0;
+		bufferInfos[i].range = VK_WHOLE_SIZE;
+
+		writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[i].dstSet = descriptorSet;
+		writes[i].dstBinding = i;
+		writes[i].descriptorCount = 1;
+		writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		writes[i].pBufferInfo = &bufferInfos[i];
+	}
+
+	vkUpdateDescriptorSets(device, BufferCount + 1, writes, 0, nullptr);
+}
+
+std::function<void()> WavefrontTracer::retireBuffers(MemoryAllocator& allocator) {
+	std::vector<Buffer> retiredBuffers(std::begin(buffers), std::end(buffers));
+	VkDescriptorPool retiredPool = descriptorPool;
+
+	for (auto& buffer : buffers) {
+		buffer = Buffer();
+	}
+
+	descriptorPool = VK_NULL_HANDLE;
+	descriptorSet = VK_NULL_HANDLE;
+	pathCount = 0;
+
+	return [device = device, &allocator, retiredBuffers, retiredPool]() mutable {
+		vkDestroyDescriptorPool(device, retiredPool, nullptr);
+
+		for (auto& buffer : retiredBuffers) {
+			if (buffer.buffer != VK_NULL_HANDLE) {
+				allocator.destroyBuffer(buffer.buffer, buffer.memory);
+			}
+		}
+	};
+}
+
+void WavefrontTracer::destroy(MemoryAllocator& allocator) {
+	retireBuffers(allocator)();
+
+	for (auto& pipeline : pipelines) {
+		vkDestroyPipeline(device, pipeline, nullptr);
+		pipeline = VK_NULL_HANDLE;
+	}
+
+	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+
+	pipelineLayout = VK_NULL_HANDLE;
+	descriptorSetLayout = VK_NULL_HANDLE;
+}
+
+void WavefrontTracer::record(VkCommandBuffer commandBuffer, VkDescriptorSet traceSet, const void* traceConstants, uint32_t samplesPerPixel,
+	uint32_t maxBounces, bool sortMaterials) {
+	VkDescriptorSet sets[2] = { traceSet, descriptorSet };
+
+	// Binding a pipeline with the same layout keeps both, so they are set once for every stage
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 2, sets, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, tracePushConstantSize, traceConstants);
+
+	WavefrontPushConstants constants = {};
+	constants.lightCount = lightCount;
+
+	uint32_t pathGroups = (pathCount + WorkgroupSize - 1) / WorkgroupSize;
+
+	for (uint32_t sample = 0; sample < samplesPerPixel; sample++) {
+		constants.sampleIndex = sample;
+		constants.bounce = 0;
+
+		// Generation appends to the first ray queue, the prepare stage of every bounce clears the ones after it
+		beforeFill(commandBuffer);
+		vkCmdFillBuffer(commandBuffer, buffers[Queues].buffer, offsetof(WavefrontQueues, queueCounts), sizeof(uint32_t), 0);
+		barrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
+
+		dispatch(commandBuffer, GenerateStage, constants, pathGroups);
+		barrier(commandBuffer);
+
+		for (uint32_t bounce = 0; bounce < maxBounces; bounce++) {
+			constants.bounce = bounce;
+
+			dispatch(commandBuffer, PrepareStage, constants, 1);
+			barrier(commandBuffer);
+
+			dispatchIndirect(commandBuffer, IntersectStage, constants, DispatchIntersect);
+			barrier(commandBuffer);
+
+			dispatch(commandBuffer, SizeDispatchesStage, constants, 1);
+			barrier(commandBuffer);
+
+			if (sortMaterials) {
+				dispatch(commandBuffer, SortScanStage, constants, 1);
+				barrier(commandBuffer);
+
+				dispatchIndirect(commandBuffer, SortScatterStage, constants, DispatchShade);
+				barrier(commandBuffer);
+			}
+
+			dispatchIndirect(commandBuffer, ShadeStage, constants, DispatchShade);
+			barrier(commandBuffer);
+
+			// The last bounce queues no shadow rays, its paths could not take the bounce they stand for
+			if (lightCount > 0 && bounce + 1 < maxBounces) {
+				dispatch(commandBuffer, SizeDispatchesStage, constants, 1);
+				barrier(commandBuffer);
+
+				dispatchIndirect(commandBuffer, ShadowStage, constants, DispatchShadow);
+				barrier(commandBuffer);
+			}
+		}
+	}
+
+	dispatch(commandBuffer, ResolveStage, constants, pathGroups);
+}
+
+void WavefrontTracer::dispatch(VkCommandBuffer commandBuffer, Stage stage, const WavefrontPushConstants& constants, uint32_t groupCount) {
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines[stage]);
+	vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, tracePushConstantSize, sizeof(WavefrontPushConstants), &constants);
+
+	vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+}
+
+void WavefrontTracer::dispatchIndirect(VkCommandBuffer commandBuffer, Stage stage, const WavefrontPushConstants& constants, uint32_t dispatchIndex) {
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines[stage]);
+	vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, tracePushConstantSize, sizeof(WavefrontPushConstants), &constants);
+
+	vkCmdDispatchIndirect(commandBuffer, buffers[Queues].buffer, offsetof(WavefrontQueues, dispatches) + sizeof(uint32_t) * 4 * dispatchIndex);
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "MemoryAllocator.h"
+#include "SceneCache.h"
+
+#include <glm/vec3.hpp>
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Mirrors Light in raytrace.comp
+struct WavefrontLight {
+	glm::vec3 v0;
+	float cdf;
+	glm::vec3 edge1;
+	uint32_t materialId;
+	glm::vec3 edge2;
+	float pdf;
+};
+
+static_assert(sizeof(WavefrontLight) == 48, "WavefrontLight must match the std430 layout of Light");
+
+// Mirrors the fields raytrace.comp adds to its push constants when built with WAVEFRONT. They directly
+// follow the trace push constants, whose size is given to createPipelines.
+struct WavefrontPushConstants {
+	uint32_t sampleIndex;
+	uint32_t bounce;
+	uint32_t lightCount;
+};
+
+// Mirrors the Queues buffer in raytrace.comp
+struct WavefrontQueues {
+	uint32_t dispatches[3][4];
+	uint32_t queueCounts[4];
+};
+
+// Path tracer split into one compute stage per kind of work, after Laine et al. 2013, "Megakernels
+// Considered Harmful: Wavefront Path Tracing on GPUs". The single kernel tracer keeps a pixel's paths in one
+// invocation, so once paths end at different bounces or hit different materials most of a workgroup idles.
+// Here each stage runs over a queue of the paths that need it, which keeps every invocation busy:
+//
+//   generate    starts one sample of every pixel and queues its camera ray
+//   intersect   traces the ray queue, finishes paths that leave the scene and queues the hits
+//   sort        optionally groups the hits by material with a counting sort
+//   shade       gathers emission, queues the next bounce and a shadow ray towards a light
+//   shadow      traces the shadow rays and adds the light of the unoccluded ones to their paths
+//   resolve     accumulates and writes every pixel like the single kernel tracer
+//
+// Queues are packed by appending through an atomic count per queue. A single invocation stage turns the
+// counts into VkDispatchIndirectCommands, so the stages after it are sized on the GPU and nothing is read
+// back between bounces. Every stage is raytrace.comp built with WAVEFRONT, so the traversal, the sampling
+// and the pixel output are the same code as the single kernel. Its descriptor set is bound as set 0, the
+// tracer's own buffers as set 1.
+//
+// Shading differs in one way: light reached through a diffuse bounce is sampled with shadow rays towards
+// the scene's emissive triangles instead of waiting for a path to run into it, which converges faster for
+// small lights. Both estimate the same image. Scenes without emissive triangles trace no shadow rays.
+//
+// Paths are processed one sample per pixel at a time, so the buffers grow with the pixel count and not
+// the sample count. All of them are shared by the frames in flight, which run in submission order on one queue.
+class WavefrontTracer {
+public:
+	// Invocations per workgroup of every stage. Must match local_size_x in raytrace.comp.
+	static constexpr uint32_t WorkgroupSize = 256;
+
+	// Emissive triangles in world space, instanced ones once per instance, with their cumulative areas
+	static std::vector<WavefrontLight> gatherLights(const SceneData& scene);
+
+	// Creates the layout of set 1 and the pipelines of every stage over traceSetLayout and it. Only touches
+	// the device and the cache, so it can run on a worker thread. Must finish before createBuffers.
+	void createPipelines(VkDevice device, VkPipelineCache pipelineCache, VkShaderModule shader, VkDescriptorSetLayout traceSetLayout,
+		uint32_t tracePushConstantSize);
+
+	// Sizes the paths and queues for one path per pixel of extent. lightBuffer holds lightCount
+	// WavefrontLights, at least one element even without lights.
+	void createBuffers(VkDevice device, MemoryAllocator& allocator, VkExtent2D extent, uint32_t materialCount, VkBuffer lightBuffer, uint32_t lightCount);
+
+	// Forgets the buffers and descriptor set, so createBuffers can replace them while frames in flight still
+	// use the old ones. Calling the result destroys the old ones.
+	std::function<void()> retireBuffers(MemoryAllocator& allocator);
+
+	void destroy(MemoryAllocator& allocator);
+
+	// Records every stage of samplesPerPixel samples of up to maxBounces bounces. traceConstants are the
+	// push constants of the single kernel tracer, with the sort flag set when sortMaterials is. Leaves the
+	// trace outputs written for the commands after it, like the single kernel dispatch.
+	void record(VkCommandBuffer commandBuffer, VkDescriptorSet traceSet, const void* traceConstants, uint32_t samplesPerPixel, uint32_t maxBounces,
+		bool sortMaterials);
+
+	uint32_t getLightCount() const {
+		return lightCount;
+	}
+
+private:
+	// Must match the Stage constants in raytrace.comp
+	enum Stage : uint32_t {
+		GenerateStage,
+		PrepareStage,
+		IntersectStage,
+		SizeDispatchesStage,
+		SortScanStage,
+		SortScatterStage,
+		ShadeStage,
+		ShadowStage,
+		ResolveStage,
+		StageCount
+	};
+
+	// Bound at the binding of their index in set 1, the lights follow them
+	enum BufferIndex : uint32_t {
+		Paths,
+		Hits,
+		ShadowRays,
+		RayQueues,
+		HitQueue,
+		ShadowQueue,
+		SortedHits,
+		MaterialBins,
+		Queues,
+		BufferCount
+	};
+
+	struct Buffer {
+		VkBuffer buffer = VK_NULL_HANDLE;
+		Allocation memory;
+	};
+
+	VkPipeline createPipeline(VkDevice device, VkPipelineCache pipelineCache, VkShaderModule shader, uint32_t stage);
+	void dispatch(VkCommandBuffer commandBuffer, Stage stage, const WavefrontPushConstants& constants, uint32_t groupCount);
+	// Takes the group count from dispatches[dispatchIndex] of the queues buffer
+	void dispatchIndirect(VkCommandBuffer commandBuffer, Stage stage, const WavefrontPushConstants& constants, uint32_t dispatchIndex);
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	VkPipeline pipelines[StageCount] = {};
+	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+	VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+	uint32_t tracePushConstantSize = 0;
+
+	Buffer buffers[BufferCount];
+	uint32_t pathCount = 0;
+	uint32_t lightCount = 0;
+};
@@ -0,0 +1,474 @@
+#include "WideBvh.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+namespace {
+	constexpr float RayEpsilon = 1e-4f;
+	constexpr float NoHitDistance = 1e30f;
+	constexpr uint32_t CacheLineSize = 64;
+
+	uint32_t leafReference(uint32_t firstTriangle, uint32_t triangleCount) {
+		return WideBvh::LeafFlag | ((triangleCount - 1) << 28) | firstTriangle;
+	}
+
+	float area(const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+		glm::vec3 extent = boundsMax - boundsMin;
+		return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+	}
+
+	float safeInverse(float value) {
+		return 1.0f / (std::fabs(value) > 1e-8f ? value : std::copysign(1e-8f, value));
+	}
+
+	// Same slab test as the tracers, with the planes given as the ray's distances to them
+	bool intersectSlabs(const glm::vec3& t1, const glm::vec3& t2, float tFar, float& tNear) {
+		glm::vec3 tMin = glm::min(t1, t2);
+		glm::vec3 tMax = glm::max(t1, t2);
+
+		tNear = std::max(std::max(tMin.x, tMin.y), std::max(tMin.z, 0.0f));
+		float tExit = std::min(std::min(tMax.x, tMax.y), std::min(tMax.z, tFar));
+
+		return tNear <= tExit;
+	}
+
+	void intersectTriangles(const std::vector<Triangle>& triangles, uint32_t first, uint32_t count, const BvhRay& ray, float& t, BvhTraversalStats& stats) {
+		for (uint32_t i = first; i < first + count; i++) {
+			const Triangle& triangle = triangles[i];
+			glm::vec3 edge1 = triangle.v1 - triangle.v0;
+			glm::vec3 edge2 = triangle.v2 - triangle.v0;
+
+			glm::vec3 p = glm::cross(ray.direction, edge2);
+			float determinant = glm::dot(edge1, p);
+			float inverseDeterminant = 1.0f / determinant;
+
+			glm::vec3 toOrigin = ray.origin - triangle.v0;
+			float u = glm::dot(toOrigin, p) * inverseDeterminant;
+
+			glm::vec3 q = glm::cross(toOrigin, edge1);
+			float v = glm::dot(ray.direction, q) * inverseDeterminant;
+			float distance = glm::dot(edge2, q) * inverseDeterminant;
+
+			if (std::fabs(determinant) > 1e-9f && u >= 0.0f && v >= 0.0f && u + v <= 1.0f && distance > RayEpsilon && distance < t) {
+				t = distance;
+			}
+		}
+
+		stats.triangleTests += count;
+	}
+
+	void recordHit(float t, size_t rayIndex, std::vector<float>* hitT, BvhTraversalStats& stats) {
+		stats.rayCount++;
+
+		if (t < NoHitDistance) {
+			stats.hitCount++;
+		}
+
+		if (hitT != nullptr) {
+			(*hitT)[rayIndex] = t < NoHitDistance ? t : -1.0f;
+		}
+	}
+}
+
+void WideBvh::collapse(const BvhNode* binaryNodes, size_t nodeCount) {
+	auto start = std::chrono::high_resolution_clock::now();
+
+	nodes.clear();
+	children.clear();
+	stackSizes.clear();
+	stats = WideBvhStats();
+
+	if (nodeCount == 0) {
+		return;
+	}
+
+	// Roughly one wide node for every six binary nodes, with most of the eight slots filled
+	nodes.reserve(nodeCount / 6 + 1);
+	children.reserve(nodes.capacity() * Width);
+	stackSizes.reserve(nodes.capacity());
+
+	const BvhNode& root = binaryNodes[0];
+
+	for (size_t i = 0; i < nodeCount; i++) {
+		const BvhNode& node = binaryNodes[i];
+
+		if (node.isLeaf() && node.leftFirst + node.count > MaxTriangles) {
+			throw std::runtime_error("Could not collapse the BVH, the scene has more than " + std::to_string(MaxTriangles) + " triangles");
+		}
+	}
+
+	// A root that is a leaf still gets a node, so traversal always starts at node 0
+	if (root.isLeaf()) {
+		if (root.count > MaxLeafSize) {
+			splitLeaf(root);
+		}
+		else {
+			uint32_t nodeIndex = addNode();
+			Child child = { root.boundsMin, root.boundsMax, leafReference(root.leftFirst, root.count) };
+			writeNode(nodeIndex, &child, 1);
+			stats.leafCount++;
+		}
+	}
+	else {
+		collapseNode(binaryNodes, root);
+	}
+
+	// The root is pushed before anything is taken off the stack
+	stats.nodeCount = static_cast<uint32_t>(nodes.size());
+	stats.stackSize = std::max(1u, stackSizes[0]);
+	stats.collapseMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	stackSizes.clear();
+	stackSizes.shrink_to_fit();
+}
+
+uint32_t WideBvh::addNode() {
+	uint32_t nodeIndex = static_cast<uint32_t>(nodes.size());
+
+	nodes.emplace_back();
+	children.resize(children.size() + Width, 0);
+	stackSizes.push_back(0);
+
+	return nodeIndex;
+}
+
+uint32_t WideBvh::collapseNode(const BvhNode* binaryNodes, const BvhNode& binaryNode) {
+	// Allocated before the children so that the root ends up at 0 and parents before their children
+	uint32_t nodeIndex = addNode();
+
+	BvhNode open[Width];
+	uint32_t openCount = 0;
+	open[openCount++] = binaryNodes[binaryNode.leftFirst];
+	open[openCount++] = binaryNodes[binaryNode.leftFirst + 1];
+
+	// Opening the largest child first keeps the boxes a ray is likely to enter in this node
+	while (openCount < Width) {
+		int largest = -1;
+		float largestArea = -1.0f;
+
+		for (uint32_t i = 0; i < openCount; i++) {
+			float childArea = area(open[i].boundsMin, open[i].boundsMax);
+
+			if (!open[i].isLeaf() && childArea > largestArea) {
+				largest = static_cast<int>(i);
+				largestArea = childArea;
+			}
+		}
+
+		if (largest < 0) {
+			break;
+		}
+
+		BvhNode opened = open[largest];
+		open[largest] = binaryNodes[opened.leftFirst];
+		open[openCount++] = binaryNodes[opened.leftFirst + 1];
+	}
+
+	Child nodeChildren[Width];
+	uint32_t interiorCount = 0;
+	uint32_t deepestChild = 0;
+
+	for (uint32_t i = 0; i < openCount; i++) {
+		const BvhNode& child = open[i];
+		nodeChildren[i].boundsMin = child.boundsMin;
+		nodeChildren[i].boundsMax = child.boundsMax;
+
+		if (child.isLeaf() && child.count <= MaxLeafSize) {
+			nodeChildren[i].reference = leafReference(child.leftFirst, child.count);
+			stats.leafCount++;
+			continue;
+		}
+
+		uint32_t childIndex = child.isLeaf() ? splitLeaf(child) : collapseNode(binaryNodes, child);
+		nodeChildren[i].reference = childIndex;
+		interiorCount++;
+		deepestChild = std::max(deepestChild, stackSizes[childIndex]);
+	}
+
+	// Taking this node off pushes its interior children, then the nearest of them is taken off again and its
+	// own subtree grows the stack from there
+	stackSizes[nodeIndex] = interiorCount == 0 ? 0 : std::max(interiorCount, interiorCount - 1 + deepestChild);
+
+	writeNode(nodeIndex, nodeChildren, openCount);
+
+	return nodeIndex;
+}
+
+uint32_t WideBvh::splitLeaf(const BvhNode& leaf) {
+	uint32_t nodeIndex = addNode();
+
+	uint32_t childCount = std::min(Width, (leaf.count + MaxLeafSize - 1) / MaxLeafSize);
+
+	Child nodeChildren[Width];
+	uint32_t interiorCount = 0;
+	uint32_t deepestChild = 0;
+
+	// Every part keeps the bounds of the whole leaf, the triangles are not at hand to tighten them
+	for (uint32_t i = 0; i < childCount; i++) {
+		BvhNode part = leaf;
+		part.leftFirst = leaf.leftFirst + leaf.count * i / childCount;
+		part.count = leaf.leftFirst + leaf.count * (i + 1) / childCount - part.leftFirst;
+
+		nodeChildren[i].boundsMin = leaf.boundsMin;
+		nodeChildren[i].boundsMax = leaf.boundsMax;
+
+		if (part.count <= MaxLeafSize) {
+			nodeChildren[i].reference = leafReference(part.leftFirst, part.count);
+			stats.leafCount++;
+			continue;
+		}
+
+		uint32_t childIndex = splitLeaf(part);
+		nodeChildren[i].reference = childIndex;
+		interiorCount++;
+		deepestChild = std::max(deepestChild, stackSizes[childIndex]);
+	}
+
+	stackSizes[nodeIndex] = interiorCount == 0 ? 0 : std::max(interiorCount, interiorCount - 1 + deepestChild);
+
+	writeNode(nodeIndex, nodeChildren, childCount);
+
+	return nodeIndex;
+}
+
+void WideBvh::writeNode(uint32_t nodeIndex, const Child* nodeChildren, uint32_t childCount) {
+	glm::vec3 boundsMin(std::numeric_limits<float>::max());
+	glm::vec3 boundsMax(-std::numeric_limits<float>::max());
+
+	for (uint32_t i = 0; i < childCount; i++) {
+		boundsMin = glm::min(boundsMin, nodeChildren[i].boundsMin);
+		boundsMax = glm::max(boundsMax, nodeChildren[i].boundsMax);
+	}
+
+	WideBvhNode& node = nodes[nodeIndex];
+	node = WideBvhNode();
+	node.origin = boundsMin;
+	node.childCount = static_cast<uint8_t>(childCount);
+
+	for (int axis = 0; axis < 3; axis++) {
+		float origin = boundsMin[axis];
+		float extent = boundsMax[axis] - origin;
+
+		// The smallest power of two that covers the extent in 255 steps. frexp gives extent / 255 as a
+		// mantissa below 1 times 2^exponent, so 2^exponent is above it.
+		int exponent = -126;
+		if (extent > 0.0f) {
+			std::frexp(extent / 255.0f, &exponent);
+		}
+
+		int biased = std::min(std::max(exponent + 127, 1), 254);
+		float scale = std::ldexp(1.0f, biased - 127);
+
+		// The last step has to reach the upper plane after rounding too
+		while (biased < 254 && origin + 255.0f * scale < boundsMax[axis]) {
+			biased++;
+			scale *= 2.0f;
+		}
+
+		node.exponents[axis] = static_cast<uint8_t>(biased);
+
+		for (uint32_t i = 0; i < childCount; i++) {
+			float lowerPlane = nodeChildren[i].boundsMin[axis];
+			float upperPlane = nodeChildren[i].boundsMax[axis];
+
+			int lower = std::min(std::max(static_cast<int>(std::floor((lowerPlane - origin) / scale)), 0), 255);
+			int upper = std::min(std::max(static_cast<int>(std::ceil((upperPlane - origin) / scale)), 0), 255);
+
+			// Division and the addition when decoding both round, so step outwards until the decoded planes
+			// contain the exact ones
+			while (lower > 0 && origin + lower * scale > lowerPlane) {
+				lower--;
+			}
+
+			while (upper < 255 && origin + upper * scale < upperPlane) {
+				upper++;
+			}
+
+			node.bounds[2 * axis][i] = static_cast<uint8_t>(lower);
+			node.bounds[2 * axis + 1][i] = static_cast<uint8_t>(upper);
+		}
+	}
+
+	for (uint32_t i = 0; i < childCount; i++) {
+		children[static_cast<size_t>(nodeIndex) * Width + i] = nodeChildren[i].reference;
+	}
+}
+
+BvhTraversalStats WideBvh::measure(const std::vector<Triangle>& triangles, const std::vector<BvhRay>& rays, std::vector<float>* hitT) const {
+	BvhTraversalStats traversal;
+
+	if (hitT != nullptr) {
+		hitT->assign(rays.size(), -1.0f);
+	}
+
+	struct StackEntry {
+		uint32_t node;
+		float tNear;
+	};
+
+	std::vector<StackEntry> stack(std::max(1u, stats.stackSize));
+
+	for (size_t rayIndex = 0; rayIndex < rays.size(); rayIndex++) {
+		const BvhRay& ray = rays[rayIndex];
+		glm::vec3 inverseDirection(safeInverse(ray.direction.x), safeInverse(ray.direction.y), safeInverse(ray.direction.z));
+		float t = NoHitDistance;
+
+		uint32_t stackSize = 0;
+
+		if (!nodes.empty()) {
+			stack[stackSize++] = { 0, 0.0f };
+		}
+
+		// The same walk as the tracers: leaves are intersected as they are found, interior children pushed
+		// farthest first
+		while (stackSize > 0) {
+			StackEntry entry = stack[--stackSize];
+
+			if (entry.tNear >= t) {
+				continue;
+			}
+
+			const WideBvhNode& node = nodes[entry.node];
+			traversal.steps++;
+			traversal.nodeBytes += sizeof(WideBvhNode);
+			traversal.cacheLines++;
+
+			glm::vec3 scale(std::ldexp(1.0f, node.exponents[0] - 127), std::ldexp(1.0f, node.exponents[1] - 127), std::ldexp(1.0f, node.exponents[2] - 127));
+			glm::vec3 planeOffset = (node.origin - ray.origin) * inverseDirection;
+			glm::vec3 planeStep = scale * inverseDirection;
+
+			StackEntry hits[Width];
+			uint32_t hitCount = 0;
+			bool readChildren = false;
+
+			for (uint32_t i = 0; i < node.childCount; i++) {
+				glm::vec3 lower(node.bounds[0][i], node.bounds[2][i], node.bounds[4][i]);
+				glm::vec3 upper(node.bounds[1][i], node.bounds[3][i], node.bounds[5][i]);
+
+				float tNear;
+				if (!intersectSlabs(planeOffset + lower * planeStep, planeOffset + upper * planeStep, t, tNear)) {
+					continue;
+				}
+
+				uint32_t reference = children[static_cast<size_t>(entry.node) * Width + i];
+				traversal.nodeBytes += sizeof(uint32_t);
+				readChildren = true;
+
+				if ((reference & LeafFlag) != 0) {
+					intersectTriangles(triangles, reference & (MaxTriangles - 1), ((reference >> 28) & 7u) + 1, ray, t, traversal);
+					continue;
+				}
+
+				// Sorted by distance, farthest first
+				uint32_t slot = hitCount++;
+				while (slot > 0 && hits[slot - 1].tNear < tNear) {
+					hits[slot] = hits[slot - 1];
+					slot--;
+				}
+				hits[slot] = { reference, tNear };
+			}
+
+			// A node's eight references share half a cache line
+			if (readChildren) {
+				traversal.cacheLines++;
+			}
+
+			for (uint32_t i = 0; i < hitCount; i++) {
+				stack[stackSize++] = hits[i];
+			}
+		}
+
+		recordHit(t, rayIndex, hitT, traversal);
+	}
+
+	return traversal;
+}
+
+BvhTraversalStats WideBvh::measureBinary(const std::vector<BvhNode>& nodes, const std::vector<Triangle>& triangles, const std::vector<BvhRay>& rays,
+	std::vector<float>* hitT) {
+	BvhTraversalStats traversal;
+
+	if (hitT != nullptr) {
+		hitT->assign(rays.size(), -1.0f);
+	}
+
+	struct StackEntry {
+		uint32_t node;
+		float tNear;
+	};
+
+	StackEntry stack[Bvh::MaxDepth + 1];
+
+	auto intersectNode = [&](const BvhNode& node, const BvhRay& ray, const glm::vec3& inverseDirection, float t, float& tNear) {
+		return intersectSlabs((node.boundsMin - ray.origin) * inverseDirection, (node.boundsMax - ray.origin) * inverseDirection, t, tNear);
+	};
+
+	auto cacheLine = [](uint32_t nodeIndex) {
+		return static_cast<size_t>(nodeIndex) * sizeof(BvhNode) / CacheLineSize;
+	};
+
+	for (size_t rayIndex = 0; rayIndex < rays.size(); rayIndex++) {
+		const BvhRay& ray = rays[rayIndex];
+		glm::vec3 inverseDirection(safeInverse(ray.direction.x), safeInverse(ray.direction.y), safeInverse(ray.direction.z));
+		float t = NoHitDistance;
+
+		uint32_t stackSize = 0;
+		float rootNear;
+
+		if (!nodes.empty() && intersectNode(nodes[0], ray, inverseDirection, t, rootNear)) {
+			stack[stackSize++] = { 0, rootNear };
+		}
+
+		// The walk of traverseMesh in raytrace.comp, which reads the node taken off the stack and then both children
+		while (stackSize > 0) {
+			StackEntry entry = stack[--stackSize];
+
+			if (entry.tNear >= t) {
+				continue;
+			}
+
+			const BvhNode& node = nodes[entry.node];
+			traversal.steps++;
+			traversal.nodeBytes += sizeof(BvhNode);
+			traversal.cacheLines++;
+
+			if (node.isLeaf()) {
+				intersectTriangles(triangles, node.leftFirst, node.count, ray, t, traversal);
+				continue;
+			}
+
+			traversal.nodeBytes += 2 * sizeof(BvhNode);
+
+			// Siblings share a line unless the pair straddles one, and the parent only by chance
+			size_t leftLine = cacheLine(node.leftFirst);
+			size_t rightLine = cacheLine(node.leftFirst + 1);
+			traversal.cacheLines += (leftLine != cacheLine(entry.node) ? 1 : 0) + (rightLine != leftLine && rightLine != cacheLine(entry.node) ? 1 : 0);
+
+			float leftNear, rightNear;
+			bool hitLeft = intersectNode(nodes[node.leftFirst], ray, inverseDirection, t, leftNear);
+			bool hitRight = intersectNode(nodes[node.leftFirst + 1], ray, inverseDirection, t, rightNear);
+
+			if (hitLeft && hitRight) {
+				bool leftFirst = leftNear <= rightNear;
+				stack[stackSize++] = leftFirst ? StackEntry{ node.leftFirst + 1, rightNear } : StackEntry{ node.leftFirst, leftNear };
+				stack[stackSize++] = leftFirst ? StackEntry{ node.leftFirst, leftNear } : StackEntry{ node.leftFirst + 1, rightNear };
+			}
+			else if (hitLeft) {
+				stack[stackSize++] = { node.leftFirst, leftNear };
+			}
+			else if (hitRight) {
+				stack[stackSize++] = { node.leftFirst + 1, rightNear };
+			}
+		}
+
+		recordHit(t, rayIndex, hitT, traversal);
+	}
+
+	return traversal;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "Bvh.h"
+#include "Scene.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// 64 byte node shared with the GPU tracer, one cache line holding the boxes of up to eight children. Every
+// child box is stored as one byte per plane in steps of scale = 2^(exponent - 127) from origin, the lower
+// corner of the node's own box, rounded outwards so the quantized boxes always contain the exact ones.
+// Child c of axis a has its lower plane in bounds[2 * a][c] and its upper plane in bounds[2 * a + 1][c].
+// Slots from childCount on are unused.
+struct alignas(64) WideBvhNode {
+	glm::vec3 origin;
+	uint8_t exponents[3];
+	uint8_t childCount;
+	uint8_t bounds[6][8];
+};
+
+static_assert(sizeof(WideBvhNode) == 64, "WideBvhNode must fill one cache line");
+
+struct WideBvhStats {
+	uint32_t nodeCount = 0;
+	uint32_t leafCount = 0;
+	// Deepest traversal stack the layout can need, see WideBvh::MaxStackSize
+	uint32_t stackSize = 0;
+	double collapseMilliseconds = 0.0;
+};
+
+struct BvhRay {
+	glm::vec3 origin;
+	glm::vec3 direction;
+};
+
+// Work of tracing rays one at a time, to compare node layouts. Steps are nodes taken off the stack, bytes
+// and cache lines those of the node records and child references read while doing so.
+struct BvhTraversalStats {
+	uint64_t rayCount = 0;
+	uint64_t hitCount = 0;
+	uint64_t steps = 0;
+	uint64_t nodeBytes = 0;
+	uint64_t cacheLines = 0;
+	uint64_t triangleTests = 0;
+};
+
+// Eight wide BVH collapsed from a binary one. Interior binary nodes are pulled up into their parent, the one
+// with the largest surface area first, until the parent has eight children or only leaves left, which takes
+// the depth of the tree from log2 to roughly log8 and replaces the two 32 byte boxes read per binary step
+// with one 64 byte node.
+//
+// Child references are kept apart from the nodes, eight per node, since only the ones of the children a ray
+// enters are read. A reference is a node index, or for leaves LeafFlag with the triangle count less one in
+// bits 28 to 30 and the first triangle below. Leaves refer to the same triangles as the binary BVH.
+class WideBvh {
+public:
+	// Collapses the binary BVH in binaryNodes, whose leaves must reference the scene's triangles. Throws if
+	// the scene has more triangles than a child reference can address.
+	void collapse(const BvhNode* binaryNodes, size_t nodeCount);
+
+	const std::vector<WideBvhNode>& getNodes() const {
+		return nodes;
+	}
+
+	const std::vector<uint32_t>& getChildren() const {
+		return children;
+	}
+
+	const WideBvhStats& getStats() const {
+		return stats;
+	}
+
+	// Whether both tracers' stacks are deep enough for this BVH, they fall back to the binary one otherwise
+	bool isTraversable() const {
+		return !nodes.empty() && stats.stackSize <= MaxStackSize;
+	}
+
+	// Traces the rays through this BVH and through the binary one it was collapsed from, counting the work.
+	// hitT receives the closest hit distance per ray, or a negative value on a miss.
+	BvhTraversalStats measure(const std::vector<Triangle>& triangles, const std::vector<BvhRay>& rays, std::vector<float>* hitT = nullptr) const;
+	static BvhTraversalStats measureBinary(const std::vector<BvhNode>& nodes, const std::vector<Triangle>& triangles, const std::vector<BvhRay>& rays,
+		std::vector<float>* hitT = nullptr);
+
+	static constexpr uint32_t Width = 8;
+	static constexpr uint32_t LeafFlag = 0x80000000u;
+	static constexpr uint32_t MaxLeafSize = 8;
+	static constexpr uint32_t MaxTriangles = 1u << 28;
+	// Stack entries of both tracers. Only interior children are pushed, leaves are intersected right away.
+	static constexpr uint32_t MaxStackSize = 96;
+
+private:
+	struct Child {
+		glm::vec3 boundsMin;
+		glm::vec3 boundsMax;
+		uint32_t reference;
+	};
+
+	uint32_t addNode();
+	uint32_t collapseNode(const BvhNode* binaryNodes, const BvhNode& binaryNode);
+	// Leaves only exceed MaxLeafSize triangles when the binary builder hit its depth limit, larger ones are
+	// spread over the children of a new node
+	uint32_t splitLeaf(const BvhNode& leaf);
+	void writeNode(uint32_t nodeIndex, const Child* nodeChildren, uint32_t childCount);
+
+	std::vector<WideBvhNode> nodes;
+	std::vector<uint32_t> children;
+	// Stack entries the subtree below every node needs, while collapsing
+	std::vector<uint32_t> stackSizes;
+	WideBvhStats stats;
+};
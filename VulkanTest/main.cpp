@@ -1,13 +1,46 @@
+// Extra console output in debug configurations. Validation is chosen at runtime, see RenderSettings.
+#ifdef _DEBUG
 #define DEBUG_BUILD
+#endif
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
 #include <glm/vec4.hpp>
 #include <glm/mat4x4.hpp>
 
+#include "Scene.h"
+#include "Bvh.h"
+#include "CpuTracer.h"
+#include "ImageIO.h"
+#include "PipelineCache.h"
+#include "AssetPack.h"
+#include "MemoryAllocator.h"
+#include "StagingUploader.h"
+#include "Profiler.h"
+#include "CommandRecorder.h"
+#include "TaskScheduler.h"
+#include "TileCoordinator.h"
+#include "TileWorker.h"
+#include "Denoiser.h"
+#include "AccelerationStructure.h"
+#include "GpuBvhBuilder.h"
+#include "ResolutionGovernor.h"
+#include "DebugMessageSink.h"
+#include "CameraPath.h"
+#include "SceneCache.h"
+#include "TwoLevelBvh.h"
+#include "WideBvh.h"
+#include "WavefrontTracer.h"
+
+#ifdef EMBED_SHADERS
+// Generated by shaders/pack_assets.py
+#include "EmbeddedShaders.h"
+#endif
+
 #include <iostream>
 #include <fstream>
 #include <stdexcept>
@@ -16,8 +49,19 @@
 #include <vector>
 #include <algorithm>
 #include <optional>
+#include <map>
 #include <set>
 #include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <memory>
+#include <thread>
+#include <random>
+#include <deque>
 
 const std::vector<const char*> validationLayers = {
 		"VK_LAYER_KHRONOS_validation"
@@ -27,9 +71,19 @@ const std::vector<const char*> deviceExtensions = {
 	VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
 
+// Only enabled when the hardware tracer is used, devices without them fall back to the compute tracer
+const std::vector<const char*> rayQueryExtensions = {
+	VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME,
+	VK_KHR_RAY_QUERY_EXTENSION_NAME,
+	VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME
+};
+
 constexpr auto WIDTH = 1280;
 constexpr auto HEIGHT = 720;
 
+// Per frame scratch space for readbacks and other data that lives for a single frame
+constexpr VkDeviceSize TransientArenaSize = 64 * 1024;
+
 #ifdef DEBUG_BUILD
 #define DEBUG_ERR(m) std::cerr << m
 #define DEBUG_OUT(m) std::cout << m
@@ -41,35 +95,361 @@ constexpr auto HEIGHT = 720;
 struct QueueFamilyIndices {
 	std::optional<uint32_t> graphicsFamily;
 	std::optional<uint32_t> presentFamily;
+	// Dedicated families when the device has them, otherwise the graphics family
+	std::optional<uint32_t> transferFamily;
+	std::optional<uint32_t> computeFamily;
 
-	bool isComplete() {
-		return graphicsFamily.has_value() && presentFamily.has_value();
+	// Headless rendering has no surface, so a present queue is only needed when a window exists
+	bool isComplete(bool requirePresent = true) const {
+		return graphicsFamily.has_value() && (presentFamily.has_value() || !requirePresent);
 	}
 };
 
-struct SwapChainSupportDetails {
-	VkSurfaceCapabilitiesKHR capabilities;
-	std::vector<VkSurfaceFormatKHR> formats;
-	std::vector<VkPresentModeKHR> presentModes;
+enum class RenderBackend {
+	Vulkan,
+	Cpu
+};
+
+// How the Vulkan backend finds the closest triangle along a ray
+enum class TraceMode {
+	// Hardware ray queries where the device supports them, the compute BVH traversal elsewhere
+	Auto,
+	Compute,
+	Hardware
+};
+
+struct RenderSettings {
+	RenderBackend backend = RenderBackend::Vulkan;
+	TraceMode traceMode = TraceMode::Auto;
+	bool headless = false;
+	uint32_t frameCount = 1;
+	std::optional<uint32_t> deviceIndex;
+	std::string outputPath = "output.ppm";
+	uint32_t samplesPerPixel = 16;
+	uint32_t maxBounces = 4;
+	uint32_t threadCount = 0;
+	uint32_t workgroupWidth = 8;
+	uint32_t workgroupHeight = 8;
+	uint32_t framesInFlight = 2;
+	bool usePipelineCache = true;
+	// Empty means pipeline_cache.bin next to the executable
+	std::string pipelineCachePath;
+	// Empty means shaders.pack next to the executable. Ignored when the shaders are embedded.
+	std::string assetPackPath;
+	bool printProfile = false;
+	// Renders one frame, reports the time from startup until it completed and exits
+	bool startupBenchmark = false;
+	// Splits the trace dispatch into bands recorded in parallel secondary command buffers. 1 records it inline.
+	uint32_t traceBands = 1;
+	// Measures how command recording scales with the thread count and exits
+	bool recordBenchmark = false;
+	// Empty means no capture is kept
+	std::string tracePath;
+	// Keeps adding samples to an accumulation image while the camera, scene and parameters stay the same
+	bool progressive = false;
+	// Progressive rendering stops tracing once either limit is reached. 0 disables the limit.
+	uint32_t targetSamples = 0;
+	float noiseThreshold = 0.0f;
+	// Error, in display units, below which an adaptive tile stops taking samples. 0 samples every pixel equally.
+	float adaptiveThreshold = 0.0f;
+	// Shows samples per pixel as a heatmap instead of the image
+	bool sampleHeatmap = false;
+	// Filters the traced image before it is displayed, off unless iterations are given
+	DenoiseSettings denoise;
+	// Builds the BVH with the compute LBVH builder instead of the binned SAH one on the CPU
+	bool gpuBvh = false;
+	// Measures GPU BVH builds and refits over growing triangle counts and exits
+	bool bvhBenchmark = false;
+	// Traces scenes without instances through the eight wide BVH collapsed from the binary one
+	bool wideBvh = false;
+	// Compares the eight wide BVH with the binary one on the CPU and exits
+	bool wideBvhBenchmark = false;
+	// Traces in stages connected by ray queues instead of one kernel per pixel, see WavefrontTracer.h
+	bool wavefront = false;
+	// Groups the hits of every bounce by material before the wavefront tracer shades them
+	bool sortMaterials = false;
+	// Compares the single kernel tracer with the wavefront tracer, with and without sorting, and exits
+	bool wavefrontBenchmark = false;
+	// Lowers the render resolution below the window's to hold a frame time, off unless a target is given
+	ResolutionSettings resolution;
+	// Loads the validation layers, on by default in debug builds. Set by --validation or VKRT_VALIDATION.
+#ifdef DEBUG_BUILD
+	bool validation = true;
+#else
+	bool validation = false;
+#endif
+	DebugMessageFilter validationFilter;
+	// Renders every frame of a camera path headless and writes an image per frame. Empty renders a single view.
+	std::string cameraPath;
+	float batchFramesPerSecond = 24.0f;
+	// OBJ or glTF scene, converted to a cache next to it on first use, or a cache itself. Empty renders the Cornell box.
+	std::string scenePath;
+	// Imports the scene again even though its cache is current
+	bool rebuildSceneCache = false;
+	// Renders a field of this many instanced meshes instead of the Cornell box, 0 for none
+	uint32_t instanceCount = 0;
+	// Compares instanced fields traced through a two level BVH with the same fields flattened and exits
+	bool instancingBenchmark = false;
+	// Renders on the CPU through this many worker processes spawned on this machine, see TileCoordinator.h
+	uint32_t distributedWorkers = 0;
+	// Where the coordinator listens for workers. Empty picks a free port on the loopback address, setting it
+	// renders distributed even without spawned workers, for workers started by hand.
+	std::string coordinatorAddress;
+	uint32_t distributedTileSize = 64;
+	// Shortest time a tile is out before it counts as late and is handed to another worker as well
+	float slowTileSeconds = 1.0f;
+	// Renders with 1, 2, 4 and so on up to distributedWorkers spawned workers of one thread each and exits
+	bool distributedBenchmark = false;
+	// Runs as a worker of the coordinator at this address instead of rendering
+	std::string tileWorkerAddress;
+};
+
+// Mirrors the push constant block in raytrace.comp. Everything is packed into vec4s to keep the
+// std430 offsets obvious.
+struct TracePushConstants {
+	glm::vec4 cameraPosition; // w = tan(verticalFov / 2)
+	glm::vec4 cameraForward; // w = aspect ratio
+	glm::vec4 cameraRight;
+	glm::vec4 cameraUp;
+	glm::vec4 backgroundColor;
+	uint32_t frameIndex;
+	uint32_t samplesPerPixel;
+	uint32_t maxBounces;
+	uint32_t nodeCount;
+	uint32_t accumulatedSamples;
+	uint32_t flags;
+	float adaptiveThreshold;
+	uint32_t maxSamples;
+	uint32_t instanceCount;
+};
+
+constexpr uint32_t TraceFlagAccumulate = 1;
+constexpr uint32_t TraceFlagAdaptive = 2;
+constexpr uint32_t TraceFlagSampleDensity = 4;
+constexpr uint32_t TraceFlagDenoise = 8;
+constexpr uint32_t TraceFlagWideBvh = 16;
+constexpr uint32_t TraceFlagSortMaterials = 32;
+
+// The wavefront tracer pushes its own constants behind these
+static_assert(sizeof(TracePushConstants) + sizeof(WavefrontPushConstants) <= 128, "Push constants exceed the 128 bytes every device supports");
+
+// Mirrors the FrameUniforms block in raytrace.comp. The push constants are already close to the 128 bytes
+// every device supports, so data the trace only needs for the denoiser goes through a uniform buffer.
+struct FrameUniforms {
+	glm::vec4 previousCameraPosition;
+	glm::vec4 previousCameraForward;
+	glm::vec4 previousCameraRight;
+	glm::vec4 previousCameraUp;
+};
+
+// Adaptive sampling decides per square tile of this many pixels. Must match raytrace.comp.
+constexpr uint32_t AdaptiveTileSize = 16;
+
+// Mirrors AdaptiveTile in raytrace.comp
+struct AdaptiveTile {
+	uint32_t sampleCount;
+	uint32_t errorSum;
+};
+
+// Mirrors the Counters buffer in raytrace.comp
+struct TraceCounters {
+	uint32_t rayCount;
+	// Per pixel standard error of the displayed value in 1/NoiseScale units
+	uint32_t noiseSum;
+	uint32_t activeTiles;
+
+	static constexpr float NoiseScale = 256.0f;
+};
+
+// Everything that invalidates the accumulated samples. It is compared every frame rather than having
+// every place that edits the camera, scene or settings remember to reset the accumulation.
+struct AccumulationKey {
+	Camera camera;
+	uint64_t sceneVersion;
+	uint32_t samplesPerPixel;
+	uint32_t maxBounces;
+	VkExtent2D extent;
+
+	bool operator==(const AccumulationKey& other) const {
+		return camera.position == other.camera.position && camera.forward == other.camera.forward && camera.up == other.camera.up &&
+			camera.verticalFov == other.camera.verticalFov && sceneVersion == other.sceneVersion && samplesPerPixel == other.samplesPerPixel &&
+			maxBounces == other.maxBounces && extent.width == other.extent.width && extent.height == other.extent.height;
+	}
+
+	bool operator!=(const AccumulationKey& other) const {
+		return !(*this == other);
+	}
 };
 
-static std::vector<char> readFile(const std::string& filename) {
-	std::ifstream file(filename, std::ios::ate | std::ios::binary);
+// Everything one frame in flight owns, so the CPU can record a frame while the GPU still runs the
+// previous ones without either side overwriting the other's data
+struct FrameResources {
+	VkCommandBuffer commandBuffer;
+	VkSemaphore imageAvailableSemaphore;
+	VkSemaphore renderFinishedSemaphore;
+	VkFence inFlightFence;
+
+	VkImage storageImage;
+	Allocation storageImageMemory;
+	VkImageView storageImageView;
+	VkDescriptorSet descriptorSet;
+
+	VkBuffer counterBuffer;
+	Allocation counterBufferMemory;
+	// Persistently mapped, written while recording the frame
+	VkBuffer uniformBuffer;
+	Allocation uniformBufferMemory;
+	// Host visible scratch space that is recycled every time the frame is recorded
+	LinearArena transientArena;
+	void* counterReadbackData = nullptr;
+
+	// Only used when running headless
+	VkBuffer readbackBuffer;
+	Allocation readbackBufferMemory;
+	void* readbackData = nullptr;
+
+	// Accumulation epoch the frame's samples went into, its noise estimate is stale once the epoch changed
+	uint64_t accumulationEpoch = 0;
+	uint32_t accumulatedSamples = 0;
+	// Render scale the frame was recorded at, the governor ignores frames from before a change
+	float renderScale = 1.0f;
+
+	// Set while the frame's fence has not been waited on yet
+	bool submitted = false;
+	std::chrono::high_resolution_clock::time_point startTime;
+};
+
+// Where the time of a batch render goes besides tracing, summed over every frame
+struct BatchTimings {
+	double gpuReadbackMilliseconds = 0.0;
+	// Copying out of the readback buffer on the render thread
+	double readbackMilliseconds = 0.0;
+	// Summed over the encode threads, so it can exceed the wall clock time
+	double encodeMilliseconds = 0.0;
+	// Time the render loop spent waiting for encodes to make room
+	double encodeWaitMilliseconds = 0.0;
+};
+
+// Reports how a scene file was loaded, from its cache or imported
+static void printSceneLoad(const std::string& path, const SceneCache& sceneCache, const SceneData& data) {
+	const SceneLoadStats& stats = sceneCache.getStats();
+
+	if (data.instanceCount > 0) {
+		std::cout << "Scene " << path << ": " << data.instanceCount << " instances of " << data.meshCount << " meshes" << std::endl;
+	}
+
+	if (stats.cacheHit) {
+		std::cout << "Scene " << path << ": " << data.triangleCount << " triangles, " << data.nodeCount << " BVH nodes, mapped " << stats.cacheBytes / (1 << 20) <<
+			" MiB from the cache in " << stats.mapMilliseconds << "ms" << std::endl;
+	}
+	else {
+		std::cout << "Scene " << path << ": " << data.triangleCount << " triangles, imported in " << stats.importMilliseconds << "ms, BVH of " << data.nodeCount <<
+			" nodes built in " << stats.bvhMilliseconds << "ms, " << stats.cacheBytes / (1 << 20) << " MiB cache written in " << stats.writeMilliseconds << "ms" << std::endl;
+	}
+}
+
+// Numbers the frames of a batch render. A pattern with one printf style %d or %u, such as frames/%04d.png,
+// takes the number there, otherwise it goes in front of the extension. %% stands for a percent sign.
+static std::string formatFramePath(const std::string& pattern, uint32_t frameIndex) {
+	// The pattern is parsed here rather than handed to snprintf, which would take any conversion in it
+	std::string path;
+	bool numbered = false;
+
+	for (size_t i = 0; i < pattern.size(); i++) {
+		if (pattern[i] != '%') {
+			path += pattern[i];
+			continue;
+		}
+
+		if (i + 1 < pattern.size() && pattern[i + 1] == '%') {
+			path += '%';
+			i++;
+			continue;
+		}
 
-	if (!file.is_open()) {
-		throw std::runtime_error("Could not open file");
+		// %[0][width]d or %[0][width]u
+		size_t end = i + 1;
+		bool zeroPad = end < pattern.size() && pattern[end] == '0';
+		if (zeroPad) {
+			end++;
+		}
+
+		uint32_t width = 0;
+		while (end < pattern.size() && pattern[end] >= '0' && pattern[end] <= '9' && width < 100) {
+			width = width * 10 + static_cast<uint32_t>(pattern[end] - '0');
+			end++;
+		}
+
+		if (numbered || end >= pattern.size() || (pattern[end] != 'd' && pattern[end] != 'u') || width >= 100) {
+			throw std::runtime_error("Output pattern must contain at most one %d or %u, optionally with a width such as %04d, and %% for a percent sign: " + pattern);
+		}
+
+		std::string number = std::to_string(frameIndex);
+		if (number.size() < width) {
+			number.insert(0, width - number.size(), zeroPad ? '0' : ' ');
+		}
+
+		path += number;
+		numbered = true;
+		i = end;
 	}
 
-	size_t fileSize = (size_t) file.tellg();
-	std::vector<char> buffer(fileSize);
+	if (numbered) {
+		return path;
+	}
+
+	char number[16];
+	std::snprintf(number, sizeof(number), "_%04u", frameIndex);
 
-	file.seekg(0);
-	file.read(buffer.data(), fileSize);
-	file.close();
+	size_t extension = path.rfind('.');
+	if (extension == std::string::npos || path.find_first_of("/\\", extension) != std::string::npos) {
+		return path + number;
+	}
 
-	return buffer;
+	return path.substr(0, extension) + number + path.substr(extension);
 }
 
+// Per frame timings collected on the CPU, averaged over the reporting interval
+struct FrameTimingStats {
+	uint32_t frameCount = 0;
+	double cpuWaitMilliseconds = 0.0;
+	double latencyMilliseconds = 0.0;
+	double maxLatencyMilliseconds = 0.0;
+
+	void reset() {
+		*this = FrameTimingStats();
+	}
+};
+
+// Objects replaced while frames in flight may still use them, destroyed once those frames completed
+struct RetiredResources {
+	// Frames submitted before the objects were replaced
+	uint32_t frameCounter;
+	std::function<void()> destroy;
+};
+
+struct SwapChainSupportDetails {
+	VkSurfaceCapabilitiesKHR capabilities;
+	std::vector<VkSurfaceFormatKHR> formats;
+	std::vector<VkPresentModeKHR> presentModes;
+};
+
+// Everything device selection needs to know about a physical device. It is queried once per device
+// and the chosen device's copy is kept for the stages that create the device, swap chain and queries.
+struct DeviceCapabilities {
+	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+	VkPhysicalDeviceProperties properties;
+	std::vector<VkQueueFamilyProperties> queueFamilies;
+	QueueFamilyIndices queueIndices;
+	std::set<std::string> extensions;
+	SwapChainSupportDetails swapChainSupport;
+	bool timelineSemaphore = false;
+	// Acceleration structures, ray queries and buffer device addresses are all available
+	bool hardwareRayTracing = false;
+	VkDeviceSize accelerationStructureScratchAlignment = 0;
+	uint32_t score = 0;
+};
+
 VkResult CreateDebugUtilsMessengerEXT(VkInstance instance, const VkDebugUtilsMessengerCreateInfoEXT* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkDebugUtilsMessengerEXT* pDebugMessenger) {
 	auto func = (PFN_vkCreateDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance, "vkCreateDebugUtilsMessengerEXT");
 	if (func != nullptr) {
@@ -89,32 +469,76 @@ void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT
 
 class HelloTriangleApplication {
 public:
-	HelloTriangleApplication(const int width, const int height) : width(width), height(height) { }
+	HelloTriangleApplication(const int width, const int height, const RenderSettings& settings) : width(width), height(height), settings(settings),
+		showSampleDensity(settings.sampleHeatmap), useWavefront(settings.wavefront), sortMaterials(settings.sortMaterials) { }
 
 	void run() {
-		initWindow();
+		auto startupStart = std::chrono::high_resolution_clock::now();
+
+		profiler.setCapture(!settings.tracePath.empty());
+
+		// Runs until cleanup, so messages from every Vulkan call on every thread reach it
+		if (settings.validation) {
+			messageSink.start(std::cout, settings.validationFilter);
+		}
+
+		if (!settings.headless) {
+			initWindow();
+		}
+
 		initVulkan();
-		mainLoop();
+
+		if (settings.startupBenchmark) {
+			reportTimeToFirstFrame(startupStart);
+		}
+		else if (settings.recordBenchmark) {
+			benchmarkRecording();
+		}
+		else if (settings.bvhBenchmark) {
+			benchmarkGpuBvh();
+		}
+		else if (settings.wavefrontBenchmark) {
+			benchmarkWavefront();
+		}
+		else if (!settings.cameraPath.empty()) {
+			renderBatch();
+		}
+		else if (settings.headless) {
+			renderHeadless();
+		}
+		else {
+			mainLoop();
+		}
+
+		vkDeviceWaitIdle(device);
+
 		cleanup();
+
+		if (settings.printProfile) {
+			profiler.printStats(std::cout);
+		}
+
+		if (!settings.tracePath.empty()) {
+			profiler.writeChromeTrace(settings.tracePath);
+			std::cout << "Wrote trace to " << settings.tracePath << std::endl;
+		}
 	}
 private:
 	void initWindow() {
 		glfwInit();
 		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-		glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
 
 		window = glfwCreateWindow(width, height, "Vulkan window", nullptr, nullptr);
-	}
 
-	static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
-		VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
-		VkDebugUtilsMessageTypeFlagsEXT messageType,
-		const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
-		void* pUserData) {
-
-		DEBUG_OUT("validation layer: " << pCallbackData->pMessage << std::endl);
+		glfwSetWindowUserPointer(window, this);
+		glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+	}
 
-		return VK_FALSE;
+	// Presenting usually reports the change too, but not on every platform, and not while the image has
+	// converged and nothing is presented
+	static void framebufferResizeCallback(GLFWwindow* window, int /*width*/, int /*height*/) {
+		auto application = static_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+		application->framebufferResized = true;
 	}
 
 	bool checkInstanceExtensions(int extensionCheckCount, const char* const* extensionCheck) {
@@ -126,11 +550,13 @@ private:
 
 		vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, allExtensions.data());
 
+#ifdef DEBUG_BUILD
 		DEBUG_OUT("Extensions (" << extensionCount << "):" << std::endl);
 
 		for (const auto& extension : allExtensions) {
 			DEBUG_OUT("\t" << extension.extensionName << std::endl);
 		}
+#endif
 
 		if (extensionCheckCount > 0) {
 			for (int i = 0; i < extensionCheckCount; i++) {
@@ -170,27 +596,32 @@ private:
 	}
 
 	std::vector<const char*> getRequiredInstanceExtensions() {
-		// Retrieve the needed extensions for GLFW to function
-		uint32_t glfwExtensionCount = 0;
-		const char** glfwExtensions;
+		std::vector<const char*> allExtensions;
 
-		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+		// Retrieve the needed extensions for GLFW to function. Headless runs never initialize GLFW.
+		if (!settings.headless) {
+			uint32_t glfwExtensionCount = 0;
+			const char** glfwExtensions;
 
-		std::vector<const char*> allExtensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+			glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
-#ifdef DEBUG_BUILD
-		allExtensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
-#endif
+			allExtensions.insert(allExtensions.end(), glfwExtensions, glfwExtensions + glfwExtensionCount);
+		}
+
+		if (settings.validation) {
+			allExtensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+		}
 
 		return allExtensions;
 	}
 
 	void createInstance() {
-#ifdef DEBUG_BUILD
-		if (!checkValidationLayerSupport()) {
-			throw std::runtime_error("Missing required validation layer");
+		PROFILE_ZONE(profiler, "createInstance");
+
+		if (settings.validation && !checkValidationLayerSupport()) {
+			std::cout << "The validation layers are not installed, running without them" << std::endl;
+			settings.validation = false;
 		}
-#endif
 
 		// Setup the application info
 		VkApplicationInfo appInfo = {};
@@ -199,23 +630,26 @@ private:
 		appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
 		appInfo.pEngineName = "No Engine";
 		appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-		appInfo.apiVersion = VK_API_VERSION_1_1;
+		appInfo.apiVersion = VK_API_VERSION_1_2;
 
 		// Create the create instance info and add the application info
 		VkInstanceCreateInfo createInfo = {};
 		createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
 		createInfo.pApplicationInfo = &appInfo;
 
-#ifdef DEBUG_BUILD
-		createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
-		createInfo.ppEnabledLayerNames = validationLayers.data();
-
+		// Chaining a messenger also reports messages from creating and destroying the instance itself
 		VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo = {};
-		populateDebugMessengerCreateInfo(debugCreateInfo);
-		createInfo.pNext = &debugCreateInfo;
-#else
-		createInfo.enabledLayerCount = 0;
-#endif		
+
+		if (settings.validation) {
+			createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
+			createInfo.ppEnabledLayerNames = validationLayers.data();
+
+			messageSink.populateCreateInfo(debugCreateInfo);
+			createInfo.pNext = &debugCreateInfo;
+		}
+		else {
+			createInfo.enabledLayerCount = 0;
+		}
 
 		// Collect all of the extensions we will be using
 		std::vector<const char*> allExtensions = getRequiredInstanceExtensions();
@@ -232,19 +666,11 @@ private:
 		}
 	}
 
-	void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& debugCreateInfo) {
-		debugCreateInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
-		debugCreateInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT |
-			VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
-		debugCreateInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT |
-			VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT;
-		debugCreateInfo.pfnUserCallback = debugCallback;
-		debugCreateInfo.pUserData = nullptr;
-	}
-
 	void setupDebugMessenger() {
+		PROFILE_ZONE(profiler, "setupDebugMessenger");
+
 		VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo = {};
-		populateDebugMessengerCreateInfo(debugCreateInfo);
+		messageSink.populateCreateInfo(debugCreateInfo);
 
 		if (CreateDebugUtilsMessengerEXT(instance, &debugCreateInfo, nullptr, &debugMessenger) != VK_SUCCESS) {
 			throw std::runtime_error("Could not set up debug messenger");
@@ -252,25 +678,134 @@ private:
 	}
 
 	void initVulkan() {
+		PROFILE_ZONE(profiler, "initVulkan");
+
+		// Building the BVH only needs the CPU, so it overlaps with everything up to the scene upload
+		std::future<void> sceneLoaded = std::async(std::launch::async, [this] { loadScene(); });
+
+		openAssets();
 		createInstance();
-#ifdef DEBUG_BUILD
-		setupDebugMessenger();
-#endif
-		createSurface();
+		if (settings.validation) {
+			setupDebugMessenger();
+		}
+		if (!settings.headless) {
+			createSurface();
+		}
 		pickPhysicalDevice();
 		createLogicalDevice();
-		createSwapChain();
-		createImageViews();
-		createGraphicsPipeline();
+
+		// Pipelines only need the device and the shaders, so they compile while the rest is created
+		std::future<void> pipelinesCreated = std::async(std::launch::async, [this] { createPipelines(); });
+
+		allocator.create(physicalDevice, device, 64ull << 20, useHardwareRayTracing);
+		if (!settings.headless) {
+			createSwapChain();
+			createImageViews();
+		}
+		frames.resize(settings.framesInFlight);
+		createStorageImages();
+		if (settings.resolution.targetMilliseconds > 0.0f) {
+			configureResolutionGovernor();
+		}
+		if (settings.headless) {
+			createReadbackBuffers();
+		}
+		createCommandPool();
+		uploader.create(device, allocator, deviceCapabilities.queueIndices.transferFamily.value(), transferQueue);
+		sceneLoaded.get();
+		createSceneBuffers();
+		// The copies run on the transfer queue while the pipeline compiles, the first frame waits for them on the GPU
+		pendingUploadValue = uploader.flush();
+		createFrameBuffers();
+		createGpuProfiler();
+		createCommandBuffers();
+		createCommandRecorder();
+		createSyncObjects();
+		if (useHardwareRayTracing) {
+			buildAccelerationStructure();
+		}
+		pipelinesCreated.get();
+		if (settings.gpuBvh) {
+			buildGpuBvh();
+		}
+		if (isWavefrontEnabled()) {
+			createWavefrontBuffers();
+		}
+		createDescriptorPool();
+		createDescriptorSets();
+
+		// Every shader module has been created by now
+		assets.close();
+
+#ifdef DEBUG_BUILD
+		allocator.printStats(std::cout);
+		DEBUG_OUT("Staged " << uploader.getStats().bytesUploaded << " bytes in " << uploader.getStats().submissionCount << " transfer submission(s)" << std::endl);
+#endif
+	}
+
+	// Runs on a worker thread during initVulkan. It may only touch the device, the asset pack and the
+	// pipeline objects, which nothing on the main thread uses until the stage has finished.
+	void createPipelines() {
+		PROFILE_ZONE(profiler, "createPipelines");
+
+		createDescriptorSetLayout();
+		createPipelineCache();
+
+		// Each pipeline compiles on its own thread. They only share the pipeline cache, which Vulkan
+		// synchronizes internally.
+		std::vector<std::future<void>> compiles;
+		compiles.push_back(std::async(std::launch::async, [this] { createRayTracingPipeline(); }));
+		if (settings.denoise.iterations > 0) {
+			compiles.push_back(std::async(std::launch::async, [this] { createDenoisePipelines(); }));
+		}
+		if (settings.gpuBvh) {
+			compiles.push_back(std::async(std::launch::async, [this] { createGpuBvhPipelines(); }));
+		}
+		if (isWavefrontEnabled()) {
+			compiles.push_back(std::async(std::launch::async, [this] { createWavefrontPipelines(); }));
+		}
+
+		for (auto& compile : compiles) {
+			compile.get();
+		}
+
+		pipelineCache.save();
+	}
+
+	void createPipelineCache() {
+		PROFILE_ZONE(profiler, "createPipelineCache");
+
+		std::string path;
+
+		if (settings.usePipelineCache) {
+			path = settings.pipelineCachePath.empty() ? getExecutableDirectory() + "/pipeline_cache.bin" : settings.pipelineCachePath;
+		}
+
+		pipelineCache.create(physicalDevice, device, path);
+	}
+
+	void openAssets() {
+		PROFILE_ZONE(profiler, "openAssets");
+
+#ifdef EMBED_SHADERS
+		assets.openMemory(EmbeddedAssetPack, EmbeddedAssetPackSize);
+#else
+		std::string path = settings.assetPackPath.empty() ? getExecutableDirectory() + "/shaders.pack" : settings.assetPackPath;
+		assets.openFile(path);
+#endif
 	}
 
 	void createSurface() {
+		PROFILE_ZONE(profiler, "createSurface");
+
 		if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS) {
 			throw std::runtime_error("Could not create window surface");
 		}
 	}
 
 	void pickPhysicalDevice() {
+		PROFILE_ZONE(profiler, "pickPhysicalDevice");
+
 		uint32_t deviceCount = 0;
 
 		vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
@@ -283,22 +818,53 @@ private:
 
 		vkEnumeratePhysicalDevices(instance, &deviceCount, physicalDevices.data());
 
-		for (auto device : physicalDevices) {
-			if (isSuitableDevice(device)) {
-				physicalDevice = device;
-				break;
+		if (settings.deviceIndex.has_value()) {
+			if (settings.deviceIndex.value() >= deviceCount) {
+				throw std::runtime_error("Requested device index is out of range");
+			}
+
+			deviceCapabilities = probeDevice(physicalDevices[settings.deviceIndex.value()]);
+
+			if (deviceCapabilities.score == 0) {
+				throw std::runtime_error("Requested device is not suitable");
+			}
+		}
+		else {
+			for (auto device : physicalDevices) {
+				DeviceCapabilities capabilities = probeDevice(device);
+
+				if (capabilities.score > deviceCapabilities.score) {
+					deviceCapabilities = std::move(capabilities);
+				}
 			}
 		}
 
-		if (physicalDevice == VK_NULL_HANDLE) {
+		if (deviceCapabilities.score == 0) {
 			throw std::runtime_error("Could not find a suitable GPU");
 		}
+
+		physicalDevice = deviceCapabilities.physicalDevice;
+		useHardwareRayTracing = settings.traceMode != TraceMode::Compute && deviceCapabilities.hardwareRayTracing;
+
+		DEBUG_OUT("Using device: " << deviceCapabilities.properties.deviceName << std::endl);
+
+		if (useHardwareRayTracing) {
+			std::cout << "Tracing with hardware ray queries" << std::endl;
+		}
+		else if (settings.traceMode == TraceMode::Auto) {
+			std::cout << deviceCapabilities.properties.deviceName << " has no hardware ray tracing, falling back to the compute tracer" << std::endl;
+		}
 	}
 
 	void createLogicalDevice() {
-		QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+		PROFILE_ZONE(profiler, "createLogicalDevice");
+
+		const QueueFamilyIndices& indices = deviceCapabilities.queueIndices;
 
-		std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily.value(), indices.presentFamily.value() };
+		std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily.value(), indices.transferFamily.value(), indices.computeFamily.value() };
+		if (indices.presentFamily.has_value()) {
+			uniqueQueueFamilies.insert(indices.presentFamily.value());
+		}
 		std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 
 		float queuePriority = 1.0f;
@@ -313,34 +879,81 @@ private:
 
 		VkPhysicalDeviceFeatures deviceFeatures = {};
 
+		VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+		vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+		vulkan12Features.timelineSemaphore = VK_TRUE;
+
+		VkPhysicalDeviceAccelerationStructureFeaturesKHR accelerationStructureFeatures = {};
+		accelerationStructureFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
+		accelerationStructureFeatures.accelerationStructure = VK_TRUE;
+
+		VkPhysicalDeviceRayQueryFeaturesKHR rayQueryFeatures = {};
+		rayQueryFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR;
+		rayQueryFeatures.pNext = &accelerationStructureFeatures;
+		rayQueryFeatures.rayQuery = VK_TRUE;
+
+		// Acceleration structure builds read the triangles through their device address
+		if (useHardwareRayTracing) {
+			vulkan12Features.bufferDeviceAddress = VK_TRUE;
+			vulkan12Features.pNext = &rayQueryFeatures;
+		}
+
 		VkDeviceCreateInfo deviceCreateInfo = {};
 		deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+		deviceCreateInfo.pNext = &vulkan12Features;
 
 		deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
 		deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
 		
-		deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-		deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
+		std::vector<const char*> requiredExtensions = getRequiredDeviceExtensions();
+		if (useHardwareRayTracing) {
+			requiredExtensions.insert(requiredExtensions.end(), rayQueryExtensions.begin(), rayQueryExtensions.end());
+		}
+		deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(requiredExtensions.size());
+		deviceCreateInfo.ppEnabledExtensionNames = requiredExtensions.data();
 
 		deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
 
-#ifdef DEBUG_BUILD
-		deviceCreateInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
-		deviceCreateInfo.ppEnabledLayerNames = validationLayers.data();
-#else
-		deviceCreateInfo.enabledLayerCount = 0;
-#endif
+		if (settings.validation) {
+			deviceCreateInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
+			deviceCreateInfo.ppEnabledLayerNames = validationLayers.data();
+		}
+		else {
+			deviceCreateInfo.enabledLayerCount = 0;
+		}
 
 		if (vkCreateDevice(physicalDevice, &deviceCreateInfo, nullptr, &device) != VK_SUCCESS) {
 			throw std::runtime_error("Could not create logical device");
 		}
 
 		vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
-		vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+		if (indices.presentFamily.has_value()) {
+			vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+		}
+		vkGetDeviceQueue(device, indices.transferFamily.value(), 0, &transferQueue);
+		vkGetDeviceQueue(device, indices.computeFamily.value(), 0, &computeQueue);
+
+		// Headless frames only trace and copy, so they can go to the async compute queue. Windowed frames
+		// blit into the swap chain, which needs a graphics queue.
+		if (settings.headless) {
+			renderFamily = indices.computeFamily.value();
+			renderQueue = computeQueue;
+		}
+		else {
+			renderFamily = indices.graphicsFamily.value();
+			renderQueue = graphicsQueue;
+		}
+
+		DEBUG_OUT("Queue families: graphics " << indices.graphicsFamily.value() << ", transfer " << indices.transferFamily.value() <<
+			", compute " << indices.computeFamily.value() << ", rendering on " << renderFamily << std::endl);
 	}
 
-	void createSwapChain() {
-		SwapChainSupportDetails details = querySwapChainSupport(physicalDevice);
+	// Passing the current swap chain as oldSwapChain retires it. Frames in flight may still present its
+	// images, so destroying it is up to the caller.
+	void createSwapChain(VkSwapchainKHR oldSwapChain = VK_NULL_HANDLE) {
+		PROFILE_ZONE(profiler, "createSwapChain");
+
+		const SwapChainSupportDetails& details = deviceCapabilities.swapChainSupport;
 
 		VkSurfaceFormatKHR format = chooseSwapSurfaceFormat(details.formats);
 		VkPresentModeKHR mode = chooseSwapPresentMode(details.presentModes);
@@ -362,9 +975,10 @@ private:
 		swapCreateInfo.imageColorSpace = format.colorSpace;
 		swapCreateInfo.imageExtent = extent;
 		swapCreateInfo.imageArrayLayers = 1;
-		swapCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+		// The traced image is blitted or copied in, nothing renders to the swap chain directly
+		swapCreateInfo.imageUsage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 
-		QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+		const QueueFamilyIndices& indices = deviceCapabilities.queueIndices;
 		uint32_t queueFamilies[] = { indices.graphicsFamily.value(), indices.presentFamily.value() };
 
 		if (indices.graphicsFamily != indices.presentFamily) {
@@ -382,7 +996,7 @@ private:
 		swapCreateInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
 		swapCreateInfo.presentMode = mode;
 		swapCreateInfo.clipped = VK_TRUE;
-		swapCreateInfo.oldSwapchain = VK_NULL_HANDLE;
+		swapCreateInfo.oldSwapchain = oldSwapChain;
 
 		if (vkCreateSwapchainKHR(device, &swapCreateInfo, nullptr, &swapChain) != VK_SUCCESS) {
 			throw std::runtime_error("Could not create swapchain");
@@ -397,6 +1011,8 @@ private:
 	}
 
 	void createImageViews() {
+		PROFILE_ZONE(profiler, "createImageViews");
+
 		swapChainImageViews.resize(swapChainImages.size());
 
 		for (size_t i = 0; i < swapChainImages.size(); i++) {
@@ -423,229 +1039,3350 @@ private:
 		}
 	}
 
-	void createGraphicsPipeline() {
-		auto vertShaderCode = readFile("shaders/vert.spv");
-		auto fragShaderCode = readFile("shaders/frag.spv");
+	void createStorageImages() {
+		PROFILE_ZONE(profiler, "createStorageImages");
 
-		VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
-		VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
+		storageFormat = VK_FORMAT_R8G8B8A8_UNORM;
+
+		if (settings.headless) {
+			storageExtent = { static_cast<uint32_t>(width), static_cast<uint32_t>(height) };
+		}
+		else {
+			storageExtent = getRenderExtent();
+		}
 
-		VkPipelineShaderStageCreateInfo vertCreateInfo = {};
-		vertCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		vertCreateInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-		vertCreateInfo.module = vertShaderModule;
-		vertCreateInfo.pName = "main";
+		VkFormatProperties storageProperties;
+		vkGetPhysicalDeviceFormatProperties(physicalDevice, storageFormat, &storageProperties);
 
-		VkPipelineShaderStageCreateInfo fragCreateInfo = {};
-		fragCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		fragCreateInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-		fragCreateInfo.module = fragShaderModule;
-		fragCreateInfo.pName = "main";
+		if (!(storageProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT)) {
+			throw std::runtime_error("Could not find storage image support for the trace target");
+		}
 
-		VkPipelineShaderStageCreateInfo shaderInfos[] = { vertCreateInfo, fragCreateInfo };
+		if (!settings.headless) {
+			VkFormatProperties swapChainProperties;
+			vkGetPhysicalDeviceFormatProperties(physicalDevice, swapChainFormat, &swapChainProperties);
 
-		vkDestroyShaderModule(device, vertShaderModule, nullptr);
-		vkDestroyShaderModule(device, fragShaderModule, nullptr);
-	}
+			// A blit converts between the RGBA storage format and whatever order the swap chain uses.
+			// Without blit support a plain copy only works if the formats already match.
+			blitToSwapChain = (storageProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT) &&
+				(swapChainProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT);
 
-	VkShaderModule createShaderModule(const std::vector<char>& code) {
-		VkShaderModuleCreateInfo moduleCreateInfo = {};
-		moduleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-		moduleCreateInfo.codeSize = code.size();
-		moduleCreateInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+			if (!blitToSwapChain && swapChainFormat != storageFormat) {
+				throw std::runtime_error("Could not find a way to copy the storage image to the swap chain");
+			}
 
-		VkShaderModule shaderModule;
-		if (vkCreateShaderModule(device, &moduleCreateInfo, nullptr, &shaderModule) != VK_SUCCESS)) {
-			throw std::runtime_error("Could not create shader module");
+			// Smooths the upscale from a reduced render scale, at full scale both filters copy the texels
+			blitFilter = (storageProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
 		}
 
-		return shaderModule;
+		// One image per frame in flight, so tracing the next frame never waits for the copy out of the last one
+		for (auto& frame : frames) {
+			createImage(storageExtent, storageFormat, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frame.storageImage, frame.storageImageMemory);
+
+			VkImageViewCreateInfo viewCreateInfo = {};
+			viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+			viewCreateInfo.image = frame.storageImage;
+			viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			viewCreateInfo.format = storageFormat;
+			viewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			viewCreateInfo.subresourceRange.levelCount = 1;
+			viewCreateInfo.subresourceRange.layerCount = 1;
+
+			if (vkCreateImageView(device, &viewCreateInfo, nullptr, &frame.storageImageView) != VK_SUCCESS) {
+				throw std::runtime_error("Could not create storage image view");
+			}
+		}
+
+		createAccumulationImage();
+		denoiser.createImages(device, allocator, storageExtent, settings.denoise.iterations);
 	}
 
-	QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device) {
-		QueueFamilyIndices indices;
+	// The window's resolution scaled by the governor. The blit to the swap chain scales it back up.
+	VkExtent2D getRenderExtent() const {
+		float scale = resolutionGovernor.getScale();
 
-		uint32_t queueFamilyCount = 0;
+		return { std::max(1u, static_cast<uint32_t>(swapChainExtent.width * scale + 0.5f)),
+			std::max(1u, static_cast<uint32_t>(swapChainExtent.height * scale + 0.5f)) };
+	}
 
-		vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+	// Starts at full resolution, which the storage images were just created at
+	void configureResolutionGovernor() {
+		if (settings.headless) {
+			std::cout << "Headless frames keep their output resolution, ignoring the frame time target" << std::endl;
+			return;
+		}
 
-		std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+		// A plain copy needs the storage image to match the swap chain in size as well as format
+		if (!blitToSwapChain) {
+			std::cout << "Cannot scale the storage image to the swap chain, rendering at the window's resolution" << std::endl;
+			return;
+		}
 
-		vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+		resolutionGovernor.configure(settings.resolution);
+	}
 
-		int i = 0;
-		for (auto& queueFamily : queueFamilies) {
-			if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-				indices.graphicsFamily = i;
-			}
+	// A single float image keeps the running sums across frames. Frames in flight share it, which is fine
+	// because they run in submission order on one queue. Without progressive rendering the shader never
+	// touches it, but the binding still needs an image, so a single texel is created.
+	void createAccumulationImage() {
+		VkFormat accumulationFormat = VK_FORMAT_R32G32B32A32_SFLOAT;
 
-			VkBool32 presentSupported = false;
-			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupported);
+		VkFormatProperties accumulationProperties;
+		vkGetPhysicalDeviceFormatProperties(physicalDevice, accumulationFormat, &accumulationProperties);
 
-			if (presentSupported) {
-				indices.presentFamily = i;
-			}
+		if (!(accumulationProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT)) {
+			throw std::runtime_error("Could not find storage image support for the accumulation image");
+		}
 
-			if (indices.isComplete()) {
-				break;
-			}
+		VkExtent2D extent = settings.progressive ? storageExtent : VkExtent2D{ 1, 1 };
 
-			i++;
+		createImage(extent, accumulationFormat, VK_IMAGE_USAGE_STORAGE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, accumulationImage, accumulationImageMemory);
+
+		VkImageViewCreateInfo viewCreateInfo = {};
+		viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewCreateInfo.image = accumulationImage;
+		viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewCreateInfo.format = accumulationFormat;
+		viewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		viewCreateInfo.subresourceRange.levelCount = 1;
+		viewCreateInfo.subresourceRange.layerCount = 1;
+
+		if (vkCreateImageView(device, &viewCreateInfo, nullptr, &accumulationImageView) != VK_SUCCESS) {
+			throw std::runtime_error("Could not create accumulation image view");
 		}
 
-		return indices;
+		// Two generations of tile state, the shader reads one and writes the other
+		adaptiveTileCount = ((storageExtent.width + AdaptiveTileSize - 1) / AdaptiveTileSize) * ((storageExtent.height + AdaptiveTileSize - 1) / AdaptiveTileSize);
+
+		createBuffer(2 * sizeof(AdaptiveTile) * adaptiveTileCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, adaptiveTileBuffer, adaptiveTileBufferMemory);
 	}
 
-	VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities) {
-		if (capabilities.currentExtent.width != UINT32_MAX) {
-			return capabilities.currentExtent;
-		}
-		else {
-			VkExtent2D actualExtent = { WIDTH, HEIGHT };
+	void createReadbackBuffers() {
+		PROFILE_ZONE(profiler, "createReadbackBuffers");
 
-			actualExtent.width = std::max(capabilities.minImageExtent.width, std::min(capabilities.maxImageExtent.width, actualExtent.width));
-			actualExtent.height = std::max(capabilities.minImageExtent.height, std::min(capabilities.maxImageExtent.height, actualExtent.height));
+		// Tightly packed RGBA8 rows are what vkCmdCopyImageToBuffer writes when bufferRowLength is 0
+		VkDeviceSize readbackSize = static_cast<VkDeviceSize>(storageExtent.width) * storageExtent.height * 4;
 
-			return actualExtent;
+		for (auto& frame : frames) {
+			createBuffer(readbackSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				frame.readbackBuffer, frame.readbackBufferMemory, VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+
+			frame.readbackData = frame.readbackBufferMemory.mapped;
 		}
 	}
 
-	VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availableModes) {
-		for (const auto mode : availableModes) {
-			if (mode == VK_PRESENT_MODE_MAILBOX_KHR) {
-				return mode;
-			}
-		}
+	void createCommandPool() {
+		PROFILE_ZONE(profiler, "createCommandPool");
 
-		return VK_PRESENT_MODE_FIFO_KHR;
-	}
+		VkCommandPoolCreateInfo poolCreateInfo = {};
+		poolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolCreateInfo.queueFamilyIndex = renderFamily;
+		poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
-	VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats) {
-		for (const auto format : availableFormats) {
-			if (format.format == VK_FORMAT_B8G8R8A8_UNORM && format.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
-				return format;
-			}
+		if (vkCreateCommandPool(device, &poolCreateInfo, nullptr, &commandPool) != VK_SUCCESS) {
+			throw std::runtime_error("Could not create command pool");
 		}
+	}
 
-		return availableFormats[0];
+	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, Allocation& memory, VkMemoryPropertyFlags preferred = 0,
+		const std::vector<uint32_t>& queueFamilies = {}) {
+		allocator.createBuffer(size, usage, properties, preferred, buffer, memory, queueFamilies);
 	}
 
-	SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device) {
-		SwapChainSupportDetails details;
+	void createImage(VkExtent2D extent, VkFormat format, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, Allocation& memory) {
+		VkImageCreateInfo imageCreateInfo = {};
+		imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageCreateInfo.format = format;
+		imageCreateInfo.extent = { extent.width, extent.height, 1 };
+		imageCreateInfo.mipLevels = 1;
+		imageCreateInfo.arrayLayers = 1;
+		imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageCreateInfo.usage = usage;
+		imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		allocator.createImage(imageCreateInfo, properties, image, memory);
+	}
 
-		vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface, &details.capabilities);
+	// Creates a device local buffer and queues its contents on the transfer queue. Nothing waits here;
+	// the frames that read the buffer wait for pendingUploadValue on the GPU instead.
+	void createDeviceLocalBuffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, Allocation& memory) {
+		std::vector<uint32_t> queueFamilies;
+		if (uploader.getQueueFamily() != renderFamily) {
+			queueFamilies = { uploader.getQueueFamily(), renderFamily };
+		}
 
-		uint32_t formatCount;
-		vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, nullptr);
+		createBuffer(size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, memory, 0, queueFamilies);
 
-		if (formatCount != 0) {
-			details.formats.resize(formatCount);
-			vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, details.formats.data());
+		uploader.upload(buffer, 0, data, size);
+	}
+
+	// Storage buffers cannot be empty, so an empty array still gets one zeroed element
+	template<typename T>
+	void createSceneBuffer(const T* data, uint32_t count, VkBufferUsageFlags usage, VkBuffer& buffer, Allocation& memory) {
+		T empty = {};
+
+		if (count == 0) {
+			createDeviceLocalBuffer(&empty, sizeof(T), usage, buffer, memory);
+		}
+		else {
+			createDeviceLocalBuffer(data, sizeof(T) * static_cast<VkDeviceSize>(count), usage, buffer, memory);
 		}
+	}
 
-		uint32_t presentModeCount;
-		vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, nullptr);
+	void loadScene() {
+		PROFILE_ZONE(profiler, "loadScene");
 
-		if (presentModeCount != 0) {
-			details.presentModes.resize(presentModeCount);
-			vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, details.presentModes.data());
+		// Scene files go through their cache, which already holds the BVH and is uploaded straight from the mapping
+		if (!settings.scenePath.empty()) {
+			TaskScheduler scheduler(settings.threadCount);
+			sceneCache.load(settings.scenePath, scheduler, settings.rebuildSceneCache);
+
+			scene.camera = sceneCache.getCamera();
+			scene.backgroundColor = sceneCache.getBackgroundColor();
+			sceneData = sceneCache.getData();
+
+			printSceneLoad(settings.scenePath, sceneCache, sceneData);
+
+			// The GPU builder has no instancing and rebuilds over the flattened triangles
+			if (sceneData.instanceCount > 0 && settings.gpuBvh) {
+				sceneCache.copyTo(scene, bvh);
+				scene = scene.flatten();
+				bvh = Bvh();
+				sceneCache.close();
+			}
+			else {
+				if (sceneData.instanceCount > 0) {
+					buildTopLevel();
+				}
+				else {
+					collapseWideBvh();
+				}
+
+				return;
+			}
 		}
+		else if (settings.instanceCount > 0) {
+			scene = Scene::createInstanced(settings.instanceCount);
 
-		return details;
+			if (settings.gpuBvh) {
+				scene = scene.flatten();
+			}
+		}
+		else {
+			scene = Scene::createDefault();
+		}
+
+		if (scene.isInstanced()) {
+			TaskScheduler scheduler(settings.threadCount);
+			twoLevelBvh.buildBottomLevels(scene.triangles, scene.meshes, scheduler);
+
+			sceneData.triangles = scene.triangles.data();
+			sceneData.triangleCount = static_cast<uint32_t>(scene.triangles.size());
+			sceneData.materials = scene.materials.data();
+			sceneData.materialCount = static_cast<uint32_t>(scene.materials.size());
+			sceneData.nodes = twoLevelBvh.getBottomNodes().data();
+			sceneData.nodeCount = static_cast<uint32_t>(twoLevelBvh.getBottomNodes().size());
+			sceneData.meshes = scene.meshes.data();
+			sceneData.meshCount = static_cast<uint32_t>(scene.meshes.size());
+			sceneData.instances = scene.instances.data();
+			sceneData.instanceCount = static_cast<uint32_t>(scene.instances.size());
+
+			buildTopLevel();
+			return;
+		}
+
+		// The GPU builder reads the triangles in scene order once they are uploaded
+		if (!settings.gpuBvh) {
+			bvh.build(scene.triangles);
+
+#ifdef DEBUG_BUILD
+			const BvhBuildStats& bvhStats = bvh.getStats();
+			DEBUG_OUT("BVH: " << scene.triangles.size() << " triangles, " << bvhStats.nodeCount << " nodes, depth " << bvhStats.maxDepth <<
+				", SAH cost " << bvhStats.sahCost << ", built in " << bvhStats.buildMilliseconds << "ms" << std::endl);
+#endif
+		}
+
+		sceneData = SceneData();
+		sceneData.triangles = scene.triangles.data();
+		sceneData.triangleCount = static_cast<uint32_t>(scene.triangles.size());
+		sceneData.materials = scene.materials.data();
+		sceneData.materialCount = static_cast<uint32_t>(scene.materials.size());
+		sceneData.nodes = bvh.getNodes().data();
+		sceneData.nodeCount = static_cast<uint32_t>(bvh.getNodes().size());
+
+		collapseWideBvh();
+	}
+
+	// Builds the top level over the instances of sceneData, whose meshes have their bottom levels in sceneData.nodes
+	void buildTopLevel() {
+		twoLevelBvh.buildTopLevel(sceneData.nodes, sceneData.meshes, sceneData.instances, sceneData.instanceCount);
+
+#ifdef DEBUG_BUILD
+		const TwoLevelBvhStats& stats = twoLevelBvh.getStats();
+		DEBUG_OUT("Two level BVH: " << sceneData.meshCount << " meshes with " << sceneData.triangleCount << " triangles and " << sceneData.nodeCount <<
+			" nodes, top level of " << stats.topNodeCount << " nodes over " << stats.instanceCount << " instances built in " << stats.topMilliseconds << "ms" << std::endl);
+#endif
 	}
 
-	bool isSuitableDevice(VkPhysicalDevice device) {
-		VkPhysicalDeviceProperties deviceProperties;
-		VkPhysicalDeviceFeatures deviceFeatures;
+	// Collapses the BVH of a scene without instances with --wide-bvh. The binary one stays in use when the
+	// wide one could overflow the shader's traversal stack.
+	void collapseWideBvh() {
+		if (!settings.wideBvh || settings.gpuBvh || sceneData.instanceCount > 0) {
+			return;
+		}
+
+		wideBvh.collapse(sceneData.nodes, sceneData.nodeCount);
 
-		vkGetPhysicalDeviceProperties(device, &deviceProperties);
-		vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
+		const WideBvhStats& stats = wideBvh.getStats();
+		DEBUG_OUT("Wide BVH: " << stats.nodeCount << " nodes and " << stats.leafCount << " leaves from " << sceneData.nodeCount << " binary nodes, " <<
+			stats.nodeCount * (sizeof(WideBvhNode) + WideBvh::Width * sizeof(uint32_t)) << " bytes instead of " << sceneData.nodeCount * sizeof(BvhNode) <<
+			", stack of " << stats.stackSize << ", collapsed in " << stats.collapseMilliseconds << "ms" << std::endl);
 
-		QueueFamilyIndices queueIndices = findQueueFamilies(device);
+		if (!wideBvh.isTraversable()) {
+			std::cout << "The wide BVH needs a traversal stack of " << stats.stackSize << " entries, more than " << WideBvh::MaxStackSize <<
+				", tracing the binary BVH instead" << std::endl;
+		}
+	}
 
-		bool extensionsSupported = checkDeviceExtensionSupport(device);
+	void createSceneBuffers() {
+		PROFILE_ZONE(profiler, "createSceneBuffers");
+
+		// The acceleration structure is built straight from the triangles
+		VkBufferUsageFlags triangleUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+		if (useHardwareRayTracing) {
+			triangleUsage |= VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
+		}
 
-		bool swapChainSupported = false;
-		if (extensionsSupported) {
-			SwapChainSupportDetails details = querySwapChainSupport(device);
-			swapChainSupported = !details.formats.empty() && !details.presentModes.empty();
+		// Copied into staging memory from wherever the data lives, which for a scene cache is the mapping itself
+		createSceneBuffer(sceneData.triangles, sceneData.triangleCount, triangleUsage, triangleBuffer, triangleBufferMemory);
+		createSceneBuffer(sceneData.materials, sceneData.materialCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, materialBuffer, materialBufferMemory);
+		createSceneBuffer(sceneData.nodes, sceneData.nodeCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, nodeBuffer, nodeBufferMemory);
+
+		// Both stay bound for scenes without instances, where the shader never reads them
+		const std::vector<BvhNode>& topNodes = twoLevelBvh.getTopNodes();
+		const std::vector<BvhInstance>& instances = twoLevelBvh.getInstances();
+		createSceneBuffer(topNodes.data(), static_cast<uint32_t>(topNodes.size()), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, topNodeBuffer, topNodeBufferMemory);
+		createSceneBuffer(instances.data(), static_cast<uint32_t>(instances.size()), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, instanceBuffer, instanceBufferMemory);
+
+		// Likewise only read with TraceFlagWideBvh
+		uint32_t wideNodeCount = wideBvh.isTraversable() ? static_cast<uint32_t>(wideBvh.getNodes().size()) : 0;
+		createSceneBuffer(wideBvh.getNodes().data(), wideNodeCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, wideNodeBuffer, wideNodeBufferMemory);
+		createSceneBuffer(wideBvh.getChildren().data(), wideNodeCount * WideBvh::Width, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, wideChildBuffer, wideChildBufferMemory);
+
+		// Only the wavefront tracer samples lights
+		std::vector<WavefrontLight> lights;
+		if (isWavefrontEnabled()) {
+			lights = WavefrontTracer::gatherLights(sceneData);
 		}
 
-		return (deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU || deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU) &&
-			deviceFeatures.geometryShader && queueIndices.isComplete() && extensionsSupported && swapChainSupported;
+		lightCount = static_cast<uint32_t>(lights.size());
+		createSceneBuffer(lights.data(), lightCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, lightBuffer, lightBufferMemory);
+
+		sceneVersion++;
 	}
 
-	bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
-		uint32_t extensionCount;
+	// Builds over the uploaded scene triangles. The tracer binds the builder's nodes and sorted triangles
+	// instead of the scene buffers.
+	void buildGpuBvh() {
+		PROFILE_ZONE(profiler, "buildGpuBvh");
 
-		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+		uint32_t triangleCount = sceneData.triangleCount;
+		gpuBvhBuilder.createBuffers(device, allocator, triangleBuffer, triangleCount);
 
-		std::vector<VkExtensionProperties> allExtensions(extensionCount);
-		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, allExtensions.data());
+		auto recordBuild = [this](VkCommandBuffer commandBuffer) { gpuBvhBuilder.recordBuild(commandBuffer); };
 
-		std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+#ifdef DEBUG_BUILD
+		double milliseconds = submitAndWait("gpuBvhBuild", recordBuild);
+		DEBUG_OUT("GPU BVH: " << triangleCount << " triangles, " << gpuBvhBuilder.getNodeCount() << " nodes, built in " << milliseconds << "ms" << std::endl);
+#else
+		submitAndWait("gpuBvhBuild", recordBuild);
+#endif
+	}
 
-		for (const auto& extension : allExtensions) {
-			requiredExtensions.erase(extension.extensionName);
+	// Records work outside the frames into a one time command buffer, submits it after the staged uploads
+	// and waits for it. Returns its GPU time, or the wall clock time without timestamps. Uses the GPU
+	// timers of slot 0, so no frame may be in flight.
+	double submitAndWait(const char* zoneName, const std::function<void(VkCommandBuffer)>& record) {
+		VkCommandBufferAllocateInfo allocateInfo = {};
+		allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocateInfo.commandPool = commandPool;
+		allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocateInfo.commandBufferCount = 1;
+
+		VkCommandBuffer commandBuffer;
+		if (vkAllocateCommandBuffers(device, &allocateInfo, &commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("Could not allocate command buffer");
 		}
 
-		return requiredExtensions.empty();
-	}
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(commandBuffer, &beginInfo);
 
-	void mainLoop() {
-		while (!glfwWindowShouldClose(window)) {
-			glfwPollEvents();
+		profiler.beginGpuFrame(commandBuffer, 0);
+		uint32_t zone = profiler.beginGpuZone(commandBuffer, 0, zoneName);
+		record(commandBuffer);
+		profiler.endGpuZone(commandBuffer, 0, zone);
+
+		if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("Could not record command buffer");
+		}
+
+		VkSemaphore uploadSemaphore = uploader.getSemaphore();
+		VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+		VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timelineInfo.waitSemaphoreValueCount = 1;
+		timelineInfo.pWaitSemaphoreValues = &pendingUploadValue;
+
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.pNext = &timelineInfo;
+		submitInfo.waitSemaphoreCount = 1;
+		submitInfo.pWaitSemaphores = &uploadSemaphore;
+		submitInfo.pWaitDstStageMask = &waitStage;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &commandBuffer;
+
+		VkFenceCreateInfo fenceCreateInfo = {};
+		fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+		VkFence fence;
+		if (vkCreateFence(device, &fenceCreateInfo, nullptr, &fence) != VK_SUCCESS) {
+			throw std::runtime_error("Could not create fence");
 		}
+
+		auto submitTime = std::chrono::high_resolution_clock::now();
+
+		if (vkQueueSubmit(renderQueue, 1, &submitInfo, fence) != VK_SUCCESS) {
+			throw std::runtime_error("Could not submit command buffer");
+		}
+
+		vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - submitTime).count();
+
+		profiler.resolveGpuFrame(0, submitTime);
+		double gpuMilliseconds = profiler.getGpuMilliseconds(0, zoneName);
+
+		vkDestroyFence(device, fence, nullptr);
+		vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+
+		return gpuMilliseconds >= 0.0 ? gpuMilliseconds : milliseconds;
 	}
 
-	void cleanup() {
+	// Blocks until the build is done, which in turn waits on the GPU for the triangle upload
+	void buildAccelerationStructure() {
+		PROFILE_ZONE(profiler, "buildAccelerationStructure");
+
+		// Instances go in the order of the instance buffer, whose indices the shader gets back from a hit. A scene
+		// without instances is one mesh placed once.
+		std::vector<Mesh> meshes(sceneData.meshes, sceneData.meshes + sceneData.meshCount);
+		std::vector<MeshInstance> instances = twoLevelBvh.getLeafInstances();
+
+		if (sceneData.instanceCount == 0) {
+			meshes.assign(1, Mesh{ 0, sceneData.triangleCount, 0, 0 });
+			instances.assign(1, MeshInstance{ glm::mat4(1.0f), 0, { 0, 0, 0 } });
+		}
+
+		accelerationStructure.create(device, allocator, deviceCapabilities.accelerationStructureScratchAlignment);
+		accelerationStructure.build(renderQueue, renderFamily, triangleBuffer, meshes, instances, uploader.getSemaphore(), pendingUploadValue);
+
 #ifdef DEBUG_BUILD
-		DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
+		const AccelerationStructureStats& stats = accelerationStructure.getStats();
+		DEBUG_OUT("Acceleration structure: " << stats.triangleCount << " triangles in " << stats.bottomLevelCount << " bottom level(s), " << stats.instanceCount <<
+			" instance(s), " << stats.bottomLevelBytes << " + " << stats.topLevelBytes << " bytes, " << stats.scratchBytes << " bytes of scratch, built in " <<
+			stats.buildMilliseconds << "ms" << std::endl);
 #endif
+	}
 
-		for (auto imageView : swapChainImageViews) {
-			vkDestroyImageView(device, imageView, nullptr);
+	void createFrameBuffers() {
+		PROFILE_ZONE(profiler, "createFrameBuffers");
+
+		// The shader counts the rays it traces so throughput can be reported without guessing path lengths
+		for (auto& frame : frames) {
+			createBuffer(sizeof(TraceCounters), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frame.counterBuffer, frame.counterBufferMemory);
+
+			createBuffer(sizeof(FrameUniforms), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				frame.uniformBuffer, frame.uniformBufferMemory);
+
+			frame.transientArena.create(allocator, TransientArenaSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
 		}
+	}
 
-		vkDestroySwapchainKHR(device, swapChain, nullptr);
-		vkDestroyDevice(device, nullptr);
-		vkDestroySurfaceKHR(instance, surface, nullptr);
-		vkDestroyInstance(instance, nullptr);
+	void createDescriptorSetLayout() {
+		PROFILE_ZONE(profiler, "createDescriptorSetLayout");
+
+		VkDescriptorSetLayoutBinding bindings[17] = {};
+
+		bindings[0].binding = 0;
+		bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		bindings[0].descriptorCount = 1;
+		bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+		// The accumulation image
+		bindings[5] = bindings[0];
+		bindings[5].binding = 5;
+
+		// Triangles, materials, BVH nodes and the ray counter
+		for (uint32_t i = 1; i < 5; i++) {
+			bindings[i].binding = i;
+			bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			bindings[i].descriptorCount = 1;
+			bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		}
 
-		glfwDestroyWindow(window);
-		glfwTerminate();
+		// Adaptive tile state
+		bindings[6] = bindings[1];
+		bindings[6].binding = 6;
+
+		// The previous camera
+		bindings[7] = bindings[0];
+		bindings[7].binding = 7;
+		bindings[7].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+
+		// Radiance, albedo, normals and depth, and motion for the denoiser
+		for (uint32_t i = 8; i < 12; i++) {
+			bindings[i] = bindings[0];
+			bindings[i].binding = i;
+		}
+
+		// The top level nodes and instances of a two level BVH
+		bindings[12] = bindings[1];
+		bindings[12].binding = 13;
+		bindings[13] = bindings[1];
+		bindings[13].binding = 14;
+
+		// The nodes and child references of the wide BVH
+		bindings[14] = bindings[1];
+		bindings[14].binding = 15;
+		bindings[15] = bindings[1];
+		bindings[15].binding = 16;
+
+		// The top level acceleration structure, only declared by the ray query shader, so it goes last
+		bindings[16] = bindings[0];
+		bindings[16].binding = 12;
+		bindings[16].descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+
+		VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {};
+		layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutCreateInfo.bindingCount = useHardwareRayTracing ? 17 : 16;
+		layoutCreateInfo.pBindings = bindings;
+
+		if (vkCreateDescriptorSetLayout(device, &layoutCreateInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS) {
+			throw std::runtime_error("Could not create descriptor set layout");
+		}
 	}
 
-	int width;
-	int height;
+	void createRayTracingPipeline() {
+		PROFILE_ZONE(profiler, "createRayTracingPipeline");
 
-	VkInstance instance;
+		const VkPhysicalDeviceLimits& limits = deviceCapabilities.properties.limits;
 
-	// Surfaces
-	GLFWwindow* window;
-	VkSurfaceKHR surface;
-	
-	// Devices
-	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
-	VkDevice device;
+		if (settings.workgroupWidth > limits.maxComputeWorkGroupSize[0] || settings.workgroupHeight > limits.maxComputeWorkGroupSize[1] ||
+			settings.workgroupWidth * settings.workgroupHeight > limits.maxComputeWorkGroupInvocations) {
+			throw std::runtime_error("Workgroup size exceeds the device limits");
+		}
 
-	// Swap chain
-	VkSwapchainKHR swapChain;
-	std::vector<VkImage> swapChainImages;
-	std::vector<VkImageView> swapChainImageViews;
-	VkFormat swapChainFormat;
-	VkExtent2D swapChainExtent;
+		auto start = std::chrono::high_resolution_clock::now();
+
+		// The same shader built with HARDWARE_RAY_QUERY, see compile.bat
+		VkShaderModule computeShaderModule = createShaderModule(assets.get(useHardwareRayTracing ? "raytrace_hw.spv" : "raytrace.spv"));
+
+		// The workgroup size is a specialization constant so it can be tuned without recompiling the shader
+		uint32_t workgroupSize[] = { settings.workgroupWidth, settings.workgroupHeight };
+
+		VkSpecializationMapEntry specializationEntries[2] = {};
+		specializationEntries[0].constantID = 0;
+		specializationEntries[0].offset = 0;
+		specializationEntries[0].size = sizeof(uint32_t);
+		specializationEntries[1].constantID = 1;
+		specializationEntries[1].offset = sizeof(uint32_t);
+		specializationEntries[1].size = sizeof(uint32_t);
+
+		VkSpecializationInfo specializationInfo = {};
+		specializationInfo.mapEntryCount = 2;
+		specializationInfo.pMapEntries = specializationEntries;
+		specializationInfo.dataSize = sizeof(workgroupSize);
+		specializationInfo.pData = workgroupSize;
+
+		VkPipelineShaderStageCreateInfo computeCreateInfo = {};
+		computeCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		computeCreateInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		computeCreateInfo.module = computeShaderModule;
+		computeCreateInfo.pName = "main";
+		computeCreateInfo.pSpecializationInfo = &specializationInfo;
+
+		VkPushConstantRange pushConstantRange = {};
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		pushConstantRange.offset = 0;
+		pushConstantRange.size = sizeof(TracePushConstants);
+
+		VkPipelineLayoutCreateInfo layoutCreateInfo = {};
+		layoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		layoutCreateInfo.setLayoutCount = 1;
+		layoutCreateInfo.pSetLayouts = &descriptorSetLayout;
+		layoutCreateInfo.pushConstantRangeCount = 1;
+		layoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+		if (vkCreatePipelineLayout(device, &layoutCreateInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
+			throw std::runtime_error("Could not create pipeline layout");
+		}
 
-	// Queues
-	VkQueue graphicsQueue;
-	VkQueue presentQueue;
+		VkComputePipelineCreateInfo pipelineCreateInfo = {};
+		pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineCreateInfo.stage = computeCreateInfo;
+		pipelineCreateInfo.layout = pipelineLayout;
+		// Lets the trace be split into bands that each dispatch a range of workgroup rows
+		pipelineCreateInfo.flags = VK_PIPELINE_CREATE_DISPATCH_BASE_BIT;
 
-	// Debugging
-	VkDebugUtilsMessengerEXT debugMessenger;
-};
+		if (vkCreateComputePipelines(device, pipelineCache.get(), 1, &pipelineCreateInfo, nullptr, &rayTracingPipeline) != VK_SUCCESS) {
+			throw std::runtime_error("Could not create ray tracing pipeline");
+		}
+
+		vkDestroyShaderModule(device, computeShaderModule, nullptr);
+
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		std::cout << "Created ray tracing pipeline in " << milliseconds << "ms (" << (pipelineCache.isWarm() ? "warm" : "cold") << " pipeline cache, " <<
+			(useHardwareRayTracing ? "hardware ray queries" : "compute BVH traversal") << ")" << std::endl;
+	}
+
+	void createDenoisePipelines() {
+		PROFILE_ZONE(profiler, "createDenoisePipelines");
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		VkShaderModule reprojectShaderModule = createShaderModule(assets.get("reproject.spv"));
+		VkShaderModule atrousShaderModule = createShaderModule(assets.get("atrous.spv"));
+
+		denoiser.createPipelines(device, pipelineCache.get(), reprojectShaderModule, atrousShaderModule);
+
+		vkDestroyShaderModule(device, atrousShaderModule, nullptr);
+		vkDestroyShaderModule(device, reprojectShaderModule, nullptr);
+
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		std::cout << "Created denoiser pipelines in " << milliseconds << "ms" << std::endl;
+	}
+
+	void createGpuBvhPipelines() {
+		PROFILE_ZONE(profiler, "createGpuBvhPipelines");
+
+		if (deviceCapabilities.properties.limits.maxComputeWorkGroupInvocations < GpuBvhBuilder::WorkgroupSize ||
+			deviceCapabilities.properties.limits.maxComputeWorkGroupSize[0] < GpuBvhBuilder::WorkgroupSize) {
+			throw std::runtime_error("The GPU BVH builder needs larger workgroups than the device supports");
+		}
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		VkShaderModule lbvhShaderModule = createShaderModule(assets.get("lbvh.spv"));
+		VkShaderModule radixSortShaderModule = createShaderModule(assets.get("radix_sort.spv"));
+
+		gpuBvhBuilder.createPipelines(device, pipelineCache.get(), lbvhShaderModule, radixSortShaderModule);
+
+		vkDestroyShaderModule(device, radixSortShaderModule, nullptr);
+		vkDestroyShaderModule(device, lbvhShaderModule, nullptr);
+
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		std::cout << "Created GPU BVH builder pipelines in " << milliseconds << "ms" << std::endl;
+	}
+
+	void createWavefrontPipelines() {
+		PROFILE_ZONE(profiler, "createWavefrontPipelines");
+
+		if (deviceCapabilities.properties.limits.maxComputeWorkGroupInvocations < WavefrontTracer::WorkgroupSize ||
+			deviceCapabilities.properties.limits.maxComputeWorkGroupSize[0] < WavefrontTracer::WorkgroupSize) {
+			throw std::runtime_error("The wavefront tracer needs larger workgroups than the device supports");
+		}
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		// raytrace.comp built with WAVEFRONT, and HARDWARE_RAY_QUERY to match the single kernel, see compile.bat
+		VkShaderModule wavefrontShaderModule = createShaderModule(assets.get(useHardwareRayTracing ? "wavefront_hw.spv" : "wavefront.spv"));
+
+		wavefrontTracer.createPipelines(device, pipelineCache.get(), wavefrontShaderModule, descriptorSetLayout, sizeof(TracePushConstants));
+
+		vkDestroyShaderModule(device, wavefrontShaderModule, nullptr);
+
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		std::cout << "Created wavefront pipelines in " << milliseconds << "ms" << std::endl;
+	}
+
+	// Sized after storageExtent, so a resize replaces them
+	void createWavefrontBuffers() {
+		wavefrontTracer.createBuffers(device, allocator, storageExtent, sceneData.materialCount, lightBuffer, lightCount);
+
+		DEBUG_OUT("Wavefront tracer: " << storageExtent.width * storageExtent.height << " paths, " << lightCount << " light triangles" << std::endl);
+	}
+
+	bool isWavefrontEnabled() const {
+		return settings.wavefront || settings.wavefrontBenchmark;
+	}
+
+	void createDescriptorPool() {
+		PROFILE_ZONE(profiler, "createDescriptorPool");
+
+		uint32_t frameCount = static_cast<uint32_t>(frames.size());
+
+		VkDescriptorPoolSize poolSizes[4] = {};
+		poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		poolSizes[0].descriptorCount = 6 * frameCount;
+		poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		poolSizes[1].descriptorCount = 9 * frameCount;
+		poolSizes[2].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		poolSizes[2].descriptorCount = frameCount;
+		poolSizes[3].type = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+		poolSizes[3].descriptorCount = frameCount;
+
+		VkDescriptorPoolCreateInfo poolCreateInfo = {};
+		poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolCreateInfo.maxSets = frameCount;
+		poolCreateInfo.poolSizeCount = useHardwareRayTracing ? 4 : 3;
+		poolCreateInfo.pPoolSizes = poolSizes;
+
+		if (vkCreateDescriptorPool(device, &poolCreateInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
+			throw std::runtime_error("Could not create descriptor pool");
+		}
+	}
+
+	void createDescriptorSets() {
+		PROFILE_ZONE(profiler, "createDescriptorSets");
+
+		std::vector<VkDescriptorSetLayout> layouts(frames.size(), descriptorSetLayout);
+
+		VkDescriptorSetAllocateInfo allocateInfo = {};
+		allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocateInfo.descriptorPool = descriptorPool;
+		allocateInfo.descriptorSetCount = static_cast<uint32_t>(layouts.size());
+		allocateInfo.pSetLayouts = layouts.data();
+
+		std::vector<VkDescriptorSet> descriptorSets(frames.size());
+		if (vkAllocateDescriptorSets(device, &allocateInfo, descriptorSets.data()) != VK_SUCCESS) {
+			throw std::runtime_error("Could not allocate descriptor sets");
+		}
+
+		for (size_t f = 0; f < frames.size(); f++) {
+			FrameResources& frame = frames[f];
+			frame.descriptorSet = descriptorSets[f];
+
+			VkDescriptorImageInfo imageInfo = {};
+			imageInfo.imageView = frame.storageImageView;
+			imageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+			VkDescriptorImageInfo accumulationInfo = {};
+			accumulationInfo.imageView = accumulationImageView;
+			accumulationInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+			VkDescriptorBufferInfo bufferInfos[9] = {};
+			bufferInfos[0].buffer = settings.gpuBvh ? gpuBvhBuilder.getTriangleBuffer() : triangleBuffer;
+			bufferInfos[1].buffer = materialBuffer;
+			bufferInfos[2].buffer = settings.gpuBvh ? gpuBvhBuilder.getNodeBuffer() : nodeBuffer;
+			bufferInfos[3].buffer = frame.counterBuffer;
+			bufferInfos[4].buffer = adaptiveTileBuffer;
+			bufferInfos[5].buffer = topNodeBuffer;
+			bufferInfos[6].buffer = instanceBuffer;
+			bufferInfos[7].buffer = wideNodeBuffer;
+			bufferInfos[8].buffer = wideChildBuffer;
+
+			VkDescriptorBufferInfo uniformInfo = {};
+			uniformInfo.buffer = frame.uniformBuffer;
+			uniformInfo.offset = 0;
+			uniformInfo.range = VK_WHOLE_SIZE;
+
+			VkDescriptorImageInfo denoiseInfos[4] = {};
+			denoiseInfos[0].imageView = denoiser.getRadianceView();
+			denoiseInfos[1].imageView = denoiser.getAlbedoView();
+			denoiseInfos[2].imageView = denoiser.getNormalDepthView();
+			denoiseInfos[3].imageView = denoiser.getMotionView();
+
+			VkAccelerationStructureKHR topLevel = accelerationStructure.getTopLevel();
+
+			VkWriteDescriptorSetAccelerationStructureKHR accelerationStructureInfo = {};
+			accelerationStructureInfo.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR;
+			accelerationStructureInfo.accelerationStructureCount = 1;
+			accelerationStructureInfo.pAccelerationStructures = &topLevel;
+
+			VkWriteDescriptorSet writes[17] = {};
+
+			writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writes[0].dstSet = frame.descriptorSet;
+			writes[0].dstBinding = 0;
+			writes[0].descriptorCount = 1;
+			writes[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+			writes[0].pImageInfo = &imageInfo;
+
+			for (uint32_t i = 0; i < 4; i++) {
+				bufferInfos[i].offset = 0;
+				bufferInfos[i].range = VK_WHOLE_SIZE;
+
+				writes[i + 1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				writes[i + 1].dstSet = frame.descriptorSet;
+				writes[i + 1].dstBinding = i + 1;
+				writes[i + 1].descriptorCount = 1;
+				writes[i + 1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				writes[i + 1].pBufferInfo = &bufferInfos[i];
+			}
+
+			writes[5] = writes[0];
+			writes[5].dstBinding = 5;
+			writes[5].pImageInfo = &accumulationInfo;
+
+			bufferInfos[4].range = VK_WHOLE_SIZE;
+
+			writes[6] = writes[1];
+			writes[6].dstBinding = 6;
+			writes[6].pBufferInfo = &bufferInfos[4];
+
+			writes[7] = writes[1];
+			writes[7].dstBinding = 7;
+			writes[7].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+			writes[7].pBufferInfo = &uniformInfo;
+
+			for (uint32_t i = 0; i < 4; i++) {
+				denoiseInfos[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+				writes[i + 8] = writes[0];
+				writes[i + 8].dstBinding = i + 8;
+				writes[i + 8].pImageInfo = &denoiseInfos[i];
+			}
+
+			// Top level nodes, instances, wide nodes and wide child references at bindings 13 to 16
+			for (uint32_t i = 0; i < 4; i++) {
+				bufferInfos[i + 5].range = VK_WHOLE_SIZE;
+
+				writes[i + 12] = writes[1];
+				writes[i + 12].dstBinding = i + 13;
+				writes[i + 12].pBufferInfo = &bufferInfos[i + 5];
+			}
+
+			writes[16] = writes[0];
+			writes[16].pNext = &accelerationStructureInfo;
+			writes[16].dstBinding = 12;
+			writes[16].descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+			writes[16].pImageInfo = nullptr;
+
+			vkUpdateDescriptorSets(device, useHardwareRayTracing ? 17 : 16, writes, 0, nullptr);
+		}
+
+		if (settings.denoise.iterations > 0) {
+			std::vector<VkImageView> displayViews;
+			for (const auto& frame : frames) {
+				displayViews.push_back(frame.storageImageView);
+			}
+
+			denoiser.createDescriptorSets(displayViews);
+		}
+	}
+
+	void createGpuProfiler() {
+		PROFILE_ZONE(profiler, "createGpuProfiler");
+
+		profiler.createGpuTimers(device, deviceCapabilities.queueFamilies[renderFamily].timestampValidBits, deviceCapabilities.properties.limits.timestampPeriod,
+			static_cast<uint32_t>(frames.size()));
+
+		// Without timestamps the throughput falls back to wall clock time around the fence wait
+		if (!profiler.hasGpuTimers()) {
+			DEBUG_OUT("Timestamps are not supported, timing frames on the CPU" << std::endl);
+		}
+	}
+
+	void createCommandBuffers() {
+		PROFILE_ZONE(profiler, "createCommandBuffers");
+
+		std::vector<VkCommandBuffer> commandBuffers(frames.size());
+
+		VkCommandBufferAllocateInfo allocateInfo = {};
+		allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocateInfo.commandPool = commandPool;
+		allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocateInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+
+		if (vkAllocateCommandBuffers(device, &allocateInfo, commandBuffers.data()) != VK_SUCCESS) {
+			throw std::runtime_error("Could not allocate command buffers");
+		}
+
+		for (size_t f = 0; f < frames.size(); f++) {
+			frames[f].commandBuffer = commandBuffers[f];
+		}
+	}
+
+	void createCommandRecorder() {
+		PROFILE_ZONE(profiler, "createCommandRecorder");
+
+		if (settings.traceBands <= 1) {
+			return;
+		}
+
+		recordScheduler = std::make_unique<TaskScheduler>(settings.threadCount);
+		recorder.create(device, renderFamily, static_cast<uint32_t>(frames.size()), *recordScheduler);
+	}
+
+	void createSyncObjects() {
+		PROFILE_ZONE(profiler, "createSyncObjects");
+
+		VkFenceCreateInfo fenceCreateInfo = {};
+		fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+		VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+		semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+		for (auto& frame : frames) {
+			if (vkCreateFence(device, &fenceCreateInfo, nullptr, &frame.inFlightFence) != VK_SUCCESS) {
+				throw std::runtime_error("Could not create fence");
+			}
+
+			if (settings.headless) {
+				continue;
+			}
+
+			if (vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &frame.imageAvailableSemaphore) != VK_SUCCESS ||
+				vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &frame.renderFinishedSemaphore) != VK_SUCCESS) {
+				throw std::runtime_error("Could not create semaphores");
+			}
+		}
+
+		// The swap chain can hand out an image that an older frame is still copying into when it has
+		// fewer images than there are frames in flight
+		imagesInFlight.assign(swapChainImages.size(), VK_NULL_HANDLE);
+	}
+
+	// The code is read straight out of the asset pack, which keeps every asset aligned for this
+	VkShaderModule createShaderModule(const AssetView& code) {
+		if (code.size == 0 || code.size % sizeof(uint32_t) != 0) {
+			throw std::runtime_error("Shader code is not a whole number of SPIR-V words");
+		}
+
+		VkShaderModuleCreateInfo moduleCreateInfo = {};
+		moduleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+		moduleCreateInfo.codeSize = code.size;
+		moduleCreateInfo.pCode = code.words();
+
+		VkShaderModule shaderModule;
+		if (vkCreateShaderModule(device, &moduleCreateInfo, nullptr, &shaderModule) != VK_SUCCESS) {
+			throw std::runtime_error("Could not create shader module");
+		}
+
+		return shaderModule;
+	}
+
+	QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device, const std::vector<VkQueueFamilyProperties>& queueFamilies) {
+		QueueFamilyIndices indices;
+
+		// Every family is visited, the dedicated ones may come after the first graphics family
+		uint32_t i = 0;
+		for (auto& queueFamily : queueFamilies) {
+			if (queueFamily.queueCount == 0) {
+				i++;
+				continue;
+			}
+
+			VkQueueFlags flags = queueFamily.queueFlags;
+
+			// The ray tracing work is compute, so the main queue must support both graphics and compute
+			if (!indices.graphicsFamily.has_value() && (flags & VK_QUEUE_GRAPHICS_BIT) && (flags & VK_QUEUE_COMPUTE_BIT)) {
+				indices.graphicsFamily = i;
+			}
+
+			// A family without graphics runs next to the main queue rather than sharing it
+			if (!indices.computeFamily.has_value() && (flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT)) {
+				indices.computeFamily = i;
+			}
+
+			// Transfer only families are usually backed by the copy engines
+			if (!indices.transferFamily.has_value() && (flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+				indices.transferFamily = i;
+			}
+
+			if (surface != VK_NULL_HANDLE && !indices.presentFamily.has_value()) {
+				VkBool32 presentSupported = false;
+				vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupported);
+
+				if (presentSupported) {
+					indices.presentFamily = i;
+				}
+			}
+
+			i++;
+		}
+
+		if (indices.graphicsFamily.has_value()) {
+			if (!indices.transferFamily.has_value()) {
+				indices.transferFamily = indices.graphicsFamily;
+			}
+
+			if (!indices.computeFamily.has_value()) {
+				indices.computeFamily = indices.graphicsFamily;
+			}
+		}
+
+		return indices;
+	}
+
+	VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities) {
+		if (capabilities.currentExtent.width != UINT32_MAX) {
+			return capabilities.currentExtent;
+		}
+		else {
+			int framebufferWidth;
+			int framebufferHeight;
+			glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+
+			VkExtent2D actualExtent = { static_cast<uint32_t>(framebufferWidth), static_cast<uint32_t>(framebufferHeight) };
+
+			actualExtent.width = std::max(capabilities.minImageExtent.width, std::min(capabilities.maxImageExtent.width, actualExtent.width));
+			actualExtent.height = std::max(capabilities.minImageExtent.height, std::min(capabilities.maxImageExtent.height, actualExtent.height));
+
+			return actualExtent;
+		}
+	}
+
+	VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availableModes) {
+		for (const auto mode : availableModes) {
+			if (mode == VK_PRESENT_MODE_MAILBOX_KHR) {
+				return mode;
+			}
+		}
+
+		return VK_PRESENT_MODE_FIFO_KHR;
+	}
+
+	VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats) {
+		for (const auto format : availableFormats) {
+			if (format.format == VK_FORMAT_B8G8R8A8_UNORM && format.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
+				return format;
+			}
+		}
+
+		return availableFormats[0];
+	}
+
+	SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device) {
+		SwapChainSupportDetails details;
+
+		vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface, &details.capabilities);
+
+		uint32_t formatCount;
+		vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, nullptr);
+
+		if (formatCount != 0) {
+			details.formats.resize(formatCount);
+			vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, details.formats.data());
+		}
+
+		uint32_t presentModeCount;
+		vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, nullptr);
+
+		if (presentModeCount != 0) {
+			details.presentModes.resize(presentModeCount);
+			vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, details.presentModes.data());
+		}
+
+		return details;
+	}
+
+	// Queries everything rateDevice and the later init stages need from a device in one pass
+	DeviceCapabilities probeDevice(VkPhysicalDevice device) {
+		DeviceCapabilities capabilities;
+		capabilities.physicalDevice = device;
+
+		vkGetPhysicalDeviceProperties(device, &capabilities.properties);
+
+		uint32_t queueFamilyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+		capabilities.queueFamilies.resize(queueFamilyCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, capabilities.queueFamilies.data());
+
+		capabilities.queueIndices = findQueueFamilies(device, capabilities.queueFamilies);
+
+		uint32_t extensionCount = 0;
+		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+		std::vector<VkExtensionProperties> allExtensions(extensionCount);
+		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, allExtensions.data());
+
+		for (const auto& extension : allExtensions) {
+			capabilities.extensions.insert(extension.extensionName);
+		}
+
+		// The 1.2 feature struct is only understood by 1.2 devices, older ones are rejected by rateDevice anyway
+		if (capabilities.properties.apiVersion >= VK_API_VERSION_1_2) {
+			VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+			vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+			VkPhysicalDeviceAccelerationStructureFeaturesKHR accelerationStructureFeatures = {};
+			accelerationStructureFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
+
+			VkPhysicalDeviceRayQueryFeaturesKHR rayQueryFeatures = {};
+			rayQueryFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR;
+			rayQueryFeatures.pNext = &accelerationStructureFeatures;
+
+			// Extension structs may only be chained when the device has the extension
+			bool hasRayQueryExtensions = std::all_of(rayQueryExtensions.begin(), rayQueryExtensions.end(),
+				[&capabilities](const char* extension) { return capabilities.extensions.count(extension) > 0; });
+
+			if (hasRayQueryExtensions) {
+				vulkan12Features.pNext = &rayQueryFeatures;
+			}
+
+			VkPhysicalDeviceFeatures2 features = {};
+			features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+			features.pNext = &vulkan12Features;
+			vkGetPhysicalDeviceFeatures2(device, &features);
+
+			capabilities.timelineSemaphore = vulkan12Features.timelineSemaphore;
+			capabilities.hardwareRayTracing = hasRayQueryExtensions && vulkan12Features.bufferDeviceAddress && accelerationStructureFeatures.accelerationStructure &&
+				rayQueryFeatures.rayQuery;
+
+			if (capabilities.hardwareRayTracing) {
+				VkPhysicalDeviceAccelerationStructurePropertiesKHR accelerationStructureProperties = {};
+				accelerationStructureProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR;
+
+				VkPhysicalDeviceProperties2 properties = {};
+				properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+				properties.pNext = &accelerationStructureProperties;
+				vkGetPhysicalDeviceProperties2(device, &properties);
+
+				capabilities.accelerationStructureScratchAlignment = accelerationStructureProperties.minAccelerationStructureScratchOffsetAlignment;
+			}
+		}
+
+		if (surface != VK_NULL_HANDLE && capabilities.queueIndices.presentFamily.has_value()) {
+			capabilities.swapChainSupport = querySwapChainSupport(device);
+		}
+
+		capabilities.score = rateDevice(capabilities);
+
+		return capabilities;
+	}
+
+	// Scores a device by what it can do rather than what kind of device it is. A score of 0 means
+	// the device cannot run the renderer at all; software drivers such as lavapipe still qualify.
+	uint32_t rateDevice(const DeviceCapabilities& capabilities) {
+		const VkPhysicalDeviceProperties& deviceProperties = capabilities.properties;
+
+		if (!capabilities.queueIndices.isComplete(!settings.headless) || !checkDeviceExtensionSupport(capabilities)) {
+			return 0;
+		}
+
+		if (!settings.headless) {
+			const SwapChainSupportDetails& details = capabilities.swapChainSupport;
+
+			if (details.formats.empty() || details.presentModes.empty()) {
+				return 0;
+			}
+
+			// The traced image reaches the swap chain through a transfer
+			if (!(details.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT)) {
+				return 0;
+			}
+		}
+
+		if (deviceProperties.limits.maxImageDimension2D < static_cast<uint32_t>(std::max(width, height))) {
+			return 0;
+		}
+
+		// Staging uploads are tracked with timeline semaphores, which are core from Vulkan 1.2
+		if (deviceProperties.apiVersion < VK_API_VERSION_1_2 || !capabilities.timelineSemaphore) {
+			return 0;
+		}
+
+		// Everything else can fall back to the compute tracer, unless the hardware one was asked for
+		if (settings.traceMode == TraceMode::Hardware && !capabilities.hardwareRayTracing) {
+			return 0;
+		}
+
+		uint32_t score = 1;
+
+		switch (deviceProperties.deviceType) {
+		case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+			score += 1000;
+			break;
+		case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+			score += 500;
+			break;
+		case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+			score += 250;
+			break;
+		default:
+			break;
+		}
+
+		// Breaks ties between devices of the same type in favour of ray tracing hardware
+		if (settings.traceMode == TraceMode::Auto && capabilities.hardwareRayTracing) {
+			score += 100;
+		}
+
+		DEBUG_OUT("Device " << deviceProperties.deviceName << " scored " << score << std::endl);
+
+		return score;
+	}
+
+	std::vector<const char*> getRequiredDeviceExtensions() {
+		std::vector<const char*> requiredExtensions;
+
+		for (auto extension : deviceExtensions) {
+			// Without a surface there is nothing to present to
+			if (settings.headless && std::strcmp(extension, VK_KHR_SWAPCHAIN_EXTENSION_NAME) == 0) {
+				continue;
+			}
+
+			requiredExtensions.push_back(extension);
+		}
+
+		return requiredExtensions;
+	}
+
+	bool checkDeviceExtensionSupport(const DeviceCapabilities& capabilities) {
+		for (const char* extension : getRequiredDeviceExtensions()) {
+			if (capabilities.extensions.count(extension) == 0) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	void mainLoop() {
+		auto reportStart = std::chrono::high_resolution_clock::now();
+		auto lastInput = reportStart;
+		uint32_t reportFrames = 0;
+
+		while (!glfwWindowShouldClose(window)) {
+			glfwPollEvents();
+
+			if (framebufferResized && !recreateSwapChain()) {
+				// A minimized window has nothing to present to, so sleep until it is restored
+				glfwWaitEvents();
+
+				lastInput = std::chrono::high_resolution_clock::now();
+				reportStart = lastInput;
+				reportFrames = 0;
+				continue;
+			}
+
+			auto inputTime = std::chrono::high_resolution_clock::now();
+			// Long pauses, like waiting for events below, must not turn into a jump of the camera
+			updateCamera(std::min(0.1f, std::chrono::duration<float>(inputTime - lastInput).count()));
+			updateDebugViews();
+			lastInput = inputTime;
+
+			if (settings.progressive) {
+				updateAccumulation();
+
+				if (isAccumulationConverged() && !redrawRequested) {
+					// The image on screen is already the result, so sleep until input may change it
+					glfwWaitEvents();
+
+					lastInput = std::chrono::high_resolution_clock::now();
+					reportStart = lastInput;
+					reportFrames = 0;
+					continue;
+				}
+			}
+
+			drawFrame();
+			reportFrames++;
+			redrawRequested = false;
+
+			auto now = std::chrono::high_resolution_clock::now();
+			double seconds = std::chrono::duration<double>(now - reportStart).count();
+
+			if (seconds >= 1.0) {
+				std::cout << reportFrames / seconds << " frames/s, " << traceRaysPerSecond() / 1e6 << " Mrays/s, " << formatFrameTimings() << std::endl;
+
+				if (resolutionGovernor.isEnabled()) {
+					std::cout << "\tRendering at " << storageExtent.width << "x" << storageExtent.height << ", scale " << resolutionGovernor.getScale() <<
+						", GPU frame " << resolutionGovernor.getSmoothedMilliseconds() << "ms for a " << settings.resolution.targetMilliseconds << "ms target" << std::endl;
+				}
+
+				if (settings.progressive) {
+					std::cout << "\t" << completedSamples << " samples per pixel accumulated, noise " << noiseEstimate << std::endl;
+				}
+
+				if (settings.denoise.iterations > 0 && profiler.hasGpuTimers()) {
+					denoiser.printTimings(profiler, std::cout);
+				}
+
+				if (settings.printProfile) {
+					profiler.printStats(std::cout);
+				}
+
+				reportStart = now;
+				reportFrames = 0;
+				tracedRays = 0;
+				traceMilliseconds = 0.0;
+				frameTimings.reset();
+			}
+		}
+	}
+
+	// WASD moves the camera, Q and E move it down and up and the arrow keys turn it
+	void updateCamera(float seconds) {
+		const float moveSpeed = 1.5f;
+		const float turnSpeed = 1.2f;
+
+		Camera& camera = scene.camera;
+		glm::vec3 forward = glm::normalize(camera.forward);
+		glm::vec3 right = glm::normalize(glm::cross(forward, camera.up));
+		glm::vec3 up = glm::cross(right, forward);
+
+		auto axis = [this](int positiveKey, int negativeKey) {
+			return (glfwGetKey(window, positiveKey) == GLFW_PRESS ? 1.0f : 0.0f) - (glfwGetKey(window, negativeKey) == GLFW_PRESS ? 1.0f : 0.0f);
+		};
+
+		glm::vec3 move = forward * axis(GLFW_KEY_W, GLFW_KEY_S) + right * axis(GLFW_KEY_D, GLFW_KEY_A) + camera.up * axis(GLFW_KEY_E, GLFW_KEY_Q);
+		float yaw = axis(GLFW_KEY_LEFT, GLFW_KEY_RIGHT) * turnSpeed * seconds;
+		float pitch = axis(GLFW_KEY_UP, GLFW_KEY_DOWN) * turnSpeed * seconds;
+
+		// The camera is only written when a key is held, an untouched camera compares equal and keeps accumulating
+		if (move != glm::vec3(0.0f)) {
+			camera.position += glm::normalize(move) * moveSpeed * seconds;
+		}
+
+		if (yaw != 0.0f || pitch != 0.0f) {
+			glm::vec3 turned = forward * std::cos(yaw) - right * std::sin(yaw);
+			turned = glm::normalize(turned * std::cos(pitch) + up * std::sin(pitch));
+
+			// Stop short of looking straight up or down, where right is undefined
+			if (std::abs(glm::dot(turned, glm::normalize(camera.up))) < 0.99f) {
+				camera.forward = turned;
+			}
+		}
+	}
+
+	// H toggles the sample density heatmap. Only the display changes, the accumulation carries on.
+	void updateDebugViews() {
+		bool heatmapKey = glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS;
+
+		if (heatmapKey && !heatmapKeyDown) {
+			showSampleDensity = !showSampleDensity;
+			redrawRequested = true;
+		}
+
+		heatmapKeyDown = heatmapKey;
+	}
+
+	AccumulationKey getAccumulationKey() const {
+		return { scene.camera, sceneVersion, settings.samplesPerPixel, settings.maxBounces, storageExtent };
+	}
+
+	// Starts the accumulation over if anything the accumulated samples depend on has changed
+	void updateAccumulation() {
+		AccumulationKey key = getAccumulationKey();
+
+		if (accumulationEpoch > 0 && key == accumulationKey) {
+			return;
+		}
+
+		accumulationKey = key;
+		accumulationEpoch++;
+		accumulatedSamples = 0;
+		completedSamples = 0;
+		noiseEstimate = 1.0;
+		accumulatedRays = 0;
+		activeTiles = adaptiveTileCount;
+		reportedConvergence = false;
+	}
+
+	// Hands the frame its share of the accumulation, the samples it adds start at frame.accumulatedSamples
+	void beginAccumulationFrame(FrameResources& frame) {
+		if (!settings.progressive) {
+			return;
+		}
+
+		updateAccumulation();
+
+		frame.accumulationEpoch = accumulationEpoch;
+		frame.accumulatedSamples = accumulatedSamples;
+		accumulatedSamples += settings.samplesPerPixel;
+	}
+
+	// The sample target counts submitted samples, since the frames in flight will complete anyway. The noise
+	// estimate comes from the last completed frame and is only trusted after a few samples, a single sample
+	// per pixel has no variance at all. Adaptive sampling is done once the last frame had every tile retired.
+	bool isAccumulationConverged() {
+		const uint32_t minimumNoiseSamples = 16;
+
+		bool reachedTarget = settings.targetSamples > 0 && accumulatedSamples >= settings.targetSamples;
+		bool belowThreshold = settings.noiseThreshold > 0.0f && completedSamples >= minimumNoiseSamples && noiseEstimate <= settings.noiseThreshold;
+		bool tilesRetired = settings.adaptiveThreshold > 0.0f && completedSamples > 0 && activeTiles == 0;
+
+		if (!reachedTarget && !belowThreshold && !tilesRetired) {
+			return false;
+		}
+
+		if (!reportedConvergence) {
+			std::cout << "Converged after " << accumulatedSamples << " samples per pixel at most, noise " << noiseEstimate << ", " << accumulatedRays << " rays (" <<
+				accumulatedRays / (static_cast<double>(storageExtent.width) * storageExtent.height) << " per pixel)" << std::endl;
+			reportedConvergence = true;
+		}
+
+		return true;
+	}
+
+	TracePushConstants getPushConstants(uint32_t frameIndex) {
+		const Camera& camera = scene.camera;
+		glm::vec3 forward = glm::normalize(camera.forward);
+		glm::vec3 right = glm::normalize(glm::cross(forward, camera.up));
+		glm::vec3 up = glm::cross(right, forward);
+
+		float aspect = static_cast<float>(storageExtent.width) / static_cast<float>(storageExtent.height);
+
+		TracePushConstants constants = {};
+		constants.cameraPosition = glm::vec4(camera.position, std::tan(camera.verticalFov * 0.5f));
+		constants.cameraForward = glm::vec4(forward, aspect);
+		constants.cameraRight = glm::vec4(right, 0.0f);
+		constants.cameraUp = glm::vec4(up, 0.0f);
+		constants.backgroundColor = glm::vec4(scene.backgroundColor, 0.0f);
+		constants.frameIndex = frameIndex;
+		constants.samplesPerPixel = settings.samplesPerPixel;
+		constants.maxBounces = settings.maxBounces;
+		constants.nodeCount = settings.gpuBvh ? gpuBvhBuilder.getNodeCount() : sceneData.nodeCount;
+		constants.instanceCount = sceneData.instanceCount > 0 ? static_cast<uint32_t>(twoLevelBvh.getInstances().size()) : 0;
+
+		if (showSampleDensity) {
+			constants.flags |= TraceFlagSampleDensity;
+		}
+
+		if (wideBvh.isTraversable()) {
+			constants.flags |= TraceFlagWideBvh;
+		}
+
+		return constants;
+	}
+
+	// Binds everything the trace shader uses and dispatches groupCountY rows of workgroups starting at
+	// firstGroupY. Safe to call from any thread as long as every thread records its own command buffer.
+	void recordTraceDispatch(VkCommandBuffer commandBuffer, const FrameResources& frame, const TracePushConstants& constants, uint32_t firstGroupY, uint32_t groupCountY) {
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, rayTracingPipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &frame.descriptorSet, 0, nullptr);
+		vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(TracePushConstants), &constants);
+
+		uint32_t groupCountX = (storageExtent.width + settings.workgroupWidth - 1) / settings.workgroupWidth;
+		vkCmdDispatchBase(commandBuffer, 0, firstGroupY, 0, groupCountX, groupCountY, 1);
+	}
+
+	// Records one trace dispatch into the resources of frames[slot]. The result is copied to
+	// swapChainImages[imageIndex] when a window exists, or into the frame's readback buffer when headless.
+	void recordTraceCommands(uint32_t slot, uint32_t frameIndex, uint32_t imageIndex) {
+		FrameResources& frame = frames[slot];
+		VkCommandBuffer commandBuffer = frame.commandBuffer;
+
+		PROFILE_ZONE(profiler, "recordTraceCommands");
+
+		// The frame's fence has been waited on, so nothing from the last use of the arena or the
+		// worker command pools is still read
+		frame.transientArena.reset();
+		if (recordScheduler) {
+			recorder.beginFrame(slot);
+		}
+
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+		if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+			throw std::runtime_error("Could not begin command buffer");
+		}
+
+		profiler.beginGpuFrame(commandBuffer, slot);
+		// Everything the GPU does for the frame, which the resolution governor holds to its target
+		uint32_t frameZone = profiler.beginGpuZone(commandBuffer, slot, "frame");
+
+		denoiser.recordPrepare(commandBuffer);
+
+		vkCmdFillBuffer(commandBuffer, frame.counterBuffer, 0, VK_WHOLE_SIZE, 0);
+
+		bool adaptive = settings.adaptiveThreshold > 0.0f;
+		// The generation of tile state this frame writes, the previous frame read it
+		VkDeviceSize tileGenerationSize = sizeof(AdaptiveTile) * adaptiveTileCount;
+		VkDeviceSize tileWriteOffset = (frame.accumulatedSamples / settings.samplesPerPixel) % 2 * tileGenerationSize;
+
+		VkBufferMemoryBarrier tilesToShader = {};
+		tilesToShader.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		tilesToShader.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		tilesToShader.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		tilesToShader.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		tilesToShader.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		tilesToShader.buffer = adaptiveTileBuffer;
+		tilesToShader.offset = 0;
+		tilesToShader.size = VK_WHOLE_SIZE;
+
+		if (adaptive) {
+			// The error sums are accumulated with atomics, so the generation written this frame starts at zero
+			VkBufferMemoryBarrier tilesToTransfer = tilesToShader;
+			tilesToTransfer.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+			tilesToTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1, &tilesToTransfer, 0, nullptr);
+			vkCmdFillBuffer(commandBuffer, adaptiveTileBuffer, tileWriteOffset, tileGenerationSize, 0);
+		}
+
+		VkBufferMemoryBarrier counterToShader = {};
+		counterToShader.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		counterToShader.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		counterToShader.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		counterToShader.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		counterToShader.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		counterToShader.buffer = frame.counterBuffer;
+		counterToShader.offset = 0;
+		counterToShader.size = VK_WHOLE_SIZE;
+
+		VkImageSubresourceRange range = {};
+		range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		range.levelCount = 1;
+		range.layerCount = 1;
+
+		// The previous contents are overwritten, so the transfer that read them only needs an execution dependency
+		VkImageMemoryBarrier storageToGeneral = {};
+		storageToGeneral.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		storageToGeneral.srcAccessMask = 0;
+		storageToGeneral.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		storageToGeneral.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		storageToGeneral.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		storageToGeneral.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		storageToGeneral.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		storageToGeneral.image = frame.storageImage;
+		storageToGeneral.subresourceRange = range;
+
+		// The previous frame's trace wrote the sums this one adds to. Starting over discards them.
+		VkImageMemoryBarrier accumulationToShader = storageToGeneral;
+		accumulationToShader.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		accumulationToShader.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		accumulationToShader.oldLayout = frame.accumulatedSamples > 0 ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_UNDEFINED;
+		accumulationToShader.image = accumulationImage;
+
+		VkImageMemoryBarrier toShader[] = { storageToGeneral, accumulationToShader };
+		VkBufferMemoryBarrier buffersToShader[] = { counterToShader, tilesToShader };
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr,
+			adaptive ? 2 : 1, buffersToShader, 2, toShader);
+
+		TracePushConstants constants = getPushConstants(frameIndex);
+
+		if (settings.progressive) {
+			// Every accumulated frame needs new samples, so the random sequence follows the samples taken so far
+			constants.frameIndex = frame.accumulatedSamples / settings.samplesPerPixel;
+			constants.accumulatedSamples = frame.accumulatedSamples;
+			constants.flags |= TraceFlagAccumulate;
+
+			if (adaptive) {
+				constants.flags |= TraceFlagAdaptive;
+				constants.adaptiveThreshold = settings.adaptiveThreshold;
+				constants.maxSamples = settings.targetSamples;
+			}
+		}
+
+		// The heatmap replaces the image, there is nothing to denoise
+		bool denoise = settings.denoise.iterations > 0 && !showSampleDensity;
+		if (denoise) {
+			constants.flags |= TraceFlagDenoise;
+		}
+
+		if (useWavefront && sortMaterials) {
+			constants.flags |= TraceFlagSortMaterials;
+		}
+
+		// Motion vectors point back to where the previously recorded frame's camera saw each hit
+		const TracePushConstants& previous = hasPreviousConstants ? previousConstants : constants;
+
+		FrameUniforms& uniforms = *static_cast<FrameUniforms*>(frame.uniformBufferMemory.mapped);
+		uniforms.previousCameraPosition = previous.cameraPosition;
+		uniforms.previousCameraForward = previous.cameraForward;
+		uniforms.previousCameraRight = previous.cameraRight;
+		uniforms.previousCameraUp = previous.cameraUp;
+
+		previousConstants = constants;
+		hasPreviousConstants = true;
+
+		uint32_t traceZone = profiler.beginGpuZone(commandBuffer, slot, "trace");
+
+		uint32_t groupCountY = (storageExtent.height + settings.workgroupHeight - 1) / settings.workgroupHeight;
+
+		// The wavefront stages depend on each other through barriers, so they are never split into bands
+		if (useWavefront) {
+			wavefrontTracer.record(commandBuffer, frame.descriptorSet, &constants, settings.samplesPerPixel, settings.maxBounces, sortMaterials);
+		}
+		else if (recordScheduler) {
+			uint32_t bandCount = std::min(settings.traceBands, groupCountY);
+
+			recorder.record(slot, commandBuffer, bandCount, [&](uint32_t band, VkCommandBuffer secondary) {
+				uint32_t firstGroupY = groupCountY * band / bandCount;
+				uint32_t lastGroupY = groupCountY * (band + 1) / bandCount;
+
+				recordTraceDispatch(secondary, frame, constants, firstGroupY, lastGroupY - firstGroupY);
+			});
+		}
+		else {
+			recordTraceDispatch(commandBuffer, frame, constants, 0, groupCountY);
+		}
+
+		profiler.endGpuZone(commandBuffer, slot, traceZone);
+
+		if (denoise) {
+			denoiser.record(commandBuffer, slot, profiler, settings.denoise);
+		}
+
+		VkBufferMemoryBarrier counterToTransfer = counterToShader;
+		counterToTransfer.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		counterToTransfer.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+		VkImageMemoryBarrier storageToTransfer = storageToGeneral;
+		storageToTransfer.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		storageToTransfer.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		storageToTransfer.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+		storageToTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1, &counterToTransfer, 1, &storageToTransfer);
+
+		uint32_t copyZone = profiler.beginGpuZone(commandBuffer, slot, "copyOut");
+
+		LinearArena::Slice counterReadback = frame.transientArena.allocate(sizeof(TraceCounters), sizeof(uint32_t));
+		frame.counterReadbackData = counterReadback.mapped;
+
+		VkBufferCopy counterRegion = {};
+		counterRegion.dstOffset = counterReadback.offset;
+		counterRegion.size = sizeof(TraceCounters);
+		vkCmdCopyBuffer(commandBuffer, frame.counterBuffer, counterReadback.buffer, 1, &counterRegion);
+
+		if (settings.headless) {
+			VkBufferImageCopy region = {};
+			region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			region.imageSubresource.layerCount = 1;
+			region.imageExtent = { storageExtent.width, storageExtent.height, 1 };
+
+			vkCmdCopyImageToBuffer(commandBuffer, frame.storageImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, frame.readbackBuffer, 1, &region);
+		}
+		else {
+			VkImageMemoryBarrier swapChainToTransfer = storageToGeneral;
+			swapChainToTransfer.srcAccessMask = 0;
+			swapChainToTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			swapChainToTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			swapChainToTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			swapChainToTransfer.image = swapChainImages[imageIndex];
+
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &swapChainToTransfer);
+
+			VkImageSubresourceLayers layers = {};
+			layers.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			layers.layerCount = 1;
+
+			if (blitToSwapChain) {
+				VkImageBlit blit = {};
+				blit.srcSubresource = layers;
+				blit.srcOffsets[1] = { static_cast<int32_t>(storageExtent.width), static_cast<int32_t>(storageExtent.height), 1 };
+				blit.dstSubresource = layers;
+				blit.dstOffsets[1] = { static_cast<int32_t>(swapChainExtent.width), static_cast<int32_t>(swapChainExtent.height), 1 };
+
+				vkCmdBlitImage(commandBuffer, frame.storageImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, swapChainImages[imageIndex],
+					VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, blitFilter);
+			}
+			else {
+				VkImageCopy copy = {};
+				copy.srcSubresource = layers;
+				copy.dstSubresource = layers;
+				copy.extent = { storageExtent.width, storageExtent.height, 1 };
+
+				vkCmdCopyImage(commandBuffer, frame.storageImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, swapChainImages[imageIndex],
+					VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
+			}
+
+			VkImageMemoryBarrier swapChainToPresent = swapChainToTransfer;
+			swapChainToPresent.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			swapChainToPresent.dstAccessMask = 0;
+			swapChainToPresent.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			swapChainToPresent.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &swapChainToPresent);
+		}
+
+		profiler.endGpuZone(commandBuffer, slot, copyZone);
+		profiler.endGpuZone(commandBuffer, slot, frameZone);
+
+		// Make the copies visible to the host once the fence signals
+		VkMemoryBarrier toHost = {};
+		toHost.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		toHost.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		toHost.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &toHost, 0, nullptr, 0, nullptr);
+
+		if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("Could not record command buffer");
+		}
+	}
+
+	// Waits until the GPU is done with frames[slot] and folds its rays, GPU time and latency into the
+	// running totals. The time spent blocked here is the CPU wait of the frame loop.
+	void waitForFrame(uint32_t slot) {
+		FrameResources& frame = frames[slot];
+
+		PROFILE_ZONE(profiler, "waitForFrame");
+
+		auto waitStart = std::chrono::high_resolution_clock::now();
+		vkWaitForFences(device, 1, &frame.inFlightFence, VK_TRUE, UINT64_MAX);
+		auto waitEnd = std::chrono::high_resolution_clock::now();
+
+		if (!frame.submitted) {
+			return;
+		}
+
+		frame.submitted = false;
+
+		double cpuWaitMilliseconds = std::chrono::duration<double, std::milli>(waitEnd - waitStart).count();
+		double latencyMilliseconds = std::chrono::duration<double, std::milli>(waitEnd - frame.startTime).count();
+
+		frameTimings.frameCount++;
+		frameTimings.cpuWaitMilliseconds += cpuWaitMilliseconds;
+		frameTimings.latencyMilliseconds += latencyMilliseconds;
+		frameTimings.maxLatencyMilliseconds = std::max(frameTimings.maxLatencyMilliseconds, latencyMilliseconds);
+
+		const TraceCounters& counters = *static_cast<const TraceCounters*>(frame.counterReadbackData);
+		tracedRays += counters.rayCount;
+
+		// Frames from before a reset finish after it, their samples and noise no longer count
+		if (settings.progressive && frame.accumulationEpoch == accumulationEpoch) {
+			completedSamples = std::max(completedSamples, frame.accumulatedSamples + settings.samplesPerPixel);
+			noiseEstimate = counters.noiseSum / TraceCounters::NoiseScale / (static_cast<double>(storageExtent.width) * storageExtent.height);
+			accumulatedRays += counters.rayCount;
+
+			if (settings.adaptiveThreshold > 0.0f) {
+				activeTiles = counters.activeTiles;
+			}
+		}
+
+		// Without timestamps the frame time is approximated by the time since the later of the frame's
+		// start and the previous completion, so overlapping frames are not counted twice
+		if (!profiler.hasGpuTimers()) {
+			double frameMilliseconds = std::chrono::duration<double, std::milli>(waitEnd - std::max(frame.startTime, lastFrameCompletion)).count();
+			traceMilliseconds += frameMilliseconds;
+			lastFrameCompletion = waitEnd;
+			updateRenderScale(frame, frameMilliseconds);
+			return;
+		}
+
+		profiler.resolveGpuFrame(slot, frame.startTime);
+
+		double gpuMilliseconds = profiler.getGpuMilliseconds(slot, "trace");
+		if (gpuMilliseconds >= 0.0) {
+			traceMilliseconds += gpuMilliseconds;
+		}
+
+		updateRenderScale(frame, profiler.getGpuMilliseconds(slot, "frame"));
+	}
+
+	// The render targets are resized before the next frame is recorded
+	void updateRenderScale(const FrameResources& frame, double frameMilliseconds) {
+		if (!resolutionGovernor.update(frame.renderScale, frameMilliseconds)) {
+			return;
+		}
+
+		renderScaleChanged = true;
+
+		VkExtent2D extent = getRenderExtent();
+		std::cout << "Render scale " << resolutionGovernor.getScale() << " (" << extent.width << "x" << extent.height << "), GPU frame " <<
+			resolutionGovernor.getSmoothedMilliseconds() << "ms for a " << settings.resolution.targetMilliseconds << "ms target" << std::endl;
+	}
+
+	double traceRaysPerSecond() const {
+		return traceMilliseconds > 0.0 ? tracedRays / (traceMilliseconds / 1000.0) : 0.0;
+	}
+
+	std::string formatFrameTimings() const {
+		if (frameTimings.frameCount == 0) {
+			return "no frames completed";
+		}
+
+		return "CPU wait " + std::to_string(frameTimings.cpuWaitMilliseconds / frameTimings.frameCount) + "ms/frame, latency " +
+			std::to_string(frameTimings.latencyMilliseconds / frameTimings.frameCount) + "ms (max " + std::to_string(frameTimings.maxLatencyMilliseconds) +
+			"ms), " + std::to_string(frames.size()) + " frame(s) in flight";
+	}
+
+	// Replaces the swap chain and everything sized after it for the window's current size. Frames in flight
+	// keep using the old objects, which are retired instead of destroyed, so nothing waits for the device.
+	// Returns false while the window is minimized and has no size to create them for.
+	bool recreateSwapChain() {
+		PROFILE_ZONE(profiler, "recreateSwapChain");
+
+		SwapChainSupportDetails& details = deviceCapabilities.swapChainSupport;
+		vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &details.capabilities);
+
+		VkExtent2D extent = chooseSwapExtent(details.capabilities);
+		if (extent.width == 0 || extent.height == 0) {
+			return false;
+		}
+
+		framebufferResized = false;
+
+		VkSwapchainKHR oldSwapChain = swapChain;
+		std::vector<VkImageView> oldSwapChainImageViews = swapChainImageViews;
+
+		retireResources([=]() {
+			for (auto imageView : oldSwapChainImageViews) {
+				vkDestroyImageView(device, imageView, nullptr);
+			}
+
+			vkDestroySwapchainKHR(device, oldSwapChain, nullptr);
+		});
+
+		createSwapChain(oldSwapChain);
+		createImageViews();
+
+		// The new images have never been copied into
+		imagesInFlight.assign(swapChainImages.size(), VK_NULL_HANDLE);
+
+		DEBUG_OUT("Recreated the swap chain at " << swapChainExtent.width << "x" << swapChainExtent.height << std::endl);
+
+		resizeRenderTargets();
+
+		return true;
+	}
+
+	// Replaces everything sized after storageExtent, for a new window size or render scale. The old
+	// objects are retired like the swap chain.
+	void resizeRenderTargets() {
+		PROFILE_ZONE(profiler, "resizeRenderTargets");
+
+		std::vector<VkImage> oldStorageImages;
+		std::vector<Allocation> oldStorageImageMemory;
+		std::vector<VkImageView> oldStorageImageViews;
+		for (const auto& frame : frames) {
+			oldStorageImages.push_back(frame.storageImage);
+			oldStorageImageMemory.push_back(frame.storageImageMemory);
+			oldStorageImageViews.push_back(frame.storageImageView);
+		}
+		VkImage oldAccumulationImage = accumulationImage;
+		Allocation oldAccumulationImageMemory = accumulationImageMemory;
+		VkImageView oldAccumulationImageView = accumulationImageView;
+		VkBuffer oldAdaptiveTileBuffer = adaptiveTileBuffer;
+		Allocation oldAdaptiveTileBufferMemory = adaptiveTileBufferMemory;
+		VkDescriptorPool oldDescriptorPool = descriptorPool;
+		std::function<void()> destroyDenoiserImages = denoiser.retireImages(allocator);
+		std::function<void()> destroyWavefrontBuffers = [] { };
+		if (isWavefrontEnabled()) {
+			destroyWavefrontBuffers = wavefrontTracer.retireBuffers(allocator);
+		}
+
+		retireResources([=]() mutable {
+			// Destroying the pool frees the frames' old descriptor sets with it
+			vkDestroyDescriptorPool(device, oldDescriptorPool, nullptr);
+			destroyDenoiserImages();
+			destroyWavefrontBuffers();
+
+			for (size_t i = 0; i < oldStorageImages.size(); i++) {
+				vkDestroyImageView(device, oldStorageImageViews[i], nullptr);
+				allocator.destroyImage(oldStorageImages[i], oldStorageImageMemory[i]);
+			}
+
+			vkDestroyImageView(device, oldAccumulationImageView, nullptr);
+			allocator.destroyImage(oldAccumulationImage, oldAccumulationImageMemory);
+			allocator.destroyBuffer(oldAdaptiveTileBuffer, oldAdaptiveTileBufferMemory);
+		});
+
+		createStorageImages();
+		if (isWavefrontEnabled()) {
+			createWavefrontBuffers();
+		}
+		createDescriptorPool();
+		createDescriptorSets();
+
+		renderScaleChanged = false;
+		// The storage extent is part of the accumulation key, so the next frame starts accumulating over
+		redrawRequested = true;
+	}
+
+	// Queues destroy to run once every frame submitted so far has completed
+	void retireResources(std::function<void()> destroy) {
+		retiredResources.push_back({ frameCounter, std::move(destroy) });
+	}
+
+	// Frames complete in submission order on one queue, so once the fence of a slot has been waited for,
+	// every frame up to the one that last used that slot is done
+	void releaseRetiredResources() {
+		uint32_t frameCount = static_cast<uint32_t>(frames.size());
+
+		while (!retiredResources.empty() && retiredResources.front().frameCounter + frameCount <= frameCounter + 1) {
+			retiredResources.front().destroy();
+			retiredResources.pop_front();
+		}
+	}
+
+	// Latency is measured from the start of a frame, right after input is polled, until the CPU sees the
+	// fence of the submission that presents it. Deeper queues raise throughput at the cost of this number.
+	void drawFrame() {
+		PROFILE_ZONE(profiler, "drawFrame");
+
+		uint32_t slot = frameCounter % static_cast<uint32_t>(frames.size());
+		FrameResources& frame = frames[slot];
+
+		waitForFrame(slot);
+		releaseRetiredResources();
+
+		if (renderScaleChanged) {
+			resizeRenderTargets();
+		}
+
+		frame.startTime = std::chrono::high_resolution_clock::now();
+
+		uint32_t imageIndex;
+		{
+			PROFILE_ZONE(profiler, "acquireNextImage");
+
+			// The fence is still signaled, so returning here leaves the slot ready for the next attempt
+			VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, frame.imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+
+			if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+				framebufferResized = true;
+				return;
+			}
+			// A suboptimal image is still presentable, the swap chain is recreated after presenting it
+			else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+				throw std::runtime_error("Could not acquire swap chain image");
+			}
+		}
+
+		// Wait for an older frame that is still copying into this swap chain image
+		if (imagesInFlight[imageIndex] != VK_NULL_HANDLE && imagesInFlight[imageIndex] != frame.inFlightFence) {
+			auto waitStart = std::chrono::high_resolution_clock::now();
+			vkWaitForFences(device, 1, &imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
+			frameTimings.cpuWaitMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - waitStart).count();
+		}
+		imagesInFlight[imageIndex] = frame.inFlightFence;
+
+		vkResetFences(device, 1, &frame.inFlightFence);
+
+		beginAccumulationFrame(frame);
+		frame.renderScale = resolutionGovernor.getScale();
+
+		vkResetCommandBuffer(frame.commandBuffer, 0);
+		recordTraceCommands(slot, frameCounter, imageIndex);
+
+		// Only the copy into the swap chain image has to wait for the presentation engine, and only the
+		// trace itself has to wait for uploads still running on the transfer queue
+		VkSemaphore waitSemaphores[] = { frame.imageAvailableSemaphore, uploader.getSemaphore() };
+		VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT };
+		// The value for the binary semaphore is ignored
+		uint64_t waitValues[] = { 0, pendingUploadValue };
+
+		VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timelineInfo.waitSemaphoreValueCount = 2;
+		timelineInfo.pWaitSemaphoreValues = waitValues;
+
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.pNext = &timelineInfo;
+		submitInfo.waitSemaphoreCount = 2;
+		submitInfo.pWaitSemaphores = waitSemaphores;
+		submitInfo.pWaitDstStageMask = waitStages;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &frame.commandBuffer;
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &frame.renderFinishedSemaphore;
+
+		if (vkQueueSubmit(renderQueue, 1, &submitInfo, frame.inFlightFence) != VK_SUCCESS) {
+			throw std::runtime_error("Could not submit frame");
+		}
+
+		frame.submitted = true;
+
+		VkPresentInfoKHR presentInfo = {};
+		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+		presentInfo.waitSemaphoreCount = 1;
+		presentInfo.pWaitSemaphores = &frame.renderFinishedSemaphore;
+		presentInfo.swapchainCount = 1;
+		presentInfo.pSwapchains = &swapChain;
+		presentInfo.pImageIndices = &imageIndex;
+
+		{
+			PROFILE_ZONE(profiler, "present");
+
+			VkResult result = vkQueuePresentKHR(presentQueue, &presentInfo);
+
+			if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+				framebufferResized = true;
+			}
+			else if (result != VK_SUCCESS) {
+				throw std::runtime_error("Could not present frame");
+			}
+		}
+
+		frameCounter++;
+	}
+
+	void submitHeadlessFrame(uint32_t frameIndex) {
+		PROFILE_ZONE(profiler, "headlessFrame");
+
+		uint32_t slot = frameIndex % static_cast<uint32_t>(frames.size());
+		FrameResources& frame = frames[slot];
+
+		waitForFrame(slot);
+
+		frame.startTime = std::chrono::high_resolution_clock::now();
+
+		beginAccumulationFrame(frame);
+
+		vkResetFences(device, 1, &frame.inFlightFence);
+		vkResetCommandBuffer(frame.commandBuffer, 0);
+		recordTraceCommands(slot, frameIndex, 0);
+
+		VkSemaphore uploadSemaphore = uploader.getSemaphore();
+		VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+		VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timelineInfo.waitSemaphoreValueCount = 1;
+		timelineInfo.pWaitSemaphoreValues = &pendingUploadValue;
+
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.pNext = &timelineInfo;
+		submitInfo.waitSemaphoreCount = 1;
+		submitInfo.pWaitSemaphores = &uploadSemaphore;
+		submitInfo.pWaitDstStageMask = &waitStage;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &frame.commandBuffer;
+
+		if (vkQueueSubmit(renderQueue, 1, &submitInfo, frame.inFlightFence) != VK_SUCCESS) {
+			throw std::runtime_error("Could not submit offscreen frame");
+		}
+
+		frame.submitted = true;
+	}
+
+	// Renders a single frame and reports how long it took from startup until its fence signalled
+	void reportTimeToFirstFrame(std::chrono::high_resolution_clock::time_point startupStart) {
+		auto initEnd = std::chrono::high_resolution_clock::now();
+
+		if (settings.headless) {
+			submitHeadlessFrame(0);
+		}
+		else {
+			drawFrame();
+		}
+
+		waitForFrame(0);
+
+		auto end = std::chrono::high_resolution_clock::now();
+
+		std::cout << "Time to first frame: " << std::chrono::duration<double, std::milli>(end - startupStart).count() << "ms (init " <<
+			std::chrono::duration<double, std::milli>(initEnd - startupStart).count() << "ms, first frame " <<
+			std::chrono::duration<double, std::milli>(end - initEnd).count() << "ms, " << (pipelineCache.isWarm() ? "warm" : "cold") << " pipeline cache)" << std::endl;
+	}
+
+	// Records the same set of small dispatches into secondary command buffers with 1, 2, 4, ... threads
+	// and reports how the CPU recording time scales. Nothing is submitted, only recording is measured.
+	void benchmarkRecording() {
+		const uint32_t dispatchCount = 16384;
+		const uint32_t secondaryCount = 256;
+		const uint32_t iterations = 20;
+
+		uint32_t maxThreads = settings.threadCount > 0 ? settings.threadCount : std::max(1u, std::thread::hardware_concurrency());
+
+		VkCommandBufferAllocateInfo allocateInfo = {};
+		allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocateInfo.commandPool = commandPool;
+		allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocateInfo.commandBufferCount = 1;
+
+		VkCommandBuffer primary;
+		if (vkAllocateCommandBuffers(device, &allocateInfo, &primary) != VK_SUCCESS) {
+			throw std::runtime_error("Could not allocate command buffer");
+		}
+
+		TracePushConstants constants = getPushConstants(0);
+		double singleThreadMilliseconds = 0.0;
+
+		std::cout << "Recording " << dispatchCount << " dispatches in " << secondaryCount << " secondary command buffers:" << std::endl;
+
+		for (uint32_t threadCount = 1; ; threadCount = std::min(threadCount * 2, maxThreads)) {
+			TaskScheduler scheduler(threadCount);
+			CommandRecorder benchmarkRecorder;
+			benchmarkRecorder.create(device, renderFamily, 1, scheduler);
+
+			double milliseconds = 0.0;
+
+			// The first iteration allocates the secondary command buffers and is not counted
+			for (uint32_t iteration = 0; iteration <= iterations; iteration++) {
+				auto start = std::chrono::high_resolution_clock::now();
+
+				benchmarkRecorder.beginFrame(0);
+				vkResetCommandBuffer(primary, 0);
+
+				VkCommandBufferBeginInfo beginInfo = {};
+				beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+				beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+				vkBeginCommandBuffer(primary, &beginInfo);
+
+				benchmarkRecorder.record(0, primary, secondaryCount, [&](uint32_t index, VkCommandBuffer secondary) {
+					uint32_t first = dispatchCount * index / secondaryCount;
+					uint32_t last = dispatchCount * (index + 1) / secondaryCount;
+
+					// Rebinding for every dispatch stands in for many passes and instances with their own state
+					for (uint32_t i = first; i < last; i++) {
+						recordTraceDispatch(secondary, frames[0], constants, 0, 1);
+					}
+				});
+
+				vkEndCommandBuffer(primary);
+
+				if (iteration > 0) {
+					milliseconds += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+				}
+			}
+
+			benchmarkRecorder.destroy();
+
+			milliseconds /= iterations;
+			if (threadCount == 1) {
+				singleThreadMilliseconds = milliseconds;
+			}
+
+			std::cout << "\t" << threadCount << " thread(s): " << milliseconds << "ms per frame, " << dispatchCount / milliseconds << " dispatches/ms, " <<
+				singleThreadMilliseconds / milliseconds << "x" << std::endl;
+
+			if (threadCount == maxThreads) {
+				break;
+			}
+		}
+
+		vkFreeCommandBuffers(device, commandPool, 1, &primary);
+	}
+
+	// Builds and refits random triangle soups of growing size on the GPU, next to the binned SAH build on the
+	// CPU. Runs instead of rendering, so it reuses the builder of the scene.
+	void benchmarkGpuBvh() {
+		const uint32_t triangleCounts[] = { 1u << 16, 1u << 18, 1u << 20 };
+		const uint32_t iterations = 10;
+
+		std::mt19937 random(1);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+		gpuBvhBuilder.destroyBuffers(allocator);
+
+		std::cout << "Building BVHs over random triangles, mean of " << iterations << " runs:" << std::endl;
+
+		for (uint32_t triangleCount : triangleCounts) {
+			// Triangles about as large as the spacing between them, like a tessellated surface
+			float size = 1.0f / std::cbrt(static_cast<float>(triangleCount));
+
+			std::vector<Triangle> triangles(triangleCount);
+			for (auto& triangle : triangles) {
+				glm::vec3 center(unit(random), unit(random), unit(random));
+				triangle = {};
+				triangle.v0 = center + (glm::vec3(unit(random), unit(random), unit(random)) - 0.5f) * size;
+				triangle.v1 = center + (glm::vec3(unit(random), unit(random), unit(random)) - 0.5f) * size;
+				triangle.v2 = center + (glm::vec3(unit(random), unit(random), unit(random)) - 0.5f) * size;
+			}
+
+			VkBuffer sourceBuffer;
+			Allocation sourceMemory;
+			createDeviceLocalBuffer(triangles.data(), sizeof(Triangle) * triangles.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sourceBuffer, sourceMemory);
+			pendingUploadValue = uploader.flush();
+
+			gpuBvhBuilder.createBuffers(device, allocator, sourceBuffer, triangleCount);
+
+			double buildMilliseconds = 0.0;
+			double refitMilliseconds = 0.0;
+
+			// The first iteration includes the upload and warms up the GPU, it is not counted
+			for (uint32_t iteration = 0; iteration <= iterations; iteration++) {
+				double build = submitAndWait("gpuBvhBuild", [this](VkCommandBuffer commandBuffer) { gpuBvhBuilder.recordBuild(commandBuffer); });
+				double refit = submitAndWait("gpuBvhRefit", [this](VkCommandBuffer commandBuffer) { gpuBvhBuilder.recordRefit(commandBuffer); });
+
+				if (iteration > 0) {
+					buildMilliseconds += build;
+					refitMilliseconds += refit;
+				}
+			}
+
+			buildMilliseconds /= iterations;
+			refitMilliseconds /= iterations;
+
+			Bvh cpuBvh;
+			cpuBvh.build(triangles);
+			double cpuMilliseconds = cpuBvh.getStats().buildMilliseconds;
+
+			double millions = triangleCount / 1e6;
+
+			std::cout << "\t" << triangleCount << " triangles: GPU build " << buildMilliseconds << "ms (" << buildMilliseconds / millions << "ms per million), refit " <<
+				refitMilliseconds << "ms (" << refitMilliseconds / millions << "ms per million), CPU SAH build " << cpuMilliseconds << "ms (" <<
+				cpuMilliseconds / millions << "ms per million)" << std::endl;
+
+			gpuBvhBuilder.destroyBuffers(allocator);
+			allocator.destroyBuffer(sourceBuffer, sourceMemory);
+		}
+	}
+
+	// Renders the same frames with the single kernel tracer and with the wavefront tracer, unsorted and sorted
+	// by material. The wavefront tracer also traces shadow rays, so samples per second compare them more
+	// fairly than rays per second.
+	void benchmarkWavefront() {
+		struct Variant {
+			const char* name;
+			bool wavefront;
+			bool sortMaterials;
+		};
+
+		const Variant variants[] = { { "single kernel", false, false }, { "wavefront", true, false }, { "wavefront, sorted by material", true, true } };
+		const uint32_t iterations = std::max(settings.frameCount, 16u);
+
+		VkExtent2D extent = storageExtent;
+		double samplesPerFrame = static_cast<double>(extent.width) * extent.height * settings.samplesPerPixel;
+		double singleKernelMilliseconds = 0.0;
+		uint32_t frameIndex = 0;
+
+		std::cout << "Tracing " << extent.width << "x" << extent.height << " at " << settings.samplesPerPixel << " samples per pixel and up to " <<
+			settings.maxBounces << " bounces, " << wavefrontTracer.getLightCount() << " light triangles, mean of " << iterations << " frames:" << std::endl;
+
+		for (const Variant& variant : variants) {
+			useWavefront = variant.wavefront;
+			sortMaterials = variant.sortMaterials;
+
+			// The first frame warms up the pipelines, it is not counted
+			submitHeadlessFrame(frameIndex++);
+			for (uint32_t slot = 0; slot < frames.size(); slot++) {
+				waitForFrame(slot);
+			}
+
+			tracedRays = 0;
+			traceMilliseconds = 0.0;
+			frameTimings.reset();
+
+			for (uint32_t iteration = 0; iteration < iterations; iteration++) {
+				submitHeadlessFrame(frameIndex++);
+			}
+
+			for (uint32_t slot = 0; slot < frames.size(); slot++) {
+				waitForFrame(slot);
+			}
+
+			double milliseconds = traceMilliseconds / iterations;
+			if (!variant.wavefront) {
+				singleKernelMilliseconds = milliseconds;
+			}
+
+			std::cout << "\t" << variant.name << ": " << milliseconds << "ms per frame, " << traceRaysPerSecond() / 1e6 << " Mrays/s, " <<
+				(milliseconds > 0.0 ? samplesPerFrame / (milliseconds * 1000.0) : 0.0) << " Msamples/s";
+			if (variant.wavefront && milliseconds > 0.0) {
+				std::cout << ", " << singleKernelMilliseconds / milliseconds << "x the single kernel";
+			}
+			std::cout << std::endl;
+		}
+
+		useWavefront = settings.wavefront;
+		sortMaterials = settings.sortMaterials;
+	}
+
+	void renderHeadless() {
+		auto start = std::chrono::high_resolution_clock::now();
+
+		// Progressive rendering treats the frame count as an upper bound and stops once the image has converged
+		uint32_t frameCount = settings.frameCount;
+
+		for (uint32_t frameIndex = 0; frameIndex < settings.frameCount; frameIndex++) {
+			if (settings.progressive && isAccumulationConverged()) {
+				frameCount = frameIndex;
+				break;
+			}
+
+			submitHeadlessFrame(frameIndex);
+		}
+
+		for (uint32_t slot = 0; slot < frames.size(); slot++) {
+			waitForFrame(slot);
+		}
+
+		auto end = std::chrono::high_resolution_clock::now();
+		double seconds = std::chrono::duration<double>(end - start).count();
+
+		std::cout << "Rendered " << frameCount << " headless frame(s) in " << seconds << "s (" <<
+			(seconds > 0.0 ? frameCount / seconds : 0.0) << " frames/s)" << std::endl;
+		std::cout << "Traced " << tracedRays << " rays in " << traceMilliseconds << "ms of " << (profiler.hasGpuTimers() ? "GPU" : "CPU") <<
+			" time (" << traceRaysPerSecond() / 1e6 << " Mrays/s, " << settings.workgroupWidth << "x" << settings.workgroupHeight << " workgroups)" << std::endl;
+		std::cout << formatFrameTimings() << std::endl;
+
+		if (settings.progressive) {
+			std::cout << "Accumulated " << completedSamples << " samples per pixel, noise " << noiseEstimate << std::endl;
+		}
+
+		if (settings.denoise.iterations > 0 && profiler.hasGpuTimers()) {
+			denoiser.printTimings(profiler, std::cout);
+		}
+
+		const FrameResources& lastFrame = frames[(frameCount - 1) % frames.size()];
+		writeImagePPM(settings.outputPath, storageExtent.width, storageExtent.height, static_cast<const uint8_t*>(lastFrame.readbackData), storageExtent.width * 4);
+	}
+
+	// Renders the camera path with every frame slot in flight. Once a slot comes around again its image is
+	// copied out of the readback buffer and encoded on a worker, so writing images overlaps tracing the
+	// next frames. Encodes are bounded by the thread count, beyond that the render loop waits for the oldest.
+	void renderBatch() {
+		CameraPath path = CameraPath::load(settings.cameraPath, scene.camera);
+		uint32_t frameCount = path.getFrameCount(settings.batchFramesPerSecond);
+		uint32_t encodeThreads = settings.threadCount > 0 ? settings.threadCount : std::max(1u, std::thread::hardware_concurrency());
+
+		if (settings.progressive) {
+			std::cout << "Batch frames are traced in a single pass, ignoring progressive rendering" << std::endl;
+			settings.progressive = false;
+		}
+
+		std::cout << "Rendering " << frameCount << " frame(s) of " << settings.cameraPath << " at " << settings.batchFramesPerSecond << " frames/s" << std::endl;
+
+		BatchTimings timings;
+		std::deque<std::future<double>> encodes;
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		for (uint32_t frameIndex = 0; frameIndex < frameCount + frames.size(); frameIndex++) {
+			// The slot's previous frame is done once its fence is waited for, which submitting the next one does anyway
+			if (frameIndex >= frames.size()) {
+				collectBatchFrame(frameIndex - static_cast<uint32_t>(frames.size()), encodes, encodeThreads, timings);
+			}
+
+			if (frameIndex < frameCount) {
+				scene.camera = path.sample(path.getStartTime() + frameIndex / settings.batchFramesPerSecond);
+				submitHeadlessFrame(frameIndex);
+			}
+		}
+
+		auto waitStart = std::chrono::high_resolution_clock::now();
+		for (auto& encode : encodes) {
+			timings.encodeMilliseconds += encode.get();
+		}
+		timings.encodeWaitMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - waitStart).count();
+
+		auto end = std::chrono::high_resolution_clock::now();
+		double seconds = std::chrono::duration<double>(end - start).count();
+
+		std::cout << "Rendered " << frameCount << " frame(s) in " << seconds << "s (" << (seconds > 0.0 ? frameCount / seconds : 0.0) << " frames/s)" << std::endl;
+		std::cout << "Per frame: trace " << traceMilliseconds / frameCount << "ms of " << (profiler.hasGpuTimers() ? "GPU" : "CPU") << " time, readback " <<
+			timings.gpuReadbackMilliseconds / frameCount << "ms GPU + " << timings.readbackMilliseconds / frameCount << "ms copy, encode " <<
+			timings.encodeMilliseconds / frameCount << "ms on " << encodeThreads << " thread(s)" << std::endl;
+		std::cout << "Render loop blocked " << timings.encodeWaitMilliseconds << "ms on encodes and " << frameTimings.cpuWaitMilliseconds << "ms on the GPU" << std::endl;
+	}
+
+	// Copies the image of a completed frame out of its readback buffer and starts encoding it
+	void collectBatchFrame(uint32_t frameIndex, std::deque<std::future<double>>& encodes, uint32_t encodeThreads, BatchTimings& timings) {
+		PROFILE_ZONE(profiler, "collectBatchFrame");
+
+		uint32_t slot = frameIndex % static_cast<uint32_t>(frames.size());
+		waitForFrame(slot);
+
+		double gpuReadbackMilliseconds = profiler.getGpuMilliseconds(slot, "copyOut");
+		if (gpuReadbackMilliseconds >= 0.0) {
+			timings.gpuReadbackMilliseconds += gpuReadbackMilliseconds;
+		}
+
+		auto copyStart = std::chrono::high_resolution_clock::now();
+
+		uint32_t imageWidth = storageExtent.width;
+		uint32_t imageHeight = storageExtent.height;
+		const uint8_t* readback = static_cast<const uint8_t*>(frames[slot].readbackData);
+		auto pixels = std::make_shared<std::vector<uint8_t>>(readback, readback + static_cast<size_t>(imageWidth) * imageHeight * 4);
+
+		timings.readbackMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - copyStart).count();
+
+		auto waitStart = std::chrono::high_resolution_clock::now();
+		while (encodes.size() >= encodeThreads) {
+			timings.encodeMilliseconds += encodes.front().get();
+			encodes.pop_front();
+		}
+		timings.encodeWaitMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - waitStart).count();
+
+		std::string filename = formatFramePath(settings.outputPath, frameIndex);
+
+		encodes.push_back(std::async(std::launch::async, [filename, imageWidth, imageHeight, pixels] {
+			auto encodeStart = std::chrono::high_resolution_clock::now();
+			writeImage(filename, imageWidth, imageHeight, pixels->data(), imageWidth * 4);
+			return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - encodeStart).count();
+		}));
+	}
+
+	void cleanup() {
+		if (settings.validation) {
+			DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
+		}
+
+		// The device is idle, so nothing still uses them
+		for (auto& retired : retiredResources) {
+			retired.destroy();
+		}
+		retiredResources.clear();
+
+		for (auto& frame : frames) {
+			vkDestroyFence(device, frame.inFlightFence, nullptr);
+			if (!settings.headless) {
+				vkDestroySemaphore(device, frame.imageAvailableSemaphore, nullptr);
+				vkDestroySemaphore(device, frame.renderFinishedSemaphore, nullptr);
+			}
+		}
+
+		vkDestroyCommandPool(device, commandPool, nullptr);
+		if (recordScheduler) {
+			recorder.destroy();
+		}
+		uploader.destroy();
+
+		profiler.destroyGpuTimers();
+
+		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+		denoiser.destroy(allocator);
+		if (settings.gpuBvh) {
+			gpuBvhBuilder.destroy(allocator);
+		}
+		if (isWavefrontEnabled()) {
+			wavefrontTracer.destroy(allocator);
+		}
+		vkDestroyPipeline(device, rayTracingPipeline, nullptr);
+		pipelineCache.destroy();
+		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+		vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+
+		accelerationStructure.destroy();
+		allocator.destroyBuffer(nodeBuffer, nodeBufferMemory);
+		allocator.destroyBuffer(topNodeBuffer, topNodeBufferMemory);
+		allocator.destroyBuffer(instanceBuffer, instanceBufferMemory);
+		allocator.destroyBuffer(wideNodeBuffer, wideNodeBufferMemory);
+		allocator.destroyBuffer(wideChildBuffer, wideChildBufferMemory);
+		allocator.destroyBuffer(lightBuffer, lightBufferMemory);
+		allocator.destroyBuffer(materialBuffer, materialBufferMemory);
+		allocator.destroyBuffer(triangleBuffer, triangleBufferMemory);
+
+		for (auto& frame : frames) {
+			frame.transientArena.destroy(allocator);
+			allocator.destroyBuffer(frame.uniformBuffer, frame.uniformBufferMemory);
+			allocator.destroyBuffer(frame.counterBuffer, frame.counterBufferMemory);
+
+			if (settings.headless) {
+				allocator.destroyBuffer(frame.readbackBuffer, frame.readbackBufferMemory);
+			}
+
+			vkDestroyImageView(device, frame.storageImageView, nullptr);
+			allocator.destroyImage(frame.storageImage, frame.storageImageMemory);
+		}
+
+		vkDestroyImageView(device, accumulationImageView, nullptr);
+		allocator.destroyImage(accumulationImage, accumulationImageMemory);
+		allocator.destroyBuffer(adaptiveTileBuffer, adaptiveTileBufferMemory);
+
+		allocator.destroy();
+
+		for (auto imageView : swapChainImageViews) {
+			vkDestroyImageView(device, imageView, nullptr);
+		}
+
+		if (!settings.headless) {
+			vkDestroySwapchainKHR(device, swapChain, nullptr);
+		}
+		vkDestroyDevice(device, nullptr);
+		if (surface != VK_NULL_HANDLE) {
+			vkDestroySurfaceKHR(instance, surface, nullptr);
+		}
+		vkDestroyInstance(instance, nullptr);
+		// Destroying the instance can still report leaks through the chained messenger
+		messageSink.stop();
+
+		if (window != nullptr) {
+			glfwDestroyWindow(window);
+			glfwTerminate();
+		}
+	}
+
+	int width;
+	int height;
+	RenderSettings settings;
+
+	VkInstance instance;
+
+	// Surfaces
+	GLFWwindow* window = nullptr;
+	VkSurfaceKHR surface = VK_NULL_HANDLE;
+	
+	// Devices
+	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+	DeviceCapabilities deviceCapabilities;
+	VkDevice device;
+	MemoryAllocator allocator;
+
+	// Swap chain
+	VkSwapchainKHR swapChain;
+	std::vector<VkImage> swapChainImages;
+	std::vector<VkImageView> swapChainImageViews;
+	VkFormat swapChainFormat;
+	VkExtent2D swapChainExtent;
+	// Set when the window is resized or presenting reports the swap chain out of date
+	bool framebufferResized = false;
+
+	// Format of the images the compute tracer writes. They are copied to the swap chain, or read back when headless.
+	VkFormat storageFormat;
+	VkExtent2D storageExtent;
+	bool blitToSwapChain = false;
+	VkFilter blitFilter = VK_FILTER_NEAREST;
+
+	// Dynamic resolution, storageExtent follows the governor's scale of swapChainExtent
+	ResolutionGovernor resolutionGovernor;
+	bool renderScaleChanged = false;
+
+	// Progressive accumulation
+	VkImage accumulationImage;
+	Allocation accumulationImageMemory;
+	VkImageView accumulationImageView;
+	AccumulationKey accumulationKey = {};
+	// Bumped on every reset, so frames still in flight from before can be told apart
+	uint64_t accumulationEpoch = 0;
+	// Samples per pixel submitted and completed since the last reset
+	uint32_t accumulatedSamples = 0;
+	uint32_t completedSamples = 0;
+	// Mean standard error of the displayed value in the last completed frame
+	double noiseEstimate = 1.0;
+	uint64_t accumulatedRays = 0;
+	bool reportedConvergence = false;
+	// Adaptive sampling tile state, see raytrace.comp
+	VkBuffer adaptiveTileBuffer;
+	Allocation adaptiveTileBufferMemory;
+	uint32_t adaptiveTileCount = 0;
+	// Tiles that traced in the last completed frame
+	uint32_t activeTiles = 0;
+
+	// Denoising, the previous frame's camera gives the motion vectors
+	Denoiser denoiser;
+	TracePushConstants previousConstants = {};
+	bool hasPreviousConstants = false;
+
+	// Debug views
+	bool showSampleDensity = false;
+	bool heatmapKeyDown = false;
+	// Draws one frame even though the image has converged, for display changes
+	bool redrawRequested = false;
+
+	// Scene
+	Scene scene;
+	Bvh bvh;
+	// The top level and instances of an instanced scene, whose bottom levels are in sceneData
+	TwoLevelBvh twoLevelBvh;
+	// Collapsed from sceneData's nodes with settings.wideBvh, empty otherwise
+	WideBvh wideBvh;
+	// Keeps the mapping of a scene file's cache open for sceneData
+	SceneCache sceneCache;
+	// What createSceneBuffers uploads, pointing into scene and bvh or into sceneCache
+	SceneData sceneData;
+	// Bumped whenever the scene buffers are replaced
+	uint64_t sceneVersion = 0;
+	VkBuffer triangleBuffer;
+	Allocation triangleBufferMemory;
+	VkBuffer materialBuffer;
+	Allocation materialBufferMemory;
+	VkBuffer nodeBuffer;
+	Allocation nodeBufferMemory;
+	VkBuffer topNodeBuffer;
+	Allocation topNodeBufferMemory;
+	VkBuffer instanceBuffer;
+	Allocation instanceBufferMemory;
+	VkBuffer wideNodeBuffer;
+	Allocation wideNodeBufferMemory;
+	VkBuffer wideChildBuffer;
+	Allocation wideChildBufferMemory;
+	// Emissive triangles the wavefront tracer samples, one empty light without it
+	VkBuffer lightBuffer;
+	Allocation lightBufferMemory;
+	uint32_t lightCount = 0;
+	// Replaces bvh and the scene buffers in the tracer's descriptor sets with settings.gpuBvh
+	GpuBvhBuilder gpuBvhBuilder;
+	// Created with settings.wavefront or the benchmark. The benchmark switches between it and the single kernel.
+	WavefrontTracer wavefrontTracer;
+	bool useWavefront;
+	bool sortMaterials;
+	// Traced with ray queries instead of the BVH buffers, decided by pickPhysicalDevice
+	bool useHardwareRayTracing = false;
+	AccelerationStructure accelerationStructure;
+
+	// Pipeline
+	VkDescriptorSetLayout descriptorSetLayout;
+	VkPipelineLayout pipelineLayout;
+	VkPipeline rayTracingPipeline;
+	PipelineCache pipelineCache;
+	AssetPack assets;
+	VkDescriptorPool descriptorPool;
+
+	// Commands
+	VkCommandPool commandPool;
+	// Only created when the trace is split into bands
+	std::unique_ptr<TaskScheduler> recordScheduler;
+	CommandRecorder recorder;
+
+	// Uploads
+	StagingUploader uploader;
+	// Timeline value every frame waits for before it reads the scene buffers
+	uint64_t pendingUploadValue = 0;
+
+	// Frames in flight
+	std::vector<FrameResources> frames;
+	std::vector<VkFence> imagesInFlight;
+	uint32_t frameCounter = 0;
+	// Replaced by a resize while frames in flight may still use them, oldest first
+	std::deque<RetiredResources> retiredResources;
+	FrameTimingStats frameTimings;
+	std::chrono::high_resolution_clock::time_point lastFrameCompletion;
+
+	// Throughput
+	Profiler profiler;
+	uint64_t tracedRays = 0;
+	double traceMilliseconds = 0.0;
+
+	// Queues
+	VkQueue graphicsQueue;
+	VkQueue presentQueue;
+	VkQueue transferQueue;
+	VkQueue computeQueue;
+	// The queue frames are submitted to, either the graphics or the async compute queue
+	VkQueue renderQueue;
+	uint32_t renderFamily;
+
+	// Debugging
+	VkDebugUtilsMessengerEXT debugMessenger;
+	DebugMessageSink messageSink;
+};
+
+// Everything the CPU tracer reads, see createCpuTracer
+struct CpuScene {
+	Scene scene;
+	Bvh bvh;
+	TwoLevelBvh twoLevelBvh;
+	WideBvh wideBvh;
+};
+
+static void loadCpuScene(const RenderSettings& settings, TaskScheduler& scheduler, Profiler& profiler, CpuScene& cpuScene) {
+	Scene& scene = cpuScene.scene;
+	Bvh& bvh = cpuScene.bvh;
+	TwoLevelBvh& twoLevelBvh = cpuScene.twoLevelBvh;
+
+	// The CPU tracer reads vectors, so a scene file's cache is copied out of the mapping
+	if (!settings.scenePath.empty()) {
+		PROFILE_ZONE(profiler, "loadScene");
+
+		SceneCache sceneCache;
+		sceneCache.load(settings.scenePath, scheduler, settings.rebuildSceneCache);
+		sceneCache.copyTo(scene, bvh);
+
+		printSceneLoad(settings.scenePath, sceneCache, sceneCache.getData());
+	}
+	else if (settings.instanceCount > 0) {
+		scene = Scene::createInstanced(settings.instanceCount);
+
+		PROFILE_ZONE(profiler, "buildBvh");
+		twoLevelBvh.buildBottomLevels(scene.triangles, scene.meshes, scheduler);
+		bvh.assign(twoLevelBvh.getBottomNodes().data(), twoLevelBvh.getBottomNodes().size());
+	}
+	else {
+		scene = Scene::createDefault();
+
+		PROFILE_ZONE(profiler, "buildBvh");
+		bvh.build(scene.triangles);
+	}
+
+	if (scene.isInstanced()) {
+		twoLevelBvh.buildTopLevel(bvh.getNodes().data(), scene.meshes.data(), scene.instances.data(), static_cast<uint32_t>(scene.instances.size()));
+
+#ifdef DEBUG_BUILD
+		const TwoLevelBvhStats& stats = twoLevelBvh.getStats();
+		DEBUG_OUT("Two level BVH: " << scene.triangles.size() << " triangles in " << stats.meshCount << " meshes, " << stats.instanceCount << " instances, " <<
+			bvh.getNodes().size() << " + " << stats.topNodeCount << " nodes, top level built in " << stats.topMilliseconds << "ms" << std::endl);
+#endif
+	}
+	else {
+#ifdef DEBUG_BUILD
+		const BvhBuildStats& bvhStats = bvh.getStats();
+		DEBUG_OUT("BVH: " << scene.triangles.size() << " triangles, " << bvhStats.nodeCount << " nodes, depth " << bvhStats.maxDepth <<
+			", SAH cost " << bvhStats.sahCost << ", built in " << bvhStats.buildMilliseconds << "ms" << std::endl);
+#endif
+	}
+
+	WideBvh& wideBvh = cpuScene.wideBvh;
+	if (settings.wideBvh && !scene.isInstanced()) {
+		PROFILE_ZONE(profiler, "collapseBvh");
+		wideBvh.collapse(bvh.getNodes().data(), bvh.getNodes().size());
+
+#ifdef DEBUG_BUILD
+		const WideBvhStats& wideStats = wideBvh.getStats();
+		DEBUG_OUT("Wide BVH: " << wideStats.nodeCount << " nodes, stack of " << wideStats.stackSize << ", collapsed in " << wideStats.collapseMilliseconds << "ms" << std::endl);
+#endif
+	}
+}
+
+static CpuTracer createCpuTracer(const CpuScene& cpuScene, TaskScheduler& scheduler) {
+	const Scene& scene = cpuScene.scene;
+	return CpuTracer(scene, cpuScene.bvh, scheduler, scene.isInstanced() ? &cpuScene.twoLevelBvh : nullptr,
+		cpuScene.wideBvh.isTraversable() ? &cpuScene.wideBvh : nullptr);
+}
+
+static void renderCpu(int width, int height, const RenderSettings& settings) {
+	Profiler profiler;
+	profiler.setCapture(!settings.tracePath.empty());
+
+	TaskScheduler scheduler(settings.threadCount);
+	CpuScene cpuScene;
+	loadCpuScene(settings, scheduler, profiler, cpuScene);
+
+	CpuTracer tracer = createCpuTracer(cpuScene, scheduler);
+
+	CpuRenderSettings cpuSettings;
+	cpuSettings.width = static_cast<uint32_t>(width);
+	cpuSettings.height = static_cast<uint32_t>(height);
+	cpuSettings.samplesPerPixel = settings.samplesPerPixel;
+	cpuSettings.maxBounces = settings.maxBounces;
+	cpuSettings.adaptiveThreshold = settings.adaptiveThreshold;
+	if (settings.targetSamples > 0) {
+		cpuSettings.maxSamplesPerPixel = settings.targetSamples;
+	}
+
+	std::vector<float> radiance;
+	std::vector<uint32_t> sampleCounts;
+	CpuRenderStats totals;
+
+	for (uint32_t frame = 0; frame < settings.frameCount; frame++) {
+		cpuSettings.frameIndex = frame;
+
+		PROFILE_ZONE(profiler, "cpuFrame");
+		CpuRenderStats stats = tracer.render(cpuSettings, radiance, &sampleCounts);
+		totals.rayCount += stats.rayCount;
+		totals.sampleCount += stats.sampleCount;
+		totals.passCount += stats.passCount;
+		totals.steals += stats.steals;
+		totals.milliseconds += stats.milliseconds;
+	}
+
+	size_t pixelCount = static_cast<size_t>(width) * height;
+
+	std::cout << "Rendered " << settings.frameCount << " CPU frame(s) on " << scheduler.getWorkerCount() << " thread(s) in " << totals.milliseconds << "ms (" <<
+		totals.raysPerSecond() / 1e6 << " Mrays/s, " << totals.steals << " tiles stolen)" << std::endl;
+
+	if (cpuSettings.adaptiveThreshold > 0.0f) {
+		std::cout << "Adaptive sampling: " << totals.rayCount << " rays, " << static_cast<double>(totals.sampleCount) / (pixelCount * settings.frameCount) <<
+			" samples per pixel on average (at most " << cpuSettings.maxSamplesPerPixel << "), " << totals.passCount / settings.frameCount << " pass(es) per frame" << std::endl;
+	}
+
+	std::vector<uint8_t> rgba(pixelCount * 4);
+	if (settings.sampleHeatmap) {
+		encodeSampleDensityRGBA8(sampleCounts.data(), pixelCount, std::max(cpuSettings.samplesPerPixel, cpuSettings.adaptiveThreshold > 0.0f ? cpuSettings.maxSamplesPerPixel : 0u),
+			rgba.data());
+	}
+	else {
+		encodeRadianceRGBA8(radiance.data(), pixelCount, rgba.data());
+	}
+
+	writeImagePPM(settings.outputPath, width, height, rgba.data(), static_cast<size_t>(width) * 4);
+
+	if (settings.printProfile) {
+		profiler.printStats(std::cout);
+	}
+
+	if (!settings.tracePath.empty()) {
+		profiler.writeChromeTrace(settings.tracePath);
+		std::cout << "Wrote trace to " << settings.tracePath << std::endl;
+	}
+}
+
+static void runTileWorker(const RenderSettings& settings) {
+	Profiler profiler;
+	TaskScheduler scheduler(settings.threadCount);
+	CpuScene cpuScene;
+	loadCpuScene(settings, scheduler, profiler, cpuScene);
+
+	CpuTracer tracer = createCpuTracer(cpuScene, scheduler);
+	TileWorker worker(tracer, scheduler);
+
+#ifdef DEBUG_BUILD
+	uint32_t tileCount = worker.run(settings.tileWorkerAddress);
+	DEBUG_OUT("Tile worker rendered " << tileCount << " tiles on " << scheduler.getWorkerCount() << " thread(s)" << std::endl);
+#else
+	worker.run(settings.tileWorkerAddress);
+#endif
+}
+
+static void printDistributedStats(const DistributedRenderStats& stats) {
+	std::cout << "Rendered " << stats.tileCount << " tiles on " << stats.workers.size() << " worker(s) in " << stats.seconds << "s after " << stats.startupSeconds <<
+		"s of startup (" << stats.tilesPerSecond() << " tiles/s, " << (stats.seconds > 0.0 ? stats.rayCount / stats.seconds / 1e6 : 0.0) << " Mrays/s), " <<
+		stats.requeuedCount << " tile(s) handed out again" << std::endl;
+
+	for (const TileWorkerStats& worker : stats.workers) {
+		std::cout << "  " << worker.name << ": " << worker.tileCount << " tiles, " << worker.tilesPerSecond() << " tiles/s, " <<
+			(worker.renderMilliseconds > 0.0 ? worker.rayCount / (worker.renderMilliseconds / 1000.0) / 1e6 : 0.0) << " Mrays/s while rendering";
+
+		if (worker.lateCount > 0 || worker.discardedCount > 0) {
+			std::cout << ", " << worker.lateCount << " late, " << worker.discardedCount << " result(s) discarded";
+		}
+		if (worker.failed) {
+			std::cout << ", disconnected";
+		}
+		std::cout << std::endl;
+	}
+}
+
+// Renders one frame on the CPU through worker processes, which are copies of this executable started with
+// workerArguments, the command line without the coordinator's own options, so they load the same scene
+static void renderDistributed(int width, int height, const RenderSettings& settings, const std::string& executable, const std::vector<std::string>& workerArguments) {
+	TileCoordinatorSettings coordinatorSettings;
+	coordinatorSettings.address = settings.coordinatorAddress;
+	coordinatorSettings.width = static_cast<uint32_t>(width);
+	coordinatorSettings.height = static_cast<uint32_t>(height);
+	coordinatorSettings.tileSize = settings.distributedTileSize;
+	coordinatorSettings.samplesPerPixel = settings.samplesPerPixel;
+	coordinatorSettings.maxBounces = settings.maxBounces;
+	coordinatorSettings.slowTileSeconds = settings.slowTileSeconds;
+
+	uint32_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	auto render = [&](uint32_t workerCount, uint32_t threadsPerWorker, std::vector<float>& radiance) {
+		TileCoordinator coordinator(coordinatorSettings);
+
+		std::vector<std::string> arguments = workerArguments;
+		arguments.insert(arguments.end(), { "--tile-worker", coordinator.getAddress(), "--threads", std::to_string(threadsPerWorker) });
+
+		for (uint32_t i = 0; i < workerCount; i++) {
+			coordinator.spawnWorker(executable, arguments);
+		}
+
+		if (workerCount == 0) {
+			std::cout << "Waiting for tile workers on " << coordinator.getAddress() << std::endl;
+		}
+
+		return coordinator.render(radiance);
+	};
+
+	std::vector<float> radiance;
+
+	if (settings.distributedBenchmark) {
+		// Workers of one thread each, so the worker count is the only thing that changes
+		uint32_t maxWorkers = settings.distributedWorkers > 0 ? settings.distributedWorkers : hardwareThreads;
+		double baseSeconds = 0.0;
+
+		std::cout << "Distributed scaling on " << width << "x" << height << " in tiles of " << coordinatorSettings.tileSize << ", one thread per worker:" << std::endl;
+
+		std::vector<uint32_t> workerCounts;
+		for (uint32_t workerCount = 1; workerCount < maxWorkers; workerCount *= 2) {
+			workerCounts.push_back(workerCount);
+		}
+		workerCounts.push_back(maxWorkers);
+
+		for (uint32_t workerCount : workerCounts) {
+			DistributedRenderStats stats = render(workerCount, 1, radiance);
+
+			if (workerCount == 1) {
+				baseSeconds = stats.seconds;
+			}
+
+			double speedup = stats.seconds > 0.0 ? baseSeconds / stats.seconds : 0.0;
+
+			std::cout << "  " << workerCount << " worker(s): " << stats.seconds << "s, " << stats.tilesPerSecond() << " tiles/s, speedup " << speedup <<
+				", efficiency " << 100.0 * speedup / workerCount << "%, " << stats.requeuedCount << " tile(s) handed out again" << std::endl;
+		}
+
+		return;
+	}
+
+	// Spawned workers share this machine's threads unless told otherwise
+	uint32_t threadsPerWorker = settings.threadCount > 0 ? settings.threadCount : std::max(1u, hardwareThreads / std::max(1u, settings.distributedWorkers));
+
+	DistributedRenderStats stats = render(settings.distributedWorkers, threadsPerWorker, radiance);
+	printDistributedStats(stats);
+
+	size_t pixelCount = static_cast<size_t>(width) * height;
+	std::vector<uint8_t> rgba(pixelCount * 4);
+	encodeRadianceRGBA8(radiance.data(), pixelCount, rgba.data());
+
+	writeImage(settings.outputPath, width, height, rgba.data(), static_cast<size_t>(width) * 4);
+	std::cout << "Wrote " << settings.outputPath << std::endl;
+}
+
+// Compares the generated instanced scene traced through a two level BVH with the same scene flattened into one,
+// at a few instance counts: memory, build times, rebuilding only the top level after every instance moved, and
+// CPU tracing speed on a small image
+static void benchmarkInstancing(const RenderSettings& settings) {
+	TaskScheduler scheduler(settings.threadCount);
+
+	CpuRenderSettings cpuSettings;
+	cpuSettings.width = 256;
+	cpuSettings.height = 256;
+	cpuSettings.samplesPerPixel = 4;
+	cpuSettings.maxBounces = settings.maxBounces;
+
+	std::cout << "Instancing benchmark on " << scheduler.getWorkerCount() << " thread(s)" << std::endl;
+
+	for (uint32_t instanceCount : { 256u, 1024u, 4096u }) {
+		Scene instanced = Scene::createInstanced(instanceCount);
+		Scene flat = instanced.flatten();
+
+		TwoLevelBvh twoLevelBvh;
+		twoLevelBvh.buildBottomLevels(instanced.triangles, instanced.meshes, scheduler);
+
+		Bvh bottomLevels;
+		bottomLevels.assign(twoLevelBvh.getBottomNodes().data(), twoLevelBvh.getBottomNodes().size());
+
+		twoLevelBvh.buildTopLevel(bottomLevels.getNodes().data(), instanced.meshes.data(), instanced.instances.data(), instanceCount);
+		TwoLevelBvhStats stats = twoLevelBvh.getStats();
+
+		Bvh flatBvh;
+		flatBvh.build(flat.triangles);
+
+		// Every instance moves, which leaves the meshes and their bottom levels as they are
+		std::vector<MeshInstance> moved = instanced.instances;
+		for (MeshInstance& instance : moved) {
+			instance.transform[3] += glm::vec4(0.5f, 0.0f, 0.25f, 0.0f);
+		}
+
+		TwoLevelBvh rebuilt = twoLevelBvh;
+		rebuilt.buildTopLevel(bottomLevels.getNodes().data(), instanced.meshes.data(), moved.data(), instanceCount);
+		double rebuildMilliseconds = rebuilt.getStats().topMilliseconds;
+
+		size_t flatBytes = flat.triangles.size() * sizeof(Triangle) + flatBvh.getNodes().size() * sizeof(BvhNode);
+		size_t instancedBytes = instanced.triangles.size() * sizeof(Triangle) + (stats.bottomNodeCount + stats.topNodeCount) * sizeof(BvhNode) +
+			stats.instanceCount * sizeof(BvhInstance);
+
+		std::vector<float> radiance;
+		CpuRenderStats flatTrace = CpuTracer(flat, flatBvh, scheduler).render(cpuSettings, radiance);
+		CpuRenderStats instancedTrace = CpuTracer(instanced, bottomLevels, scheduler, &twoLevelBvh).render(cpuSettings, radiance);
+
+		std::cout << instanceCount << " instances:" << std::endl;
+		std::cout << "  flat       " << flat.triangles.size() << " triangles, " << flatBvh.getNodes().size() << " nodes, " << flatBytes / 1024 << " KiB, built in " <<
+			flatBvh.getStats().buildMilliseconds << "ms, " << flatTrace.raysPerSecond() / 1e6 << " Mrays/s" << std::endl;
+		std::cout << "  two level  " << instanced.triangles.size() << " triangles, " << stats.bottomNodeCount << " + " << stats.topNodeCount << " nodes, " <<
+			instancedBytes / 1024 << " KiB, built in " << stats.bottomMilliseconds << " + " << stats.topMilliseconds << "ms, " <<
+			instancedTrace.raysPerSecond() / 1e6 << " Mrays/s" << std::endl;
+		std::cout << "  moving every instance rebuilds the top level in " << rebuildMilliseconds << "ms" << std::endl;
+	}
+}
+
+// Compares the eight wide BVH with the binary one it is collapsed from: node memory, the nodes, bytes and cache
+// lines one ray at a time reads through each, for camera rays and for rays bounced off their hits, and CPU
+// tracing speed. Runs on the Cornell box, a flattened field of instances and the scene file, if one is given.
+static void benchmarkWideBvh(const RenderSettings& settings) {
+	TaskScheduler scheduler(settings.threadCount);
+
+	std::vector<std::pair<std::string, Scene>> scenes;
+	scenes.emplace_back("Cornell box", Scene::createDefault());
+	scenes.emplace_back("1024 instances, flattened", Scene::createInstanced(1024).flatten());
+
+	if (!settings.scenePath.empty()) {
+		SceneCache sceneCache;
+		sceneCache.load(settings.scenePath, scheduler, settings.rebuildSceneCache);
+
+		Scene scene;
+		Bvh cachedBvh;
+		sceneCache.copyTo(scene, cachedBvh);
+		scenes.emplace_back(settings.scenePath, scene.isInstanced() ? scene.flatten() : scene);
+	}
+
+	constexpr uint32_t ImageSize = 256;
+
+	CpuRenderSettings cpuSettings;
+	cpuSettings.width = ImageSize;
+	cpuSettings.height = ImageSize;
+	cpuSettings.samplesPerPixel = 4;
+	cpuSettings.maxBounces = settings.maxBounces;
+
+	std::cout << "Wide BVH benchmark on " << scheduler.getWorkerCount() << " thread(s), per ray over " << ImageSize << "x" << ImageSize << " camera rays" << std::endl;
+
+	for (auto& [name, scene] : scenes) {
+		Bvh bvh;
+		bvh.build(scene.triangles);
+
+		WideBvh wideBvh;
+		wideBvh.collapse(bvh.getNodes().data(), bvh.getNodes().size());
+		const WideBvhStats& wideStats = wideBvh.getStats();
+
+		// One ray through the centre of every pixel
+		const Camera& camera = scene.camera;
+		glm::vec3 forward = glm::normalize(camera.forward);
+		glm::vec3 right = glm::normalize(glm::cross(forward, camera.up));
+		glm::vec3 up = glm::cross(right, forward);
+		float tanHalfFov = std::tan(camera.verticalFov * 0.5f);
+
+		std::vector<BvhRay> cameraRays;
+		cameraRays.reserve(ImageSize * ImageSize);
+
+		for (uint32_t y = 0; y < ImageSize; y++) {
+			for (uint32_t x = 0; x < ImageSize; x++) {
+				float u = (2.0f * (x + 0.5f) / ImageSize - 1.0f) * tanHalfFov;
+				float v = (1.0f - 2.0f * (y + 0.5f) / ImageSize) * tanHalfFov;
+				cameraRays.push_back({ camera.position, glm::normalize(forward + right * u + up * v) });
+			}
+		}
+
+		std::vector<float> hitT;
+		BvhTraversalStats binaryCamera = WideBvh::measureBinary(bvh.getNodes(), scene.triangles, cameraRays, &hitT);
+		BvhTraversalStats wideCamera = wideBvh.measure(scene.triangles, cameraRays);
+
+		// Incoherent rays leaving every hit in random directions on the side it was seen from
+		std::mt19937 random(1);
+		std::normal_distribution<float> normal;
+		std::vector<BvhRay> bounceRays;
+
+		for (size_t i = 0; i < cameraRays.size(); i++) {
+			if (hitT[i] < 0.0f) {
+				continue;
+			}
+
+			glm::vec3 direction = glm::normalize(glm::vec3(normal(random), normal(random), normal(random)));
+			if (glm::dot(direction, cameraRays[i].direction) > 0.0f) {
+				direction = -direction;
+			}
+
+			bounceRays.push_back({ cameraRays[i].origin + cameraRays[i].direction * hitT[i], direction });
+		}
+
+		BvhTraversalStats binaryBounce = WideBvh::measureBinary(bvh.getNodes(), scene.triangles, bounceRays);
+		BvhTraversalStats wideBounce = wideBvh.measure(scene.triangles, bounceRays);
+
+		std::vector<float> radiance;
+		CpuRenderStats binaryTrace = CpuTracer(scene, bvh, scheduler).render(cpuSettings, radiance);
+		CpuRenderStats wideTrace = CpuTracer(scene, bvh, scheduler, nullptr, wideBvh.isTraversable() ? &wideBvh : nullptr).render(cpuSettings, radiance);
+
+		size_t binaryBytes = bvh.getNodes().size() * sizeof(BvhNode);
+		size_t wideBytes = wideBvh.getNodes().size() * sizeof(WideBvhNode) + wideBvh.getChildren().size() * sizeof(uint32_t);
+
+		auto printTraversal = [](const char* label, const BvhTraversalStats& traversal) {
+			double rays = static_cast<double>(std::max<uint64_t>(1, traversal.rayCount));
+			std::cout << "    " << label << traversal.steps / rays << " steps, " << traversal.nodeBytes / rays << " bytes, " << traversal.cacheLines / rays <<
+				" cache lines, " << traversal.triangleTests / rays << " triangle tests" << std::endl;
+		};
+
+		std::cout << name << ": " << scene.triangles.size() << " triangles" << std::endl;
+		std::cout << "  binary  " << bvh.getNodes().size() << " nodes, " << binaryBytes / 1024 << " KiB, " << binaryTrace.raysPerSecond() / 1e6 << " Mrays/s" << std::endl;
+		printTraversal("camera  ", binaryCamera);
+		printTraversal("bounce  ", binaryBounce);
+		std::cout << "  wide    " << wideStats.nodeCount << " nodes, " << wideBytes / 1024 << " KiB, collapsed in " << wideStats.collapseMilliseconds << "ms, stack of " <<
+			wideStats.stackSize << ", " << wideTrace.raysPerSecond() / 1e6 << " Mrays/s" << (wideBvh.isTraversable() ? "" : " (binary, stack too deep)") << std::endl;
+		printTraversal("camera  ", wideCamera);
+		printTraversal("bounce  ", wideBounce);
+	}
+}
+
+// "off" disables validation, "on" enables it with warnings and errors of every type, anything else is
+// a DebugMessageFilter list that enables it with that filter
+static void parseValidation(const std::string& value, RenderSettings& settings) {
+	if (value == "off" || value == "0") {
+		settings.validation = false;
+		return;
+	}
+
+	settings.validation = true;
+	settings.validationFilter = value == "on" || value == "1" ? DebugMessageFilter() : DebugMessageFilter::parse(value);
+}
+
+int main(int argc, char** argv) {
+	RenderSettings settings;
+	int width = WIDTH;
+	int height = HEIGHT;
+
+	try {
+		// The flag overrides the environment
+		if (const char* validation = std::getenv("VKRT_VALIDATION")) {
+			parseValidation(validation, settings);
+		}
+
+		for (int i = 1; i < argc; i++) {
+			std::string arg(argv[i]);
+			bool hasValue = i + 1 < argc;
+
+			if (arg == "--headless") {
+				settings.headless = true;
+			}
+			else if (arg == "--frames" && hasValue) {
+				settings.frameCount = static_cast<uint32_t>(std::max(1, std::stoi(argv[++i])));
+			}
+			else if (arg == "--device" && hasValue) {
+				settings.deviceIndex = static_cast<uint32_t>(std::stoi(argv[++i]));
+			}
+			else if (arg == "--output" && hasValue) {
+				settings.outputPath = argv[++i];
+			}
+			else if (arg == "--backend" && hasValue) {
+				std::string backend(argv[++i]);
+
+				if (backend == "cpu") {
+					settings.backend = RenderBackend::Cpu;
+				}
+				else if (backend == "vulkan") {
+					settings.backend = RenderBackend::Vulkan;
+				}
+				else {
+					throw std::runtime_error("Unknown backend: " + backend);
+				}
+			}
+			else if (arg == "--tracer" && hasValue) {
+				std::string tracer(argv[++i]);
+
+				if (tracer == "auto") {
+					settings.traceMode = TraceMode::Auto;
+				}
+				else if (tracer == "compute") {
+					settings.traceMode = TraceMode::Compute;
+				}
+				else if (tracer == "hardware") {
+					settings.traceMode = TraceMode::Hardware;
+				}
+				else {
+					throw std::runtime_error("Unknown tracer: " + tracer);
+				}
+			}
+			else if (arg == "--spp" && hasValue) {
+				settings.samplesPerPixel = static_cast<uint32_t>(std::max(1, std::stoi(argv[++i])));
+			}
+			else if (arg == "--bounces" && hasValue) {
+				settings.maxBounces = static_cast<uint32_t>(std::max(1, std::stoi(argv[++i])));
+			}
+			else if (arg == "--workgroup" && hasValue) {
+				// Given as WxH, for example 16x8
+				std::string size(argv[++i]);
+				size_t separator = size.find('x');
+
+				if (separator == std::string::npos) {
+					throw std::runtime_error("Workgroup size must be given as WxH: " + size);
+				}
+
+				settings.workgroupWidth = static_cast<uint32_t>(std::max(1, std::stoi(size.substr(0, separator))));
+				settings.workgroupHeight = static_cast<uint32_t>(std::max(1, std::stoi(size.substr(separator + 1))));
+			}
+			else if (arg == "--frames-in-flight" && hasValue) {
+				settings.framesInFlight = static_cast<uint32_t>(std::max(1, std::stoi(argv[++i])));
+			}
+			else if (arg == "--pipeline-cache" && hasValue) {
+				settings.pipelineCachePath = argv[++i];
+			}
+			else if (arg == "--no-pipeline-cache") {
+				settings.usePipelineCache = false;
+			}
+			else if (arg == "--assets" && hasValue) {
+				settings.assetPackPath = argv[++i];
+			}
+			else if (arg == "--startup-benchmark") {
+				settings.startupBenchmark = true;
+			}
+			else if (arg == "--trace-bands" && hasValue) {
+				settings.traceBands = static_cast<uint32_t>(std::max(1, std::stoi(argv[++i])));
+			}
+			else if (arg == "--record-benchmark") {
+				settings.recordBenchmark = true;
+			}
+			else if (arg == "--progressive") {
+				settings.progressive = true;
+			}
+			else if (arg == "--target-spp" && hasValue) {
+				settings.targetSamples = static_cast<uint32_t>(std::max(0, std::stoi(argv[++i])));
+			}
+			else if (arg == "--noise-threshold" && hasValue) {
+				settings.noiseThreshold = std::max(0.0f, std::stof(argv[++i]));
+			}
+			else if (arg == "--adaptive" && hasValue) {
+				// Adaptive sampling builds on the accumulation image
+				settings.adaptiveThreshold = std::max(0.0f, std::stof(argv[++i]));
+				settings.progressive = true;
+			}
+			else if (arg == "--sample-heatmap") {
+				settings.sampleHeatmap = true;
+			}
+			else if (arg == "--denoise" && hasValue) {
+				// Number of filter passes
+				settings.denoise.iterations = std::min(static_cast<uint32_t>(std::max(0, std::stoi(argv[++i]))), Denoiser::MaxIterations);
+			}
+			else if (arg == "--denoise-phi" && hasValue) {
+				// Edge stopping strengths given as color,normal,depth, for example 4,128,0.1
+				std::string values(argv[++i]);
+				size_t first = values.find(',');
+				size_t second = first == std::string::npos ? std::string::npos : values.find(',', first + 1);
+
+				if (second == std::string::npos) {
+					throw std::runtime_error("Denoiser strengths must be given as color,normal,depth: " + values);
+				}
+
+				settings.denoise.phiColor = std::max(0.0f, std::stof(values.substr(0, first)));
+				settings.denoise.phiNormal = std::max(0.0f, std::stof(values.substr(first + 1, second - first - 1)));
+				settings.denoise.phiDepth = std::max(0.0f, std::stof(values.substr(second + 1)));
+			}
+			else if (arg == "--gpu-bvh") {
+				// The hardware tracer builds its own acceleration structure, so the BVH only matters to the compute one
+				settings.gpuBvh = true;
+				settings.traceMode = TraceMode::Compute;
+			}
+			else if (arg == "--bvh-benchmark") {
+				settings.bvhBenchmark = true;
+				settings.gpuBvh = true;
+				settings.traceMode = TraceMode::Compute;
+			}
+			else if (arg == "--wide-bvh") {
+				settings.wideBvh = true;
+				settings.traceMode = TraceMode::Compute;
+			}
+			else if (arg == "--wide-bvh-benchmark") {
+				settings.wideBvhBenchmark = true;
+			}
+			else if (arg == "--wavefront") {
+				settings.wavefront = true;
+			}
+			else if (arg == "--sort-materials") {
+				settings.wavefront = true;
+				settings.sortMaterials = true;
+			}
+			else if (arg == "--wavefront-benchmark") {
+				// Renders offscreen, the frames are only timed
+				settings.wavefrontBenchmark = true;
+				settings.headless = true;
+			}
+			else if (arg == "--target-ms" && hasValue) {
+				// GPU milliseconds per frame the resolution governor holds
+				settings.resolution.targetMilliseconds = std::max(0.0f, std::stof(argv[++i]));
+			}
+			else if (arg == "--min-scale" && hasValue) {
+				settings.resolution.minScale = std::stof(argv[++i]);
+			}
+			else if (arg == "--validation" && hasValue) {
+				parseValidation(argv[++i], settings);
+			}
+			else if (arg == "--camera-path" && hasValue) {
+				// Batch renders always run headless
+				settings.cameraPath = argv[++i];
+				settings.headless = true;
+			}
+			else if (arg == "--fps" && hasValue) {
+				settings.batchFramesPerSecond = std::max(0.001f, std::stof(argv[++i]));
+			}
+			else if (arg == "--scene" && hasValue) {
+				settings.scenePath = argv[++i];
+			}
+			else if (arg == "--rebuild-scene-cache") {
+				settings.rebuildSceneCache = true;
+			}
+			else if (arg == "--instances" && hasValue) {
+				// Replaces the default scene with a generated one of this many instances
+				settings.instanceCount = static_cast<uint32_t>(std::max(0, std::stoi(argv[++i])));
+			}
+			else if (arg == "--instancing-benchmark") {
+				settings.instancingBenchmark = true;
+			}
+			else if (arg == "--distributed" && hasValue) {
+				// Number of worker processes to spawn
+				settings.distributedWorkers = static_cast<uint32_t>(std::max(0, std::stoi(argv[++i])));
+			}
+			else if (arg == "--listen" && hasValue) {
+				// host:port or unix:path
+				settings.coordinatorAddress = argv[++i];
+			}
+			else if (arg == "--tile-size" && hasValue) {
+				settings.distributedTileSize = static_cast<uint32_t>(std::max(1, std::stoi(argv[++i])));
+			}
+			else if (arg == "--slow-tile" && hasValue) {
+				settings.slowTileSeconds = std::max(0.0f, std::stof(argv[++i]));
+			}
+			else if (arg == "--distributed-benchmark") {
+				settings.distributedBenchmark = true;
+			}
+			else if (arg == "--tile-worker" && hasValue) {
+				settings.tileWorkerAddress = argv[++i];
+			}
+			else if (arg == "--profile") {
+				settings.printProfile = true;
+			}
+			else if (arg == "--trace" && hasValue) {
+				settings.tracePath = argv[++i];
+			}
+			else if (arg == "--threads" && hasValue) {
+				settings.threadCount = static_cast<uint32_t>(std::max(0, std::stoi(argv[++i])));
+			}
+			else if (arg == "--width" && hasValue) {
+				width = std::max(1, std::stoi(argv[++i]));
+			}
+			else if (arg == "--height" && hasValue) {
+				height = std::max(1, std::stoi(argv[++i]));
+			}
+			else {
+				throw std::runtime_error("Unknown argument: " + arg);
+			}
+		}
+	}
+	catch (const std::exception & e) {
+		std::cerr << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	if (settings.instancingBenchmark || settings.wideBvhBenchmark) {
+		try {
+			if (settings.instancingBenchmark) {
+				benchmarkInstancing(settings);
+			}
+			else {
+				benchmarkWideBvh(settings);
+			}
+		}
+		catch (const std::exception & e) {
+			std::cerr << e.what() << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	if (!settings.tileWorkerAddress.empty()) {
+		try {
+			runTileWorker(settings);
+		}
+		catch (const std::exception & e) {
+			std::cerr << e.what() << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	if (settings.distributedWorkers > 0 || !settings.coordinatorAddress.empty() || settings.distributedBenchmark) {
+		// Options only the coordinator reads, with the number of values they take. Everything else is passed on.
+		const std::map<std::string, int> coordinatorOptions = {
+			{ "--distributed", 1 }, { "--listen", 1 }, { "--tile-size", 1 }, { "--slow-tile", 1 }, { "--distributed-benchmark", 0 }, { "--output", 1 }, { "--threads", 1 }
+		};
+
+		std::vector<std::string> workerArguments;
+		for (int i = 1; i < argc; i++) {
+			auto option = coordinatorOptions.find(argv[i]);
+
+			if (option != coordinatorOptions.end()) {
+				i += option->second;
+			}
+			else {
+				workerArguments.push_back(argv[i]);
+			}
+		}
+
+		try {
+			renderDistributed(width, height, settings, argv[0], workerArguments);
+		}
+		catch (const std::exception & e) {
+			std::cerr << e.what() << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	if (settings.backend == RenderBackend::Cpu) {
+		try {
+			renderCpu(width, height, settings);
+		}
+		catch (const std::exception & e) {
+			std::cerr << e.what() << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		return EXIT_SUCCESS;
+	}
 
-int main() {
-	HelloTriangleApplication app(WIDTH, HEIGHT);
+	HelloTriangleApplication app(width, height, settings);
 
 	try {
 		app.run();
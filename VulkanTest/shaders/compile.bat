@@ -1,2 +1,9 @@
-glslc %1.vert -o ../../Debug/shaders/vert.spv
-glslc %1.frag -o ../../Debug/shaders/frag.spv
+glslc raytrace.comp -o ../../Debug/shaders/raytrace.spv
+glslc --target-env=vulkan1.2 -DHARDWARE_RAY_QUERY raytrace.comp -o ../../Debug/shaders/raytrace_hw.spv
+glslc reproject.comp -o ../../Debug/shaders/reproject.spv
+glslc atrous.comp -o ../../Debug/shaders/atrous.spv
+glslc lbvh.comp -o ../../Debug/shaders/lbvh.spv
+glslc radix_sort.comp -o ../../Debug/shaders/radix_sort.spv
+glslc -DWAVEFRONT raytrace.comp -o ../../Debug/shaders/wavefront.spv
+glslc --target-env=vulkan1.2 -DHARDWARE_RAY_QUERY -DWAVEFRONT raytrace.comp -o ../../Debug/shaders/wavefront_hw.spv
+python pack_assets.py ../../Debug/shaders.pack ../../Debug/shaders/raytrace.spv ../../Debug/shaders/raytrace_hw.spv ../../Debug/shaders/reproject.spv ../../Debug/shaders/atrous.spv ../../Debug/shaders/lbvh.spv ../../Debug/shaders/radix_sort.spv ../../Debug/shaders/wavefront.spv ../../Debug/shaders/wavefront_hw.spv --header ../EmbeddedShaders.h
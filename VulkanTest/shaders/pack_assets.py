@@ -0,0 +1,95 @@
+"""Packs compiled shaders into the archive read by AssetPack.
+
+    python pack_assets.py <output.pack> <file>... [--header <EmbeddedShaders.h>]
+
+Each file is stored under its base name. With --header the same bytes are also written as a C++
+array, which the application uses instead of the file when built with EMBED_SHADERS.
+"""
+
+import os
+import struct
+import sys
+
+MAGIC = 0x50415456  # "VTAP"
+VERSION = 1
+NAME_LENGTH = 48
+ALIGNMENT = 16
+HEADER_SIZE = 16
+ENTRY_SIZE = NAME_LENGTH + 16
+
+
+def align(value):
+    return (value + ALIGNMENT - 1) // ALIGNMENT * ALIGNMENT
+
+
+def build_pack(paths):
+    assets = []
+    for path in paths:
+        name = os.path.basename(path).encode("utf-8")
+        if len(name) >= NAME_LENGTH:
+            raise ValueError("asset name too long: %s" % path)
+        with open(path, "rb") as f:
+            assets.append((name, f.read()))
+
+    toc_offset = HEADER_SIZE
+    offset = align(toc_offset + ENTRY_SIZE * len(assets))
+
+    header = struct.pack("<4I", MAGIC, VERSION, len(assets), toc_offset)
+    toc = b""
+    data = b""
+
+    for name, contents in assets:
+        toc += struct.pack("<%dsQQ" % NAME_LENGTH, name, offset, len(contents))
+        padded = contents + b"\0" * (align(len(contents)) - len(contents))
+        data += padded
+        offset += len(padded)
+
+    pack = header + toc
+    return pack + b"\0" * (align(len(pack)) - len(pack)) + data
+
+
+def write_header(path, pack):
+    lines = [
+        "// Generated by shaders/pack_assets.py, do not edit",
+        "#pragma once",
+        "",
+        "#include <cstddef>",
+        "",
+        "alignas(16) static const unsigned char EmbeddedAssetPack[] = {",
+    ]
+
+    for start in range(0, len(pack), 16):
+        lines.append("\t" + ", ".join("0x%02x" % b for b in pack[start:start + 16]) + ",")
+
+    lines.append("};")
+    lines.append("")
+    lines.append("static const size_t EmbeddedAssetPackSize = sizeof(EmbeddedAssetPack);")
+
+    with open(path, "w", newline="\n") as f:
+        f.write("\n".join(lines) + "\n")
+
+
+def main(args):
+    header_path = None
+    if "--header" in args:
+        index = args.index("--header")
+        header_path = args[index + 1]
+        del args[index:index + 2]
+
+    if len(args) < 2:
+        print(__doc__)
+        return 1
+
+    pack = build_pack(args[1:])
+
+    with open(args[0], "wb") as f:
+        f.write(pack)
+
+    if header_path:
+        write_header(header_path, pack)
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))